@@ -0,0 +1,334 @@
+// Runs the CPU reference simulation split across worker processes, with
+// halos exchanged through shared memory. First checks that the distributed
+// end state matches a single process run, then reports strong scaling (fixed
+// grid, more workers) and weak scaling (fixed cells per worker).
+//
+// Usage: DistributedBenchmark [--size N] [--steps N] [--max-workers N]
+//                             [--halo N]
+//
+// Exits with a failure code if a distributed run fails or its end state is
+// off by more than the tolerance.
+
+#include "ReferenceSimulation.h"
+#include "SharedMemoryTransport.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace StableFluids;
+
+namespace {
+constexpr float PI = 3.14159265358979323846f;
+
+// Same tolerance as the kernel benchmark's golden checks
+constexpr float ABS_TOLERANCE = 1e-4f;
+constexpr float REL_TOLERANCE = 1e-3f;
+
+constexpr uint32_t CHECK_WIDTH = 96;
+constexpr uint32_t CHECK_HEIGHT = 64;
+constexpr uint32_t CHECK_STEPS = 16;
+
+// Velocity and color floats per cell in the gathered state
+constexpr uint32_t STATE_FLOATS = 6;
+
+// Same vortices as the kernel benchmark, written into the owned cells
+void seedVelocity(ReferenceSimulation& sim) {
+  const ReferenceSimulationSettings& s = sim.getSettings();
+  const Subdomain& subdomain = sim.getSubdomain();
+  std::vector<ReferenceSimulation::Vec2>& velocity = sim.getVelocity();
+  for (uint32_t y = subdomain.y; y < subdomain.y + subdomain.height; ++y) {
+    for (uint32_t x = subdomain.x; x < subdomain.x + subdomain.width; ++x) {
+      float u = (x + 0.5f) / s.width;
+      float v = (y + 0.5f) / s.height;
+      velocity[sim.getIndex(x, y)] = {
+          0.5f * std::sin(2.0f * PI * v) * std::cos(PI * u),
+          -0.5f * std::sin(2.0f * PI * u) * std::cos(PI * v)};
+    }
+  }
+}
+
+// Copies the owned velocity and color into a grid sized state buffer
+void gatherState(const ReferenceSimulation& sim, float* state) {
+  const ReferenceSimulationSettings& s = sim.getSettings();
+  const Subdomain& subdomain = sim.getSubdomain();
+  for (uint32_t y = subdomain.y; y < subdomain.y + subdomain.height; ++y) {
+    for (uint32_t x = subdomain.x; x < subdomain.x + subdomain.width; ++x) {
+      size_t idx = sim.getIndex(x, y);
+      const ReferenceSimulation::Vec2& v = sim.getVelocity()[idx];
+      const ReferenceSimulation::Vec4& c = sim.getColor()[idx];
+      float* cell = state + (static_cast<size_t>(y) * s.width + x) *
+                                STATE_FLOATS;
+      cell[0] = v.x;
+      cell[1] = v.y;
+      cell[2] = c.r;
+      cell[3] = c.g;
+      cell[4] = c.b;
+      cell[5] = c.a;
+    }
+  }
+}
+
+struct DistributedResult {
+  bool bSucceeded;
+  // Slowest worker's time for all steps, excluding setup
+  double ms;
+  // Gathered end state, if requested
+  std::vector<float> state;
+};
+
+// Forks one process per subdomain. Workers report their time and end state
+// through an anonymous shared mapping.
+DistributedResult runDistributed(
+    const ReferenceSimulationSettings& settings,
+    const DomainDecomposition& decomposition,
+    uint32_t steps,
+    bool bGatherState) {
+  uint32_t workerCount = decomposition.getWorkerCount();
+  size_t stateFloats = bGatherState ? static_cast<size_t>(settings.width) *
+                                          settings.height * STATE_FLOATS
+                                    : 0;
+  size_t resultSize =
+      workerCount * sizeof(double) + stateFloats * sizeof(float);
+
+  void* pResults = mmap(
+      nullptr,
+      resultSize,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS,
+      -1,
+      0);
+  if (pResults == MAP_FAILED) {
+    std::cerr << "Failed to map the result buffer\n";
+    return {false, 0.0, {}};
+  }
+  double* workerMs = static_cast<double*>(pResults);
+  float* state = reinterpret_cast<float*>(workerMs + workerCount);
+
+  static uint32_t runIndex = 0;
+  std::string name = "/stable-fluids-" + std::to_string(getpid()) + "-" +
+                     std::to_string(runIndex++);
+
+  std::vector<uint32_t> fieldChannels(
+      std::begin(ReferenceSimulation::HALO_FIELD_CHANNELS),
+      std::end(ReferenceSimulation::HALO_FIELD_CHANNELS));
+  SharedMemoryTransport segment =
+      SharedMemoryTransport::create(name, decomposition, fieldChannels);
+
+  std::vector<pid_t> workers;
+  for (uint32_t rank = 0; rank < workerCount; ++rank) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      std::cerr << "Failed to fork worker " << rank << "\n";
+      break;
+    }
+
+    if (pid == 0) {
+      // Leave without running destructors, the segment belongs to the parent
+      int exitCode = EXIT_SUCCESS;
+      try {
+        SharedMemoryTransport transport(
+            name,
+            decomposition,
+            fieldChannels,
+            rank);
+        ReferenceSimulation sim(settings, &transport);
+        seedVelocity(sim);
+        // Also waits for every worker to finish its setup
+        sim.exchangeHalos();
+
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < steps; ++i)
+          sim.step();
+        workerMs[rank] = std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+        if (bGatherState)
+          gatherState(sim, state);
+      } catch (const std::exception& e) {
+        std::cerr << "Worker " << rank << " failed: " << e.what() << "\n";
+        exitCode = EXIT_FAILURE;
+      }
+      _exit(exitCode);
+    }
+
+    workers.push_back(pid);
+  }
+
+  bool bSucceeded = workers.size() == workerCount;
+  for (pid_t pid : workers) {
+    int status = 0;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != EXIT_SUCCESS) {
+      bSucceeded = false;
+    }
+  }
+
+  DistributedResult result{bSucceeded, 0.0, {}};
+  for (uint32_t rank = 0; rank < workerCount; ++rank)
+    result.ms = std::max(result.ms, workerMs[rank]);
+  result.state.assign(state, state + stateFloats);
+
+  munmap(pResults, resultSize);
+  return result;
+}
+
+bool checkDistributed(uint32_t workerCount, uint32_t halo) {
+  ReferenceSimulationSettings settings{};
+  settings.width = CHECK_WIDTH;
+  settings.height = CHECK_HEIGHT;
+
+  ReferenceSimulation reference(settings);
+  seedVelocity(reference);
+  for (uint32_t i = 0; i < CHECK_STEPS; ++i)
+    reference.step();
+
+  std::vector<float> expected(
+      static_cast<size_t>(CHECK_WIDTH) * CHECK_HEIGHT * STATE_FLOATS);
+  gatherState(reference, expected.data());
+
+  DomainDecomposition decomposition = DomainDecomposition::create(
+      CHECK_WIDTH,
+      CHECK_HEIGHT,
+      workerCount,
+      halo);
+  DistributedResult result =
+      runDistributed(settings, decomposition, CHECK_STEPS, true);
+  if (!result.bSucceeded) {
+    std::cout << "FAIL " << workerCount << " workers: run failed\n";
+    return false;
+  }
+
+  float maxError = 0.0f;
+  size_t failures = 0;
+  for (size_t i = 0; i < expected.size(); ++i) {
+    float error = std::abs(result.state[i] - expected[i]);
+    maxError = std::max(maxError, error);
+    if (!(error <= ABS_TOLERANCE + REL_TOLERANCE * std::abs(expected[i])))
+      ++failures;
+  }
+
+  std::cout << (failures == 0 ? "PASS " : "FAIL ") << workerCount
+            << " workers (" << decomposition.tilesX << "x"
+            << decomposition.tilesY << "): max abs error " << maxError << ", "
+            << failures << " values out of tolerance\n";
+  return failures == 0;
+}
+
+// Splits a worker count into the squarest tile grid, wider than tall
+void getTiles(uint32_t workerCount, uint32_t& tilesX, uint32_t& tilesY) {
+  tilesY = 1;
+  for (uint32_t i = 1; i * i <= workerCount; ++i) {
+    if (workerCount % i == 0)
+      tilesY = i;
+  }
+  tilesX = workerCount / tilesY;
+}
+
+bool runScaling(
+    const char* mode,
+    uint32_t size,
+    uint32_t steps,
+    uint32_t maxWorkers,
+    uint32_t halo,
+    bool bWeak) {
+  bool bSucceeded = true;
+  double baseMs = 0.0;
+  for (uint32_t workerCount = 1; workerCount <= maxWorkers;
+       workerCount <<= 1) {
+    // Weak scaling grows the grid by one size x size block per worker
+    uint32_t tilesX = 1;
+    uint32_t tilesY = 1;
+    if (bWeak)
+      getTiles(workerCount, tilesX, tilesY);
+
+    ReferenceSimulationSettings settings{};
+    settings.width = size * tilesX;
+    settings.height = size * tilesY;
+
+    DomainDecomposition decomposition = DomainDecomposition::create(
+        settings.width,
+        settings.height,
+        workerCount,
+        halo);
+    DistributedResult result =
+        runDistributed(settings, decomposition, steps, false);
+    if (!result.bSucceeded) {
+      std::cout << mode << "," << workerCount << ",failed\n";
+      bSucceeded = false;
+      continue;
+    }
+
+    if (workerCount == 1)
+      baseMs = result.ms;
+
+    double speedup = baseMs / result.ms;
+    double efficiency = bWeak ? speedup : speedup / workerCount;
+    std::cout << mode << "," << workerCount << "," << settings.width << ","
+              << settings.height << "," << result.ms / steps << ","
+              << speedup << "," << efficiency << "\n";
+  }
+
+  return bSucceeded;
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  uint32_t size = 512;
+  uint32_t steps = 8;
+  uint32_t maxWorkers =
+      std::clamp(std::thread::hardware_concurrency(), 1u, 8u);
+  // Enough for the advection backtraces at the default time step
+  uint32_t halo = 4;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--size" && i + 1 < argc) {
+      size = std::atoi(argv[++i]);
+    } else if (arg == "--steps" && i + 1 < argc) {
+      steps = std::atoi(argv[++i]);
+    } else if (arg == "--max-workers" && i + 1 < argc) {
+      maxWorkers = std::max(std::atoi(argv[++i]), 1);
+    } else if (arg == "--halo" && i + 1 < argc) {
+      halo = std::atoi(argv[++i]);
+    } else {
+      std::cerr << "Unknown argument: " << arg << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  // The pressure stencil reaches two cells out
+  if (halo < 2) {
+    std::cerr << "The halo must be at least 2 cells wide\n";
+    return EXIT_FAILURE;
+  }
+
+  bool bPassed = true;
+  try {
+    for (uint32_t workerCount = 2; workerCount <= 4; workerCount <<= 1)
+      bPassed = checkDistributed(workerCount, halo) && bPassed;
+
+    std::cout << "mode,workers,width,height,msPerStep,speedup,efficiency\n";
+    bPassed = runScaling("strong", size, steps, maxWorkers, halo, false) &&
+              bPassed;
+    bPassed =
+        runScaling("weak", size, steps, maxWorkers, halo, true) && bPassed;
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return bPassed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,303 @@
+// Times each simulation stage in isolation on the CPU reference across grid
+// sizes, then runs a fixed number of full steps with each pressure solver and
+// compares the end state against stored golden snapshots.
+//
+// Bytes per cell count every field texel a stage reads or writes once, at
+// the CPU precision, so GB/s is an effective bandwidth. Neighbour taps that
+// hit the cache and the FFT scratch traffic are not counted.
+//
+// Usage: KernelBenchmark [--max-size N] [--steps N] [--golden-dir DIR]
+//                        [--update-golden]
+//
+// Exits with a failure code if an end state is off by more than the
+// tolerance or a snapshot is missing.
+
+#include "ReferenceSimulation.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef STABLE_FLUIDS_GOLDEN_DIR
+#define STABLE_FLUIDS_GOLDEN_DIR "Benchmarks/Golden"
+#endif
+
+using namespace StableFluids;
+
+namespace {
+constexpr float PI = 3.14159265358979323846f;
+
+// Per value |a - b| <= ABS_TOLERANCE + REL_TOLERANCE * |b|
+constexpr float ABS_TOLERANCE = 1e-4f;
+constexpr float REL_TOLERANCE = 1e-3f;
+
+constexpr uint32_t GOLDEN_MAGIC = 0x44474653; // "SFGD"
+
+// Not a power of two on purpose, so the spectral path pads
+constexpr uint32_t GOLDEN_WIDTH = 96;
+constexpr uint32_t GOLDEN_HEIGHT = 64;
+
+// Each stage is timed until it has run for at least this long
+constexpr double MIN_STAGE_MS = 200.0;
+
+struct Stage {
+  std::string name;
+  size_t bytesPerCell;
+  std::function<void(ReferenceSimulation&)> run;
+};
+
+// A few large vortices. Built from sin / cos only, so the initial state does
+// not depend on the standard library's random distributions.
+void seedVelocity(ReferenceSimulation& sim) {
+  const ReferenceSimulationSettings& s = sim.getSettings();
+  std::vector<ReferenceSimulation::Vec2>& velocity = sim.getVelocity();
+  for (uint32_t y = 0; y < s.height; ++y) {
+    for (uint32_t x = 0; x < s.width; ++x) {
+      float u = (x + 0.5f) / s.width;
+      float v = (y + 0.5f) / s.height;
+      velocity[sim.getIndex(x, y)] = {
+          0.5f * std::sin(2.0f * PI * v) * std::cos(PI * u),
+          -0.5f * std::sin(2.0f * PI * u) * std::cos(PI * v)};
+    }
+  }
+}
+
+std::vector<Stage> makeStages(uint32_t pressureIterations) {
+  size_t vel = 2 * sizeof(float);
+  size_t color = 4 * sizeof(float);
+  size_t scalar = sizeof(float);
+
+  return {
+      {"fractal",
+       sizeof(int32_t) + scalar,
+       [](ReferenceSimulation& sim) { sim.computeFractal(); }},
+      {"departures",
+       vel + vel,
+       [](ReferenceSimulation& sim) { sim.computeDepartures(); }},
+      {"advectVelocity",
+       vel + vel + color + vel,
+       [](ReferenceSimulation& sim) { sim.advectVelocity(); }},
+      {"curl",
+       vel + scalar,
+       [](ReferenceSimulation& sim) { sim.computeCurl(); }},
+      {"vorticity",
+       scalar + 2 * vel,
+       [](ReferenceSimulation& sim) { sim.applyVorticity(); }},
+      {"divergence",
+       vel + color + scalar,
+       [](ReferenceSimulation& sim) { sim.computeDivergence(); }},
+      {"pressureIteration",
+       3 * scalar,
+       [](ReferenceSimulation& sim) { sim.iteratePressure(); }},
+      {"pressureJacobi" + std::to_string(pressureIterations),
+       pressureIterations * 3 * scalar,
+       [pressureIterations](ReferenceSimulation& sim) {
+         for (uint32_t i = 0; i < pressureIterations; ++i)
+           sim.iteratePressure();
+       }},
+      {"updateVelocity",
+       vel + scalar + vel,
+       [](ReferenceSimulation& sim) { sim.updateVelocity(); }},
+      {"spectralProjection",
+       2 * vel,
+       [](ReferenceSimulation& sim) { sim.projectSpectral(); }},
+      {"advectColor",
+       vel + scalar + color + color,
+       [](ReferenceSimulation& sim) { sim.advectColor(); }},
+      {"copyColors",
+       2 * color,
+       [](ReferenceSimulation& sim) { sim.copyColors(); }},
+      {"exposureReduction",
+       color,
+       [](ReferenceSimulation& sim) { sim.reduceExposure(); }}};
+}
+
+void runStageSweep(uint32_t maxSize) {
+  std::cout << "size,stage,nsPerCell,GBps\n";
+
+  for (uint32_t size = 64; size <= maxSize; size <<= 1) {
+    ReferenceSimulationSettings settings{};
+    settings.width = size;
+    settings.height = size;
+
+    ReferenceSimulation sim(settings);
+    seedVelocity(sim);
+
+    // Get some dye and pressure into the fields first
+    for (uint32_t i = 0; i < 4; ++i)
+      sim.step();
+
+    for (const Stage& stage : makeStages(settings.pressureIterations)) {
+      // Also faults in any lazily touched memory
+      stage.run(sim);
+
+      uint32_t runs = 0;
+      double ms = 0.0;
+      auto start = std::chrono::steady_clock::now();
+      while (ms < MIN_STAGE_MS || runs < 3) {
+        stage.run(sim);
+        ++runs;
+        ms = std::chrono::duration<double, std::milli>(
+                 std::chrono::steady_clock::now() - start)
+                 .count();
+      }
+
+      double nsPerCell = ms * 1e6 / runs / sim.getCellCount();
+      double gbps = stage.bytesPerCell / nsPerCell;
+      std::cout << size << "," << stage.name << "," << nsPerCell << ","
+                << gbps << "\n";
+    }
+  }
+}
+
+// Velocity followed by color, as raw floats
+std::vector<float> captureState(const ReferenceSimulation& sim) {
+  std::vector<float> state;
+  state.reserve(sim.getCellCount() * 6);
+  for (const ReferenceSimulation::Vec2& v : sim.getVelocity()) {
+    state.push_back(v.x);
+    state.push_back(v.y);
+  }
+  for (const ReferenceSimulation::Vec4& c : sim.getColor()) {
+    state.push_back(c.r);
+    state.push_back(c.g);
+    state.push_back(c.b);
+    state.push_back(c.a);
+  }
+
+  return state;
+}
+
+struct GoldenHeader {
+  uint32_t magic;
+  uint32_t width;
+  uint32_t height;
+  uint32_t steps;
+};
+
+bool writeGolden(
+    const std::string& path,
+    const GoldenHeader& header,
+    const std::vector<float>& state) {
+  std::ofstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(
+      reinterpret_cast<const char*>(state.data()),
+      state.size() * sizeof(float));
+  return static_cast<bool>(file);
+}
+
+bool readGolden(
+    const std::string& path,
+    const GoldenHeader& expectedHeader,
+    std::vector<float>& state) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+
+  GoldenHeader header{};
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!file ||
+      std::memcmp(&header, &expectedHeader, sizeof(GoldenHeader)) != 0) {
+    return false;
+  }
+
+  file.read(
+      reinterpret_cast<char*>(state.data()),
+      state.size() * sizeof(float));
+  return static_cast<bool>(file);
+}
+
+bool checkGolden(
+    const std::string& goldenDir,
+    uint32_t steps,
+    bool bSpectral,
+    bool bUpdate) {
+  const char* solverName = bSpectral ? "spectral" : "iterative";
+  std::string path = goldenDir + "/" + solverName + "_" +
+                     std::to_string(GOLDEN_WIDTH) + "x" +
+                     std::to_string(GOLDEN_HEIGHT) + "_" +
+                     std::to_string(steps) + ".bin";
+
+  ReferenceSimulationSettings settings{};
+  settings.width = GOLDEN_WIDTH;
+  settings.height = GOLDEN_HEIGHT;
+  settings.bSpectralPressure = bSpectral;
+
+  ReferenceSimulation sim(settings);
+  seedVelocity(sim);
+  for (uint32_t i = 0; i < steps; ++i)
+    sim.step();
+
+  std::vector<float> state = captureState(sim);
+  GoldenHeader header{GOLDEN_MAGIC, GOLDEN_WIDTH, GOLDEN_HEIGHT, steps};
+
+  if (bUpdate) {
+    bool bWritten = writeGolden(path, header, state);
+    std::cout << (bWritten ? "Updated " : "Failed to write ") << path << "\n";
+    return bWritten;
+  }
+
+  std::vector<float> golden(state.size());
+  if (!readGolden(path, header, golden)) {
+    std::cout << "FAIL " << solverName << ": missing or mismatched snapshot "
+              << path << "\n";
+    return false;
+  }
+
+  float maxError = 0.0f;
+  size_t failures = 0;
+  for (size_t i = 0; i < state.size(); ++i) {
+    float error = std::abs(state[i] - golden[i]);
+    maxError = std::max(maxError, error);
+    if (!(error <= ABS_TOLERANCE + REL_TOLERANCE * std::abs(golden[i])))
+      ++failures;
+  }
+
+  std::cout << (failures == 0 ? "PASS " : "FAIL ") << solverName << ": "
+            << steps << " steps, max abs error " << maxError << ", "
+            << failures << " values out of tolerance\n";
+  return failures == 0;
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  uint32_t maxSize = 1024;
+  uint32_t steps = 32;
+  std::string goldenDir = STABLE_FLUIDS_GOLDEN_DIR;
+  bool bUpdateGolden = false;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--max-size" && i + 1 < argc) {
+      maxSize = std::atoi(argv[++i]);
+    } else if (arg == "--steps" && i + 1 < argc) {
+      steps = std::atoi(argv[++i]);
+    } else if (arg == "--golden-dir" && i + 1 < argc) {
+      goldenDir = argv[++i];
+    } else if (arg == "--update-golden") {
+      bUpdateGolden = true;
+    } else {
+      std::cerr << "Unknown argument: " << arg << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  runStageSweep(maxSize);
+
+  bool bPassed = checkGolden(goldenDir, steps, false, bUpdateGolden);
+  bPassed = checkGolden(goldenDir, steps, true, bUpdateGolden) && bPassed;
+
+  return bPassed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,155 @@
+// Compares the spectral projection against the iterative pressure solve used
+// by CalculatePressure.comp, on the CPU, across grid sizes. Reports the time
+// per projection and the divergence left behind by each. The GPU kernels of
+// both solvers are timed in the projectionMs column of the stats log (G to
+// enable stats, L to log, Ctrl+P to switch solvers).
+//
+// Usage: PressureSolverBenchmark [iterations] [threads]
+
+#include "SpectralProjection.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace StableFluids;
+
+namespace {
+struct VelocityField {
+  uint32_t width;
+  uint32_t height;
+  std::vector<float> u;
+  std::vector<float> v;
+
+  size_t index(int x, int y) const {
+    // Periodic, which is what the spectral projection assumes
+    x = (x + width) % width;
+    y = (y + height) % height;
+    return static_cast<size_t>(y) * width + x;
+  }
+};
+
+VelocityField makeRandomField(uint32_t width, uint32_t height) {
+  VelocityField field{width, height, {}, {}};
+  field.u.resize(static_cast<size_t>(width) * height);
+  field.v.resize(field.u.size());
+
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  for (size_t i = 0; i < field.u.size(); ++i) {
+    field.u[i] = dist(rng);
+    field.v[i] = dist(rng);
+  }
+
+  return field;
+}
+
+std::vector<float> computeDivergence(const VelocityField& field, float h) {
+  std::vector<float> divergence(field.u.size());
+  for (int y = 0; y < (int)field.height; ++y) {
+    for (int x = 0; x < (int)field.width; ++x) {
+      divergence[field.index(x, y)] =
+          0.5f / h *
+          (field.u[field.index(x + 1, y)] - field.u[field.index(x - 1, y)] +
+           field.v[field.index(x, y + 1)] - field.v[field.index(x, y - 1)]);
+    }
+  }
+
+  return divergence;
+}
+
+float maxAbs(const std::vector<float>& values) {
+  float m = 0.0f;
+  for (float value : values)
+    m = std::max(m, std::abs(value));
+  return m;
+}
+
+// Same Jacobi iteration, stencil and velocity update as the GPU passes
+void iterativeProject(VelocityField& field, uint32_t iterations) {
+  float h = 1.0f / std::max(field.width, field.height);
+  std::vector<float> divergence = computeDivergence(field, h);
+  std::vector<float> pressureA(field.u.size(), 0.0f);
+  std::vector<float> pressureB(field.u.size(), 0.0f);
+
+  for (uint32_t iter = 0; iter < iterations; ++iter) {
+    for (int y = 0; y < (int)field.height; ++y) {
+      for (int x = 0; x < (int)field.width; ++x) {
+        pressureB[field.index(x, y)] =
+            0.25f * (pressureA[field.index(x + 2, y)] +
+                     pressureA[field.index(x - 2, y)] +
+                     pressureA[field.index(x, y + 2)] +
+                     pressureA[field.index(x, y - 2)] -
+                     divergence[field.index(x, y)] * h * h);
+      }
+    }
+    std::swap(pressureA, pressureB);
+  }
+
+  std::vector<float> u = field.u;
+  std::vector<float> v = field.v;
+  for (int y = 0; y < (int)field.height; ++y) {
+    for (int x = 0; x < (int)field.width; ++x) {
+      size_t idx = field.index(x, y);
+      u[idx] -= 0.5f / h *
+                (pressureA[field.index(x + 1, y)] -
+                 pressureA[field.index(x - 1, y)]);
+      v[idx] -= 0.5f / h *
+                (pressureA[field.index(x, y + 1)] -
+                 pressureA[field.index(x, y - 1)]);
+    }
+  }
+
+  field.u = std::move(u);
+  field.v = std::move(v);
+}
+
+template <typename TFunc> double timeMs(const TFunc& func) {
+  auto start = std::chrono::steady_clock::now();
+  func();
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  uint32_t iterations = argc > 1 ? std::atoi(argv[1]) : 40;
+  uint32_t threadCount = argc > 2 ? std::atoi(argv[2]) : 0;
+
+  std::cout << "size,solver,ms,maxDivergenceBefore,maxDivergenceAfter\n";
+
+  for (uint32_t size : {128u, 256u, 512u, 1024u, 2048u}) {
+    float h = 1.0f / size;
+    VelocityField initial = makeRandomField(size, size);
+    float divergenceBefore = maxAbs(computeDivergence(initial, h));
+
+    {
+      VelocityField field = initial;
+      double ms = timeMs([&]() { iterativeProject(field, iterations); });
+      std::cout << size << ",jacobi" << iterations << "," << ms << ","
+                << divergenceBefore << ","
+                << maxAbs(computeDivergence(field, h)) << "\n";
+    }
+
+    {
+      VelocityField field = initial;
+      SpectralProjector projector(size, size, threadCount);
+      // The first run includes page faults on the spectrum buffer
+      projector.project(field.u.data(), field.v.data());
+
+      field = initial;
+      double ms = timeMs(
+          [&]() { projector.project(field.u.data(), field.v.data()); });
+      std::cout << size << ",spectral," << ms << "," << divergenceBefore << ","
+                << maxAbs(computeDivergence(field, h)) << "\n";
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+namespace StableFluids {
+// Volumes are stored in cubic bricks of BRICK_SIZE^3 voxels. Only bricks
+// around smoke are resident, everything else reads as zero and costs neither
+// memory nor simulation time.
+constexpr uint32_t BRICK_SIZE = 8;
+constexpr uint32_t BRICK_VOXELS = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+
+// Size of a cubic volume grid and of the pool its resident bricks are
+// allocated from. The pool is laid out as an atlas of atlasX * atlasY *
+// atlasZ bricks, so on the GPU it can back a single 3D image per field.
+struct BrickLayout {
+  // Voxels per axis
+  uint32_t size = 0;
+  // Bricks per axis
+  uint32_t bricks = 0;
+
+  uint32_t atlasX = 0;
+  uint32_t atlasY = 0;
+  uint32_t atlasZ = 0;
+
+  // Sizes the pool for at most maxOccupancy of the grid's bricks, rounded up
+  // to whole atlas slices. Throws if the size is not a positive multiple of
+  // BRICK_SIZE or the occupancy is not in (0, 1].
+  static BrickLayout create(uint32_t size, float maxOccupancy);
+
+  uint32_t getBrickCount() const { return bricks * bricks * bricks; }
+  uint32_t getCapacity() const { return atlasX * atlasY * atlasZ; }
+
+  // Brick coordinates packed the same way as the brick lists on the GPU
+  uint32_t getBrickIndex(uint32_t bx, uint32_t by, uint32_t bz) const {
+    return (bz * bricks + by) * bricks + bx;
+  }
+};
+} // namespace StableFluids
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "ShaderCache.h"
+
+#include <Althea/Application.h>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+// A compute pipeline created from pre-compiled SPIR-V through a shared
+// VkPipelineCache. All simulation kernels use the same layout: the bindless
+// heap descriptor set plus a single push constant block.
+//
+// Specialization constants are all 32-bit, the i-th value is bound to
+// constant_id = i in the shader.
+class ComputeKernel {
+public:
+  ComputeKernel() = default;
+  ComputeKernel(
+      const Application& app,
+      const CompiledShader& shader,
+      VkPipelineCache pipelineCache,
+      VkDescriptorSetLayout heapSetLayout,
+      uint32_t pushConstantsSize,
+      const std::vector<uint32_t>& specializationConstants = {});
+  ~ComputeKernel();
+
+  ComputeKernel(ComputeKernel&& rhs);
+  ComputeKernel& operator=(ComputeKernel&& rhs);
+
+  ComputeKernel(const ComputeKernel& rhs) = delete;
+  ComputeKernel& operator=(const ComputeKernel& rhs) = delete;
+
+  void bindPipeline(VkCommandBuffer commandBuffer) const {
+    vkCmdBindPipeline(
+        commandBuffer,
+        VK_PIPELINE_BIND_POINT_COMPUTE,
+        this->_pipeline);
+  }
+
+  VkPipeline getPipeline() const { return this->_pipeline; }
+  VkPipelineLayout getLayout() const { return this->_layout; }
+
+  operator bool() const { return this->_pipeline != VK_NULL_HANDLE; }
+
+private:
+  void _destroy();
+
+  VkDevice _device = VK_NULL_HANDLE;
+  VkPipelineLayout _layout = VK_NULL_HANDLE;
+  VkPipeline _pipeline = VK_NULL_HANDLE;
+};
+} // namespace StableFluids
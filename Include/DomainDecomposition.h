@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+
+namespace StableFluids {
+// A rectangle of the global grid owned by one worker, plus the width of the
+// ghost cell border kept around it
+struct Subdomain {
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
+  uint32_t halo;
+
+  uint32_t getPaddedWidth() const { return width + 2 * halo; }
+  uint32_t getPaddedHeight() const { return height + 2 * halo; }
+};
+
+// Splits a grid into tilesX * tilesY rectangular subdomains, numbered row by
+// row. Subdomain sizes differ by at most one cell.
+struct DomainDecomposition {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t tilesX = 1;
+  uint32_t tilesY = 1;
+  uint32_t halo = 0;
+
+  // Picks the tiling for the given worker count whose subdomains are
+  // closest to square. Throws if a subdomain would be narrower than the
+  // halo, since halos are only ever exchanged with direct neighbours.
+  static DomainDecomposition
+  create(uint32_t width, uint32_t height, uint32_t workerCount, uint32_t halo);
+
+  uint32_t getWorkerCount() const { return tilesX * tilesY; }
+
+  Subdomain getSubdomain(uint32_t rank) const {
+    uint32_t tx = rank % tilesX;
+    uint32_t ty = rank / tilesX;
+    uint32_t x0 = getTileStart(tx, tilesX, width);
+    uint32_t y0 = getTileStart(ty, tilesY, height);
+    return {
+        x0,
+        y0,
+        getTileStart(tx + 1, tilesX, width) - x0,
+        getTileStart(ty + 1, tilesY, height) - y0,
+        halo};
+  }
+
+  // The rank owning global cell (x, y)
+  uint32_t getOwner(uint32_t x, uint32_t y) const {
+    return getTileIndex(y, tilesY, height) * tilesX +
+           getTileIndex(x, tilesX, width);
+  }
+
+private:
+  static uint32_t getTileStart(uint32_t tile, uint32_t tiles, uint32_t n) {
+    return static_cast<uint32_t>(static_cast<uint64_t>(n) * tile / tiles);
+  }
+
+  static uint32_t getTileIndex(uint32_t i, uint32_t tiles, uint32_t n) {
+    // Inverse of getTileStart, the estimate is off by at most one
+    uint32_t tile =
+        static_cast<uint32_t>(static_cast<uint64_t>(i) * tiles / n);
+    tile = tile < tiles ? tile : tiles - 1;
+    while (tile > 0 && getTileStart(tile, tiles, n) > i)
+      --tile;
+    while (tile + 1 < tiles && getTileStart(tile + 1, tiles, n) <= i)
+      ++tile;
+    return tile;
+  }
+};
+
+// Fills the ghost cells of a worker's padded field with the values owned by
+// its neighbours. Every worker calls exchange() for the same fields in the
+// same order, so implementations can double as a step barrier.
+//
+// Only ghost cells inside the global grid are filled, boundary conditions
+// are applied by the simulation itself in global coordinates.
+class HaloTransport {
+public:
+  virtual ~HaloTransport() = default;
+
+  // `field` is the worker's padded field, row-major with `channels` floats
+  // per cell. `fieldId` must be less than the field count the transport was
+  // created for.
+  virtual void exchange(uint32_t fieldId, float* field, uint32_t channels) = 0;
+
+  virtual const DomainDecomposition& getDecomposition() const = 0;
+  virtual uint32_t getRank() const = 0;
+};
+} // namespace StableFluids
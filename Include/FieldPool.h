@@ -0,0 +1,159 @@
+#pragma once
+
+#include <Althea/Application.h>
+#include <Althea/GlobalHeap.h>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+// The range of passes within a simulation step during which a field holds
+// meaningful data, from the pass that first writes it to the pass that last
+// reads it. Fields that carry over from one step to the next span the whole
+// step.
+struct FieldLifetime {
+  uint32_t firstPass;
+  uint32_t lastPass;
+
+  bool overlaps(const FieldLifetime& rhs) const {
+    return firstPass <= rhs.lastPass && rhs.firstPass <= lastPass;
+  }
+};
+
+struct FieldDesc {
+  VkFormat format;
+  VkImageUsageFlags usage;
+  FieldLifetime lifetime;
+
+  // Only used when the field is sampled as a texture
+  VkFilter filter = VK_FILTER_LINEAR;
+  VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+
+  // The field is this many times coarser than the pool, rounded up
+  uint32_t downsample = 1;
+};
+
+// A simulation image whose memory lives in a FieldPool. The layout is
+// tracked the same way as for a regular Image.
+class PooledField {
+public:
+  void transitionLayout(
+      VkCommandBuffer commandBuffer,
+      VkImageLayout layout,
+      VkAccessFlags accessMask,
+      VkPipelineStageFlags stage);
+
+  // Transitions the field without preserving its contents. Must be used by
+  // the first pass in a step that writes a transient field, since the memory
+  // may have been used by a different field in the meantime.
+  void discard(
+      VkCommandBuffer commandBuffer,
+      VkImageLayout layout,
+      VkAccessFlags accessMask,
+      VkPipelineStageFlags stage);
+
+  VkImage getImage() const { return this->_image; }
+  VkImageView getView() const { return this->_view; }
+  const FieldDesc& getDesc() const { return this->_desc; }
+  const VkExtent3D& getExtent() const { return this->_extent; }
+  VkImageLayout getLayout() const { return this->_layout; }
+
+  // Where the image is bound within the pool's allocation
+  VkDeviceSize getOffset() const { return this->_offset; }
+
+  // Only valid if the field has storage / sampled usage respectively
+  ImageHandle imageHandle{};
+  TextureHandle textureHandle{};
+
+private:
+  friend class FieldPool;
+
+  void _barrier(
+      VkCommandBuffer commandBuffer,
+      VkImageLayout oldLayout,
+      VkAccessFlags srcAccessMask,
+      VkPipelineStageFlags srcStage,
+      VkImageLayout newLayout,
+      VkAccessFlags dstAccessMask,
+      VkPipelineStageFlags dstStage);
+
+  FieldDesc _desc{};
+  VkExtent3D _extent{};
+  VkImage _image = VK_NULL_HANDLE;
+  VkImageView _view = VK_NULL_HANDLE;
+  VkSampler _sampler = VK_NULL_HANDLE;
+
+  VkDeviceSize _offset = 0;
+  VkDeviceSize _size = 0;
+
+  VkImageLayout _layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  VkAccessFlags _accessMask = 0;
+  VkPipelineStageFlags _stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+};
+
+// Allocates a set of fields out of a single device memory allocation, each
+// at the pool resolution or an integer fraction of it. Pools with a depth
+// other than 1 hold 3D fields. Fields whose
+// lifetimes within a step do not overlap are placed at overlapping offsets,
+// so transient fields share memory.
+//
+// Storage image handles are registered in the order the fields are given,
+// so consecutive storage fields get consecutive heap indices.
+//
+// Exportable pools can hand their allocation to other processes or APIs as
+// an opaque file descriptor, the device needs VK_KHR_external_memory_fd.
+class FieldPool {
+public:
+  FieldPool() = default;
+  FieldPool(
+      const Application& app,
+      GlobalHeap& heap,
+      uint32_t width,
+      uint32_t height,
+      const std::vector<FieldDesc>& fields,
+      uint32_t depth = 1,
+      bool bExportable = false);
+  ~FieldPool();
+
+  FieldPool(FieldPool&& rhs);
+  FieldPool& operator=(FieldPool&& rhs);
+
+  FieldPool(const FieldPool& rhs) = delete;
+  FieldPool& operator=(const FieldPool& rhs) = delete;
+
+  PooledField& operator[](size_t i) { return this->_fields[i]; }
+  const PooledField& operator[](size_t i) const { return this->_fields[i]; }
+
+  size_t getFieldCount() const { return this->_fields.size(); }
+
+  // Size of the pooled allocation
+  VkDeviceSize getPooledSize() const { return this->_pooledSize; }
+  // Memory the same fields would need as separate allocations
+  VkDeviceSize getSeparateSize() const { return this->_separateSize; }
+
+  uint32_t getMemoryTypeIndex() const { return this->_memoryTypeIndex; }
+  bool isExportable() const { return this->_bExportable; }
+
+  // Returns a new file descriptor referencing the pooled allocation, owned by
+  // the caller. Importers bind an identically created image at the field's
+  // offset. Only fields that are live for the whole step are safe to read
+  // from outside, transient fields alias each other. Throws if the pool is
+  // not exportable.
+  int exportMemory() const;
+
+private:
+  void _destroy();
+
+  VkDevice _device = VK_NULL_HANDLE;
+  VkDeviceMemory _memory = VK_NULL_HANDLE;
+  uint32_t _memoryTypeIndex = 0;
+  bool _bExportable = false;
+  std::vector<PooledField> _fields;
+
+  VkDeviceSize _pooledSize = 0;
+  VkDeviceSize _separateSize = 0;
+};
+} // namespace StableFluids
@@ -1,6 +1,9 @@
 #pragma once
 
+#include "InputRecording.h"
+#include "ShaderCache.h"
 #include "Simulation.h"
+#include "SimulationTuner.h"
 
 #include <Althea/Allocator.h>
 #include <Althea/CameraController.h>
@@ -24,6 +27,8 @@
 #include <glm/glm.hpp>
 
 #include <array>
+#include <fstream>
+#include <memory>
 #include <vector>
 
 using namespace AltheaEngine;
@@ -53,7 +58,13 @@ public:
 private:
   GlobalHeap _heap;
 
+  ShaderCache _shaderCache;
   Simulation _simulation;
+  SimulationTuner _tuner;
+  std::unique_ptr<std::ofstream> _pStatsLog;
+  std::unique_ptr<InputRecorder> _pInputRecorder;
+  std::unique_ptr<InputReplay> _pInputReplay;
+  std::unique_ptr<CameraPath> _pCameraPath;
   ImageResource _hdrImage;
   std::array<BufferAllocation, MAX_FRAMES_IN_FLIGHT> _hdrStagingBuffers;
   
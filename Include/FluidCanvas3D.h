@@ -0,0 +1,46 @@
+#pragma once
+
+#include "ShaderCache.h"
+#include "Simulation3D.h"
+
+#include <Althea/FrameBuffer.h>
+#include <Althea/GlobalHeap.h>
+#include <Althea/IGameInstance.h>
+#include <Althea/PerFrameResources.h>
+#include <Althea/RenderPass.h>
+
+using namespace AltheaEngine;
+
+namespace AltheaEngine {
+class Application;
+} // namespace AltheaEngine
+
+namespace StableFluids {
+// Volumetric counterpart of FluidCanvas2D, selected with --volume, see
+// Simulation3D
+class FluidCanvas3D : public IGameInstance {
+public:
+  FluidCanvas3D();
+
+  void initGame(Application& app) override;
+  void shutdownGame(Application& app) override;
+
+  void createRenderState(Application& app) override;
+  void destroyRenderState(Application& app) override;
+
+  void tick(Application& app, const FrameContext& frame) override;
+  void draw(
+      Application& app,
+      VkCommandBuffer commandBuffer,
+      const FrameContext& frame) override;
+
+private:
+  GlobalHeap _heap;
+
+  ShaderCache _shaderCache;
+  Simulation3D _simulation;
+
+  RenderPass _renderPass;
+  SwapChainFrameBufferCollection _swapChainFrameBuffers;
+};
+} // namespace StableFluids
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "ShaderCache.h"
+#include "Simulation.h"
+
+#include <Althea/Application.h>
+#include <Althea/GlobalHeap.h>
+#include <Althea/PerFrameResources.h>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+struct FluidSolverDesc {
+  // Dye resolution, the velocity grid is velocityDownsample times coarser
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t velocityDownsample = 1;
+
+  // Allocates the fields and the step semaphore exportable, see
+  // FluidSolver::exportField. The device needs VK_KHR_external_memory_fd and
+  // VK_KHR_external_semaphore_fd enabled.
+  bool bExportable = false;
+};
+
+// Knobs that may change between steps, see the Simulation members of the
+// same names
+struct FluidSolverParameters {
+  float timestep = 1.0f / 30.0f;
+  float vorticity = 0.5f;
+  float velocityDetail = 1.0f;
+  SimulationPreset preset = SimulationPreset::Default;
+  PressureSolver pressureSolver = PressureSolver::Iterative;
+  AdvectionScheme advectionScheme = AdvectionScheme::SemiLagrangian;
+};
+
+// The fields a solver exposes, the rest are internal to a step
+enum class FluidSolverField : uint32_t {
+  // RG16F, on the velocity grid
+  Velocity = 0,
+  // RGBA32F, at the dye resolution
+  Dye
+};
+
+// Everything an importer needs to alias a solver field: create an image
+// with the same format, extent and usage plus VkExternalMemoryImageCreateInfo,
+// import the file descriptor with VkImportMemoryFdInfoKHR and bind the image
+// at offset.
+struct ExternalField {
+  // Owned by the caller, importing the memory transfers ownership to the
+  // importing API
+  int memoryFd = -1;
+  VkDeviceSize allocationSize = 0;
+  uint32_t memoryTypeIndex = 0;
+  VkDeviceSize offset = 0;
+
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkExtent3D extent{};
+  VkImageUsageFlags usage = 0;
+  // Layout the field is left in after every step
+  VkImageLayout layout = VK_IMAGE_LAYOUT_GENERAL;
+};
+
+// Self-contained entry point into the 2D simulation for hosts other than
+// FluidCanvas2D. Owns its heap and shader cache and records steps into the
+// host's command buffer, without any rendering or interaction.
+//
+// Steps are ordered against other devices or processes with a timeline
+// semaphore. The host signals getStepSemaphore() with getStepValue() in the
+// submission containing step(), consumers wait on that value before reading
+// the fields. A consumer must be done reading before the host submits the
+// next step, e.g. by having the host wait on a semaphore the consumer
+// signals.
+//
+// The simulation and its shader watcher point into the solver, so it stays
+// where it was constructed, hosts that need to hand it around keep it behind
+// a pointer.
+class FluidSolver {
+public:
+  FluidSolver(Application& app, const FluidSolverDesc& desc);
+  ~FluidSolver();
+
+  FluidSolver(const FluidSolver& rhs) = delete;
+  FluidSolver& operator=(const FluidSolver& rhs) = delete;
+
+  // Records as many fixed timesteps as frame.deltaTime covers, see
+  // Simulation::update, and advances the step value
+  void step(
+      Application& app,
+      VkCommandBuffer commandBuffer,
+      const FrameContext& frame);
+
+  void setParameters(const FluidSolverParameters& parameters);
+  const FluidSolverParameters& getParameters() const {
+    return this->_parameters;
+  }
+
+  // Clears the fields on the next step
+  void reset() { this->_simulation.clear = true; }
+
+  const PooledField& getField(FluidSolverField field) const;
+
+  // Returns a new file descriptor for the field's memory along with its
+  // image parameters, throws if the solver is not exportable
+  ExternalField exportField(FluidSolverField field) const;
+
+  // Returns a new file descriptor for the step semaphore, owned by the
+  // caller. Throws if the solver is not exportable.
+  int exportStepSemaphore() const;
+
+  VkSemaphore getStepSemaphore() const { return this->_stepSemaphore; }
+  // The value the submission of the last step() has to signal
+  uint64_t getStepValue() const { return this->_stepValue; }
+
+  GlobalHeap& getHeap() { return this->_heap; }
+  Simulation& getSimulation() { return this->_simulation; }
+
+private:
+  VkDevice _device = VK_NULL_HANDLE;
+  bool _bExportable = false;
+
+  GlobalHeap _heap;
+  ShaderCache _shaderCache;
+  Simulation _simulation;
+  FluidSolverParameters _parameters{};
+
+  VkSemaphore _stepSemaphore = VK_NULL_HANDLE;
+  uint64_t _stepValue = 0;
+};
+} // namespace StableFluids
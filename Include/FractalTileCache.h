@@ -0,0 +1,216 @@
+#pragma once
+
+#include "FieldPool.h"
+#include "MappedFile.h"
+#include "TileSlotCache.h"
+
+#include <Althea/Application.h>
+#include <Althea/GlobalHeap.h>
+#include <Althea/PerFrameResources.h>
+#include <Althea/StructuredBuffer.h>
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+// Texels per side of a fractal tile
+constexpr uint32_t FRACTAL_TILE_SIZE = 64;
+constexpr size_t FRACTAL_TILE_BYTES =
+    FRACTAL_TILE_SIZE * FRACTAL_TILE_SIZE * sizeof(float);
+
+// Texel spacing of level 0 in the complex plane, each level halves it. Level
+// 0 tiles are 4 wide, so the whole set fits in a single tile.
+constexpr double FRACTAL_LEVEL0_SPACING = 4.0 / FRACTAL_TILE_SIZE;
+// Past this the texel spacing drops below double precision around the set
+constexpr int32_t MAX_FRACTAL_TILE_LEVEL = 48;
+
+// The atlas holds this many screens worth of tiles, so zooming out by a
+// level and back in again still hits
+constexpr uint32_t FRACTAL_TILE_CACHE_VIEWS = 2;
+
+// Bounds the staging memory of the spill file, evictions and misses past
+// these get dropped and recomputed respectively
+constexpr uint32_t MAX_SPILLED_FRACTAL_TILES_PER_UPDATE = 64;
+constexpr uint32_t MAX_LOADED_FRACTAL_TILES_PER_UPDATE = 64;
+
+// Matches FractalTileRequest in SimulationCommon.glsl
+struct FractalTileRequest {
+  // Point sampled by texel (0, 0) of the tile
+  double originX;
+  double originY;
+  double texelSpacing;
+  uint32_t slot;
+  uint32_t padding;
+};
+
+// Tiles evicted from the atlas, in a memory-mapped scratch file. The file is
+// truncated on open, it only outlives the atlas entries, not the process.
+class FractalSpillFile {
+public:
+  FractalSpillFile(const std::string& path, uint32_t capacity);
+
+  FractalSpillFile(const FractalSpillFile& rhs) = delete;
+  FractalSpillFile& operator=(const FractalSpillFile& rhs) = delete;
+
+  // Marks the tile as most recently used, null if it is not in the file
+  const float* find(const TileKey& key);
+  bool contains(const TileKey& key) const {
+    return this->_slots.contains(key);
+  }
+
+  // Where to write a tile that is not in the file yet
+  float* insert(const TileKey& key);
+
+  void clear() { this->_slots.clear(); }
+
+private:
+  float* _getTile(uint32_t slot) {
+    return reinterpret_cast<float*>(
+        this->_file.getData() + static_cast<size_t>(slot) * FRACTAL_TILE_BYTES);
+  }
+
+  TileSlotCache _slots;
+  MappedFile _file;
+};
+
+// Where the visible tiles are, for the fractal assembly pass
+struct FractalTileView {
+  int32_t level = 0;
+  // Point sampled by texel (0, 0) of the top left visible tile
+  glm::dvec2 gridOrigin = glm::dvec2(0.0);
+  double texelSpacing = FRACTAL_LEVEL0_SPACING;
+  uint32_t gridWidth = 0;
+  uint32_t gridHeight = 0;
+  // Tiles the tile pass has to compute, in the request buffer
+  uint32_t requestCount = 0;
+};
+
+struct FractalTileStats {
+  // Of the last update
+  uint32_t visibleTiles = 0;
+  // Found in the atlas
+  uint32_t cachedTiles = 0;
+  // Copied back from the spill file
+  uint32_t loadedTiles = 0;
+  uint32_t computedTiles = 0;
+  uint32_t spilledTiles = 0;
+
+  // Since the cache was created, a hit is any tile that did not have to be
+  // computed
+  uint64_t totalLookups = 0;
+  uint64_t totalHits = 0;
+
+  float getHitRate() const {
+    if (this->totalLookups == 0)
+      return 0.0f;
+    return static_cast<float>(this->totalHits) /
+           static_cast<float>(this->totalLookups);
+  }
+};
+
+// Caches fractal tiles across camera moves, keyed by level and tile
+// position. Each level halves the texel spacing, and every view is drawn
+// from the coarsest level whose texels are no larger than a screen pixel, so
+// zooming back and forth over the same region finds its tiles again. The
+// tiles live in an atlas image with an LRU policy, and can optionally spill
+// to a file on eviction.
+//
+// update() decides which tiles are visible and records the uploads of the
+// page table, the tile requests and any tiles loaded from the spill file.
+// The simulation then computes the requested tiles and assembles the
+// fractal field out of the atlas, see FractalTiles.comp and Mandelbrot.comp.
+class FractalTileCache {
+public:
+  FractalTileCache() = default;
+  // Sized for views of the given extent
+  FractalTileCache(
+      const Application& app,
+      GlobalHeap& heap,
+      const VkExtent2D& extent);
+
+  // Evicted tiles get written to the file from now on, up to capacity tiles
+  // of FRACTAL_TILE_BYTES each. Throws if the file cannot be mapped.
+  void openSpillFile(
+      const Application& app,
+      const std::string& path,
+      uint32_t capacity);
+
+  // Finishes the spills recorded the last time this frame slot came up, must
+  // be called every frame before update()
+  void beginFrame(const FrameContext& frame);
+
+  // Records the uploads for the view of a camera, at most once per frame.
+  // Leaves the atlas ready for the tile pass to write.
+  const FractalTileView& update(
+      VkCommandBuffer commandBuffer,
+      const FrameContext& frame,
+      double zoom,
+      const glm::dvec2& offset);
+
+  // Drops every tile, the fractal looks different after a permutation change
+  void clear();
+
+  const FractalTileView& getView() const { return this->_view; }
+  const FractalTileStats& getStats() const { return this->_stats; }
+
+  PooledField& getAtlas() { return this->_atlas[0]; }
+  const PooledField& getAtlas() const { return this->_atlas[0]; }
+  uint32_t getAtlasTilesX() const { return this->_atlasTilesX; }
+  uint32_t getCapacity() const { return this->_slots.getCapacity(); }
+
+  BufferHandle getPageTableHandle() const {
+    return this->_pageTable.getHandle();
+  }
+  BufferHandle getRequestsHandle() const { return this->_requests.getHandle(); }
+
+private:
+  void _transferBarrier(
+      VkCommandBuffer commandBuffer,
+      VkBuffer buffer,
+      VkAccessFlags srcAccess,
+      VkPipelineStageFlags srcStage,
+      VkAccessFlags dstAccess,
+      VkPipelineStageFlags dstStage) const;
+
+  struct FrameStaging {
+    // Page table followed by the requests
+    BufferAllocation upload;
+
+    // Only with a spill file. Tiles loaded from the file, and tiles evicted
+    // during the update that get written to the file once the frame is done.
+    BufferAllocation load;
+    BufferAllocation spill;
+    std::vector<TileKey> spilledKeys;
+    // Spills from before a clear are stale
+    uint32_t generation = 0;
+  };
+
+  VmaAllocator _allocator = VK_NULL_HANDLE;
+  VkExtent2D _extent{};
+  uint32_t _maxGridWidth = 0;
+  uint32_t _maxGridHeight = 0;
+  uint32_t _atlasTilesX = 0;
+
+  TileSlotCache _slots;
+  std::unique_ptr<FractalSpillFile> _pSpillFile;
+
+  FieldPool _atlas;
+  // Atlas slot of every visible tile, row by row
+  StructuredBuffer<uint32_t> _pageTable;
+  StructuredBuffer<FractalTileRequest> _requests;
+  std::array<FrameStaging, MAX_FRAMES_IN_FLIGHT> _staging;
+
+  FractalTileView _view{};
+  FractalTileStats _stats{};
+  // Bumped by every clear
+  uint32_t _generation = 0;
+};
+} // namespace StableFluids
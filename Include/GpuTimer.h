@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Althea/Application.h>
+#include <Althea/PerFrameResources.h>
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstdint>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+// Times a span of commands once per frame in flight with a pair of
+// timestamp queries. Results are read back when the frame slot comes around
+// again, so reading never stalls the frame.
+class GpuTimer {
+public:
+  GpuTimer() = default;
+  GpuTimer(const Application& app);
+  ~GpuTimer();
+
+  GpuTimer(GpuTimer&& rhs);
+  GpuTimer& operator=(GpuTimer&& rhs);
+
+  GpuTimer(const GpuTimer& rhs) = delete;
+  GpuTimer& operator=(const GpuTimer& rhs) = delete;
+
+  // False if the graphics queue does not write timestamps, begin() and end()
+  // do nothing then
+  bool isSupported() const { return this->_validBitsMask != 0; }
+
+  // Bracket the span, both wait for all previously recorded commands
+  void begin(VkCommandBuffer commandBuffer, const FrameContext& frame);
+  void end(VkCommandBuffer commandBuffer, const FrameContext& frame);
+
+  // The span recorded the last time this frame slot came up, false if there
+  // was none. Must be called after that frame's fence was waited on.
+  bool read(const FrameContext& frame, float& ms);
+
+private:
+  void _destroy();
+
+  VkDevice _device = VK_NULL_HANDLE;
+  VkQueryPool _queryPool = VK_NULL_HANDLE;
+  // Nanoseconds per timestamp tick
+  float _timestampPeriod = 0.0f;
+  // Timestamps only have this many valid low bits
+  uint64_t _validBitsMask = 0;
+  std::array<bool, MAX_FRAMES_IN_FLIGHT> _pending{};
+};
+} // namespace StableFluids
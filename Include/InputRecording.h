@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace StableFluids {
+// Everything from the outside world that drives one simulation update
+struct InputFrame {
+  uint32_t inputMask;
+  float zoomDir;
+  // Unclamped frame time
+  float deltaTime;
+  uint32_t flags;
+
+  // Simulation settings in effect for the update, so toggling them while
+  // recording replays the same. The enums are stored as their values.
+  uint32_t preset;
+  uint32_t pressureSolver;
+  uint32_t advectionScheme;
+  float vorticity;
+};
+
+enum InputFrameFlags : uint32_t { INPUT_FRAME_FLAG_CLEAR = 1 };
+
+// Appends input frames to a compact binary file as they happen
+class InputRecorder {
+public:
+  InputRecorder(const std::string& path);
+
+  void record(const InputFrame& frame);
+
+  uint32_t getFrameCount() const { return this->_frameCount; }
+
+private:
+  std::ofstream _file;
+  uint32_t _frameCount = 0;
+};
+
+// Plays back a file written by InputRecorder, frame by frame
+class InputReplay {
+public:
+  InputReplay(const std::string& path);
+
+  // Returns false once all recorded frames have been played
+  bool next(InputFrame& frame);
+
+  bool isFinished() const { return this->_nextFrame >= this->_frames.size(); }
+  size_t getFrameCount() const { return this->_frames.size(); }
+
+private:
+  std::vector<InputFrame> _frames;
+  size_t _nextFrame = 0;
+};
+
+// Scripted camera motion, keyframed zoom and offset advanced at a fixed
+// timestep. Loaded from a text file with one "time zoom offsetX offsetY"
+// keyframe per line, in increasing time order. Lines starting with # are
+// comments.
+//
+// Zoom is interpolated geometrically and the offset linearly. The last
+// keyframe is held once the path has finished.
+class CameraPath {
+public:
+  struct Keyframe {
+    double time;
+    double zoom;
+    double offsetX;
+    double offsetY;
+  };
+
+  CameraPath(const std::string& path, float timestep);
+
+  // Returns the camera at the current time, then advances the path by one
+  // timestep
+  Keyframe step();
+
+  float getTimestep() const { return this->_timestep; }
+  bool isFinished() const {
+    return this->_time > this->_keyframes.back().time;
+  }
+
+private:
+  std::vector<Keyframe> _keyframes;
+  float _timestep;
+  double _time = 0.0;
+};
+} // namespace StableFluids
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+
+namespace StableFluids {
+// Command line options, see LaunchOptions::USAGE
+struct LaunchOptions {
+  // Input recording file to write
+  std::string recordInputPath;
+  // Input recording file to play back instead of live input
+  std::string replayInputPath;
+  // Keyframed camera path that overrides the camera, see CameraPath
+  std::string cameraPath;
+  float cameraPathTimestep = 1.0f / 60.0f;
+  // Simulates velocity on a grid this many times coarser than the dye
+  uint32_t velocityDownsample = 1;
+  // Runs the volumetric simulation on a cube with this many voxels per side
+  // instead of the 2D canvas, 0 for 2D
+  uint32_t volumeSize = 0;
+  // Scratch file that fractal tiles evicted from the atlas spill to, none if
+  // empty
+  std::string fractalCachePath;
+  // Records the dye into a paged canvas with this many texels per side, 0
+  // for none. See PagedCanvas.
+  uint32_t canvasSize = 0;
+
+  static constexpr const char* USAGE =
+      "Usage: StableFluids [--record-input FILE] [--replay-input FILE]\n"
+      "                    [--camera-path FILE] [--camera-timestep SECONDS]\n"
+      "                    [--velocity-downsample N] [--volume N]\n"
+      "                    [--fractal-cache FILE] [--canvas N]";
+
+  // Throws on unknown or incomplete arguments
+  static LaunchOptions parse(int argc, char** argv);
+};
+
+// Set once by main before the game is created
+extern LaunchOptions GLaunchOptions;
+} // namespace StableFluids
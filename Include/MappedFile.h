@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace StableFluids {
+// A file mapped read-write into memory. The file is created or truncated on
+// open, so it only serves as scratch space for the lifetime of the mapping.
+// Not supported on Windows, the constructor throws there.
+class MappedFile {
+public:
+  MappedFile() = default;
+  MappedFile(const std::string& path, size_t size);
+  ~MappedFile();
+
+  MappedFile(MappedFile&& rhs);
+  MappedFile& operator=(MappedFile&& rhs);
+
+  MappedFile(const MappedFile& rhs) = delete;
+  MappedFile& operator=(const MappedFile& rhs) = delete;
+
+  std::byte* getData() { return this->_pData; }
+  const std::byte* getData() const { return this->_pData; }
+  size_t getSize() const { return this->_size; }
+
+private:
+  void _destroy();
+
+  std::byte* _pData = nullptr;
+  size_t _size = 0;
+  int _fd = -1;
+};
+} // namespace StableFluids
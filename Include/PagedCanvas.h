@@ -0,0 +1,190 @@
+#pragma once
+
+#include "FieldPool.h"
+#include "MappedFile.h"
+#include "TileSlotCache.h"
+
+#include <Althea/Application.h>
+#include <Althea/GlobalHeap.h>
+#include <Althea/PerFrameResources.h>
+#include <Althea/StructuredBuffer.h>
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+// Texels per side of a canvas tile, matches CANVAS_TILE_SIZE in
+// SimulationCommon.glsl
+constexpr uint32_t CANVAS_TILE_SIZE = 128;
+// Tiles are stored as RGBA16F, on the GPU and in the backing file alike
+constexpr size_t CANVAS_TILE_BYTES =
+    CANVAS_TILE_SIZE * CANVAS_TILE_SIZE * 4 * sizeof(uint16_t);
+
+// Bounds the staging memory of an update, tiles past these stay unrecorded
+// until a later update gets to them
+constexpr uint32_t MAX_CANVAS_TILES_PAGED_PER_UPDATE = 32;
+
+// The tile pool holds this many screens worth of tiles, so panning back and
+// forth does not page the same tiles in and out
+constexpr uint32_t CANVAS_TILE_POOL_VIEWS = 2;
+
+// Page table entry of a visible tile that is not resident yet
+constexpr uint32_t INVALID_CANVAS_SLOT = 0xFFFFFFFF;
+
+// Where the visible tiles are, for the deposit pass
+struct CanvasView {
+  // Point of the plane sampled by texel (0, 0) of the top left visible tile
+  glm::dvec2 gridOrigin = glm::dvec2(0.0);
+  uint32_t gridWidth = 0;
+  uint32_t gridHeight = 0;
+};
+
+struct CanvasStats {
+  // Of the last update
+  uint32_t residentTiles = 0;
+  uint32_t visibleTiles = 0;
+  uint32_t pagedInTiles = 0;
+  uint32_t pagedOutTiles = 0;
+
+  // Since the canvas was created
+  uint32_t storedTiles = 0;
+  uint64_t totalPagedInBytes = 0;
+  uint64_t totalPagedOutBytes = 0;
+  // Updates that saw more tiles than the pool holds and recorded nothing
+  uint32_t skippedUpdates = 0;
+  double elapsedSeconds = 0.0;
+
+  // Between the tile pool and the backing file, in MB/s
+  double getPagingBandwidth() const {
+    if (this->elapsedSeconds <= 0.0)
+      return 0.0;
+    return static_cast<double>(
+               this->totalPagedInBytes + this->totalPagedOutBytes) /
+           (1024.0 * 1024.0) / this->elapsedSeconds;
+  }
+};
+
+// A dye canvas much larger than the simulation grid, covering a fixed region
+// of the plane at a fixed texel spacing. The dye under the camera gets
+// deposited into the canvas tiles it overlaps every step, so panning across
+// the plane paints the canvas.
+//
+// Only the tiles around the view are resident, in a tile pool with an LRU
+// policy. Evicted tiles are paged out to a memory-mapped backing file, as
+// half floats, and tiles that hold no dye at all are not stored. The backing
+// file is truncated on open, so it only outlives the pool entries, not the
+// process.
+//
+// update() decides which tiles are visible and records the page-ins and
+// page-outs and the page table upload. The simulation then deposits the dye
+// into the tile pool, see DepositCanvas.comp.
+class PagedCanvas {
+public:
+  PagedCanvas() = default;
+  // Sized for views of the given simulation extent. Canvas texel (0, 0)
+  // samples the given point of the plane.
+  PagedCanvas(
+      const Application& app,
+      GlobalHeap& heap,
+      const VkExtent2D& simExtent,
+      uint32_t width,
+      uint32_t height,
+      const glm::dvec2& origin,
+      double texelSpacing,
+      const std::string& backingPath);
+
+  PagedCanvas(const PagedCanvas& rhs) = delete;
+  PagedCanvas& operator=(const PagedCanvas& rhs) = delete;
+
+  // Writes the page-outs recorded the last time this frame slot came up to
+  // the backing file, must be called every frame before update()
+  void beginFrame(const FrameContext& frame);
+
+  // Records the paging for the view of a camera, at most once per frame.
+  // Leaves the tile pool ready for the deposit pass to write.
+  const CanvasView& update(
+      VkCommandBuffer commandBuffer,
+      const FrameContext& frame,
+      double zoom,
+      const glm::dvec2& offset);
+
+  // Writes the whole canvas as an uncompressed half RGBA EXR. Waits for the
+  // device to go idle and pages out every resident tile first. Scanlines are
+  // streamed from the backing file, so the image never has to fit in memory.
+  void exportExr(const Application& app, const std::string& path);
+
+  uint32_t getWidth() const { return this->_width; }
+  uint32_t getHeight() const { return this->_height; }
+  double getTexelSpacing() const { return this->_texelSpacing; }
+
+  const CanvasView& getView() const { return this->_view; }
+  const CanvasStats& getStats() const { return this->_stats; }
+
+  PooledField& getAtlas() { return this->_atlas[0]; }
+  const PooledField& getAtlas() const { return this->_atlas[0]; }
+  uint32_t getAtlasTilesX() const { return this->_atlasTilesX; }
+
+  BufferHandle getPageTableHandle() const {
+    return this->_pageTable.getHandle();
+  }
+
+private:
+  void _flushPageOuts(uint32_t frameRingBufferIndex);
+  std::byte* _getBackingTile(uint32_t tile) {
+    return this->_file.getData() +
+           static_cast<size_t>(tile) * CANVAS_TILE_BYTES;
+  }
+
+  enum TileFlags : uint8_t {
+    // The backing file holds the tile
+    TILE_STORED = 1,
+    // Evicted, waiting for its frame to finish before it reaches the file
+    TILE_PAGING_OUT = 2
+  };
+
+  struct FrameStaging {
+    // Page table followed by the tiles paged in
+    BufferAllocation upload;
+    // Tiles evicted during the update, written to the file once the frame
+    // is done
+    BufferAllocation pageOut;
+    std::vector<uint32_t> pageOutTiles;
+  };
+
+  VmaAllocator _allocator = VK_NULL_HANDLE;
+  VkExtent2D _simExtent{};
+  uint32_t _width = 0;
+  uint32_t _height = 0;
+  uint32_t _tilesX = 0;
+  uint32_t _tilesY = 0;
+  glm::dvec2 _origin = glm::dvec2(0.0);
+  double _texelSpacing = 1.0;
+
+  uint32_t _maxGridWidth = 0;
+  uint32_t _maxGridHeight = 0;
+  uint32_t _atlasTilesX = 0;
+
+  // Keyed by tile position at level 0
+  TileSlotCache _slots;
+  // Tile in each pool slot as a row major index into the canvas tiles, if
+  // the slot was ever used
+  std::vector<uint32_t> _slotTiles;
+  std::vector<uint8_t> _tileFlags;
+  MappedFile _file;
+
+  FieldPool _atlas;
+  // Pool slot of every visible tile, row by row
+  StructuredBuffer<uint32_t> _pageTable;
+  std::array<FrameStaging, MAX_FRAMES_IN_FLIGHT> _staging;
+
+  CanvasView _view{};
+  CanvasStats _stats{};
+};
+} // namespace StableFluids
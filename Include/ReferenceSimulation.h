@@ -0,0 +1,194 @@
+#pragma once
+
+#include "DomainDecomposition.h"
+#include "SpectralProjection.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace StableFluids {
+struct ReferenceSimulationSettings {
+  uint32_t width = 0;
+  uint32_t height = 0;
+
+  // Same meaning as the matching KernelPermutation fields
+  uint32_t advectionSteps = 4;
+  uint32_t fractalIterations = 1000;
+  uint32_t curlDownsample = 1;
+
+  uint32_t pressureIterations = 40;
+  bool bSpectralPressure = false;
+  // AdvectionScheme::MacCormack
+  bool bMacCormack = false;
+
+  float dt = 1.0f / 30.0f;
+  float vorticity = 0.5f;
+
+  double zoom = 1.0;
+  double offsetX = -0.706835;
+  double offsetY = 0.235839;
+};
+
+// Single-threaded CPU mirror of the simulation compute kernels, one method
+// per kernel. Samplers are emulated with the same filter and address modes
+// as the GPU fields, but every field is stored as fp32, including the ones
+// that are fp16 on the GPU. The camera stays fixed, so there is no
+// reprojection.
+//
+// Used by the kernel benchmarks to time each stage in isolation and to check
+// the end state after a number of steps against stored snapshots.
+//
+// With a halo transport the simulation only owns one subdomain of the grid.
+// Fields are stored with a ghost cell border and step() exchanges halos
+// wherever a stage reads neighbouring cells, including between pressure
+// sweeps. Advection traces back at most the halo width, or half of it for
+// the MacCormack round trip, further samples are clamped to the border. The
+// spectral projection and coarse curl fields need the whole grid and are not
+// supported in this mode.
+class ReferenceSimulation {
+public:
+  // Fields exchanged with neighbouring subdomains, as transport field ids
+  enum HaloField : uint32_t {
+    HALO_FIELD_VELOCITY = 0,
+    HALO_FIELD_ADVECTED_VELOCITY,
+    HALO_FIELD_CURL,
+    HALO_FIELD_PRESSURE,
+    HALO_FIELD_COLOR,
+    HALO_FIELD_DEPARTURE,
+    HALO_FIELD_COUNT
+  };
+
+  // Floats per cell for each HaloField
+  static constexpr uint32_t HALO_FIELD_CHANNELS[HALO_FIELD_COUNT] =
+      {2, 2, 1, 1, 4, 2};
+
+  struct Vec2 {
+    float x;
+    float y;
+  };
+
+  struct Vec4 {
+    float r;
+    float g;
+    float b;
+    float a;
+  };
+
+  ReferenceSimulation() = default;
+  // Simulates the subdomain of the transport's rank if a transport is
+  // given, the whole grid otherwise. The transport must outlive the
+  // simulation.
+  explicit ReferenceSimulation(
+      const ReferenceSimulationSettings& settings,
+      HaloTransport* pTransport = nullptr);
+
+  // Runs all stages in the same order as Simulation::update
+  void step();
+
+  // Exchanges every halo field, needed after fields were written directly
+  void exchangeHalos();
+
+  // Mandelbrot.comp
+  void computeFractal();
+  // ComputeDepartures.comp
+  void computeDepartures();
+  // AdvectVelocity.comp
+  void advectVelocity();
+  // CalculateCurl.comp
+  void computeCurl();
+  // VorticityConfinement.comp
+  void applyVorticity();
+  // CalculateDivergence.comp
+  void computeDivergence();
+  // One CalculatePressure.comp dispatch, swaps the pressure ping-pong pair
+  void iteratePressure();
+  // UpdateVelocity.comp
+  void updateVelocity();
+  // SpectralLoad.comp through SpectralStore.comp
+  void projectSpectral();
+  // AdvectColor.comp
+  void advectColor();
+  // CopyColors.comp
+  void copyColors();
+  // AutoExposure.comp, without the temporal smoothing
+  void reduceExposure();
+
+  const ReferenceSimulationSettings& getSettings() const {
+    return this->_settings;
+  }
+
+  const Subdomain& getSubdomain() const { return this->_subdomain; }
+
+  // Cells owned by this simulation
+  size_t getCellCount() const {
+    return static_cast<size_t>(this->_subdomain.width) *
+           this->_subdomain.height;
+  }
+
+  // Storage index of global cell (x, y), which must be owned by this
+  // simulation or lie in its halo
+  size_t getIndex(int x, int y) const {
+    return static_cast<size_t>(y - this->_y0 + this->_subdomain.halo) *
+               this->_subdomain.getPaddedWidth() +
+           (x - this->_x0 + this->_subdomain.halo);
+  }
+
+  std::vector<Vec2>& getVelocity() { return this->_velocity; }
+  const std::vector<Vec2>& getVelocity() const { return this->_velocity; }
+  const std::vector<Vec4>& getColor() const { return this->_colorA; }
+  const std::vector<float>& getDivergence() const { return this->_divergence; }
+  const std::vector<float>& getPressure() const { return this->_pressureA; }
+  const std::vector<float>& getFractal() const { return this->_fractal; }
+  const std::vector<Vec2>& getDepartures() const { return this->_departures; }
+
+  float getMinIntensity() const { return this->_minIntensity; }
+  float getMaxIntensity() const { return this->_maxIntensity; }
+
+private:
+  // Applies the sampler address mode, then like getIndex but clamped to the
+  // halo
+  size_t _sampleIndex(int x, int y, bool bMirror) const;
+  size_t _curlIndex(int x, int y) const;
+
+  void _exchange(HaloField field, float* data);
+
+  // Bilinear texture lookups at normalized coordinates
+  Vec2 _sampleVelocity(float u, float v) const;
+  Vec4 _sampleColor(float u, float v) const;
+  float _sampleFractal(float u, float v) const;
+  // getDepartureUv in SimulationCommon.glsl
+  Vec2 _getDepartureUv(float u, float v) const;
+
+  ReferenceSimulationSettings _settings{};
+  HaloTransport* _pTransport = nullptr;
+  Subdomain _subdomain{};
+  // Owned range in global cells
+  int _x0 = 0;
+  int _y0 = 0;
+  int _x1 = 0;
+  int _y1 = 0;
+
+  float _h = 0.0f;
+  uint32_t _curlWidth = 0;
+  uint32_t _curlHeight = 0;
+
+  std::vector<int32_t> _iterationCounts;
+  std::vector<float> _fractal;
+  std::vector<Vec2> _departures;
+  std::vector<Vec2> _velocity;
+  std::vector<Vec2> _advectedVelocity;
+  std::vector<float> _curl;
+  std::vector<float> _divergence;
+  std::vector<float> _pressureA;
+  std::vector<float> _pressureB;
+  std::vector<Vec4> _colorA;
+  std::vector<Vec4> _colorB;
+
+  SpectralProjector _projector;
+  std::vector<float> _spectralX;
+  std::vector<float> _spectralY;
+
+  float _minIntensity = 0.0f;
+  float _maxIntensity = 0.0f;
+};
+} // namespace StableFluids
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "BrickLayout.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace StableFluids {
+struct ReferenceSimulation3DSettings {
+  // Voxels per axis, a multiple of BRICK_SIZE
+  uint32_t size = 0;
+  // Brick pool capacity as a fraction of the grid's bricks. Bricks that do
+  // not fit are not allocated and count as overflow.
+  float maxOccupancy = 0.25f;
+  // Keeps every brick resident, for comparison against a dense grid
+  bool bDense = false;
+
+  // Even, so the pressure ping-pong ends where it started
+  uint32_t pressureIterations = 20;
+
+  float dt = 1.0f / 30.0f;
+  // Upward acceleration per unit of smoke density
+  float buoyancy = 1.0f;
+  // Fraction of the smoke lost per second
+  float densityDecay = 0.1f;
+
+  // Sphere that keeps emitting smoke, in normalized coordinates
+  float emitterX = 0.5f;
+  float emitterY = 0.15f;
+  float emitterZ = 0.5f;
+  float emitterRadius = 0.06f;
+  float emitterSpeed = 0.5f;
+};
+
+// Single-threaded CPU mirror of the volume compute kernels of Simulation3D,
+// one method per kernel, with the same bricked storage. Every field is
+// stored as fp32, including the ones that are fp16 on the GPU.
+//
+// Brick residency is decided once per step from the flags the previous step
+// left behind: a brick stays or becomes resident if it or one of its 26
+// neighbours holds smoke, or if it touches the emitter. Non resident bricks
+// read as zero, which makes them still, smoke free and at ambient pressure.
+//
+// Used by the volume benchmark to report memory use and step times.
+class ReferenceSimulation3D {
+public:
+  struct Vec3 {
+    float x;
+    float y;
+    float z;
+  };
+
+  ReferenceSimulation3D() = default;
+  explicit ReferenceSimulation3D(const ReferenceSimulation3DSettings& settings);
+
+  // Runs all stages in the same order as Simulation3D::update
+  void step();
+
+  // VolumeUpdateBricks.comp, releases and allocates bricks and rebuilds the
+  // list of resident bricks
+  void updateBricks();
+  // VolumeClearBricks.comp
+  void clearBricks();
+  // VolumeAdvect.comp
+  void advect();
+  // VolumeDivergence.comp
+  void computeDivergence();
+  // One VolumePressure.comp dispatch, swaps the pressure ping-pong pair
+  void iteratePressure();
+  // VolumeProject.comp
+  void project();
+  // VolumeFlagBricks.comp
+  void flagBricks();
+
+  const ReferenceSimulation3DSettings& getSettings() const {
+    return this->_settings;
+  }
+  const BrickLayout& getLayout() const { return this->_layout; }
+
+  uint32_t getResidentBrickCount() const {
+    return static_cast<uint32_t>(this->_activeBricks.size());
+  }
+  // Bricks that wanted to become resident but found the pool exhausted,
+  // summed over all steps
+  uint64_t getOverflowCount() const { return this->_overflowCount; }
+
+  // Zero outside resident bricks
+  float getDensity(int x, int y, int z) const;
+  Vec3 getVelocity(int x, int y, int z) const;
+  // Total smoke in the volume
+  double getDensitySum() const;
+
+private:
+  // Storage index of voxel (x, y, z) or NO_VOXEL if it lies outside the grid
+  // or in a brick that is not resident
+  size_t _getVoxel(int x, int y, int z) const;
+  // Storage index of the first voxel of a brick's pool slot
+  static size_t _getSlotStart(uint32_t slot) {
+    return static_cast<size_t>(slot) * BRICK_VOXELS;
+  }
+
+  // Trilinear lookups at voxel coordinates, voxel centers are at + 0.5
+  Vec3 _sampleVelocity(float x, float y, float z) const;
+  float _sampleDensity(float x, float y, float z) const;
+
+  bool _touchesEmitter(uint32_t bx, uint32_t by, uint32_t bz) const;
+
+  // Calls fn(x, y, z, voxel) for every voxel of every resident brick
+  template <typename TFn> void _forEachVoxel(const TFn& fn) const;
+
+  ReferenceSimulation3DSettings _settings{};
+  BrickLayout _layout{};
+
+  // Pool slot + 1 per brick, 0 if the brick is not resident
+  std::vector<uint32_t> _brickMap;
+  // Set by flagBricks for the next updateBricks
+  std::vector<uint8_t> _brickFlags;
+  std::vector<uint32_t> _freeSlots;
+  std::vector<uint32_t> _newSlots;
+  // Brick indices, see BrickLayout::getBrickIndex
+  std::vector<uint32_t> _activeBricks;
+  uint64_t _overflowCount = 0;
+
+  std::vector<Vec3> _velocityA;
+  std::vector<Vec3> _velocityB;
+  std::vector<float> _densityA;
+  std::vector<float> _densityB;
+  std::vector<float> _divergence;
+  std::vector<float> _pressureA;
+  std::vector<float> _pressureB;
+};
+} // namespace StableFluids
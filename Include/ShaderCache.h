@@ -0,0 +1,83 @@
+#pragma once
+
+#include <Althea/Application.h>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+// Root of the simulation sources, the compute shaders live under Shaders/.
+// The library target bakes in its own location, so hosts other than the
+// StableFluids executable find the shaders regardless of their project
+// directory.
+std::string getSimulationDirectory();
+
+struct CompiledShader {
+  std::string path;
+  std::vector<uint32_t> spirv;
+
+  // The shader source file followed by every file it transitively includes
+  std::vector<std::string> dependencies;
+
+  // Hash of the source, all includes and the compile options, used as the
+  // key into the on-disk SPIR-V cache
+  uint64_t hash = 0;
+  bool bCacheHit = false;
+
+  std::string errors;
+
+  bool hasErrors() const { return !errors.empty(); }
+};
+
+// Compiles GLSL compute shaders into SPIR-V, backed by an on-disk cache of
+// previously compiled binaries. Also owns a VkPipelineCache that is loaded
+// from disk on construction and written back on destruction, so warm starts
+// skip both GLSL compilation and driver-side pipeline compilation.
+//
+// Compilation is safe to call concurrently from multiple threads.
+class ShaderCache {
+public:
+  ShaderCache() = default;
+  ShaderCache(const Application& app);
+  ~ShaderCache();
+
+  ShaderCache(ShaderCache&& rhs);
+  ShaderCache& operator=(ShaderCache&& rhs);
+
+  ShaderCache(const ShaderCache& rhs) = delete;
+  ShaderCache& operator=(const ShaderCache& rhs) = delete;
+
+  CompiledShader compileComputeShader(const std::string& shaderPath) const;
+
+  // Collects the shader file and all of its transitive includes, without
+  // compiling anything.
+  std::vector<std::string>
+  collectDependencies(const std::string& shaderPath) const;
+
+  void savePipelineCache() const;
+
+  VkPipelineCache getPipelineCache() const { return this->_pipelineCache; }
+
+  // True if a valid pipeline cache was loaded from disk
+  bool isPipelineCacheWarm() const { return this->_bPipelineCacheWarm; }
+
+  const std::string& getCacheDirectory() const {
+    return this->_cacheDirectory;
+  }
+
+private:
+  void _destroy();
+
+  VkDevice _device = VK_NULL_HANDLE;
+  VkPhysicalDeviceProperties _deviceProperties{};
+  VkPipelineCache _pipelineCache = VK_NULL_HANDLE;
+  bool _bPipelineCacheWarm = false;
+
+  std::string _cacheDirectory;
+  std::vector<std::string> _includeDirectories;
+};
+} // namespace StableFluids
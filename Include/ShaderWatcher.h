@@ -0,0 +1,72 @@
+#pragma once
+
+#include "ShaderCache.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace StableFluids {
+struct ShaderReload {
+  // Index into the shader list the watcher was created with
+  size_t shaderIndex;
+  CompiledShader shader;
+};
+
+// Polls a set of shaders and their include graphs for changes on a
+// background thread. Only shaders that (transitively) include a modified
+// file get recompiled. Compile errors are logged, and recompiled shaders are
+// only reported once no watched shader is in a failed state, so callers never
+// see a partially updated set of shaders.
+class ShaderWatcher {
+public:
+  // Invoked on the watcher thread
+  using CompiledCallback = std::function<void(std::vector<ShaderReload>&&)>;
+
+  ShaderWatcher(
+      const ShaderCache& shaderCache,
+      const std::vector<CompiledShader>& shaders,
+      CompiledCallback onCompiled);
+  ~ShaderWatcher();
+
+  ShaderWatcher(const ShaderWatcher& rhs) = delete;
+  ShaderWatcher& operator=(const ShaderWatcher& rhs) = delete;
+
+  // Recompile all shaders on the next poll, regardless of timestamps. Unchanged
+  // shaders will be served from the SPIR-V cache.
+  void requestRecompileAll();
+
+private:
+  struct WatchedShader {
+    std::string path;
+    std::vector<std::string> dependencies;
+    std::filesystem::file_time_type lastWriteTime;
+    bool bFailed = false;
+  };
+
+  static std::filesystem::file_time_type
+  _getLastWriteTime(const std::vector<std::string>& dependencies);
+
+  void _run();
+
+  const ShaderCache* _pShaderCache;
+  std::vector<WatchedShader> _shaders;
+  CompiledCallback _onCompiled;
+
+  // Only accessed from the watcher thread
+  std::vector<ShaderReload> _pendingReloads;
+
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  bool _bStop = false;
+  bool _bRecompileAll = false;
+
+  std::thread _thread;
+};
+} // namespace StableFluids
@@ -0,0 +1,86 @@
+#pragma once
+
+#ifndef _WIN32
+
+#include "DomainDecomposition.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace StableFluids {
+// Halo exchange between worker processes on the same machine, through a
+// named POSIX shared memory segment.
+//
+// Every worker owns a double-buffered ring per field holding the cells along
+// its subdomain edges. An exchange writes the worker's own ring, waits on a
+// process-shared barrier and then copies the ghost cells out of the
+// neighbours' rings. Consecutive exchanges alternate buffers, so a worker
+// running ahead can never overwrite a ring that is still being read and one
+// barrier per exchange is enough.
+class SharedMemoryTransport : public HaloTransport {
+public:
+  SharedMemoryTransport() = default;
+
+  // Creates and initializes the segment for all workers of the
+  // decomposition. The returned transport owns the segment name and unlinks
+  // it when destroyed, but is not a worker itself.
+  static SharedMemoryTransport create(
+      const std::string& name,
+      const DomainDecomposition& decomposition,
+      const std::vector<uint32_t>& fieldChannels);
+
+  // Attaches worker `rank` to a segment made by create(), the decomposition
+  // and field channels must match
+  SharedMemoryTransport(
+      const std::string& name,
+      const DomainDecomposition& decomposition,
+      const std::vector<uint32_t>& fieldChannels,
+      uint32_t rank);
+  ~SharedMemoryTransport();
+
+  SharedMemoryTransport(SharedMemoryTransport&& rhs);
+  SharedMemoryTransport& operator=(SharedMemoryTransport&& rhs);
+
+  SharedMemoryTransport(const SharedMemoryTransport& rhs) = delete;
+  SharedMemoryTransport& operator=(const SharedMemoryTransport& rhs) = delete;
+
+  void exchange(uint32_t fieldId, float* field, uint32_t channels) override;
+
+  const DomainDecomposition& getDecomposition() const override {
+    return this->_decomposition;
+  }
+  uint32_t getRank() const override { return this->_rank; }
+
+private:
+  struct Header;
+
+  void _map(int fd, bool bCreate);
+  void _destroy();
+
+  // Offset of a worker's ring for one field and buffer, in floats from the
+  // start of the ring storage
+  size_t _getRingOffset(uint32_t rank, uint32_t fieldId, uint32_t parity)
+      const;
+  size_t _getRingSize(uint32_t rank, uint32_t fieldId) const;
+  // Position of an owned cell in its owner's ring, in cells
+  static size_t _getRingCell(const Subdomain& subdomain, int x, int y);
+
+  std::string _name;
+  DomainDecomposition _decomposition{};
+  std::vector<uint32_t> _fieldChannels;
+  uint32_t _rank = 0;
+  bool _bOwner = false;
+
+  void* _pMapping = nullptr;
+  size_t _mappingSize = 0;
+  Header* _pHeader = nullptr;
+  float* _pRings = nullptr;
+  std::vector<size_t> _ringOffsets;
+
+  uint64_t _exchangeCount = 0;
+};
+} // namespace StableFluids
+
+#endif // _WIN32
@@ -1,7 +1,15 @@
 #pragma once
 
+#include "ComputeKernel.h"
+#include "FieldPool.h"
+#include "FractalTileCache.h"
+#include "GpuTimer.h"
+#include "InputRecording.h"
+#include "PagedCanvas.h"
+#include "ShaderCache.h"
+#include "ShaderWatcher.h"
+
 #include <Althea/Application.h>
-#include <Althea/ComputePipeline.h>
 #include <Althea/DescriptorSet.h>
 #include <Althea/DynamicBuffer.h>
 #include <Althea/GlobalHeap.h>
@@ -14,7 +22,15 @@
 #include <glm/glm.hpp>
 #include <vulkan/vulkan.h>
 
+#include <array>
+#include <cstdint>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 using namespace AltheaEngine;
 
@@ -32,16 +48,19 @@ struct SimulationPushConstants {
 };
 
 struct SimulationUniforms {
+  // Only the fractal pass needs the camera in double precision
   double offsetX;
   double offsetY;
-  double lastOffsetX;
-  double lastOffsetY;
 
   double zoom;
-  double lastZoom;
   int width;
   int height;
 
+  // Maps a texel position to where it was under last frame's camera
+  glm::vec2 reprojectOffset;
+  float reprojectScale;
+  uint32_t padding;
+
   float time;
   float dt;
   float sorOmega;
@@ -50,7 +69,7 @@ struct SimulationUniforms {
   float vorticity;
   uint32_t flags;
   uint32_t inputMask;
-  uint32_t padding2;
+  uint32_t spectralBuffer;
 
   uint32_t fractalTexture;
   uint32_t velocityFieldTexture;
@@ -65,10 +84,46 @@ struct SimulationUniforms {
   uint32_t pressureFieldImage;
   uint32_t fractalImage;
   uint32_t velocityFieldImage;
-  uint32_t iterationCountsImage;
+  uint32_t fractalAtlasImage;
 
   uint32_t colorFieldImage;
   uint32_t autoExposureBuffer;
+  uint32_t statsBuffer;
+  uint32_t curlFieldImage;
+
+  uint32_t pressureResidualImage;
+  uint32_t pressureCorrectionImage;
+  uint32_t displayImage;
+  uint32_t displayTexture;
+
+  uint32_t displayExposureEntry;
+  float velocityDetail;
+  uint32_t departureMapImage;
+  uint32_t departureMapTexture;
+
+  // The fractal tiles of the current view, see FractalTileCache
+  double fractalGridOriginX;
+  double fractalGridOriginY;
+  double fractalTexelSpacing;
+  uint32_t fractalTilePageTable;
+  uint32_t fractalTileRequests;
+
+  uint32_t fractalGridWidth;
+  uint32_t fractalGridHeight;
+  uint32_t fractalAtlasTilesX;
+  uint32_t padding2;
+
+  // The canvas tiles of the current view, see PagedCanvas
+  double canvasGridOriginX;
+  double canvasGridOriginY;
+  double canvasTexelSpacing;
+  uint32_t canvasPageTable;
+  uint32_t canvasAtlasImage;
+
+  uint32_t canvasGridWidth;
+  uint32_t canvasGridHeight;
+  uint32_t canvasAtlasTilesX;
+  uint32_t padding3;
 };
 
 struct AutoExposure {
@@ -76,56 +131,464 @@ struct AutoExposure {
   float maxIntensity;
 };
 
+// Matches SimulationStatsEntry in SimulationCommon.glsl
+struct SimulationStatsEntry {
+  float kineticEnergy;
+  float divergenceSum;
+  float divergenceMax;
+  float residualSum;
+
+  float residualMax;
+  float velocityMax;
+  float dyeMass;
+  float dyeDetail;
+};
+
+// Per-step diagnostics. These are read back asynchronously, so they describe
+// the last step of an earlier update, lagging the current frame by up to
+// MAX_FRAMES_IN_FLIGHT.
+struct SimulationStats {
+  // Counts simulation steps from zero, an update may run several or none
+  uint64_t stepNumber = 0;
+  float kineticEnergy = 0.0f;
+  // Divergence of the velocity field after projection
+  float maxDivergence = 0.0f;
+  float meanDivergence = 0.0f;
+  // Residual of the pressure Poisson equation after the last iteration
+  float maxPressureResidual = 0.0f;
+  float meanPressureResidual = 0.0f;
+  float maxVelocity = 0.0f;
+  // Max number of cells crossed by a particle in a single step
+  float cflNumber = 0.0f;
+  float dyeMass = 0.0f;
+  // Energy of the dye's one texel high-pass, the top octave of its
+  // spectrum. Compare runs with --velocity-downsample N against 1 to see how
+  // much of the fine dye structure the synthesized velocity detail restores.
+  float dyeDetail = 0.0f;
+  // Fractal tiles computed by the step, and the fraction of all tile
+  // lookups so far that did not need computing
+  uint32_t fractalTilesComputed = 0;
+  float fractalTileHitRate = 0.0f;
+  // Canvas tiles in the tile pool, and the bytes paged between the pool and
+  // the backing file by the step. Zero without a paged canvas.
+  uint32_t canvasResidentTiles = 0;
+  uint64_t canvasPagedBytes = 0;
+  // GPU time of the pressure projection in the step, with either solver.
+  // Zero if the device does not support timestamps.
+  float projectionMs = 0.0f;
+};
+
+// Values baked into the compute kernels as specialization constants, so
+// loop counts, group sizes and grid bounds are compile-time constants in the
+// generated code. Each distinct permutation gets its own set of pipelines.
+struct KernelPermutation {
+  uint32_t localSizeX = 16;
+  uint32_t localSizeY = 16;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  // Integration steps of the backtrace shared by the velocity and the dye
+  uint32_t advectionSteps = 4;
+  uint32_t fractalIterations = 1000;
+  // Vorticity confinement runs on a curl field this many times coarser than
+  // the velocity grid
+  uint32_t curlDownsample = 1;
+  // Velocity is simulated on a grid this many times coarser than the dye,
+  // see AdvectColor.comp for the detail synthesized in between
+  uint32_t velocityDownsample = 1;
+
+  // Matches VEL_WIDTH / VEL_HEIGHT in SimulationCommon.glsl
+  uint32_t getVelocityWidth() const {
+    return (width - 1) / velocityDownsample + 1;
+  }
+  uint32_t getVelocityHeight() const {
+    return (height - 1) / velocityDownsample + 1;
+  }
+
+  // Ordered by constant_id, see SimulationCommon.glsl
+  std::vector<uint32_t> getSpecializationConstants() const {
+    return {
+        localSizeX,
+        localSizeY,
+        width,
+        height,
+        advectionSteps,
+        fractalIterations,
+        curlDownsample,
+        velocityDownsample};
+  }
+
+  bool operator==(const KernelPermutation& rhs) const {
+    return localSizeX == rhs.localSizeX && localSizeY == rhs.localSizeY &&
+           width == rhs.width && height == rhs.height &&
+           advectionSteps == rhs.advectionSteps &&
+           fractalIterations == rhs.fractalIterations &&
+           curlDownsample == rhs.curlDownsample &&
+           velocityDownsample == rhs.velocityDownsample;
+  }
+};
+
+struct KernelPermutationHash {
+  size_t operator()(const KernelPermutation& permutation) const {
+    size_t hash = permutation.localSizeX;
+    hash = hash * 31 + permutation.localSizeY;
+    hash = hash * 31 + permutation.width;
+    hash = hash * 31 + permutation.height;
+    hash = hash * 31 + permutation.advectionSteps;
+    hash = hash * 31 + permutation.fractalIterations;
+    hash = hash * 31 + permutation.curlDownsample;
+    hash = hash * 31 + permutation.velocityDownsample;
+    return hash;
+  }
+};
+
+// Caps the number of fixed timesteps one update catches up on, any frame time
+// beyond that is dropped so a slow frame does not make the next one slower
+constexpr uint32_t MAX_SIMULATION_STEPS_PER_FRAME = 4;
+
+// Knobs that only change how fast a step runs on a given device, not what it
+// computes. Picked per device by SimulationTuner.
+struct SimulationTuning {
+  // Workgroup shape of the grid kernels, at least 8 on either side
+  uint32_t localSizeX = 16;
+  uint32_t localSizeY = 16;
+
+  bool operator==(const SimulationTuning& rhs) const {
+    return localSizeX == rhs.localSizeX && localSizeY == rhs.localSizeY;
+  }
+};
+
+enum class SimulationPreset : uint32_t { Preview = 0, Default, HighQuality };
+
+// How the velocity field is projected onto its divergence-free part
+enum class PressureSolver : uint32_t {
+  // Fixed number of Jacobi iterations, leaves some residual divergence. The
+  // sweeps run on an fp16 correction, refined against the fp32 pressure.
+  Iterative = 0,
+  // Exact solve with FFTs over the zero padded periodic grid, see
+  // SpectralProjection.h for the CPU reference. Ignores the closed walls, so
+  // the field is only divergence free away from them.
+  Spectral
+};
+
+// How the velocity and dye are transported along the departure map
+enum class AdvectionScheme : uint32_t {
+  // One bilinear sample at the departure point
+  SemiLagrangian = 0,
+  // Compensates half the error of a forward and backward round trip through
+  // the departure map, clamped to the sampled texels. Sharper, at three
+  // times the samples.
+  MacCormack
+};
+
+// Indices into the simulation's field pool. Ping-pong pairs must stay
+// adjacent, kernels address the second one relative to the first.
+enum SimulationField : uint32_t {
+  FIELD_FRACTAL = 0,
+  // Where each velocity cell was at the start of the step, relative to the
+  // cell and in velocity texels
+  FIELD_DEPARTURE,
+  FIELD_VELOCITY,
+  FIELD_ADVECTED_VELOCITY,
+  FIELD_CURL,
+  FIELD_DIVERGENCE,
+  FIELD_PRESSURE,
+  FIELD_PRESSURE_RESIDUAL,
+  FIELD_PRESSURE_CORRECTION_A,
+  FIELD_PRESSURE_CORRECTION_B,
+  FIELD_COLOR_A,
+  FIELD_COLOR_B,
+  // What gets drawn, one per frame in flight so the next step never waits
+  // on a frame that is still being rendered
+  FIELD_DISPLAY,
+  FIELD_COUNT = FIELD_DISPLAY + MAX_FRAMES_IN_FLIGHT
+};
+
+struct SimulationKernels {
+  ComputeKernel fractalTilesPass;
+  ComputeKernel fractalPass;
+  ComputeKernel departurePass;
+  ComputeKernel advectPass;
+  ComputeKernel curlPass;
+  ComputeKernel vorticityPass;
+  ComputeKernel divergencePass;
+  ComputeKernel pressurePass;
+  ComputeKernel updateVelocityPass;
+  ComputeKernel advectColorPass;
+  ComputeKernel updateColorPass;
+  ComputeKernel autoExposurePass;
+  ComputeKernel statsPass;
+  ComputeKernel reduceStatsPass;
+  ComputeKernel spectralLoadPass;
+  ComputeKernel fftPass;
+  ComputeKernel spectralProjectPass;
+  ComputeKernel spectralStorePass;
+  ComputeKernel pressureResidualPass;
+  ComputeKernel pressureCorrectionPass;
+  ComputeKernel composeDisplayPass;
+  ComputeKernel depositCanvasPass;
+};
+
 class Simulation {
 public:
   Simulation() = default;
+  // The dye fields are allocated at the given extent, which stays fixed for
+  // the lifetime of the simulation, and the velocity, pressure and divergence
+  // fields velocityDownsample times coarser. The field pool is allocated
+  // exportable if requested, see FieldPool::exportMemory.
   Simulation(
       Application& app,
       SingleTimeCommandBuffer& commandBuffer,
-      GlobalHeap& heap);
+      GlobalHeap& heap,
+      const ShaderCache& shaderCache,
+      const VkExtent2D& extent,
+      uint32_t velocityDownsample = 1,
+      bool bExportFields = false);
   void update(
-      const Application& app,
+      Application& app,
       VkCommandBuffer commandBuffer,
       VkDescriptorSet heapSet,
       const FrameContext& frame);
 
-  void tryRecompileShaders(Application& app);
+  // Requests an asynchronous recompile of all simulation shaders. Shaders
+  // are also recompiled automatically whenever they or any of their includes
+  // change on disk, the new kernels get swapped in at the start of a later
+  // update.
+  void tryRecompileShaders();
 
-  const ImageResource& getFractalIterations() const {
-    return this->_iterationCounts;
-  }
+  // Switches the kernel permutation used by subsequent updates. Permutations
+  // are created on first use and cached afterwards.
+  void setPreset(SimulationPreset preset) { this->_preset = preset; }
+  SimulationPreset getPreset() const { return this->_preset; }
 
-  const ImageResource& getFractalTexture() const {
-    return this->_fractalTexture;
+  void setPressureSolver(PressureSolver solver) {
+    this->_pressureSolver = solver;
   }
+  PressureSolver getPressureSolver() const { return this->_pressureSolver; }
 
-  const ImageResource& getVelocityTexture() const {
-    return this->_velocityField;
+  void setAdvectionScheme(AdvectionScheme scheme) {
+    this->_advectionScheme = scheme;
+  }
+  AdvectionScheme getAdvectionScheme() const {
+    return this->_advectionScheme;
   }
 
-  const ImageResource& getDivergenceTexture() const {
-    return this->_divergenceField;
+  // Applies from the next update on, throws if the tuning is invalid. Kernels
+  // for a new tuning are created in the background, updates keep stepping
+  // with the previous ones until they are ready.
+  void setTuning(const SimulationTuning& tuning);
+  const SimulationTuning& getTuning() const { return this->_tuning; }
+  // Whether the last step ran with the kernels of the current tuning
+  bool isTuningActive() const {
+    return this->_activePermutation.localSizeX == this->_tuning.localSizeX &&
+           this->_activePermutation.localSizeY == this->_tuning.localSizeY;
   }
 
-  const ImageResource& getPressureTexture() const {
-    return this->_pressureFieldA;
+  // Reads the input mask from the application's input manager, otherwise
+  // updates run without interaction unless an input replay drives them
+  void setLiveInputEnabled(bool enabled) { this->_bLiveInput = enabled; }
+  bool isLiveInputEnabled() const { return this->_bLiveInput; }
+
+  // Enables the statistics reduction pass, it is skipped entirely otherwise
+  void setStatsEnabled(bool enabled) { this->_bStatsEnabled = enabled; }
+  bool isStatsEnabled() const { return this->_bStatsEnabled; }
+
+  // The most recent statistics that finished reading back
+  const SimulationStats& getStats() const { return this->_stats; }
+
+  // Writes one CSV row per read back step to the given stream, or stops
+  // logging if null. The stream must outlive the simulation or be unset.
+  void setStatsLog(std::ostream* pLog);
+
+  // Records the input driving each update, or stops recording if null. The
+  // recorder must outlive the simulation or be unset.
+  void setInputRecorder(InputRecorder* pRecorder) {
+    this->_pInputRecorder = pRecorder;
   }
 
-  const ImageResource& getColorTexture() const { return this->_colorFieldA; }
+  // Drives updates from recorded input instead of live input until the
+  // replay runs out, or stops replaying if null. Same lifetime rules as the
+  // recorder.
+  void setInputReplay(InputReplay* pReplay) { this->_pInputReplay = pReplay; }
 
+  // Overrides the camera with a scripted path, advanced by the path's fixed
+  // timestep every update, or hands the camera back if null. Same lifetime
+  // rules as the recorder.
+  void setCameraPath(CameraPath* pPath) { this->_pCameraPath = pPath; }
+
+  const PooledField& getField(SimulationField field) const {
+    return this->_fields[field];
+  }
+  // Fields may be transitioned between updates, the simulation picks up
+  // from whatever layout they are left in
+  PooledField& getField(SimulationField field) { return this->_fields[field]; }
+
+  const FieldPool& getFieldPool() const { return this->_fields; }
+  // Fixed timesteps recorded by the last update, may be zero
+  uint32_t getLastStepCount() const { return this->_lastStepCount; }
+  const VkExtent2D& getExtent() const { return this->_extent; }
+
+  FractalTileCache& getFractalTileCache() { return this->_fractalTiles; }
+  const FractalTileCache& getFractalTileCache() const {
+    return this->_fractalTiles;
+  }
+
+  // Records the dye under the camera into a canvas of the given size in
+  // texels from the next update on, centered on the current view at one
+  // canvas texel per simulation texel. Tiles away from the view are paged
+  // to the backing file. Replaces any previous canvas.
+  void enablePagedCanvas(
+      const Application& app,
+      GlobalHeap& heap,
+      uint32_t width,
+      uint32_t height,
+      const std::string& backingPath);
+  // Null unless enabled
+  PagedCanvas* getPagedCanvas() { return this->_pCanvas.get(); }
+  const PagedCanvas* getPagedCanvas() const { return this->_pCanvas.get(); }
+
+  // Peak memory of the simulation fields, with transients aliased
+  VkDeviceSize getFieldMemory() const { return this->_fields.getPooledSize(); }
+
+  // The uniforms of the last step recorded for this frame, these also point
+  // the display pass at the frame's display field
   UniformHandle getSimUniforms(const FrameContext& frame) const {
-    return _simulationUniforms.getCurrentHandle(frame);
+    return _simulationUniforms[_displayUniforms].getCurrentHandle(frame);
   }
   
   bool clear = true;
+  // Simulated time per step. Updates run as many whole steps as the frame
+  // time allows, up to MAX_SIMULATION_STEPS_PER_FRAME, and carry the
+  // remainder over to the next frame.
+  float timestep = 1.0f / 30.0f;
+  // Vorticity confinement strength, the curl and confinement passes are
+  // skipped entirely when this is zero
+  float vorticity = 0.5f;
+  // Strength of the curl noise added to a coarse velocity grid when
+  // advecting the dye, relative to the estimated unresolved velocity
+  float velocityDetail = 1.0f;
   double zoom = 1.0f;
   glm::dvec2 offset = glm::dvec2(-0.706835, 0.235839);
   glm::vec2 targetPanDir = glm::vec2(0.0f);
   float targetZoomDir = 0.0f;
 
 private:
-  void _autoExposureBarrier(VkCommandBuffer commandBuffer);
+  KernelPermutation
+  _getPermutation(const VkExtent2D& extent, SimulationPreset preset) const;
+  // Returns nullptr while the kernels are still being created, unless bWait
+  // is set
+  const SimulationKernels* _getKernels(
+      const Application& app,
+      const KernelPermutation& permutation,
+      bool bWait);
+  void _compileShaders();
+  // Kernels being created on a worker thread, with the shader reload count
+  // at the time so kernels of since reloaded shaders are not installed
+  struct PendingKernels {
+    std::future<SimulationKernels> kernels;
+    uint32_t shaderReloadCount = 0;
+  };
+  PendingKernels _createKernelsAsync(
+      const Application& app,
+      const KernelPermutation& permutation) const;
+  // Only the kernels created at startup log to StartupTimes.csv
+  static SimulationKernels _createKernels(
+      const Application& app,
+      const ShaderCache& shaderCache,
+      VkDescriptorSetLayout heapSetLayout,
+      const std::vector<CompiledShader>& shaders,
+      const KernelPermutation& permutation,
+      bool bLogStartupTime);
+
+  void _applyShaderReloads(Application& app, const FrameContext& frame);
+
+  SimulationUniforms
+  _makeUniforms(const VkExtent2D& extent, const FrameContext& frame) const;
+  void _step(
+      VkCommandBuffer commandBuffer,
+      VkDescriptorSet heapSet,
+      const FrameContext& frame,
+      const KernelPermutation& permutation,
+      const SimulationKernels& kernels,
+      uint32_t stepIndex,
+      bool bLastStep);
+  void _composeDisplay(
+      VkCommandBuffer commandBuffer,
+      VkDescriptorSet heapSet,
+      const FrameContext& frame,
+      const KernelPermutation& permutation,
+      const SimulationKernels& kernels,
+      bool bReproject);
+  void _depositCanvas(
+      VkCommandBuffer commandBuffer,
+      VkDescriptorSet heapSet,
+      const FrameContext& frame,
+      const KernelPermutation& permutation,
+      const SimulationKernels& kernels);
+
+  void _autoExposureBarrier(
+      VkCommandBuffer commandBuffer,
+      VkPipelineStageFlags dstStage,
+      VkAccessFlags dstAccess);
+  void _statsBarrier(
+      VkCommandBuffer commandBuffer,
+      VkPipelineStageFlags dstStage,
+      VkAccessFlags dstAccess);
+  void _readBackStats(const FrameContext& frame);
+  void _spectralBarrier(VkCommandBuffer commandBuffer);
+
+  // Shared with the shader watcher thread, which recompiles changed shaders
+  // and creates new kernels for every known permutation in the background.
+  struct KernelReloadState {
+    struct PendingReload {
+      std::vector<ShaderReload> shaders;
+      // One kernel per reloaded shader, for each permutation
+      std::vector<std::pair<KernelPermutation, std::vector<ComputeKernel>>>
+          kernels;
+    };
+
+    std::mutex mutex;
+    std::vector<KernelPermutation> permutations;
+    std::vector<PendingReload> pending;
+  };
+
+  const ShaderCache* _pShaderCache = nullptr;
+  VkDescriptorSetLayout _heapSetLayout = VK_NULL_HANDLE;
+  VmaAllocator _allocator = VK_NULL_HANDLE;
+
+  // Compiled SPIR-V, shared by all kernel permutations
+  std::vector<CompiledShader> _shaders;
+  std::unordered_map<
+      KernelPermutation,
+      SimulationKernels,
+      KernelPermutationHash>
+      _kernelPermutations;
+  std::unordered_map<KernelPermutation, PendingKernels, KernelPermutationHash>
+      _pendingKernels;
+  uint32_t _shaderReloadCount = 0;
+  SimulationPreset _preset = SimulationPreset::Default;
+  PressureSolver _pressureSolver = PressureSolver::Iterative;
+  AdvectionScheme _advectionScheme = AdvectionScheme::SemiLagrangian;
+  SimulationTuning _tuning{};
+  uint32_t _velocityDownsample = 1;
+  VkExtent2D _extent{};
+  KernelPermutation _activePermutation{};
+
+  std::shared_ptr<KernelReloadState> _reloadState;
+  std::unique_ptr<ShaderWatcher> _shaderWatcher;
   
+  InputRecorder* _pInputRecorder = nullptr;
+  InputReplay* _pInputReplay = nullptr;
+  CameraPath* _pCameraPath = nullptr;
+  bool _bLiveInput = true;
+
+  // Advanced by one timestep per step
+  double _time = 0.0;
+  // Frame time not yet simulated, at most one timestep between updates
+  double _timeAccumulator = 0.0;
+  uint32_t _lastStepCount = 0;
+  // Input mask of the current update, for the debug views
+  uint32_t _inputMask = 0;
+
   double _lastZoom = 0.0f;
   glm::dvec2 _lastOffset = glm::dvec2(0.0f);
 
@@ -144,46 +607,52 @@ private:
 
   float _velocitySettleTime = 2.0f;
 
-  // Simulation uniforms
-  TransientUniforms<SimulationUniforms> _simulationUniforms;
+  // Simulation uniforms, one set per step of an update
+  std::array<
+      TransientUniforms<SimulationUniforms>,
+      MAX_SIMULATION_STEPS_PER_FRAME>
+      _simulationUniforms;
+  uint32_t _displayUniforms = 0;
 
-  // Fractal pass
-  ImageResource _iterationCounts{};
-  ImageResource _fractalTexture{};
-  ComputePipeline _fractalPass;
+  // All full-resolution simulation images, see SimulationField
+  FieldPool _fields;
 
-  // Velocity advection pass
-  ImageResource _velocityField{};
-  ImageResource _advectedVelocityField{};
-  ComputePipeline _advectPass;
+  // Tiles the fractal field is assembled from
+  FractalTileCache _fractalTiles;
 
-  // Divergence calculation pass
-  ImageResource _divergenceField{};
-  ComputePipeline _divergencePass;
+  // Optional out-of-core record of the dye
+  std::unique_ptr<PagedCanvas> _pCanvas;
 
-  // Pressure calculation pass
-  // Ping-pong buffers for pressure computation
-  ImageResource _pressureFieldA{};
-  ImageResource _pressureFieldB{};
-  ComputePipeline _pressurePass;
-
-  // Velocity update pass
-  ImageResource _colorFieldA{};
-  ImageResource _colorFieldB{};
-  ComputePipeline _updateVelocityPass;
-
-  // Advect color dye
-  ComputePipeline _advectColorPass;
-
-  // Udate color field
-  ComputePipeline _updateColorPass;
+  // Spectral projection, ping-pong halves for the FFT stages
+  StructuredBuffer<glm::vec4> _spectralBuffer;
 
   // Auto exposure
-  ComputePipeline _autoExposurePass;
   StructuredBuffer<AutoExposure> _autoExposureBuffer;
 
+  // Diagnostics
+  struct StatsReadback {
+    BufferAllocation buffer;
+    bool bPending = false;
+    uint64_t stepNumber = 0;
+    float dt = 0.0f;
+    float h = 0.0f;
+    uint32_t cellCount = 0;
+    uint32_t fractalTilesComputed = 0;
+    float fractalTileHitRate = 0.0f;
+    uint32_t canvasResidentTiles = 0;
+    uint64_t canvasPagedBytes = 0;
+  };
+
+  bool _bStatsEnabled = false;
+  StructuredBuffer<SimulationStatsEntry> _statsBuffer;
+  std::array<StatsReadback, MAX_FRAMES_IN_FLIGHT> _statsReadbacks;
+  GpuTimer _projectionTimer;
+  SimulationStats _stats{};
+  std::ostream* _pStatsLog = nullptr;
+  uint64_t _stepNumber = 0;
+
   // Particle storage buffer
   DynamicBuffer _particles{};
-  ComputePipeline _updateParticlesPass;
+  ComputeKernel _updateParticlesPass;
 };
 } // namespace StableFluids
\ No newline at end of file
@@ -0,0 +1,224 @@
+#pragma once
+
+#include "BrickLayout.h"
+#include "ComputeKernel.h"
+#include "FieldPool.h"
+#include "ShaderCache.h"
+#include "ShaderWatcher.h"
+#include "Simulation.h"
+
+#include <Althea/Application.h>
+#include <Althea/GlobalHeap.h>
+#include <Althea/PerFrameResources.h>
+#include <Althea/SingleTimeCommandBuffer.h>
+#include <Althea/StructuredBuffer.h>
+#include <Althea/TransientUniforms.h>
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+// Matches VolumeUniforms in VolumeCommon.glsl
+struct VolumeUniforms {
+  glm::mat4 inverseViewProjection;
+  glm::vec4 cameraPosition;
+  // Center in normalized coordinates and radius
+  glm::vec4 emitter;
+
+  float time;
+  float dt;
+  float buoyancy;
+  float densityDecay;
+
+  float emitterSpeed;
+  uint32_t brickBuffer;
+  uint32_t velocityImage;
+  uint32_t densityImage;
+
+  uint32_t divergenceImage;
+  uint32_t pressureImage;
+  uint32_t displayImage;
+  uint32_t displayTexture;
+};
+
+// Matches the header of BrickBuffer in VolumeCommon.glsl
+struct BrickCounters {
+  int32_t freeCount;
+  uint32_t newCount;
+  uint32_t activeCount;
+  uint32_t overflowCount;
+};
+
+// Indices into the volume field pool, all of them atlas sized 3D images.
+// Ping-pong pairs must stay adjacent, kernels address the second one relative
+// to the first.
+enum VolumeField : uint32_t {
+  VOLUME_FIELD_VELOCITY_A = 0,
+  VOLUME_FIELD_VELOCITY_B,
+  VOLUME_FIELD_DENSITY_A,
+  VOLUME_FIELD_DENSITY_B,
+  VOLUME_FIELD_DIVERGENCE,
+  VOLUME_FIELD_PRESSURE_A,
+  VOLUME_FIELD_PRESSURE_B,
+  VOLUME_FIELD_COUNT
+};
+
+struct VolumeKernels {
+  ComputeKernel updateBricksPass;
+  ComputeKernel clearBricksPass;
+  ComputeKernel advectPass;
+  ComputeKernel divergencePass;
+  ComputeKernel pressurePass;
+  ComputeKernel projectPass;
+  ComputeKernel flagBricksPass;
+  ComputeKernel raymarchPass;
+};
+
+// Smoke rising from a spherical emitter in a closed cubic volume, simulated
+// on bricks of BRICK_SIZE^3 voxels. Only bricks around smoke are resident.
+// They are allocated from a fixed pool that backs one atlas image per field,
+// and every kernel but the brick update only runs over the resident bricks.
+// See ReferenceSimulation3D for the CPU mirror of the kernels.
+//
+// The volume is raymarched into a per-frame display field, from an orbit
+// camera around the volume.
+class Simulation3D {
+public:
+  Simulation3D() = default;
+  // The pool holds at most maxOccupancy of the volume's bricks, bricks that
+  // do not fit are dropped and counted as overflow
+  Simulation3D(
+      Application& app,
+      SingleTimeCommandBuffer& commandBuffer,
+      GlobalHeap& heap,
+      const ShaderCache& shaderCache,
+      uint32_t size,
+      float maxOccupancy = 0.25f);
+
+  void update(
+      Application& app,
+      VkCommandBuffer commandBuffer,
+      VkDescriptorSet heapSet,
+      const FrameContext& frame);
+
+  // Same as Simulation::tryRecompileShaders
+  void tryRecompileShaders();
+
+  const BrickLayout& getLayout() const { return this->_layout; }
+
+  // The most recent brick counters that finished reading back, lagging the
+  // current frame by up to MAX_FRAMES_IN_FLIGHT
+  const BrickCounters& getBrickCounters() const {
+    return this->_brickCounters;
+  }
+
+  // Memory of the atlas fields and of the same fields at full resolution
+  VkDeviceSize getFieldMemory() const { return this->_fields.getPooledSize(); }
+  VkDeviceSize getDenseFieldMemory() const;
+
+  // The uniforms of this frame, these also point the draw at the frame's
+  // display field
+  UniformHandle getUniforms(const FrameContext& frame) const {
+    return this->_uniforms.getCurrentHandle(frame);
+  }
+
+  bool clear = true;
+  // Simulated time per step, see Simulation::timestep
+  float timestep = 1.0f / 30.0f;
+  float buoyancy = 1.0f;
+  float densityDecay = 0.1f;
+  glm::vec3 emitterCenter = glm::vec3(0.5f, 0.15f, 0.5f);
+  float emitterRadius = 0.06f;
+  float emitterSpeed = 0.5f;
+
+  // Orbit camera around the volume center, in radians and volume widths
+  float cameraYaw = 0.6f;
+  float cameraPitch = 0.3f;
+  float cameraDistance = 2.0f;
+  float targetZoomDir = 0.0f;
+
+private:
+  void _compileShaders();
+  std::vector<uint32_t> _getSpecializationConstants() const;
+  VolumeKernels _createKernels(const Application& app) const;
+  void _applyShaderReloads(Application& app, const FrameContext& frame);
+
+  VolumeUniforms _makeUniforms(
+      const VkExtent2D& extent,
+      const FrameContext& frame) const;
+  void _step(
+      VkCommandBuffer commandBuffer,
+      VkDescriptorSet heapSet,
+      const FrameContext& frame);
+  void _raymarch(
+      VkCommandBuffer commandBuffer,
+      VkDescriptorSet heapSet,
+      const FrameContext& frame);
+
+  void _brickBarrier(
+      VkCommandBuffer commandBuffer,
+      VkPipelineStageFlags dstStage,
+      VkAccessFlags dstAccess);
+  // Copies the active and new brick counts into the indirect dispatches
+  void _writeDispatchArgs(VkCommandBuffer commandBuffer);
+  void _readBackCounters(const FrameContext& frame);
+
+  // Shared with the shader watcher thread, see Simulation::KernelReloadState.
+  // There is only one kernel permutation per volume.
+  struct KernelReloadState {
+    struct PendingReload {
+      std::vector<ShaderReload> shaders;
+      // One kernel per reloaded shader
+      std::vector<ComputeKernel> kernels;
+    };
+
+    std::mutex mutex;
+    std::vector<PendingReload> pending;
+  };
+
+  const ShaderCache* _pShaderCache = nullptr;
+  VkDescriptorSetLayout _heapSetLayout = VK_NULL_HANDLE;
+  VmaAllocator _allocator = VK_NULL_HANDLE;
+
+  BrickLayout _layout{};
+
+  std::vector<CompiledShader> _shaders;
+  VolumeKernels _kernels;
+
+  std::shared_ptr<KernelReloadState> _reloadState;
+  std::unique_ptr<ShaderWatcher> _shaderWatcher;
+
+  // Advanced by one timestep per step
+  double _time = 0.0;
+  // See Simulation::_timeAccumulator
+  double _timeAccumulator = 0.0;
+
+  TransientUniforms<VolumeUniforms> _uniforms;
+
+  // Brick atlas, see VolumeField
+  FieldPool _fields;
+  // What gets drawn, one 2D field per frame in flight
+  FieldPool _displayFields;
+  VkExtent2D _displayExtent{};
+
+  // Brick map, flags and lists, see BrickBuffer in VolumeCommon.glsl
+  StructuredBuffer<uint32_t> _brickBuffer;
+  // One VkDispatchIndirectCommand per BrickDispatch
+  BufferAllocation _dispatchArgs;
+
+  struct CountersReadback {
+    BufferAllocation buffer;
+    bool bPending = false;
+  };
+
+  std::array<CountersReadback, MAX_FRAMES_IN_FLIGHT> _countersReadbacks;
+  BrickCounters _brickCounters{};
+};
+} // namespace StableFluids
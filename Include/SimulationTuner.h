@@ -0,0 +1,117 @@
+#pragma once
+
+#include "GpuTimer.h"
+#include "ShaderCache.h"
+#include "Simulation.h"
+
+#include <Althea/Application.h>
+#include <Althea/PerFrameResources.h>
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+// Identifies the device, driver and grid a tuning was measured for
+struct SimulationTuningKey {
+  uint32_t vendorID = 0;
+  uint32_t deviceID = 0;
+  uint32_t driverID = 0;
+  uint32_t driverVersion = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t velocityDownsample = 1;
+
+  bool operator==(const SimulationTuningKey& rhs) const {
+    return vendorID == rhs.vendorID && deviceID == rhs.deviceID &&
+           driverID == rhs.driverID && driverVersion == rhs.driverVersion &&
+           width == rhs.width && height == rhs.height &&
+           velocityDownsample == rhs.velocityDownsample;
+  }
+};
+
+// Finds the fastest SimulationTuning for the current device and grid by
+// timing candidates on the live simulation with timestamp queries. Only the
+// workgroup shape is tuned, since it does not change the results. The winner
+// is appended to Tuning.csv in the shader cache directory, and load() finds
+// it again on later runs with the same device, driver and grid.
+//
+// Timings are read back when a frame slot comes around again, so tuning
+// never stalls the frame. Each candidate gets a few frames to warm up, then
+// the median GPU time per simulation step of the following frames counts.
+class SimulationTuner {
+public:
+  SimulationTuner() = default;
+  SimulationTuner(
+      const Application& app,
+      const ShaderCache& shaderCache,
+      const VkExtent2D& extent,
+      uint32_t velocityDownsample);
+
+  // Looks up the last stored tuning for this device and grid, returns false
+  // if there is none
+  bool load(SimulationTuning& tuning) const;
+
+  // False if the graphics queue has no valid timestamp bits
+  bool isSupported() const { return this->_timer.isSupported(); }
+
+  // Starts timing candidates from the next update on, the simulation's
+  // current tuning is restored if tuning gets cancelled. Throws if tuning
+  // is not supported.
+  void start(Simulation& simulation);
+  void cancel(Simulation& simulation);
+  bool isRunning() const { return this->_bRunning; }
+
+  // Must bracket Simulation::update while tuning. beginUpdate() collects
+  // the timing of the frame slot and switches the simulation to the next
+  // candidate as needed, the last candidate applies the fastest tuning.
+  void beginUpdate(
+      VkCommandBuffer commandBuffer,
+      const FrameContext& frame,
+      Simulation& simulation);
+  void endUpdate(
+      VkCommandBuffer commandBuffer,
+      const FrameContext& frame,
+      const Simulation& simulation);
+
+  const SimulationTuningKey& getKey() const { return this->_key; }
+
+private:
+  void _finish(Simulation& simulation);
+  void _save(const SimulationTuning& tuning, float msPerStep) const;
+
+  struct Candidate {
+    SimulationTuning tuning;
+    std::vector<float> msPerStep;
+    uint32_t warmupFrames = 0;
+  };
+
+  // Prints the timings of the candidates and returns the fastest
+  const Candidate& _getFastest(float& msPerStep) const;
+
+  struct PendingTiming {
+    bool bPending = false;
+    // Into _candidates
+    uint32_t candidate = 0;
+    uint32_t stepCount = 0;
+  };
+
+  GpuTimer _timer;
+  uint32_t _maxInvocations = 0;
+  uint32_t _maxSizeX = 0;
+  uint32_t _maxSizeY = 0;
+
+  SimulationTuningKey _key{};
+  std::string _path;
+
+  bool _bRunning = false;
+  SimulationTuning _initialTuning{};
+  std::vector<Candidate> _candidates;
+  uint32_t _currentCandidate = 0;
+  std::array<PendingTiming, MAX_FRAMES_IN_FLIGHT> _pendingTimings{};
+};
+} // namespace StableFluids
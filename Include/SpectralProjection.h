@@ -0,0 +1,65 @@
+#pragma once
+
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+namespace StableFluids {
+// Projects a 2D velocity field onto its divergence-free part with an exact
+// Poisson solve in frequency space: forward FFT of both velocity components,
+// removal of the gradient component, inverse FFT. This is O(N log N) and
+// leaves no residual divergence, unlike a fixed number of Jacobi iterations.
+//
+// The domain is treated as periodic. Grids that are not a power of two are
+// zero padded up to the next power of two, which behaves like an open domain
+// surrounded by still fluid. The projection uses the spectral symbols of the
+// central difference operators used by the GPU passes, so the result is
+// divergence free with respect to CalculateDivergence.comp, but only on that
+// padded periodic domain. The closed walls of the simulation are not part of
+// the solve: velocity may flow through them, and once the padding is cropped
+// off the field is not divergence free along the walls.
+//
+// Rows and columns are transformed on multiple threads. This has no
+// dependencies besides the standard library, it mirrors the GPU spectral
+// passes and serves as their reference.
+class SpectralProjector {
+public:
+  SpectralProjector() = default;
+  // A thread count of 0 uses all hardware threads
+  SpectralProjector(uint32_t width, uint32_t height, uint32_t threadCount = 0);
+
+  // Velocity components are row-major, width * height floats each
+  void project(float* velocityX, float* velocityY);
+
+  uint32_t getWidth() const { return this->_width; }
+  uint32_t getHeight() const { return this->_height; }
+  uint32_t getPaddedWidth() const { return this->_paddedWidth; }
+  uint32_t getPaddedHeight() const { return this->_paddedHeight; }
+
+private:
+  using Complex = std::complex<float>;
+
+  // Both velocity components are transformed side by side, so every
+  // butterfly shares its twiddle factor between the two
+  struct Spectrum {
+    Complex u;
+    Complex v;
+  };
+
+  void _fftRows(bool bInverse);
+  void _fftColumns(bool bInverse);
+  void _projectSpectrum();
+
+  uint32_t _width = 0;
+  uint32_t _height = 0;
+  uint32_t _paddedWidth = 0;
+  uint32_t _paddedHeight = 0;
+  uint32_t _threadCount = 1;
+
+  std::vector<Spectrum> _spectrum;
+
+  // Twiddle factors exp(-2 pi i k / n) for k < n / 2
+  std::vector<Complex> _rowTwiddles;
+  std::vector<Complex> _columnTwiddles;
+};
+} // namespace StableFluids
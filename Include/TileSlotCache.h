@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace StableFluids {
+// A square tile of a 2D grid, at a level of detail for grids that have more
+// than one
+struct TileKey {
+  int32_t level;
+  int64_t x;
+  int64_t y;
+
+  bool operator==(const TileKey& rhs) const {
+    return level == rhs.level && x == rhs.x && y == rhs.y;
+  }
+};
+
+struct TileKeyHash {
+  size_t operator()(const TileKey& key) const {
+    size_t hash = static_cast<size_t>(key.level);
+    hash = hash * 0x9E3779B97F4A7C15ull + static_cast<size_t>(key.x);
+    hash = hash * 0x9E3779B97F4A7C15ull + static_cast<size_t>(key.y);
+    return hash;
+  }
+};
+
+// Maps keys to a fixed number of slots, evicting the least recently used
+// key once all slots are taken
+class TileSlotCache {
+public:
+  TileSlotCache() = default;
+  TileSlotCache(uint32_t capacity);
+
+  // Marks the key as most recently used, returns false if not resident
+  bool find(const TileKey& key, uint32_t& slot);
+  bool contains(const TileKey& key) const {
+    return this->_slotsByKey.count(key) != 0;
+  }
+
+  // Assigns a slot to a key that is not resident. Returns true if the
+  // slot's previous key got evicted for it.
+  bool insert(const TileKey& key, uint32_t& slot, TileKey& evictedKey);
+
+  void clear();
+
+  uint32_t getCapacity() const {
+    return static_cast<uint32_t>(this->_keys.size());
+  }
+  uint32_t getSize() const {
+    return static_cast<uint32_t>(this->_slotsByKey.size());
+  }
+
+private:
+  std::vector<TileKey> _keys;
+  // Most recently used first
+  std::list<uint32_t> _lru;
+  std::vector<std::list<uint32_t>::iterator> _lruEntries;
+  std::vector<uint32_t> _freeSlots;
+  std::unordered_map<TileKey, uint32_t, TileKeyHash> _slotsByKey;
+};
+} // namespace StableFluids
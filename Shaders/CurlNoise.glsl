@@ -0,0 +1,61 @@
+#ifndef _CURLNOISE_
+#define _CURLNOISE_
+
+#define CURL_NOISE_PI 3.14159265359
+
+uint hashLattice(ivec2 p) {
+  uint h = uint(p.x) * 0x8da6b343u ^ uint(p.y) * 0xd8163841u;
+  h ^= h >> 16;
+  h *= 0x7feb352du;
+  h ^= h >> 15;
+  h *= 0x846ca68bu;
+  h ^= h >> 16;
+  return h;
+}
+
+// Unit gradient of a lattice point, rotated by angle. Neighbouring points
+// spin in opposite directions so the noise churns instead of drifting.
+vec2 latticeGradient(ivec2 p, float angle) {
+  uint h = hashLattice(p);
+  float a = float(h >> 1) * (2.0 * CURL_NOISE_PI / 2147483648.0);
+  a += bool(h & 1u) ? angle : -angle;
+  return vec2(cos(a), sin(a));
+}
+
+// Gradient noise whose lattice gradients rotate over time ("flow noise"),
+// band-limited around one cycle per lattice cell. Returns the value in x and
+// the analytic derivatives in yz.
+vec3 flowNoise(vec2 p, float angle) {
+  ivec2 i = ivec2(floor(p));
+  vec2 f = fract(p);
+
+  // Quintic fade, C2 continuous across cells
+  vec2 u = f * f * f * (f * (f * 6.0 - 15.0) + 10.0);
+  vec2 du = 30.0 * f * f * (f * (f - 2.0) + 1.0);
+
+  vec2 ga = latticeGradient(i, angle);
+  vec2 gb = latticeGradient(i + ivec2(1, 0), angle);
+  vec2 gc = latticeGradient(i + ivec2(0, 1), angle);
+  vec2 gd = latticeGradient(i + ivec2(1, 1), angle);
+
+  float va = dot(ga, f);
+  float vb = dot(gb, f - vec2(1.0, 0.0));
+  float vc = dot(gc, f - vec2(0.0, 1.0));
+  float vd = dot(gd, f - vec2(1.0, 1.0));
+
+  float k = va - vb - vc + vd;
+  float value = va + u.x * (vb - va) + u.y * (vc - va) + u.x * u.y * k;
+  vec2 derivative = ga + u.x * (gb - ga) + u.y * (gc - ga) +
+                    u.x * u.y * (ga - gb - gc + gd) +
+                    du * (u.yx * k + vec2(vb, vc) - va);
+
+  return vec3(value, derivative);
+}
+
+// Divergence-free velocity from the curl of flow noise, (d/dy, -d/dx)
+vec2 curlNoise(vec2 p, float angle) {
+  vec2 d = flowNoise(p, angle).yz;
+  return vec2(d.y, -d.x);
+}
+
+#endif // _CURLNOISE_
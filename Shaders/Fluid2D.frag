@@ -7,48 +7,14 @@ layout(location=0) in vec2 screenUV;
 layout(location=0) out vec4 outColor;
 layout(location=1) out vec4 outHdrColor;
 
-#define imageWidth push.params0
-#define imageHeight push.params1
-
 void main() {
-  vec2 vel = texture(velocityFieldTexture, screenUV).rg;
-  float pres = texture(pressureFieldTexture, screenUV).r;
-  float div = texture(divergenceFieldTexture, screenUV).r;
-  float f = texture(fractalTexture, screenUV).r;
-  float f2 = f * f;//100.0 * f * f;
-
-  // By default show color field
-  bool bTonemap = true;
-  vec3 color = texture(colorFieldTexture, screenUV).rgb;
-
-  //if (screenUV.x < 0.5)
-  {
-    // Show velocity
-    if (bool(simUniforms.inputMask & INPUT_BIT_V)) {
-      color = vec3(length(vel));
-      bTonemap = false;
-    }
-
-    // Show fractal
-    if (bool(simUniforms.inputMask & INPUT_BIT_F)) {
-      color = vec3(f2);
-      bTonemap = false;
-    }
-
-    // Show pressure
-    if (bool(simUniforms.inputMask & INPUT_BIT_P)) {
-      color = vec3(1000. * abs(pres));
-      bTonemap = false;
-    }
-
-    // Show divergence
-    if (bool(simUniforms.inputMask & INPUT_BIT_B)) {
-      color = vec3(1. * abs(div));
-      bTonemap = false;
-    }
-  }
+  // Composed by ComposeDisplay.comp into this frame's display field, the
+  // alpha channel marks whether the color gets tonemapped
+  vec4 display = texture(displayTexture, screenUV);
+  vec3 color = display.rgb;
+  bool bTonemap = display.a > 0.5;
 
-  AutoExposure exposure = getAutoExposureEntry((imageWidth * imageHeight - 1) / 32 + 2);
+  AutoExposure exposure = getAutoExposureEntry(simUniforms.displayExposureEntry);
 
   if (bTonemap)
   {
@@ -0,0 +1,13 @@
+#version 450
+
+#include "VolumeCommon.glsl"
+
+layout(location=0) in vec2 screenUV;
+
+layout(location=0) out vec4 outColor;
+
+void main() {
+  // Raymarched by RaymarchVolume.comp into this frame's display field
+  vec3 color = texture(displayTexture, screenUV).rgb;
+  outColor = vec4(vec3(1.0) - exp(-2.0 * color), 1.0);
+}
@@ -4,6 +4,31 @@
 #include <Bindless/GlobalHeap.glsl>
 #include <Misc/Input.glsl>
 
+// Specialization constants, the IDs must match the order in
+// KernelPermutation::getSpecializationConstants(). IDs 0 and 1 are the
+// workgroup size, see local_size_x_id / local_size_y_id in the kernels.
+layout(constant_id = 2) const int SIM_WIDTH = 1;
+layout(constant_id = 3) const int SIM_HEIGHT = 1;
+layout(constant_id = 4) const int ADV_STEPS = 4;
+layout(constant_id = 5) const int FRACTAL_ITERS = 1000;
+layout(constant_id = 6) const int CURL_DOWNSAMPLE = 1;
+layout(constant_id = 7) const int VEL_DOWNSAMPLE = 1;
+
+// Resolution of the velocity grid. The velocity, pressure and divergence
+// fields live on it, the dye and the fractal stay on the simulation grid.
+#define VEL_WIDTH ((SIM_WIDTH - 1) / VEL_DOWNSAMPLE + 1)
+#define VEL_HEIGHT ((SIM_HEIGHT - 1) / VEL_DOWNSAMPLE + 1)
+
+// Resolution of the curl field used for vorticity confinement, relative to
+// the velocity grid
+#define CURL_WIDTH ((VEL_WIDTH - 1) / CURL_DOWNSAMPLE + 1)
+#define CURL_HEIGHT ((VEL_HEIGHT - 1) / CURL_DOWNSAMPLE + 1)
+
+// The spectral projection works on the velocity grid zero padded up to
+// power of two dimensions
+#define SPECTRAL_WIDTH (1 << (findMSB(VEL_WIDTH - 1) + 1))
+#define SPECTRAL_HEIGHT (1 << (findMSB(VEL_HEIGHT - 1) + 1))
+
 layout(push_constant) uniform PushConstant {
   uint simUniforms;
   uint params0;
@@ -13,12 +38,14 @@ layout(push_constant) uniform PushConstant {
 
 UNIFORM_BUFFER(_simulationUniforms, SimulationUniforms{
   dvec2 offset;
-  dvec2 lastOffset;
 
   double zoom;
-  double lastZoom;
   int width;
   int height;
+
+  vec2 reprojectOffset;
+  float reprojectScale;
+  uint padding;
   
   float time;
   float dt;
@@ -28,7 +55,7 @@ UNIFORM_BUFFER(_simulationUniforms, SimulationUniforms{
   float vorticity;
   uint flags;
   uint inputMask;
-  uint padding2;
+  uint spectralBuffer;
 
   uint fractalTexture;
   uint velocityFieldTexture;
@@ -43,10 +70,42 @@ UNIFORM_BUFFER(_simulationUniforms, SimulationUniforms{
   uint pressureFieldImage;
   uint fractalImage;
   uint velocityFieldImage;
-  uint iterationCountsImage;
+  uint fractalAtlasImage;
 
   uint colorFieldImage;
   uint autoExposureBuffer;
+  uint statsBuffer;
+  uint curlFieldImage;
+
+  uint pressureResidualImage;
+  uint pressureCorrectionImage;
+  uint displayImage;
+  uint displayTexture;
+
+  uint displayExposureEntry;
+  float velocityDetail;
+  uint departureMapImage;
+  uint departureMapTexture;
+
+  dvec2 fractalGridOrigin;
+  double fractalTexelSpacing;
+  uint fractalTilePageTable;
+  uint fractalTileRequests;
+
+  uint fractalGridWidth;
+  uint fractalGridHeight;
+  uint fractalAtlasTilesX;
+  uint padding2;
+
+  dvec2 canvasGridOrigin;
+  double canvasTexelSpacing;
+  uint canvasPageTable;
+  uint canvasAtlasImage;
+
+  uint canvasGridWidth;
+  uint canvasGridHeight;
+  uint canvasAtlasTilesX;
+  uint padding3;
 });
 #define simUniforms _simulationUniforms[push.simUniforms]
 
@@ -55,7 +114,7 @@ IMAGE2D_RW(_rgba32fimageHeap, rgba32f);
 IMAGE2D_RW(_r32fimageHeap, r32f);
 IMAGE2D_RW(_rg16fimageHeap, rg16f);
 IMAGE2D_RW(_r16fimageHeap, r16f);
-DECL_IMAGE_HEAP(uniform iimage2D _iimageHeap, r32i);
+IMAGE2D_RW(_rgba16fimageHeap, rgba16f);
 
 struct AutoExposure {
   float minIntensity;
@@ -67,6 +126,77 @@ BUFFER_RW(_autoExposureBuffer, AutoExposureBuffer{
 });
 #define getAutoExposureEntry(idx)   _autoExposureBuffer[simUniforms.autoExposureBuffer].entries[idx]
 
+// Entry 0 holds the final reduced statistics, followed by one partial entry
+// per workgroup of the stats pass
+struct SimulationStatsEntry {
+  float kineticEnergy;
+  float divergenceSum;
+  float divergenceMax;
+  float residualSum;
+
+  float residualMax;
+  float velocityMax;
+  float dyeMass;
+  float dyeDetail;
+};
+
+BUFFER_RW(_simulationStatsBuffer, SimulationStatsBuffer{
+  SimulationStatsEntry entries[];
+});
+#define getStatsEntry(idx)          _simulationStatsBuffer[simUniforms.statsBuffer].entries[idx]
+
+// Two ping-pong halves of SPECTRAL_WIDTH * SPECTRAL_HEIGHT entries, each
+// entry holds the complex spectra of both velocity components as
+// (u.re, u.im, v.re, v.im)
+BUFFER_RW(_spectralBuffer, SpectralBuffer{
+  vec4 entries[];
+});
+#define getSpectralEntry(half, idx) _spectralBuffer[simUniforms.spectralBuffer].entries[(half) * SPECTRAL_WIDTH * SPECTRAL_HEIGHT + (idx)]
+
+// Texels per side of a fractal tile, matches FRACTAL_TILE_SIZE in
+// FractalTileCache.h
+#define FRACTAL_TILE_SIZE 64
+
+// Matches FractalTileRequest in FractalTileCache.h
+struct FractalTileRequest {
+  dvec2 origin;
+  double texelSpacing;
+  uint slot;
+  uint padding;
+};
+
+BUFFER_RW(_fractalTileRequests, FractalTileRequests{
+  FractalTileRequest entries[];
+});
+#define getFractalTileRequest(idx)  _fractalTileRequests[simUniforms.fractalTileRequests].entries[idx]
+
+// Atlas slot of every visible tile, row by row
+BUFFER_RW(_fractalPageTable, FractalPageTable{
+  uint entries[];
+});
+#define getFractalPageTableEntry(idx) _fractalPageTable[simUniforms.fractalTilePageTable].entries[idx]
+
+// Top left texel of an atlas slot
+#define getFractalAtlasTile(slot) \
+    (ivec2((slot) % simUniforms.fractalAtlasTilesX, \
+           (slot) / simUniforms.fractalAtlasTilesX) * FRACTAL_TILE_SIZE)
+
+// Texels per side of a canvas tile, matches CANVAS_TILE_SIZE in
+// PagedCanvas.h
+#define CANVAS_TILE_SIZE 128
+
+// Pool slot of every visible canvas tile, row by row, 0xFFFFFFFF for tiles
+// that are not resident yet
+BUFFER_RW(_canvasPageTable, CanvasPageTable{
+  uint entries[];
+});
+#define getCanvasPageTableEntry(idx) _canvasPageTable[simUniforms.canvasPageTable].entries[idx]
+
+// Top left texel of a canvas pool slot
+#define getCanvasAtlasTile(slot) \
+    (ivec2((slot) % simUniforms.canvasAtlasTilesX, \
+           (slot) / simUniforms.canvasAtlasTilesX) * CANVAS_TILE_SIZE)
+
 #define fractalTexture              _textureHeap[simUniforms.fractalTexture]
 #define velocityFieldTexture        _textureHeap[simUniforms.velocityFieldTexture]
 #define colorFieldTexture           _textureHeap[simUniforms.colorFieldTexture]
@@ -75,13 +205,55 @@ BUFFER_RW(_autoExposureBuffer, AutoExposureBuffer{
 #define pressureFieldTexture        _textureHeap[simUniforms.pressureFieldTexture]
 #define advectedColorFieldImage     _rgba32fimageHeap[simUniforms.advectedColorFieldImage]
 #define advectedVelocityFieldImage  _rg16fimageHeap[simUniforms.advectedVelocityFieldImage]
-#define divergenceFieldImage        _r16fimageHeap[simUniforms.divergenceFieldImage]
+#define divergenceFieldImage        _r32fimageHeap[simUniforms.divergenceFieldImage]
+
+#define pressureFieldImage          _r32fimageHeap[simUniforms.pressureFieldImage]
+#define pressureResidualImage       _r16fimageHeap[simUniforms.pressureResidualImage]
+#define pressureCorrectionImage     _r16fimageHeap[simUniforms.pressureCorrectionImage]
 
 #define fractalImage                _r32fimageHeap[simUniforms.fractalImage]
 #define velocityFieldImage          _rg16fimageHeap[simUniforms.velocityFieldImage]
+#define curlFieldImage              _r16fimageHeap[simUniforms.curlFieldImage]
+#define departureMapImage           _rg16fimageHeap[simUniforms.departureMapImage]
+#define departureMapTexture         _textureHeap[simUniforms.departureMapTexture]
+
+#define fractalAtlasImage           _r32fimageHeap[simUniforms.fractalAtlasImage]
+#define canvasAtlasImage            _rgba16fimageHeap[simUniforms.canvasAtlasImage]
 
-#define iterationCountsImage        _iimageHeap[simUniforms.iterationCountsImage]
+#define displayImage                _rgba32fimageHeap[simUniforms.displayImage]
+#define displayTexture              _textureHeap[simUniforms.displayTexture]
 
 #define isClearFlagSet() bool(simUniforms.flags & 1) 
+#define isMacCormackFlagSet() bool(simUniforms.flags & 2)
+// The spectral solve never writes the pressure
+#define isSpectralFlagSet() bool(simUniforms.flags & 4)
+
+// Camera reprojection, the identity when the camera did not move
+#define reprojectTexelPos(texelPosf) \
+    (simUniforms.reprojectScale * (texelPosf) + simUniforms.reprojectOffset)
+// Same in normalized coordinates, for grids other than the simulation grid
+#define reprojectUv(uv) \
+    (simUniforms.reprojectScale * (uv) + \
+     simUniforms.reprojectOffset / vec2(SIM_WIDTH, SIM_HEIGHT))
+
+// Where a point in normalized coordinates was at the start of the step, in
+// last frame's camera. Interpolated from the velocity grid, see
+// ComputeDepartures.comp.
+vec2 getDepartureUv(vec2 uv) {
+  vec2 velCell = vec2(1.0) / vec2(VEL_WIDTH, VEL_HEIGHT);
+  return uv + texture(departureMapTexture, uv).rg * velCell;
+}
+
+// MacCormack runs the departure map forwards from the departure point and
+// back again. Whatever the round trip misses of the reprojected start is
+// the advection error, half of which gets compensated. Returns the
+// roundtrip's departure point, sample the field there and at the reprojected
+// point and pass both to applyMacCormack.
+vec2 getRoundTripUv(vec2 uv, vec2 departureUv) {
+  return getDepartureUv(uv + (reprojectUv(uv) - departureUv));
+}
+
+#define applyMacCormack(advected, reprojected, roundTrip, minValue, maxValue) \
+    clamp((advected) + 0.5 * ((reprojected) - (roundTrip)), minValue, maxValue)
 
 #endif // _SIMULATIONCOMMON_
\ No newline at end of file
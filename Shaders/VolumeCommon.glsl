@@ -0,0 +1,191 @@
+#ifndef _VOLUMECOMMON_
+#define _VOLUMECOMMON_
+
+#include <Bindless/GlobalHeap.glsl>
+
+// Specialization constants, the IDs must match the order in
+// Simulation3D::_createKernels()
+layout(constant_id = 0) const int VOLUME_SIZE = 8;
+layout(constant_id = 1) const int ATLAS_BRICKS_X = 1;
+layout(constant_id = 2) const int ATLAS_BRICKS_Y = 1;
+layout(constant_id = 3) const int ATLAS_BRICKS_Z = 1;
+
+// See BrickLayout.h
+#define BRICK_SIZE 8
+#define BRICKS (VOLUME_SIZE / BRICK_SIZE)
+#define BRICK_COUNT (BRICKS * BRICKS * BRICKS)
+#define BRICK_CAPACITY (ATLAS_BRICKS_X * ATLAS_BRICKS_Y * ATLAS_BRICKS_Z)
+
+// Smoke density above which a brick counts as occupied
+#define OCCUPANCY_THRESHOLD 1e-3
+
+// The brick kernels run one 8x8x2 workgroup per resident brick, each thread
+// covers every other z slice of its column
+#define BRICK_SLICES_PER_THREAD 4
+#define BRICK_WORKGROUP layout(local_size_x = 8, local_size_y = 8, local_size_z = 2) in
+
+layout(push_constant) uniform PushConstant {
+  uint simUniforms;
+  uint params0;
+  uint params1;
+  uint params2;
+} push;
+
+UNIFORM_BUFFER(_volumeUniforms, VolumeUniforms{
+  mat4 inverseViewProjection;
+  vec4 cameraPosition;
+  vec4 emitter;
+
+  float time;
+  float dt;
+  float buoyancy;
+  float densityDecay;
+
+  float emitterSpeed;
+  uint brickBuffer;
+  uint velocityImage;
+  uint densityImage;
+
+  uint divergenceImage;
+  uint pressureImage;
+  uint displayImage;
+  uint displayTexture;
+});
+#define volUniforms _volumeUniforms[push.simUniforms]
+
+SAMPLER2D(_textureHeap);
+IMAGE2D_RW(_rgba32fimageHeap, rgba32f);
+DECL_IMAGE_HEAP(uniform image3D _rgba16fvolumeHeap, rgba16f);
+DECL_IMAGE_HEAP(uniform image3D _r16fvolumeHeap, r16f);
+DECL_IMAGE_HEAP(uniform image3D _r32fvolumeHeap, r32f);
+
+// The counters are followed by the brick map (slot + 1 per brick, 0 if not
+// resident), the brick flags and the free, new and active lists
+BUFFER_RW(_brickBuffer, BrickBuffer{
+  int freeCount;
+  uint newCount;
+  uint activeCount;
+  uint overflowCount;
+  uint entries[];
+});
+#define brickBuffer                 _brickBuffer[volUniforms.brickBuffer]
+#define brickMap(i)                 brickBuffer.entries[i]
+#define brickFlags(i)               brickBuffer.entries[BRICK_COUNT + (i)]
+#define freeSlots(i)                brickBuffer.entries[2 * BRICK_COUNT + (i)]
+#define newSlots(i)                 brickBuffer.entries[2 * BRICK_COUNT + BRICK_CAPACITY + (i)]
+#define activeBricks(i)             brickBuffer.entries[2 * BRICK_COUNT + 2 * BRICK_CAPACITY + (i)]
+
+#define velocityFieldA              _rgba16fvolumeHeap[volUniforms.velocityImage]
+#define velocityFieldB              _rgba16fvolumeHeap[volUniforms.velocityImage+1]
+#define densityFieldA               _r16fvolumeHeap[volUniforms.densityImage]
+#define densityFieldB               _r16fvolumeHeap[volUniforms.densityImage+1]
+#define divergenceField             _r32fvolumeHeap[volUniforms.divergenceImage]
+
+#define displayImage                _rgba32fimageHeap[volUniforms.displayImage]
+#define displayTexture              _textureHeap[volUniforms.displayTexture]
+
+uint getBrickIndex(ivec3 brickPos) {
+  return (brickPos.z * BRICKS + brickPos.y) * BRICKS + brickPos.x;
+}
+
+ivec3 getBrickPos(uint brick) {
+  return ivec3(brick % BRICKS, brick / BRICKS % BRICKS, brick / (BRICKS * BRICKS));
+}
+
+// Brick map entry of the brick holding a voxel, 0 outside the volume
+uint getBrickEntry(ivec3 pos) {
+  if (any(lessThan(pos, ivec3(0))) || any(greaterThanEqual(pos, ivec3(VOLUME_SIZE))))
+    return 0;
+  return brickMap(getBrickIndex(pos / BRICK_SIZE));
+}
+
+// Atlas texel of a voxel, given the pool slot of its brick
+ivec3 getAtlasPos(uint slot, ivec3 pos) {
+  ivec3 atlasBrick = ivec3(
+      slot % ATLAS_BRICKS_X,
+      slot / ATLAS_BRICKS_X % ATLAS_BRICKS_Y,
+      slot / (ATLAS_BRICKS_X * ATLAS_BRICKS_Y));
+  return atlasBrick * BRICK_SIZE + (pos & (BRICK_SIZE - 1));
+}
+
+// Voxel loads through the brick map, non resident voxels read as zero
+vec3 loadVelocity(uint image, ivec3 pos) {
+  uint entry = getBrickEntry(pos);
+  if (entry == 0)
+    return vec3(0.0);
+  return imageLoad(_rgba16fvolumeHeap[image], getAtlasPos(entry - 1, pos)).xyz;
+}
+
+float loadDensity(uint image, ivec3 pos) {
+  uint entry = getBrickEntry(pos);
+  if (entry == 0)
+    return 0.0;
+  return imageLoad(_r16fvolumeHeap[image], getAtlasPos(entry - 1, pos)).x;
+}
+
+// Walls are closed, non resident bricks are at ambient pressure
+float loadPressure(uint image, ivec3 pos) {
+  pos = clamp(pos, ivec3(0), ivec3(VOLUME_SIZE - 1));
+  uint entry = getBrickEntry(pos);
+  if (entry == 0)
+    return 0.0;
+  return imageLoad(_r32fvolumeHeap[image], getAtlasPos(entry - 1, pos)).x;
+}
+
+// Trilinear lookups at voxel coordinates, voxel centers are at + 0.5
+vec3 sampleVelocity(uint image, vec3 pos) {
+  pos -= vec3(0.5);
+  ivec3 p = ivec3(floor(pos));
+  vec3 f = pos - vec3(p);
+  return mix(
+      mix(mix(loadVelocity(image, p), loadVelocity(image, p + ivec3(1, 0, 0)), f.x),
+          mix(loadVelocity(image, p + ivec3(0, 1, 0)), loadVelocity(image, p + ivec3(1, 1, 0)), f.x),
+          f.y),
+      mix(mix(loadVelocity(image, p + ivec3(0, 0, 1)), loadVelocity(image, p + ivec3(1, 0, 1)), f.x),
+          mix(loadVelocity(image, p + ivec3(0, 1, 1)), loadVelocity(image, p + ivec3(1, 1, 1)), f.x),
+          f.y),
+      f.z);
+}
+
+float sampleDensity(uint image, vec3 pos) {
+  pos -= vec3(0.5);
+  ivec3 p = ivec3(floor(pos));
+  vec3 f = pos - vec3(p);
+  return mix(
+      mix(mix(loadDensity(image, p), loadDensity(image, p + ivec3(1, 0, 0)), f.x),
+          mix(loadDensity(image, p + ivec3(0, 1, 0)), loadDensity(image, p + ivec3(1, 1, 0)), f.x),
+          f.y),
+      mix(mix(loadDensity(image, p + ivec3(0, 0, 1)), loadDensity(image, p + ivec3(1, 0, 1)), f.x),
+          mix(loadDensity(image, p + ivec3(0, 1, 1)), loadDensity(image, p + ivec3(1, 1, 1)), f.x),
+          f.y),
+      f.z);
+}
+
+// The resident brick of this workgroup, false for the workgroups past the end
+// of the active list
+bool getActiveBrick(out ivec3 brickPos, out uint slot) {
+  if (gl_WorkGroupID.x >= brickBuffer.activeCount)
+    return false;
+
+  uint brick = activeBricks(gl_WorkGroupID.x);
+  brickPos = getBrickPos(brick);
+  slot = brickMap(brick) - 1;
+  return true;
+}
+
+// Voxel i of this thread's column within its brick
+ivec3 getBrickVoxel(ivec3 brickPos, int i) {
+  ivec3 local = ivec3(gl_LocalInvocationID);
+  local.z += i * int(gl_WorkGroupSize.z);
+  return brickPos * BRICK_SIZE + local;
+}
+
+bool touchesEmitter(ivec3 brickPos) {
+  vec3 center = volUniforms.emitter.xyz * VOLUME_SIZE;
+  vec3 lo = vec3(brickPos * BRICK_SIZE);
+  vec3 closest = clamp(center, lo, lo + vec3(BRICK_SIZE));
+  float radius = volUniforms.emitter.w * VOLUME_SIZE;
+  return dot(center - closest, center - closest) < radius * radius;
+}
+
+#endif // _VOLUMECOMMON_
@@ -0,0 +1,33 @@
+#include "BrickLayout.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace StableFluids {
+/*static*/
+BrickLayout BrickLayout::create(uint32_t size, float maxOccupancy) {
+  if (size == 0 || size % BRICK_SIZE != 0) {
+    throw std::runtime_error(
+        "Volume size must be a positive multiple of the brick size!");
+  }
+
+  if (!(maxOccupancy > 0.0f && maxOccupancy <= 1.0f))
+    throw std::runtime_error("Brick occupancy must be in (0, 1]!");
+
+  BrickLayout layout{};
+  layout.size = size;
+  layout.bricks = size / BRICK_SIZE;
+
+  // Whole slices of the grid's brick footprint, so the atlas never gets
+  // wider than the grid itself
+  layout.atlasX = layout.bricks;
+  layout.atlasY = layout.bricks;
+  layout.atlasZ = std::clamp(
+      static_cast<uint32_t>(std::ceil(layout.bricks * maxOccupancy)),
+      1u,
+      layout.bricks);
+
+  return layout;
+}
+} // namespace StableFluids
@@ -0,0 +1,132 @@
+#include "ComputeKernel.h"
+
+#include <stdexcept>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+
+ComputeKernel::ComputeKernel(
+    const Application& app,
+    const CompiledShader& shader,
+    VkPipelineCache pipelineCache,
+    VkDescriptorSetLayout heapSetLayout,
+    uint32_t pushConstantsSize,
+    const std::vector<uint32_t>& specializationConstants)
+    : _device(app.getDevice()) {
+  if (shader.hasErrors() || shader.spirv.empty()) {
+    throw std::runtime_error(
+        "Cannot create compute kernel from " + shader.path + ":\n" +
+        shader.errors);
+  }
+
+  VkPushConstantRange pushConstants{};
+  pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushConstants.offset = 0;
+  pushConstants.size = pushConstantsSize;
+
+  VkPipelineLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &heapSetLayout;
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &pushConstants;
+
+  if (vkCreatePipelineLayout(
+          this->_device,
+          &layoutInfo,
+          nullptr,
+          &this->_layout) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create compute pipeline layout!");
+  }
+
+  VkShaderModuleCreateInfo moduleInfo{};
+  moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  moduleInfo.codeSize = shader.spirv.size() * sizeof(uint32_t);
+  moduleInfo.pCode = shader.spirv.data();
+
+  VkShaderModule shaderModule;
+  if (vkCreateShaderModule(
+          this->_device,
+          &moduleInfo,
+          nullptr,
+          &shaderModule) != VK_SUCCESS) {
+    this->_destroy();
+    throw std::runtime_error("Failed to create shader module!");
+  }
+
+  std::vector<VkSpecializationMapEntry> mapEntries(
+      specializationConstants.size());
+  for (uint32_t i = 0; i < mapEntries.size(); ++i) {
+    mapEntries[i].constantID = i;
+    mapEntries[i].offset = i * sizeof(uint32_t);
+    mapEntries[i].size = sizeof(uint32_t);
+  }
+
+  VkSpecializationInfo specializationInfo{};
+  specializationInfo.mapEntryCount = static_cast<uint32_t>(mapEntries.size());
+  specializationInfo.pMapEntries = mapEntries.data();
+  specializationInfo.dataSize =
+      specializationConstants.size() * sizeof(uint32_t);
+  specializationInfo.pData = specializationConstants.data();
+
+  VkComputePipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = shaderModule;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.stage.pSpecializationInfo =
+      mapEntries.empty() ? nullptr : &specializationInfo;
+  pipelineInfo.layout = this->_layout;
+
+  VkResult result = vkCreateComputePipelines(
+      this->_device,
+      pipelineCache,
+      1,
+      &pipelineInfo,
+      nullptr,
+      &this->_pipeline);
+
+  // The module is no longer needed once the pipeline has been created
+  vkDestroyShaderModule(this->_device, shaderModule, nullptr);
+
+  if (result != VK_SUCCESS) {
+    this->_destroy();
+    throw std::runtime_error("Failed to create compute pipeline!");
+  }
+}
+
+ComputeKernel::~ComputeKernel() { this->_destroy(); }
+
+ComputeKernel::ComputeKernel(ComputeKernel&& rhs) { *this = std::move(rhs); }
+
+ComputeKernel& ComputeKernel::operator=(ComputeKernel&& rhs) {
+  if (this != &rhs) {
+    this->_destroy();
+
+    this->_device = rhs._device;
+    this->_layout = rhs._layout;
+    this->_pipeline = rhs._pipeline;
+
+    rhs._device = VK_NULL_HANDLE;
+    rhs._layout = VK_NULL_HANDLE;
+    rhs._pipeline = VK_NULL_HANDLE;
+  }
+
+  return *this;
+}
+
+void ComputeKernel::_destroy() {
+  if (this->_pipeline != VK_NULL_HANDLE) {
+    vkDestroyPipeline(this->_device, this->_pipeline, nullptr);
+    this->_pipeline = VK_NULL_HANDLE;
+  }
+
+  if (this->_layout != VK_NULL_HANDLE) {
+    vkDestroyPipelineLayout(this->_device, this->_layout, nullptr);
+    this->_layout = VK_NULL_HANDLE;
+  }
+}
+} // namespace StableFluids
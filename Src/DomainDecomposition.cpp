@@ -0,0 +1,50 @@
+#include "DomainDecomposition.h"
+
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace StableFluids {
+/*static*/
+DomainDecomposition DomainDecomposition::create(
+    uint32_t width,
+    uint32_t height,
+    uint32_t workerCount,
+    uint32_t halo) {
+  if (width == 0 || height == 0 || workerCount == 0)
+    throw std::runtime_error("Cannot decompose an empty grid!");
+
+  // The tiling with the shortest subdomain perimeter also exchanges the
+  // fewest halo cells
+  DomainDecomposition result{width, height, 0, 0, halo};
+  double bestPerimeter = std::numeric_limits<double>::max();
+  for (uint32_t tilesX = 1; tilesX <= workerCount; ++tilesX) {
+    if (workerCount % tilesX != 0)
+      continue;
+
+    uint32_t tilesY = workerCount / tilesX;
+    if (tilesX > width || tilesY > height)
+      continue;
+
+    // The smallest subdomain must still cover the halo of its neighbours
+    if (width / tilesX < halo || height / tilesY < halo)
+      continue;
+
+    double perimeter = static_cast<double>(width) / tilesX +
+                       static_cast<double>(height) / tilesY;
+    if (perimeter < bestPerimeter) {
+      bestPerimeter = perimeter;
+      result.tilesX = tilesX;
+      result.tilesY = tilesY;
+    }
+  }
+
+  if (result.tilesX == 0) {
+    throw std::runtime_error(
+        "Grid is too small to split between " + std::to_string(workerCount) +
+        " workers with a halo of " + std::to_string(halo) + " cells!");
+  }
+
+  return result;
+}
+} // namespace StableFluids
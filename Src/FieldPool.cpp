@@ -0,0 +1,360 @@
+#include "FieldPool.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+namespace {
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+uint32_t findDeviceLocalMemoryType(
+    VkPhysicalDevice physicalDevice,
+    uint32_t memoryTypeBits) {
+  VkPhysicalDeviceMemoryProperties properties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &properties);
+
+  for (uint32_t i = 0; i < properties.memoryTypeCount; ++i) {
+    if ((memoryTypeBits & (1u << i)) &&
+        (properties.memoryTypes[i].propertyFlags &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+      return i;
+    }
+  }
+
+  throw std::runtime_error("Failed to find memory type for pooled fields!");
+}
+
+#ifndef _WIN32
+constexpr VkExternalMemoryHandleTypeFlagBits EXTERNAL_MEMORY_HANDLE_TYPE =
+    VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
+#else
+constexpr VkExternalMemoryHandleTypeFlagBits EXTERNAL_MEMORY_HANDLE_TYPE =
+    VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_WIN32_BIT;
+#endif
+} // namespace
+
+void PooledField::transitionLayout(
+    VkCommandBuffer commandBuffer,
+    VkImageLayout layout,
+    VkAccessFlags accessMask,
+    VkPipelineStageFlags stage) {
+  this->_barrier(
+      commandBuffer,
+      this->_layout,
+      this->_accessMask,
+      this->_stage,
+      layout,
+      accessMask,
+      stage);
+}
+
+void PooledField::discard(
+    VkCommandBuffer commandBuffer,
+    VkImageLayout layout,
+    VkAccessFlags accessMask,
+    VkPipelineStageFlags stage) {
+  // Any field aliasing this memory may have been written or read by compute
+  // since this one was last used. Rendering only reads the per-frame display
+  // fields, whose last reader was fenced before this frame slot came up.
+  this->_barrier(
+      commandBuffer,
+      VK_IMAGE_LAYOUT_UNDEFINED,
+      VK_ACCESS_SHADER_WRITE_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      layout,
+      accessMask,
+      stage);
+}
+
+void PooledField::_barrier(
+    VkCommandBuffer commandBuffer,
+    VkImageLayout oldLayout,
+    VkAccessFlags srcAccessMask,
+    VkPipelineStageFlags srcStage,
+    VkImageLayout newLayout,
+    VkAccessFlags dstAccessMask,
+    VkPipelineStageFlags dstStage) {
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.image = this->_image;
+  barrier.oldLayout = oldLayout;
+  barrier.newLayout = newLayout;
+  barrier.srcAccessMask = srcAccessMask;
+  barrier.dstAccessMask = dstAccessMask;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      srcStage,
+      dstStage,
+      0,
+      0,
+      nullptr,
+      0,
+      nullptr,
+      1,
+      &barrier);
+
+  this->_layout = newLayout;
+  this->_accessMask = dstAccessMask;
+  this->_stage = dstStage;
+}
+
+FieldPool::FieldPool(
+    const Application& app,
+    GlobalHeap& heap,
+    uint32_t width,
+    uint32_t height,
+    const std::vector<FieldDesc>& fields,
+    uint32_t depth,
+    bool bExportable)
+    : _device(app.getDevice()), _bExportable(bExportable) {
+  this->_fields.resize(fields.size());
+
+  VkExternalMemoryImageCreateInfo externalImageInfo{};
+  externalImageInfo.sType =
+      VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO;
+  externalImageInfo.handleTypes = EXTERNAL_MEMORY_HANDLE_TYPE;
+
+  uint32_t memoryTypeBits = ~0u;
+  VkDeviceSize alignment = 1;
+  for (size_t i = 0; i < fields.size(); ++i) {
+    PooledField& field = this->_fields[i];
+    field._desc = fields[i];
+    field._extent = {
+        (width - 1) / field._desc.downsample + 1,
+        (height - 1) / field._desc.downsample + 1,
+        (depth - 1) / field._desc.downsample + 1};
+
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.pNext = bExportable ? &externalImageInfo : nullptr;
+    imageInfo.imageType = depth > 1 ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D;
+    imageInfo.format = field._desc.format;
+    imageInfo.extent = field._extent;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = field._desc.usage;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    if (vkCreateImage(this->_device, &imageInfo, nullptr, &field._image) !=
+        VK_SUCCESS) {
+      this->_destroy();
+      throw std::runtime_error("Failed to create pooled field image!");
+    }
+
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(this->_device, field._image, &requirements);
+
+    field._size = alignUp(requirements.size, requirements.alignment);
+    memoryTypeBits &= requirements.memoryTypeBits;
+    alignment = std::max(alignment, requirements.alignment);
+
+    this->_separateSize += field._size;
+  }
+
+  if (memoryTypeBits == 0) {
+    this->_destroy();
+    throw std::runtime_error("Pooled fields have no common memory type!");
+  }
+
+  // Place the largest fields first. Each field goes at the lowest offset
+  // that does not collide with an already placed field it is live together
+  // with.
+  std::vector<size_t> order(this->_fields.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return this->_fields[a]._size > this->_fields[b]._size;
+  });
+
+  std::vector<size_t> placed;
+  for (size_t i : order) {
+    PooledField& field = this->_fields[i];
+    field._offset = 0;
+
+    bool bCollides = true;
+    while (bCollides) {
+      bCollides = false;
+      for (size_t j : placed) {
+        const PooledField& other = this->_fields[j];
+        if (!field._desc.lifetime.overlaps(other._desc.lifetime))
+          continue;
+
+        if (field._offset < other._offset + other._size &&
+            other._offset < field._offset + field._size) {
+          field._offset = alignUp(other._offset + other._size, alignment);
+          bCollides = true;
+        }
+      }
+    }
+
+    placed.push_back(i);
+    this->_pooledSize =
+        std::max(this->_pooledSize, field._offset + field._size);
+  }
+
+  this->_memoryTypeIndex =
+      findDeviceLocalMemoryType(app.getPhysicalDevice(), memoryTypeBits);
+
+  VkExportMemoryAllocateInfo exportInfo{};
+  exportInfo.sType = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO;
+  exportInfo.handleTypes = EXTERNAL_MEMORY_HANDLE_TYPE;
+
+  VkMemoryAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.pNext = bExportable ? &exportInfo : nullptr;
+  allocInfo.allocationSize = this->_pooledSize;
+  allocInfo.memoryTypeIndex = this->_memoryTypeIndex;
+
+  if (vkAllocateMemory(this->_device, &allocInfo, nullptr, &this->_memory) !=
+      VK_SUCCESS) {
+    this->_destroy();
+    throw std::runtime_error("Failed to allocate pooled field memory!");
+  }
+
+  for (PooledField& field : this->_fields) {
+    if (vkBindImageMemory(
+            this->_device,
+            field._image,
+            this->_memory,
+            field._offset) != VK_SUCCESS) {
+      this->_destroy();
+      throw std::runtime_error("Failed to bind pooled field memory!");
+    }
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = field._image;
+    viewInfo.viewType =
+        depth > 1 ? VK_IMAGE_VIEW_TYPE_3D : VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = field._desc.format;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    if (vkCreateImageView(this->_device, &viewInfo, nullptr, &field._view) !=
+        VK_SUCCESS) {
+      this->_destroy();
+      throw std::runtime_error("Failed to create pooled field view!");
+    }
+
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = field._desc.filter;
+    samplerInfo.minFilter = field._desc.filter;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = field._desc.addressMode;
+    samplerInfo.addressModeV = field._desc.addressMode;
+    samplerInfo.addressModeW = field._desc.addressMode;
+    samplerInfo.maxLod = 0.0f;
+    samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+
+    if (vkCreateSampler(
+            this->_device,
+            &samplerInfo,
+            nullptr,
+            &field._sampler) != VK_SUCCESS) {
+      this->_destroy();
+      throw std::runtime_error("Failed to create pooled field sampler!");
+    }
+  }
+
+  // Storage handles first, in field order, since some kernels index the
+  // image heap relative to another field (e.g. ping-pong pairs)
+  for (PooledField& field : this->_fields) {
+    if (field._desc.usage & VK_IMAGE_USAGE_STORAGE_BIT) {
+      field.imageHandle = heap.registerImage();
+      heap.updateStorageImage(field.imageHandle, field._view, field._sampler);
+    }
+  }
+
+  for (PooledField& field : this->_fields) {
+    if (field._desc.usage & VK_IMAGE_USAGE_SAMPLED_BIT) {
+      field.textureHandle = heap.registerTexture();
+      heap.updateTexture(field.textureHandle, field._view, field._sampler);
+    }
+  }
+}
+
+FieldPool::~FieldPool() { this->_destroy(); }
+
+FieldPool::FieldPool(FieldPool&& rhs) { *this = std::move(rhs); }
+
+FieldPool& FieldPool::operator=(FieldPool&& rhs) {
+  if (this != &rhs) {
+    this->_destroy();
+
+    this->_device = rhs._device;
+    this->_memory = rhs._memory;
+    this->_memoryTypeIndex = rhs._memoryTypeIndex;
+    this->_bExportable = rhs._bExportable;
+    this->_fields = std::move(rhs._fields);
+    this->_pooledSize = rhs._pooledSize;
+    this->_separateSize = rhs._separateSize;
+
+    rhs._device = VK_NULL_HANDLE;
+    rhs._memory = VK_NULL_HANDLE;
+    rhs._fields.clear();
+  }
+
+  return *this;
+}
+
+int FieldPool::exportMemory() const {
+  if (!this->_bExportable)
+    throw std::runtime_error("Field pool was not created exportable!");
+
+#ifndef _WIN32
+  auto getMemoryFd = reinterpret_cast<PFN_vkGetMemoryFdKHR>(
+      vkGetDeviceProcAddr(this->_device, "vkGetMemoryFdKHR"));
+  if (!getMemoryFd)
+    throw std::runtime_error("VK_KHR_external_memory_fd is not enabled!");
+
+  VkMemoryGetFdInfoKHR getFdInfo{};
+  getFdInfo.sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR;
+  getFdInfo.memory = this->_memory;
+  getFdInfo.handleType = EXTERNAL_MEMORY_HANDLE_TYPE;
+
+  int fd = -1;
+  if (getMemoryFd(this->_device, &getFdInfo, &fd) != VK_SUCCESS)
+    throw std::runtime_error("Failed to export pooled field memory!");
+
+  return fd;
+#else
+  throw std::runtime_error("Field memory export needs file descriptors!");
+#endif
+}
+
+void FieldPool::_destroy() {
+  for (PooledField& field : this->_fields) {
+    if (field._sampler != VK_NULL_HANDLE)
+      vkDestroySampler(this->_device, field._sampler, nullptr);
+    if (field._view != VK_NULL_HANDLE)
+      vkDestroyImageView(this->_device, field._view, nullptr);
+    if (field._image != VK_NULL_HANDLE)
+      vkDestroyImage(this->_device, field._image, nullptr);
+  }
+  this->_fields.clear();
+
+  if (this->_memory != VK_NULL_HANDLE) {
+    vkFreeMemory(this->_device, this->_memory, nullptr);
+    this->_memory = VK_NULL_HANDLE;
+  }
+}
+} // namespace StableFluids
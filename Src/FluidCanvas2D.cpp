@@ -1,5 +1,7 @@
 #include "FluidCanvas2D.h"
 
+#include "LaunchOptions.h"
+
 #include <Althea/Application.h>
 #include <Althea/Camera.h>
 #include <Althea/Cubemap.h>
@@ -19,6 +21,8 @@
 
 #include <array>
 #include <cstdint>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -34,18 +38,168 @@ FluidCanvas2D::FluidCanvas2D() {}
 void FluidCanvas2D::initGame(Application& app) {
   const VkExtent2D& windowDims = app.getSwapChainExtent();
 
+  // Loads the on-disk pipeline cache, it gets written back on shutdown
+  _shaderCache = ShaderCache(app);
+
+  // Reproducible runs, see LaunchOptions
+  if (!GLaunchOptions.recordInputPath.empty()) {
+    _pInputRecorder =
+        std::make_unique<InputRecorder>(GLaunchOptions.recordInputPath);
+  }
+  if (!GLaunchOptions.replayInputPath.empty()) {
+    _pInputReplay =
+        std::make_unique<InputReplay>(GLaunchOptions.replayInputPath);
+  }
+  if (!GLaunchOptions.cameraPath.empty()) {
+    _pCameraPath = std::make_unique<CameraPath>(
+        GLaunchOptions.cameraPath,
+        GLaunchOptions.cameraPathTimestep);
+  }
+
   // Recreate any stale pipelines (shader hot-reload)
   app.getInputManager().addKeyBinding(
       {GLFW_KEY_R, GLFW_PRESS, GLFW_MOD_CONTROL},
       [&app, that = this]() {
         that->_renderPass.tryRecompile(app);
-        that->_simulation.tryRecompileShaders(app);
+        that->_simulation.tryRecompileShaders();
       });
 
   app.getInputManager().addKeyBinding(
       {GLFW_KEY_C, GLFW_PRESS, 0},
       [&app, that = this]() { that->_simulation.clear = true; });
 
+  // Toggle vorticity confinement, plain V shows the velocity field
+  app.getInputManager().addKeyBinding(
+      {GLFW_KEY_V, GLFW_PRESS, GLFW_MOD_CONTROL},
+      [that = this]() {
+        that->_simulation.vorticity =
+            that->_simulation.vorticity == 0.0f ? 0.5f : 0.0f;
+      });
+
+  // Toggle between the iterative and the spectral pressure solve, plain P
+  // shows the pressure field. The spectral solve treats the domain as
+  // periodic and lets flow through the walls.
+  app.getInputManager().addKeyBinding(
+      {GLFW_KEY_P, GLFW_PRESS, GLFW_MOD_CONTROL},
+      [that = this]() {
+        that->_simulation.setPressureSolver(
+            that->_simulation.getPressureSolver() == PressureSolver::Spectral
+                ? PressureSolver::Iterative
+                : PressureSolver::Spectral);
+      });
+
+  // Toggle between semi-Lagrangian and MacCormack advection
+  app.getInputManager().addKeyBinding(
+      {GLFW_KEY_A, GLFW_PRESS, GLFW_MOD_CONTROL},
+      [that = this]() {
+        that->_simulation.setAdvectionScheme(
+            that->_simulation.getAdvectionScheme() ==
+                    AdvectionScheme::MacCormack
+                ? AdvectionScheme::SemiLagrangian
+                : AdvectionScheme::MacCormack);
+      });
+
+  // Toggle simulation statistics
+  app.getInputManager().addKeyBinding(
+      {GLFW_KEY_G, GLFW_PRESS, 0},
+      [that = this]() {
+        that->_simulation.setStatsEnabled(
+            !that->_simulation.isStatsEnabled());
+      });
+
+  // Print the fractal tile cache statistics
+  app.getInputManager().addKeyBinding(
+      {GLFW_KEY_T, GLFW_PRESS, 0},
+      [that = this]() {
+        const FractalTileCache& tiles =
+            that->_simulation.getFractalTileCache();
+        const FractalTileStats& stats = tiles.getStats();
+        std::cout << "Fractal tiles: " << stats.visibleTiles << " visible at "
+                  << "level " << tiles.getView().level << ", "
+                  << stats.cachedTiles << " cached, " << stats.loadedTiles
+                  << " loaded, " << stats.computedTiles << " computed, "
+                  << stats.spilledTiles << " spilled, hit rate "
+                  << stats.getHitRate() << std::endl;
+      });
+
+  // Print the paged canvas statistics
+  app.getInputManager().addKeyBinding(
+      {GLFW_KEY_X, GLFW_PRESS, 0},
+      [that = this]() {
+        const PagedCanvas* pCanvas = that->_simulation.getPagedCanvas();
+        if (!pCanvas)
+          return;
+
+        const CanvasStats& stats = pCanvas->getStats();
+        std::cout << "Canvas tiles: " << stats.visibleTiles << " visible, "
+                  << stats.residentTiles << " resident, " << stats.storedTiles
+                  << " stored, " << stats.pagedInTiles << " paged in, "
+                  << stats.pagedOutTiles << " paged out, "
+                  << stats.skippedUpdates << " skipped updates, paging "
+                  << stats.getPagingBandwidth() << "MB/s" << std::endl;
+      });
+
+  // Export the whole paged canvas
+  app.getInputManager().addKeyBinding(
+      {GLFW_KEY_X, GLFW_PRESS, GLFW_MOD_CONTROL},
+      [&app, that = this]() {
+        PagedCanvas* pCanvas = that->_simulation.getPagedCanvas();
+        if (!pCanvas)
+          return;
+
+        std::filesystem::create_directories(GProjectDirectory + "/HdrCaptures");
+        pCanvas->exportExr(app, GProjectDirectory + "/HdrCaptures/Canvas.exr");
+      });
+
+  // Toggle autotuning of the workgroup shape for this device and resolution
+  app.getInputManager().addKeyBinding(
+      {GLFW_KEY_T, GLFW_PRESS, GLFW_MOD_CONTROL},
+      [that = this]() {
+        if (that->_tuner.isRunning()) {
+          that->_tuner.cancel(that->_simulation);
+          std::cout << "Tuning cancelled" << std::endl;
+        } else if (!that->_tuner.isSupported()) {
+          std::cout << "Tuning needs timestamp queries on the graphics queue"
+                    << std::endl;
+        } else {
+          that->_tuner.start(that->_simulation);
+        }
+      });
+
+  // Toggle per-frame statistics logging
+  app.getInputManager().addKeyBinding(
+      {GLFW_KEY_L, GLFW_PRESS, 0},
+      [that = this]() {
+        if (that->_pStatsLog) {
+          that->_simulation.setStatsLog(nullptr);
+          that->_pStatsLog = nullptr;
+          return;
+        }
+
+        std::filesystem::create_directories(GProjectDirectory + "/Logs");
+        that->_pStatsLog = std::make_unique<std::ofstream>(
+            GProjectDirectory + "/Logs/SimulationStats.csv");
+        that->_simulation.setStatsEnabled(true);
+        that->_simulation.setStatsLog(that->_pStatsLog.get());
+      });
+
+  // Quality presets, each one maps to a cached kernel permutation
+  app.getInputManager().addKeyBinding(
+      {GLFW_KEY_1, GLFW_PRESS, 0},
+      [that = this]() {
+        that->_simulation.setPreset(SimulationPreset::Preview);
+      });
+  app.getInputManager().addKeyBinding(
+      {GLFW_KEY_2, GLFW_PRESS, 0},
+      [that = this]() {
+        that->_simulation.setPreset(SimulationPreset::Default);
+      });
+  app.getInputManager().addKeyBinding(
+      {GLFW_KEY_3, GLFW_PRESS, 0},
+      [that = this]() {
+        that->_simulation.setPreset(SimulationPreset::HighQuality);
+      });
+
   // app.getInputManager().addMousePositionCallback(
   //     [that = this, &app](double mPosX, double mPosY, bool clicked) {
   //       glm::vec2 fromCenter(mPosX - 1.0, 1.0 - mPosY);
@@ -71,7 +225,12 @@ void FluidCanvas2D::initGame(Application& app) {
       });
 }
 
-void FluidCanvas2D::shutdownGame(Application& app) {}
+void FluidCanvas2D::shutdownGame(Application& app) {
+  _shaderCache = {};
+  _pInputRecorder = nullptr;
+  _pInputReplay = nullptr;
+  _pCameraPath = nullptr;
+}
 
 void FluidCanvas2D::createRenderState(Application& app) {
   const VkExtent2D& extent = app.getSwapChainExtent();
@@ -79,7 +238,49 @@ void FluidCanvas2D::createRenderState(Application& app) {
   SingleTimeCommandBuffer commandBuffer(app);
 
   _heap = GlobalHeap(app);
-  _simulation = Simulation(app, commandBuffer, _heap);
+  _simulation = Simulation(
+      app,
+      commandBuffer,
+      _heap,
+      _shaderCache,
+      extent,
+      GLaunchOptions.velocityDownsample);
+  _simulation.setStatsEnabled(_pStatsLog != nullptr);
+  _simulation.setStatsLog(_pStatsLog.get());
+  _simulation.setInputRecorder(_pInputRecorder.get());
+  _simulation.setInputReplay(_pInputReplay.get());
+  _simulation.setCameraPath(_pCameraPath.get());
+
+  _tuner = SimulationTuner(
+      app,
+      _shaderCache,
+      extent,
+      GLaunchOptions.velocityDownsample);
+  SimulationTuning tuning{};
+  if (_tuner.load(tuning)) {
+    _simulation.setTuning(tuning);
+    std::cout << "Loaded tuning for this device: " << tuning.localSizeX << "x"
+              << tuning.localSizeY << " workgroups" << std::endl;
+  }
+
+  if (!GLaunchOptions.fractalCachePath.empty()) {
+    // 256MB of spilled tiles
+    _simulation.getFractalTileCache().openSpillFile(
+        app,
+        GLaunchOptions.fractalCachePath,
+        16384);
+  }
+
+  // The canvas does not survive a swapchain rebuild, it is recreated along
+  // with the simulation
+  if (GLaunchOptions.canvasSize > 0) {
+    _simulation.enablePagedCanvas(
+        app,
+        _heap,
+        GLaunchOptions.canvasSize,
+        GLaunchOptions.canvasSize,
+        _shaderCache.getCacheDirectory() + "/Canvas.bin");
+  }
 
   // hdr buffers
   {
@@ -170,6 +371,7 @@ void FluidCanvas2D::destroyRenderState(Application& app) {
   _hdrImage = {};
   _hdrStagingBuffers = {};
 
+  _tuner = {};
   _simulation = {};
 
   _heap = {};
@@ -193,7 +395,9 @@ void FluidCanvas2D::draw(
   VkExtent2D extent = app.getSwapChainExtent();
 
   VkDescriptorSet heapSet = _heap.getDescriptorSet();
+  _tuner.beginUpdate(commandBuffer, frame, _simulation);
   _simulation.update(app, commandBuffer, heapSet, frame);
+  _tuner.endUpdate(commandBuffer, frame, _simulation);
 
   _hdrImage.image.transitionLayout(
       commandBuffer,
@@ -213,8 +417,6 @@ void FluidCanvas2D::draw(
 
     SimulationPushConstants push{};
     push.simUniforms = _simulation.getSimUniforms(frame).index;
-    push.params0 = extent.width;
-    push.params1 = extent.height;
     pass.getDrawContext().updatePushConstants(push, 0);
 
     // Draw simulation
@@ -0,0 +1,157 @@
+#include "FluidCanvas3D.h"
+
+#include "LaunchOptions.h"
+
+#include <Althea/Application.h>
+#include <Althea/GraphicsPipeline.h>
+#include <Althea/InputManager.h>
+#include <Althea/SingleTimeCommandBuffer.h>
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include <iostream>
+#include <vector>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+
+FluidCanvas3D::FluidCanvas3D() {}
+
+void FluidCanvas3D::initGame(Application& app) {
+  // Loads the on-disk pipeline cache, it gets written back on shutdown
+  _shaderCache = ShaderCache(app);
+
+  // Recreate any stale pipelines (shader hot-reload)
+  app.getInputManager().addKeyBinding(
+      {GLFW_KEY_R, GLFW_PRESS, GLFW_MOD_CONTROL},
+      [&app, that = this]() {
+        that->_renderPass.tryRecompile(app);
+        that->_simulation.tryRecompileShaders();
+      });
+
+  app.getInputManager().addKeyBinding(
+      {GLFW_KEY_C, GLFW_PRESS, 0},
+      [that = this]() { that->_simulation.clear = true; });
+
+  // Print the brick pool usage
+  app.getInputManager().addKeyBinding(
+      {GLFW_KEY_G, GLFW_PRESS, 0},
+      [that = this]() {
+        const BrickCounters& counters = that->_simulation.getBrickCounters();
+        const BrickLayout& layout = that->_simulation.getLayout();
+        std::cout << counters.activeCount << " of " << layout.getCapacity()
+                  << " pooled bricks resident (" << layout.getBrickCount()
+                  << " in the volume), " << counters.overflowCount
+                  << " dropped since the last clear" << std::endl;
+      });
+
+  // Zoom the orbit camera
+  app.getInputManager().addKeyBinding(
+      {GLFW_KEY_E, GLFW_PRESS, 0},
+      [that = this]() {
+        that->_simulation.targetZoomDir =
+            glm::clamp(that->_simulation.targetZoomDir + 1.0f, -1.0f, 1.0f);
+      });
+
+  app.getInputManager().addKeyBinding(
+      {GLFW_KEY_Q, GLFW_PRESS, 0},
+      [that = this]() {
+        that->_simulation.targetZoomDir =
+            glm::clamp(that->_simulation.targetZoomDir - 1.0f, -1.0f, 1.0f);
+      });
+}
+
+void FluidCanvas3D::shutdownGame(Application& app) { _shaderCache = {}; }
+
+void FluidCanvas3D::createRenderState(Application& app) {
+  const VkExtent2D& extent = app.getSwapChainExtent();
+
+  SingleTimeCommandBuffer commandBuffer(app);
+
+  _heap = GlobalHeap(app);
+  _simulation = Simulation3D(
+      app,
+      commandBuffer,
+      _heap,
+      _shaderCache,
+      GLaunchOptions.volumeSize);
+
+  std::vector<SubpassBuilder> subpassBuilders;
+
+  // Render pass, presents the raymarched display field
+  {
+    SubpassBuilder& subpassBuilder = subpassBuilders.emplace_back();
+    subpassBuilder.colorAttachments = {0};
+
+    subpassBuilder.pipelineBuilder
+        .setFrontFace(VK_FRONT_FACE_CLOCKWISE)
+        .addVertexShader(GProjectDirectory + "/Shaders/Fluid2D.vert")
+        .addFragmentShader(GProjectDirectory + "/Shaders/Fluid3D.frag")
+        .layoutBuilder
+        .addDescriptorSet(_heap.getDescriptorSetLayout())
+        .addPushConstants<SimulationPushConstants>(
+            VK_SHADER_STAGE_FRAGMENT_BIT);
+  }
+
+  VkClearValue colorClear;
+  colorClear.color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+
+  std::vector<Attachment> attachments = {
+      {ATTACHMENT_FLAG_COLOR,
+       app.getSwapChainImageFormat(),
+       colorClear,
+       true,
+       false}};
+
+  this->_renderPass = RenderPass(
+      app,
+      extent,
+      std::move(attachments),
+      std::move(subpassBuilders));
+
+  _swapChainFrameBuffers =
+      SwapChainFrameBufferCollection(app, _renderPass, {});
+}
+
+void FluidCanvas3D::destroyRenderState(Application& app) {
+  _renderPass = {};
+  _swapChainFrameBuffers = {};
+
+  _simulation = {};
+
+  _heap = {};
+}
+
+void FluidCanvas3D::tick(Application& app, const FrameContext& frame) {}
+
+namespace {
+struct FullScreenTriangle {
+  void draw(const DrawContext& context) const {
+    context.bindDescriptorSets();
+    context.draw(3);
+  }
+};
+} // namespace
+
+void FluidCanvas3D::draw(
+    Application& app,
+    VkCommandBuffer commandBuffer,
+    const FrameContext& frame) {
+  VkDescriptorSet heapSet = _heap.getDescriptorSet();
+  _simulation.update(app, commandBuffer, heapSet, frame);
+
+  ActiveRenderPass pass = _renderPass.begin(
+      app,
+      commandBuffer,
+      frame,
+      this->_swapChainFrameBuffers.getCurrentFrameBuffer(frame));
+  pass.setGlobalDescriptorSets(gsl::span(&heapSet, 1));
+
+  SimulationPushConstants push{};
+  push.simUniforms = _simulation.getUniforms(frame).index;
+  pass.getDrawContext().updatePushConstants(push, 0);
+
+  pass.draw(FullScreenTriangle{});
+}
+} // namespace StableFluids
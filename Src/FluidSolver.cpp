@@ -0,0 +1,158 @@
+#include "FluidSolver.h"
+
+#include <Althea/SingleTimeCommandBuffer.h>
+
+#include <stdexcept>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+namespace {
+SimulationField getSimulationField(FluidSolverField field) {
+  switch (field) {
+  case FluidSolverField::Velocity:
+    return FIELD_VELOCITY;
+  case FluidSolverField::Dye:
+  default:
+    return FIELD_COLOR_A;
+  }
+}
+} // namespace
+
+FluidSolver::FluidSolver(Application& app, const FluidSolverDesc& desc)
+    : _device(app.getDevice()), _bExportable(desc.bExportable) {
+  if (desc.width == 0 || desc.height == 0)
+    throw std::runtime_error("Fluid solver extent must be positive!");
+#ifdef _WIN32
+  if (desc.bExportable)
+    throw std::runtime_error("Fluid solver export needs file descriptors!");
+#endif
+
+  this->_shaderCache = ShaderCache(app);
+  this->_heap = GlobalHeap(app);
+
+  {
+    SingleTimeCommandBuffer commandBuffer(app);
+    this->_simulation = Simulation(
+        app,
+        commandBuffer,
+        this->_heap,
+        this->_shaderCache,
+        {desc.width, desc.height},
+        desc.velocityDownsample,
+        desc.bExportable);
+  }
+
+  // Nobody looks at the display fields, keep the interaction and the
+  // diagnostics out of the step
+  this->_simulation.setLiveInputEnabled(false);
+  this->_simulation.setStatsEnabled(false);
+  this->setParameters(this->_parameters);
+
+  VkExportSemaphoreCreateInfo exportInfo{};
+  exportInfo.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO;
+  exportInfo.handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT;
+
+  VkSemaphoreTypeCreateInfo typeInfo{};
+  typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  typeInfo.pNext = desc.bExportable ? &exportInfo : nullptr;
+  typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  typeInfo.initialValue = 0;
+
+  VkSemaphoreCreateInfo semaphoreInfo{};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphoreInfo.pNext = &typeInfo;
+
+  if (vkCreateSemaphore(
+          this->_device,
+          &semaphoreInfo,
+          nullptr,
+          &this->_stepSemaphore) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create fluid solver semaphore!");
+  }
+}
+
+FluidSolver::~FluidSolver() {
+  if (this->_stepSemaphore != VK_NULL_HANDLE)
+    vkDestroySemaphore(this->_device, this->_stepSemaphore, nullptr);
+}
+
+void FluidSolver::step(
+    Application& app,
+    VkCommandBuffer commandBuffer,
+    const FrameContext& frame) {
+  this->_simulation.update(
+      app,
+      commandBuffer,
+      this->_heap.getDescriptorSet(),
+      frame);
+
+  // Hand the exposed fields over in a layout any importer can use. The
+  // semaphore signal makes the writes available, so the barrier only has to
+  // order the transition after the last pass.
+  for (FluidSolverField field :
+       {FluidSolverField::Velocity, FluidSolverField::Dye}) {
+    this->_simulation.getField(getSimulationField(field))
+        .transitionLayout(
+            commandBuffer,
+            VK_IMAGE_LAYOUT_GENERAL,
+            0,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+  }
+
+  ++this->_stepValue;
+}
+
+void FluidSolver::setParameters(const FluidSolverParameters& parameters) {
+  this->_parameters = parameters;
+
+  this->_simulation.timestep = parameters.timestep;
+  this->_simulation.vorticity = parameters.vorticity;
+  this->_simulation.velocityDetail = parameters.velocityDetail;
+  this->_simulation.setPreset(parameters.preset);
+  this->_simulation.setPressureSolver(parameters.pressureSolver);
+  this->_simulation.setAdvectionScheme(parameters.advectionScheme);
+}
+
+const PooledField& FluidSolver::getField(FluidSolverField field) const {
+  return this->_simulation.getField(getSimulationField(field));
+}
+
+ExternalField FluidSolver::exportField(FluidSolverField field) const {
+  const FieldPool& pool = this->_simulation.getFieldPool();
+  const PooledField& pooledField = this->getField(field);
+
+  ExternalField result{};
+  result.memoryFd = pool.exportMemory();
+  result.allocationSize = pool.getPooledSize();
+  result.memoryTypeIndex = pool.getMemoryTypeIndex();
+  result.offset = pooledField.getOffset();
+  result.format = pooledField.getDesc().format;
+  result.extent = pooledField.getExtent();
+  result.usage = pooledField.getDesc().usage;
+  result.layout = VK_IMAGE_LAYOUT_GENERAL;
+
+  return result;
+}
+
+int FluidSolver::exportStepSemaphore() const {
+  if (!this->_bExportable)
+    throw std::runtime_error("Fluid solver was not created exportable!");
+
+  auto getSemaphoreFd = reinterpret_cast<PFN_vkGetSemaphoreFdKHR>(
+      vkGetDeviceProcAddr(this->_device, "vkGetSemaphoreFdKHR"));
+  if (!getSemaphoreFd)
+    throw std::runtime_error("VK_KHR_external_semaphore_fd is not enabled!");
+
+  VkSemaphoreGetFdInfoKHR getFdInfo{};
+  getFdInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR;
+  getFdInfo.semaphore = this->_stepSemaphore;
+  getFdInfo.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT;
+
+  int fd = -1;
+  if (getSemaphoreFd(this->_device, &getFdInfo, &fd) != VK_SUCCESS)
+    throw std::runtime_error("Failed to export fluid solver semaphore!");
+
+  return fd;
+}
+} // namespace StableFluids
@@ -0,0 +1,443 @@
+#include "FractalTileCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+namespace {
+VkBufferImageCopy
+makeTileCopy(uint32_t slot, uint32_t atlasTilesX, VkDeviceSize bufferOffset) {
+  VkBufferImageCopy region{};
+  region.bufferOffset = bufferOffset;
+  region.bufferRowLength = 0;
+  region.bufferImageHeight = 0;
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.mipLevel = 0;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount = 1;
+  region.imageOffset = {
+      static_cast<int32_t>(slot % atlasTilesX * FRACTAL_TILE_SIZE),
+      static_cast<int32_t>(slot / atlasTilesX * FRACTAL_TILE_SIZE),
+      0};
+  region.imageExtent = {FRACTAL_TILE_SIZE, FRACTAL_TILE_SIZE, 1};
+  return region;
+}
+} // namespace
+
+FractalSpillFile::FractalSpillFile(const std::string& path, uint32_t capacity)
+    : _slots(capacity),
+      _file(path, static_cast<size_t>(capacity) * FRACTAL_TILE_BYTES) {}
+
+const float* FractalSpillFile::find(const TileKey& key) {
+  uint32_t slot;
+  if (!this->_slots.find(key, slot))
+    return nullptr;
+  return this->_getTile(slot);
+}
+
+float* FractalSpillFile::insert(const TileKey& key) {
+  uint32_t slot;
+  TileKey evictedKey;
+  this->_slots.insert(key, slot, evictedKey);
+  return this->_getTile(slot);
+}
+
+FractalTileCache::FractalTileCache(
+    const Application& app,
+    GlobalHeap& heap,
+    const VkExtent2D& extent)
+    : _allocator(app.getAllocator()), _extent(extent) {
+  // Tiles are drawn at between half and all of their size in pixels, plus
+  // partially visible tiles along both edges
+  this->_maxGridWidth =
+      (2 * extent.width + FRACTAL_TILE_SIZE - 1) / FRACTAL_TILE_SIZE + 2;
+  this->_maxGridHeight =
+      (2 * extent.height + FRACTAL_TILE_SIZE - 1) / FRACTAL_TILE_SIZE + 2;
+  uint32_t maxVisibleTiles = this->_maxGridWidth * this->_maxGridHeight;
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(app.getPhysicalDevice(), &properties);
+  uint32_t maxAtlasTiles =
+      properties.limits.maxImageDimension2D / FRACTAL_TILE_SIZE;
+
+  uint32_t capacity = FRACTAL_TILE_CACHE_VIEWS * maxVisibleTiles;
+  this->_atlasTilesX = std::min(capacity, maxAtlasTiles);
+  uint32_t atlasTilesY = std::min(
+      (capacity - 1) / this->_atlasTilesX + 1,
+      maxAtlasTiles);
+  capacity = this->_atlasTilesX * atlasTilesY;
+  if (capacity < maxVisibleTiles)
+    throw std::runtime_error("Fractal tile atlas does not fit a view!");
+
+  this->_slots = TileSlotCache(capacity);
+
+  {
+    FieldDesc atlasDesc{
+        VK_FORMAT_R32_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+            VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        {0, 0},
+        VK_FILTER_NEAREST};
+    this->_atlas = FieldPool(
+        app,
+        heap,
+        this->_atlasTilesX * FRACTAL_TILE_SIZE,
+        atlasTilesY * FRACTAL_TILE_SIZE,
+        {atlasDesc});
+
+    std::cout << "Allocated fractal tile atlas of " << capacity
+              << " tiles in " << (this->_atlas.getPooledSize() >> 20) << "MB"
+              << std::endl;
+  }
+
+  this->_pageTable = StructuredBuffer<uint32_t>(app, maxVisibleTiles);
+  this->_pageTable.registerToHeap(heap);
+  this->_requests = StructuredBuffer<FractalTileRequest>(app, maxVisibleTiles);
+  this->_requests.registerToHeap(heap);
+
+  VmaAllocationCreateInfo uploadInfo{};
+  uploadInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+  uploadInfo.usage = VMA_MEMORY_USAGE_AUTO;
+
+  for (FrameStaging& staging : this->_staging) {
+    staging.upload = BufferUtilities::createBuffer(
+        app,
+        this->_pageTable.getSize() + this->_requests.getSize(),
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        uploadInfo);
+  }
+}
+
+void FractalTileCache::openSpillFile(
+    const Application& app,
+    const std::string& path,
+    uint32_t capacity) {
+  this->_pSpillFile = std::make_unique<FractalSpillFile>(path, capacity);
+
+  VmaAllocationCreateInfo loadInfo{};
+  loadInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+  loadInfo.usage = VMA_MEMORY_USAGE_AUTO;
+
+  VmaAllocationCreateInfo spillInfo{};
+  spillInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
+  spillInfo.usage = VMA_MEMORY_USAGE_AUTO;
+
+  for (FrameStaging& staging : this->_staging) {
+    staging.load = BufferUtilities::createBuffer(
+        app,
+        MAX_LOADED_FRACTAL_TILES_PER_UPDATE * FRACTAL_TILE_BYTES,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        loadInfo);
+    staging.spill = BufferUtilities::createBuffer(
+        app,
+        MAX_SPILLED_FRACTAL_TILES_PER_UPDATE * FRACTAL_TILE_BYTES,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        spillInfo);
+    staging.spilledKeys.clear();
+  }
+
+  std::cout << "Spilling evicted fractal tiles to " << path << " ("
+            << ((static_cast<size_t>(capacity) * FRACTAL_TILE_BYTES) >> 20)
+            << "MB)" << std::endl;
+}
+
+void FractalTileCache::beginFrame(const FrameContext& frame) {
+  FrameStaging& staging = this->_staging[frame.frameRingBufferIndex];
+  if (staging.spilledKeys.empty())
+    return;
+
+  if (this->_pSpillFile && staging.generation == this->_generation) {
+    // Random access readbacks may land in non-coherent memory
+    vmaInvalidateAllocation(
+        this->_allocator,
+        staging.spill.getAllocation(),
+        0,
+        VK_WHOLE_SIZE);
+
+    const float* pSrc = static_cast<const float*>(staging.spill.mapMemory());
+    for (const TileKey& key : staging.spilledKeys) {
+      if (!this->_pSpillFile->contains(key)) {
+        memcpy(this->_pSpillFile->insert(key), pSrc, FRACTAL_TILE_BYTES);
+      }
+      pSrc += FRACTAL_TILE_SIZE * FRACTAL_TILE_SIZE;
+    }
+    staging.spill.unmapMemory();
+  }
+
+  staging.spilledKeys.clear();
+}
+
+const FractalTileView& FractalTileCache::update(
+    VkCommandBuffer commandBuffer,
+    const FrameContext& frame,
+    double zoom,
+    const glm::dvec2& offset) {
+  FrameStaging& staging = this->_staging[frame.frameRingBufferIndex];
+  staging.generation = this->_generation;
+
+  // Texel p of the simulation samples (2 * p * h - 1) / zoom + offset, see
+  // Mandelbrot.comp. Pick the coarsest level that is at least that fine.
+  double h = 1.0 / std::max(this->_extent.width, this->_extent.height);
+  double pixelSpacing = 2.0 * h / zoom;
+  int32_t level = static_cast<int32_t>(
+      std::ceil(std::log2(FRACTAL_LEVEL0_SPACING / pixelSpacing)));
+  level = std::min(level, MAX_FRACTAL_TILE_LEVEL);
+
+  double texelSpacing = std::ldexp(FRACTAL_LEVEL0_SPACING, -level);
+  double tileExtent = texelSpacing * FRACTAL_TILE_SIZE;
+
+  glm::dvec2 viewMin = offset - glm::dvec2(1.0 / zoom);
+  glm::dvec2 viewMax =
+      (2.0 * h *
+           glm::dvec2(this->_extent.width - 1, this->_extent.height - 1) -
+       glm::dvec2(1.0)) /
+          zoom +
+      offset;
+
+  // The assembly rounds to the nearest texel, which may be the first one of
+  // the next tile
+  int64_t tileX0 = static_cast<int64_t>(std::floor(viewMin.x / tileExtent));
+  int64_t tileY0 = static_cast<int64_t>(std::floor(viewMin.y / tileExtent));
+  int64_t tileX1 = static_cast<int64_t>(
+      std::floor((viewMax.x + 0.5 * texelSpacing) / tileExtent));
+  int64_t tileY1 = static_cast<int64_t>(
+      std::floor((viewMax.y + 0.5 * texelSpacing) / tileExtent));
+
+  // Only clamps past MAX_FRACTAL_TILE_LEVEL, where the fractal has no detail
+  // left to show anyway
+  FractalTileView& view = this->_view;
+  view.level = level;
+  view.gridOrigin = glm::dvec2(tileX0, tileY0) * tileExtent;
+  view.texelSpacing = texelSpacing;
+  view.gridWidth = static_cast<uint32_t>(std::min<int64_t>(
+      tileX1 - tileX0 + 1,
+      this->_maxGridWidth));
+  view.gridHeight = static_cast<uint32_t>(std::min<int64_t>(
+      tileY1 - tileY0 + 1,
+      this->_maxGridHeight));
+  view.requestCount = 0;
+
+  FractalTileStats& stats = this->_stats;
+  stats.visibleTiles = view.gridWidth * view.gridHeight;
+  stats.cachedTiles = 0;
+  stats.loadedTiles = 0;
+  stats.computedTiles = 0;
+  stats.spilledTiles = 0;
+
+  uint8_t* pUpload = static_cast<uint8_t*>(staging.upload.mapMemory());
+  uint32_t* pPageTable = reinterpret_cast<uint32_t*>(pUpload);
+  FractalTileRequest* pRequests = reinterpret_cast<FractalTileRequest*>(
+      pUpload + this->_pageTable.getSize());
+  float* pLoads =
+      this->_pSpillFile ? static_cast<float*>(staging.load.mapMemory())
+                        : nullptr;
+
+  std::vector<VkBufferImageCopy> spillCopies;
+  std::vector<VkBufferImageCopy> loadCopies;
+
+  // Touch every resident tile first, so the misses below never evict a
+  // visible tile. The atlas always has room for one full view.
+  std::vector<uint32_t> misses;
+  for (uint32_t y = 0; y < view.gridHeight; ++y) {
+    for (uint32_t x = 0; x < view.gridWidth; ++x) {
+      TileKey key{level, tileX0 + x, tileY0 + y};
+      uint32_t i = y * view.gridWidth + x;
+      if (this->_slots.find(key, pPageTable[i]))
+        ++stats.cachedTiles;
+      else
+        misses.push_back(i);
+    }
+  }
+
+  for (uint32_t i : misses) {
+    TileKey key{
+        level,
+        tileX0 + i % view.gridWidth,
+        tileY0 + i / view.gridWidth};
+
+    uint32_t slot;
+    TileKey evictedKey;
+    if (this->_slots.insert(key, slot, evictedKey) && this->_pSpillFile &&
+        spillCopies.size() < MAX_SPILLED_FRACTAL_TILES_PER_UPDATE &&
+        !this->_pSpillFile->contains(evictedKey)) {
+      spillCopies.push_back(makeTileCopy(
+          slot,
+          this->_atlasTilesX,
+          spillCopies.size() * FRACTAL_TILE_BYTES));
+      staging.spilledKeys.push_back(evictedKey);
+    }
+    pPageTable[i] = slot;
+
+    const float* pSpilled =
+        this->_pSpillFile &&
+                loadCopies.size() < MAX_LOADED_FRACTAL_TILES_PER_UPDATE
+            ? this->_pSpillFile->find(key)
+            : nullptr;
+    if (pSpilled) {
+      memcpy(
+          pLoads + loadCopies.size() * FRACTAL_TILE_SIZE * FRACTAL_TILE_SIZE,
+          pSpilled,
+          FRACTAL_TILE_BYTES);
+      loadCopies.push_back(makeTileCopy(
+          slot,
+          this->_atlasTilesX,
+          loadCopies.size() * FRACTAL_TILE_BYTES));
+      continue;
+    }
+
+    FractalTileRequest& request = pRequests[view.requestCount++];
+    request.originX = static_cast<double>(key.x) * tileExtent;
+    request.originY = static_cast<double>(key.y) * tileExtent;
+    request.texelSpacing = texelSpacing;
+    request.slot = slot;
+  }
+
+  staging.upload.unmapMemory();
+  if (pLoads)
+    staging.load.unmapMemory();
+
+  stats.loadedTiles = static_cast<uint32_t>(loadCopies.size());
+  stats.computedTiles = view.requestCount;
+  stats.spilledTiles = static_cast<uint32_t>(spillCopies.size());
+  stats.totalLookups += stats.visibleTiles;
+  stats.totalHits += stats.visibleTiles - view.requestCount;
+
+  // Evicted tiles leave the atlas before anything overwrites their slots
+  PooledField& atlas = this->getAtlas();
+  if (!spillCopies.empty()) {
+    atlas.transitionLayout(
+        commandBuffer,
+        VK_IMAGE_LAYOUT_GENERAL,
+        VK_ACCESS_TRANSFER_READ_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT);
+    vkCmdCopyImageToBuffer(
+        commandBuffer,
+        atlas.getImage(),
+        VK_IMAGE_LAYOUT_GENERAL,
+        staging.spill.getBuffer(),
+        static_cast<uint32_t>(spillCopies.size()),
+        spillCopies.data());
+    this->_transferBarrier(
+        commandBuffer,
+        staging.spill.getBuffer(),
+        VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_ACCESS_HOST_READ_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT);
+  }
+
+  if (!loadCopies.empty()) {
+    atlas.transitionLayout(
+        commandBuffer,
+        VK_IMAGE_LAYOUT_GENERAL,
+        VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT);
+    vkCmdCopyBufferToImage(
+        commandBuffer,
+        staging.load.getBuffer(),
+        atlas.getImage(),
+        VK_IMAGE_LAYOUT_GENERAL,
+        static_cast<uint32_t>(loadCopies.size()),
+        loadCopies.data());
+  }
+
+  // The last assembly may still be reading the previous page table
+  for (VkBuffer buffer :
+       {this->_pageTable.getAllocation().getBuffer(),
+        this->_requests.getAllocation().getBuffer()}) {
+    this->_transferBarrier(
+        commandBuffer,
+        buffer,
+        VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT);
+  }
+
+  VkBufferCopy pageTableCopy{};
+  pageTableCopy.srcOffset = 0;
+  pageTableCopy.dstOffset = 0;
+  pageTableCopy.size = stats.visibleTiles * sizeof(uint32_t);
+  vkCmdCopyBuffer(
+      commandBuffer,
+      staging.upload.getBuffer(),
+      this->_pageTable.getAllocation().getBuffer(),
+      1,
+      &pageTableCopy);
+
+  if (view.requestCount > 0) {
+    VkBufferCopy requestsCopy{};
+    requestsCopy.srcOffset = this->_pageTable.getSize();
+    requestsCopy.dstOffset = 0;
+    requestsCopy.size = view.requestCount * sizeof(FractalTileRequest);
+    vkCmdCopyBuffer(
+        commandBuffer,
+        staging.upload.getBuffer(),
+        this->_requests.getAllocation().getBuffer(),
+        1,
+        &requestsCopy);
+  }
+
+  for (VkBuffer buffer :
+       {this->_pageTable.getAllocation().getBuffer(),
+        this->_requests.getAllocation().getBuffer()}) {
+    this->_transferBarrier(
+        commandBuffer,
+        buffer,
+        VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  }
+
+  atlas.transitionLayout(
+      commandBuffer,
+      VK_IMAGE_LAYOUT_GENERAL,
+      VK_ACCESS_SHADER_WRITE_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+  return view;
+}
+
+void FractalTileCache::clear() {
+  this->_slots.clear();
+  if (this->_pSpillFile)
+    this->_pSpillFile->clear();
+  ++this->_generation;
+}
+
+void FractalTileCache::_transferBarrier(
+    VkCommandBuffer commandBuffer,
+    VkBuffer buffer,
+    VkAccessFlags srcAccess,
+    VkPipelineStageFlags srcStage,
+    VkAccessFlags dstAccess,
+    VkPipelineStageFlags dstStage) const {
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.buffer = buffer;
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+  barrier.srcAccessMask = srcAccess;
+  barrier.dstAccessMask = dstAccess;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      srcStage,
+      dstStage,
+      0,
+      0,
+      nullptr,
+      1,
+      &barrier,
+      0,
+      nullptr);
+}
+} // namespace StableFluids
@@ -0,0 +1,137 @@
+#include "GpuTimer.h"
+
+#include <stdexcept>
+#include <vector>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+GpuTimer::GpuTimer(const Application& app) : _device(app.getDevice()) {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(app.getPhysicalDevice(), &properties);
+  this->_timestampPeriod = properties.limits.timestampPeriod;
+
+  // Everything is submitted to the first graphics capable queue family
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(
+      app.getPhysicalDevice(),
+      &familyCount,
+      nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(
+      app.getPhysicalDevice(),
+      &familyCount,
+      families.data());
+
+  uint32_t validBits = 0;
+  for (const VkQueueFamilyProperties& family : families) {
+    if (family.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+      validBits = family.timestampValidBits;
+      break;
+    }
+  }
+
+  if (validBits == 0 || this->_timestampPeriod <= 0.0f)
+    return;
+
+  this->_validBitsMask =
+      validBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << validBits) - 1;
+
+  VkQueryPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  // A begin and end timestamp per frame in flight
+  poolInfo.queryCount = 2 * MAX_FRAMES_IN_FLIGHT;
+
+  if (vkCreateQueryPool(
+          this->_device,
+          &poolInfo,
+          nullptr,
+          &this->_queryPool) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create timestamp query pool!");
+  }
+}
+
+GpuTimer::~GpuTimer() { this->_destroy(); }
+
+GpuTimer::GpuTimer(GpuTimer&& rhs) { *this = std::move(rhs); }
+
+GpuTimer& GpuTimer::operator=(GpuTimer&& rhs) {
+  if (this != &rhs) {
+    this->_destroy();
+
+    this->_device = rhs._device;
+    this->_queryPool = rhs._queryPool;
+    this->_timestampPeriod = rhs._timestampPeriod;
+    this->_validBitsMask = rhs._validBitsMask;
+    this->_pending = rhs._pending;
+
+    rhs._device = VK_NULL_HANDLE;
+    rhs._queryPool = VK_NULL_HANDLE;
+    rhs._validBitsMask = 0;
+  }
+
+  return *this;
+}
+
+void GpuTimer::_destroy() {
+  if (this->_queryPool == VK_NULL_HANDLE)
+    return;
+
+  vkDestroyQueryPool(this->_device, this->_queryPool, nullptr);
+  this->_queryPool = VK_NULL_HANDLE;
+}
+
+void GpuTimer::begin(VkCommandBuffer commandBuffer, const FrameContext& frame) {
+  if (!this->isSupported())
+    return;
+
+  uint32_t firstQuery = 2 * frame.frameRingBufferIndex;
+  vkCmdResetQueryPool(commandBuffer, this->_queryPool, firstQuery, 2);
+  vkCmdWriteTimestamp(
+      commandBuffer,
+      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+      this->_queryPool,
+      firstQuery);
+}
+
+void GpuTimer::end(VkCommandBuffer commandBuffer, const FrameContext& frame) {
+  if (!this->isSupported())
+    return;
+
+  vkCmdWriteTimestamp(
+      commandBuffer,
+      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+      this->_queryPool,
+      2 * frame.frameRingBufferIndex + 1);
+  this->_pending[frame.frameRingBufferIndex] = true;
+}
+
+bool GpuTimer::read(const FrameContext& frame, float& ms) {
+  bool& bPending = this->_pending[frame.frameRingBufferIndex];
+  if (!bPending)
+    return false;
+  bPending = false;
+
+  uint64_t timestamps[2];
+  if (vkGetQueryPoolResults(
+          this->_device,
+          this->_queryPool,
+          2 * frame.frameRingBufferIndex,
+          2,
+          sizeof(timestamps),
+          timestamps,
+          sizeof(uint64_t),
+          VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+    return false;
+  }
+
+  // The counter may wrap around within its valid bits
+  uint64_t ticks =
+      ((timestamps[1] & this->_validBitsMask) -
+       (timestamps[0] & this->_validBitsMask)) &
+      this->_validBitsMask;
+  ms = static_cast<float>(ticks) * this->_timestampPeriod * 1e-6f;
+  return true;
+}
+} // namespace StableFluids
@@ -0,0 +1,117 @@
+#include "InputRecording.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace StableFluids {
+namespace {
+constexpr uint32_t INPUT_RECORDING_MAGIC = 0x52494653; // "SFIR"
+constexpr uint32_t INPUT_RECORDING_VERSION = 3;
+
+struct InputRecordingHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t frameSize;
+};
+} // namespace
+
+InputRecorder::InputRecorder(const std::string& path)
+    : _file(path, std::ios::binary) {
+  if (!this->_file)
+    throw std::runtime_error("Failed to open input recording: " + path);
+
+  InputRecordingHeader header{
+      INPUT_RECORDING_MAGIC,
+      INPUT_RECORDING_VERSION,
+      sizeof(InputFrame)};
+  this->_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+void InputRecorder::record(const InputFrame& frame) {
+  this->_file.write(reinterpret_cast<const char*>(&frame), sizeof(frame));
+  ++this->_frameCount;
+}
+
+InputReplay::InputReplay(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    throw std::runtime_error("Failed to open input recording: " + path);
+
+  InputRecordingHeader header{};
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!file || header.magic != INPUT_RECORDING_MAGIC ||
+      header.version != INPUT_RECORDING_VERSION ||
+      header.frameSize != sizeof(InputFrame)) {
+    throw std::runtime_error("Invalid input recording: " + path);
+  }
+
+  InputFrame frame{};
+  while (file.read(reinterpret_cast<char*>(&frame), sizeof(frame)))
+    this->_frames.push_back(frame);
+}
+
+bool InputReplay::next(InputFrame& frame) {
+  if (this->isFinished())
+    return false;
+
+  frame = this->_frames[this->_nextFrame++];
+  return true;
+}
+
+CameraPath::CameraPath(const std::string& path, float timestep)
+    : _timestep(timestep) {
+  std::ifstream file(path);
+  if (!file)
+    throw std::runtime_error("Failed to open camera path: " + path);
+
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    std::istringstream stream(line);
+    Keyframe keyframe{};
+    if (!(stream >> keyframe.time >> keyframe.zoom >> keyframe.offsetX >>
+          keyframe.offsetY) ||
+        keyframe.zoom <= 0.0) {
+      throw std::runtime_error("Invalid camera path keyframe: " + line);
+    }
+
+    if (!this->_keyframes.empty() &&
+        keyframe.time <= this->_keyframes.back().time) {
+      throw std::runtime_error("Camera path keyframes must be in time order!");
+    }
+
+    this->_keyframes.push_back(keyframe);
+  }
+
+  if (this->_keyframes.empty())
+    throw std::runtime_error("Camera path has no keyframes: " + path);
+}
+
+CameraPath::Keyframe CameraPath::step() {
+  double time = this->_time;
+  this->_time += this->_timestep;
+
+  if (time <= this->_keyframes.front().time)
+    return this->_keyframes.front();
+  if (time >= this->_keyframes.back().time)
+    return this->_keyframes.back();
+
+  size_t i = 1;
+  while (this->_keyframes[i].time < time)
+    ++i;
+
+  const Keyframe& a = this->_keyframes[i - 1];
+  const Keyframe& b = this->_keyframes[i];
+  double t = (time - a.time) / (b.time - a.time);
+
+  Keyframe result{};
+  result.time = time;
+  result.zoom = a.zoom * std::pow(b.zoom / a.zoom, t);
+  result.offsetX = a.offsetX + (b.offsetX - a.offsetX) * t;
+  result.offsetY = a.offsetY + (b.offsetY - a.offsetY) * t;
+  return result;
+}
+} // namespace StableFluids
@@ -0,0 +1,62 @@
+#include "LaunchOptions.h"
+
+#include "BrickLayout.h"
+
+#include <stdexcept>
+
+namespace StableFluids {
+LaunchOptions GLaunchOptions{};
+
+/*static*/
+LaunchOptions LaunchOptions::parse(int argc, char** argv) {
+  LaunchOptions options{};
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg != "--record-input" && arg != "--replay-input" &&
+        arg != "--camera-path" && arg != "--camera-timestep" &&
+        arg != "--velocity-downsample" && arg != "--volume" &&
+        arg != "--fractal-cache" && arg != "--canvas") {
+      throw std::runtime_error("Unknown argument: " + arg);
+    }
+
+    if (i + 1 >= argc)
+      throw std::runtime_error("Missing value for argument: " + arg);
+
+    std::string value = argv[++i];
+    if (arg == "--record-input") {
+      options.recordInputPath = value;
+    } else if (arg == "--replay-input") {
+      options.replayInputPath = value;
+    } else if (arg == "--camera-path") {
+      options.cameraPath = value;
+    } else if (arg == "--camera-timestep") {
+      options.cameraPathTimestep = std::stof(value);
+      if (!(options.cameraPathTimestep > 0.0f))
+        throw std::runtime_error("Camera timestep must be positive!");
+    } else if (arg == "--fractal-cache") {
+      options.fractalCachePath = value;
+    } else if (arg == "--canvas") {
+      int size = std::stoi(value);
+      if (size < 1)
+        throw std::runtime_error("Canvas size must be positive!");
+      options.canvasSize = static_cast<uint32_t>(size);
+    } else if (arg == "--volume") {
+      int size = std::stoi(value);
+      if (size < 1 || size % BRICK_SIZE != 0) {
+        throw std::runtime_error(
+            "Volume size must be a positive multiple of " +
+            std::to_string(BRICK_SIZE) + "!");
+      }
+      options.volumeSize = static_cast<uint32_t>(size);
+    } else {
+      int downsample = std::stoi(value);
+      if (downsample < 1)
+        throw std::runtime_error("Velocity downsample must be positive!");
+      options.velocityDownsample = static_cast<uint32_t>(downsample);
+    }
+  }
+
+  return options;
+}
+} // namespace StableFluids
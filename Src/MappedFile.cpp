@@ -0,0 +1,79 @@
+#include "MappedFile.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace StableFluids {
+namespace {
+std::runtime_error makeError(const std::string& what) {
+  return std::runtime_error(what + ": " + std::strerror(errno));
+}
+} // namespace
+
+#ifndef _WIN32
+MappedFile::MappedFile(const std::string& path, size_t size) : _size(size) {
+  this->_fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0600);
+  if (this->_fd < 0)
+    throw makeError("Failed to open " + path);
+
+  // Sparse, pages that are never written take no disk space
+  if (ftruncate(this->_fd, static_cast<off_t>(size)) != 0) {
+    close(this->_fd);
+    throw makeError("Failed to size " + path);
+  }
+
+  void* pData =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, this->_fd, 0);
+  if (pData == MAP_FAILED) {
+    close(this->_fd);
+    throw makeError("Failed to map " + path);
+  }
+
+  this->_pData = static_cast<std::byte*>(pData);
+}
+
+void MappedFile::_destroy() {
+  if (this->_pData)
+    munmap(this->_pData, this->_size);
+  if (this->_fd >= 0)
+    close(this->_fd);
+
+  this->_pData = nullptr;
+  this->_size = 0;
+  this->_fd = -1;
+}
+#else
+MappedFile::MappedFile(const std::string& path, size_t size) {
+  throw std::runtime_error("Mapped files are not supported on Windows!");
+}
+
+void MappedFile::_destroy() {}
+#endif
+
+MappedFile::~MappedFile() { this->_destroy(); }
+
+MappedFile::MappedFile(MappedFile&& rhs) { *this = std::move(rhs); }
+
+MappedFile& MappedFile::operator=(MappedFile&& rhs) {
+  if (this != &rhs) {
+    this->_destroy();
+
+    this->_pData = rhs._pData;
+    this->_size = rhs._size;
+    this->_fd = rhs._fd;
+
+    rhs._pData = nullptr;
+    rhs._size = 0;
+    rhs._fd = -1;
+  }
+
+  return *this;
+}
+} // namespace StableFluids
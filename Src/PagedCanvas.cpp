@@ -0,0 +1,620 @@
+#include "PagedCanvas.h"
+
+#include <Althea/SingleTimeCommandBuffer.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+namespace {
+// Pool slot that never held a tile
+constexpr uint32_t UNUSED_CANVAS_SLOT = 0xFFFFFFFF;
+
+VkBufferImageCopy
+makeTileCopy(uint32_t slot, uint32_t atlasTilesX, VkDeviceSize bufferOffset) {
+  VkBufferImageCopy region{};
+  region.bufferOffset = bufferOffset;
+  region.bufferRowLength = 0;
+  region.bufferImageHeight = 0;
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.mipLevel = 0;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount = 1;
+  region.imageOffset = {
+      static_cast<int32_t>(slot % atlasTilesX * CANVAS_TILE_SIZE),
+      static_cast<int32_t>(slot / atlasTilesX * CANVAS_TILE_SIZE),
+      0};
+  region.imageExtent = {CANVAS_TILE_SIZE, CANVAS_TILE_SIZE, 1};
+  return region;
+}
+
+void bufferBarrier(
+    VkCommandBuffer commandBuffer,
+    VkBuffer buffer,
+    VkAccessFlags srcAccess,
+    VkPipelineStageFlags srcStage,
+    VkAccessFlags dstAccess,
+    VkPipelineStageFlags dstStage) {
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.buffer = buffer;
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+  barrier.srcAccessMask = srcAccess;
+  barrier.dstAccessMask = dstAccess;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      srcStage,
+      dstStage,
+      0,
+      0,
+      nullptr,
+      1,
+      &barrier,
+      0,
+      nullptr);
+}
+
+bool isEmptyTile(const std::byte* pTile) {
+  // Positive and negative zero are both empty
+  const uint16_t* pHalfs = reinterpret_cast<const uint16_t*>(pTile);
+  for (size_t i = 0; i < CANVAS_TILE_BYTES / sizeof(uint16_t); ++i) {
+    if ((pHalfs[i] & 0x7FFF) != 0)
+      return false;
+  }
+  return true;
+}
+
+template <typename T> void writeExrValue(std::ostream& stream, const T& value) {
+  stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void writeExrAttribute(
+    std::ostream& stream,
+    const char* name,
+    const char* type,
+    const void* pValue,
+    int32_t size) {
+  stream.write(name, strlen(name) + 1);
+  stream.write(type, strlen(type) + 1);
+  writeExrValue(stream, size);
+  stream.write(reinterpret_cast<const char*>(pValue), size);
+}
+
+// Header of a single part, uncompressed scanline OpenEXR file with half RGBA
+// channels, followed by the offset table. Each chunk holds one scanline, so
+// all offsets are known before any pixels are written.
+void writeExrHeader(std::ostream& stream, uint32_t width, uint32_t height) {
+  writeExrValue(stream, uint32_t(20000630));
+  writeExrValue(stream, uint32_t(2));
+
+  // Channels have to be listed in alphabetical order
+  std::vector<char> channels;
+  for (char channel : {'A', 'B', 'G', 'R'}) {
+    const int32_t halfType = 1;
+    const int32_t sampling = 1;
+    channels.push_back(channel);
+    channels.push_back('\0');
+    channels.insert(
+        channels.end(),
+        reinterpret_cast<const char*>(&halfType),
+        reinterpret_cast<const char*>(&halfType) + sizeof(halfType));
+    // pLinear and reserved
+    channels.insert(channels.end(), 4, '\0');
+    for (int i = 0; i < 2; ++i) {
+      channels.insert(
+          channels.end(),
+          reinterpret_cast<const char*>(&sampling),
+          reinterpret_cast<const char*>(&sampling) + sizeof(sampling));
+    }
+  }
+  channels.push_back('\0');
+
+  const int32_t window[4] = {
+      0,
+      0,
+      static_cast<int32_t>(width) - 1,
+      static_cast<int32_t>(height) - 1};
+  const uint8_t noCompression = 0;
+  const uint8_t increasingY = 0;
+  const float one = 1.0f;
+  const float center[2] = {0.0f, 0.0f};
+
+  writeExrAttribute(
+      stream,
+      "channels",
+      "chlist",
+      channels.data(),
+      static_cast<int32_t>(channels.size()));
+  writeExrAttribute(stream, "compression", "compression", &noCompression, 1);
+  writeExrAttribute(stream, "dataWindow", "box2i", window, sizeof(window));
+  writeExrAttribute(stream, "displayWindow", "box2i", window, sizeof(window));
+  writeExrAttribute(stream, "lineOrder", "lineOrder", &increasingY, 1);
+  writeExrAttribute(stream, "pixelAspectRatio", "float", &one, sizeof(one));
+  writeExrAttribute(
+      stream,
+      "screenWindowCenter",
+      "v2f",
+      center,
+      sizeof(center));
+  writeExrAttribute(stream, "screenWindowWidth", "float", &one, sizeof(one));
+  stream.put('\0');
+
+  uint64_t chunkOffset =
+      static_cast<uint64_t>(stream.tellp()) + height * sizeof(uint64_t);
+  uint64_t chunkBytes = 2 * sizeof(int32_t) + width * 4 * sizeof(uint16_t);
+  for (uint32_t y = 0; y < height; ++y)
+    writeExrValue(stream, chunkOffset + y * chunkBytes);
+}
+} // namespace
+
+PagedCanvas::PagedCanvas(
+    const Application& app,
+    GlobalHeap& heap,
+    const VkExtent2D& simExtent,
+    uint32_t width,
+    uint32_t height,
+    const glm::dvec2& origin,
+    double texelSpacing,
+    const std::string& backingPath)
+    : _allocator(app.getAllocator()),
+      _simExtent(simExtent),
+      _width(width),
+      _height(height),
+      _tilesX((width - 1) / CANVAS_TILE_SIZE + 1),
+      _tilesY((height - 1) / CANVAS_TILE_SIZE + 1),
+      _origin(origin),
+      _texelSpacing(texelSpacing) {
+  if (width == 0 || height == 0)
+    throw std::runtime_error("Canvas must not be empty!");
+
+  this->_tileFlags.resize(static_cast<size_t>(this->_tilesX) * this->_tilesY);
+  this->_file = MappedFile(
+      backingPath,
+      this->_tileFlags.size() * CANVAS_TILE_BYTES);
+
+  // Up to two canvas texels per simulation texel, past that the canvas stops
+  // recording instead of paging through the whole pool every frame. Plus
+  // partially visible tiles along both edges.
+  this->_maxGridWidth =
+      (2 * simExtent.width + CANVAS_TILE_SIZE - 1) / CANVAS_TILE_SIZE + 2;
+  this->_maxGridHeight =
+      (2 * simExtent.height + CANVAS_TILE_SIZE - 1) / CANVAS_TILE_SIZE + 2;
+  uint32_t maxVisibleTiles = this->_maxGridWidth * this->_maxGridHeight;
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(app.getPhysicalDevice(), &properties);
+  uint32_t maxAtlasTiles =
+      properties.limits.maxImageDimension2D / CANVAS_TILE_SIZE;
+
+  uint32_t capacity = CANVAS_TILE_POOL_VIEWS * maxVisibleTiles;
+  this->_atlasTilesX = std::min(capacity, maxAtlasTiles);
+  uint32_t atlasTilesY = std::min(
+      (capacity - 1) / this->_atlasTilesX + 1,
+      maxAtlasTiles);
+  capacity = this->_atlasTilesX * atlasTilesY;
+  if (capacity < maxVisibleTiles)
+    throw std::runtime_error("Canvas tile pool does not fit a view!");
+
+  this->_slots = TileSlotCache(capacity);
+  this->_slotTiles.resize(capacity, UNUSED_CANVAS_SLOT);
+
+  {
+    FieldDesc atlasDesc{
+        VK_FORMAT_R16G16B16A16_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+            VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        {0, 0},
+        VK_FILTER_NEAREST};
+    this->_atlas = FieldPool(
+        app,
+        heap,
+        this->_atlasTilesX * CANVAS_TILE_SIZE,
+        atlasTilesY * CANVAS_TILE_SIZE,
+        {atlasDesc});
+  }
+
+  this->_pageTable = StructuredBuffer<uint32_t>(app, maxVisibleTiles);
+  this->_pageTable.registerToHeap(heap);
+
+  VmaAllocationCreateInfo uploadInfo{};
+  uploadInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+  uploadInfo.usage = VMA_MEMORY_USAGE_AUTO;
+
+  VmaAllocationCreateInfo pageOutInfo{};
+  pageOutInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
+  pageOutInfo.usage = VMA_MEMORY_USAGE_AUTO;
+
+  for (FrameStaging& staging : this->_staging) {
+    staging.upload = BufferUtilities::createBuffer(
+        app,
+        this->_pageTable.getSize() +
+            MAX_CANVAS_TILES_PAGED_PER_UPDATE * CANVAS_TILE_BYTES,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        uploadInfo);
+    staging.pageOut = BufferUtilities::createBuffer(
+        app,
+        MAX_CANVAS_TILES_PAGED_PER_UPDATE * CANVAS_TILE_BYTES,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        pageOutInfo);
+  }
+
+  std::cout << "Allocated " << width << "x" << height << " paged canvas, "
+            << capacity << " resident tiles in "
+            << (this->_atlas.getPooledSize() >> 20) << "MB, backed by "
+            << backingPath << std::endl;
+}
+
+void PagedCanvas::beginFrame(const FrameContext& frame) {
+  this->_stats.elapsedSeconds += frame.deltaTime;
+  this->_flushPageOuts(frame.frameRingBufferIndex);
+}
+
+void PagedCanvas::_flushPageOuts(uint32_t frameRingBufferIndex) {
+  FrameStaging& staging = this->_staging[frameRingBufferIndex];
+  if (staging.pageOutTiles.empty())
+    return;
+
+  // Random access readbacks may land in non-coherent memory
+  vmaInvalidateAllocation(
+      this->_allocator,
+      staging.pageOut.getAllocation(),
+      0,
+      VK_WHOLE_SIZE);
+
+  const std::byte* pSrc =
+      static_cast<const std::byte*>(staging.pageOut.mapMemory());
+  for (uint32_t tile : staging.pageOutTiles) {
+    uint8_t& flags = this->_tileFlags[tile];
+    bool bWasStored = (flags & TILE_STORED) != 0;
+
+    // Tiles without dye stay sparse in the file
+    if (isEmptyTile(pSrc)) {
+      flags &= ~TILE_STORED;
+    } else {
+      memcpy(this->_getBackingTile(tile), pSrc, CANVAS_TILE_BYTES);
+      flags |= TILE_STORED;
+    }
+    flags &= ~TILE_PAGING_OUT;
+
+    bool bStored = (flags & TILE_STORED) != 0;
+    if (bStored != bWasStored) {
+      if (bStored)
+        ++this->_stats.storedTiles;
+      else
+        --this->_stats.storedTiles;
+    }
+
+    pSrc += CANVAS_TILE_BYTES;
+  }
+  staging.pageOut.unmapMemory();
+
+  staging.pageOutTiles.clear();
+}
+
+const CanvasView& PagedCanvas::update(
+    VkCommandBuffer commandBuffer,
+    const FrameContext& frame,
+    double zoom,
+    const glm::dvec2& offset) {
+  FrameStaging& staging = this->_staging[frame.frameRingBufferIndex];
+
+  CanvasStats& stats = this->_stats;
+  stats.visibleTiles = 0;
+  stats.pagedInTiles = 0;
+  stats.pagedOutTiles = 0;
+
+  // Texel p of the simulation samples (2 * p * h - 1) / zoom + offset, find
+  // the canvas texels under the first and last simulation texel
+  double h = 1.0 / std::max(this->_simExtent.width, this->_simExtent.height);
+  glm::dvec2 viewMin = offset - glm::dvec2(1.0 / zoom);
+  glm::dvec2 viewMax =
+      (2.0 * h *
+           glm::dvec2(this->_simExtent.width - 1, this->_simExtent.height - 1) -
+       glm::dvec2(1.0)) /
+          zoom +
+      offset;
+
+  glm::dvec2 texelMin = (viewMin - this->_origin) / this->_texelSpacing;
+  glm::dvec2 texelMax = (viewMax - this->_origin) / this->_texelSpacing;
+  int64_t tileX0 = std::max<int64_t>(
+      static_cast<int64_t>(std::floor(texelMin.x)) / CANVAS_TILE_SIZE,
+      0);
+  int64_t tileY0 = std::max<int64_t>(
+      static_cast<int64_t>(std::floor(texelMin.y)) / CANVAS_TILE_SIZE,
+      0);
+  int64_t tileX1 = std::min<int64_t>(
+      static_cast<int64_t>(std::ceil(texelMax.x)) / CANVAS_TILE_SIZE,
+      this->_tilesX - 1);
+  int64_t tileY1 = std::min<int64_t>(
+      static_cast<int64_t>(std::ceil(texelMax.y)) / CANVAS_TILE_SIZE,
+      this->_tilesY - 1);
+
+  CanvasView& view = this->_view;
+  view.gridWidth = 0;
+  view.gridHeight = 0;
+
+  // The view is off the canvas
+  if (tileX1 < tileX0 || tileY1 < tileY0)
+    return view;
+
+  if (tileX1 - tileX0 + 1 > this->_maxGridWidth ||
+      tileY1 - tileY0 + 1 > this->_maxGridHeight) {
+    ++stats.skippedUpdates;
+    return view;
+  }
+
+  view.gridOrigin = this->_origin + glm::dvec2(tileX0, tileY0) *
+                                        static_cast<double>(CANVAS_TILE_SIZE) *
+                                        this->_texelSpacing;
+  view.gridWidth = static_cast<uint32_t>(tileX1 - tileX0 + 1);
+  view.gridHeight = static_cast<uint32_t>(tileY1 - tileY0 + 1);
+  stats.visibleTiles = view.gridWidth * view.gridHeight;
+
+  std::byte* pUpload = static_cast<std::byte*>(staging.upload.mapMemory());
+  uint32_t* pPageTable = reinterpret_cast<uint32_t*>(pUpload);
+  std::byte* pPageIns = pUpload + this->_pageTable.getSize();
+
+  std::vector<VkBufferImageCopy> pageOutCopies;
+  std::vector<VkBufferImageCopy> pageInCopies;
+
+  // Touch every resident tile first, so the misses below never evict a
+  // visible tile. The pool always has room for one full view.
+  std::vector<uint32_t> misses;
+  for (uint32_t y = 0; y < view.gridHeight; ++y) {
+    for (uint32_t x = 0; x < view.gridWidth; ++x) {
+      TileKey key{0, tileX0 + x, tileY0 + y};
+      uint32_t i = y * view.gridWidth + x;
+      if (!this->_slots.find(key, pPageTable[i]))
+        misses.push_back(i);
+    }
+  }
+
+  for (uint32_t i : misses) {
+    TileKey key{0, tileX0 + i % view.gridWidth, tileY0 + i / view.gridWidth};
+    uint32_t tile = static_cast<uint32_t>(key.y * this->_tilesX + key.x);
+
+    // A tile still on its way to the file comes back once it got there, the
+    // dye it misses in the meantime is lost. Past the staging limits tiles
+    // wait for a later update the same way.
+    bool bPoolFull = this->_slots.getSize() == this->_slots.getCapacity();
+    if ((this->_tileFlags[tile] & TILE_PAGING_OUT) ||
+        pageInCopies.size() == MAX_CANVAS_TILES_PAGED_PER_UPDATE ||
+        (bPoolFull &&
+         pageOutCopies.size() == MAX_CANVAS_TILES_PAGED_PER_UPDATE)) {
+      pPageTable[i] = INVALID_CANVAS_SLOT;
+      continue;
+    }
+
+    uint32_t slot;
+    TileKey evictedKey;
+    if (this->_slots.insert(key, slot, evictedKey)) {
+      uint32_t evictedTile = this->_slotTiles[slot];
+      pageOutCopies.push_back(makeTileCopy(
+          slot,
+          this->_atlasTilesX,
+          pageOutCopies.size() * CANVAS_TILE_BYTES));
+      staging.pageOutTiles.push_back(evictedTile);
+      this->_tileFlags[evictedTile] |= TILE_PAGING_OUT;
+    }
+    this->_slotTiles[slot] = tile;
+    pPageTable[i] = slot;
+
+    std::byte* pPageIn = pPageIns + pageInCopies.size() * CANVAS_TILE_BYTES;
+    if (this->_tileFlags[tile] & TILE_STORED)
+      memcpy(pPageIn, this->_getBackingTile(tile), CANVAS_TILE_BYTES);
+    else
+      memset(pPageIn, 0, CANVAS_TILE_BYTES);
+    pageInCopies.push_back(makeTileCopy(
+        slot,
+        this->_atlasTilesX,
+        this->_pageTable.getSize() + pageInCopies.size() * CANVAS_TILE_BYTES));
+  }
+
+  staging.upload.unmapMemory();
+
+  stats.residentTiles = this->_slots.getSize();
+  stats.pagedInTiles = static_cast<uint32_t>(pageInCopies.size());
+  stats.pagedOutTiles = static_cast<uint32_t>(pageOutCopies.size());
+  stats.totalPagedInBytes += pageInCopies.size() * CANVAS_TILE_BYTES;
+  stats.totalPagedOutBytes += pageOutCopies.size() * CANVAS_TILE_BYTES;
+
+  // Evicted tiles leave the pool before anything overwrites their slots
+  PooledField& atlas = this->getAtlas();
+  if (!pageOutCopies.empty()) {
+    atlas.transitionLayout(
+        commandBuffer,
+        VK_IMAGE_LAYOUT_GENERAL,
+        VK_ACCESS_TRANSFER_READ_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT);
+    vkCmdCopyImageToBuffer(
+        commandBuffer,
+        atlas.getImage(),
+        VK_IMAGE_LAYOUT_GENERAL,
+        staging.pageOut.getBuffer(),
+        static_cast<uint32_t>(pageOutCopies.size()),
+        pageOutCopies.data());
+    bufferBarrier(
+        commandBuffer,
+        staging.pageOut.getBuffer(),
+        VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_ACCESS_HOST_READ_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT);
+  }
+
+  if (!pageInCopies.empty()) {
+    atlas.transitionLayout(
+        commandBuffer,
+        VK_IMAGE_LAYOUT_GENERAL,
+        VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT);
+    vkCmdCopyBufferToImage(
+        commandBuffer,
+        staging.upload.getBuffer(),
+        atlas.getImage(),
+        VK_IMAGE_LAYOUT_GENERAL,
+        static_cast<uint32_t>(pageInCopies.size()),
+        pageInCopies.data());
+  }
+
+  // The last deposit may still be reading the previous page table
+  VkBuffer pageTable = this->_pageTable.getAllocation().getBuffer();
+  bufferBarrier(
+      commandBuffer,
+      pageTable,
+      VK_ACCESS_SHADER_READ_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+  VkBufferCopy pageTableCopy{};
+  pageTableCopy.srcOffset = 0;
+  pageTableCopy.dstOffset = 0;
+  pageTableCopy.size = stats.visibleTiles * sizeof(uint32_t);
+  vkCmdCopyBuffer(
+      commandBuffer,
+      staging.upload.getBuffer(),
+      pageTable,
+      1,
+      &pageTableCopy);
+
+  bufferBarrier(
+      commandBuffer,
+      pageTable,
+      VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_SHADER_READ_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+  atlas.transitionLayout(
+      commandBuffer,
+      VK_IMAGE_LAYOUT_GENERAL,
+      VK_ACCESS_SHADER_WRITE_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+  return view;
+}
+
+void PagedCanvas::exportExr(const Application& app, const std::string& path) {
+  vkDeviceWaitIdle(app.getDevice());
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    this->_flushPageOuts(i);
+
+  // Page out the resident tiles too, a batch at a time through the staging
+  // of the first frame slot, which is idle now
+  {
+    // Slots are never freed, only handed to another tile
+    std::vector<uint32_t> residentSlots;
+    for (uint32_t slot = 0; slot < this->_slotTiles.size(); ++slot) {
+      if (this->_slotTiles[slot] != UNUSED_CANVAS_SLOT)
+        residentSlots.push_back(slot);
+    }
+
+    PooledField& atlas = this->getAtlas();
+    FrameStaging& staging = this->_staging[0];
+    for (size_t first = 0; first < residentSlots.size();
+         first += MAX_CANVAS_TILES_PAGED_PER_UPDATE) {
+      size_t count = std::min<size_t>(
+          residentSlots.size() - first,
+          MAX_CANVAS_TILES_PAGED_PER_UPDATE);
+
+      std::vector<VkBufferImageCopy> copies;
+      for (size_t i = 0; i < count; ++i) {
+        uint32_t slot = residentSlots[first + i];
+        copies.push_back(
+            makeTileCopy(slot, this->_atlasTilesX, i * CANVAS_TILE_BYTES));
+        staging.pageOutTiles.push_back(this->_slotTiles[slot]);
+      }
+
+      {
+        SingleTimeCommandBuffer commandBuffer(app);
+        atlas.transitionLayout(
+            commandBuffer,
+            VK_IMAGE_LAYOUT_GENERAL,
+            VK_ACCESS_TRANSFER_READ_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT);
+        vkCmdCopyImageToBuffer(
+            commandBuffer,
+            atlas.getImage(),
+            VK_IMAGE_LAYOUT_GENERAL,
+            staging.pageOut.getBuffer(),
+            static_cast<uint32_t>(copies.size()),
+            copies.data());
+        bufferBarrier(
+            commandBuffer,
+            staging.pageOut.getBuffer(),
+            VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_HOST_READ_BIT,
+            VK_PIPELINE_STAGE_HOST_BIT);
+      }
+
+      this->_flushPageOuts(0);
+    }
+  }
+
+  // Every tile is in the file or empty now. Stream the image out a scanline
+  // at a time straight from the backing file.
+  std::ofstream file(path, std::ios::binary);
+  if (!file)
+    throw std::runtime_error("Failed to open EXR export: " + path);
+  writeExrHeader(file, this->_width, this->_height);
+
+  // Channels are stored one after the other in alphabetical order
+  std::vector<uint16_t> scanline(4 * static_cast<size_t>(this->_width));
+  uint16_t* pA = scanline.data();
+  uint16_t* pB = pA + this->_width;
+  uint16_t* pG = pB + this->_width;
+  uint16_t* pR = pG + this->_width;
+  int32_t scanlineBytes =
+      static_cast<int32_t>(scanline.size() * sizeof(uint16_t));
+
+  for (uint32_t y = 0; y < this->_height; ++y) {
+    std::fill(scanline.begin(), scanline.end(), uint16_t(0));
+
+    uint32_t tileY = y / CANVAS_TILE_SIZE;
+    uint32_t row = y % CANVAS_TILE_SIZE;
+    for (uint32_t tileX = 0; tileX < this->_tilesX; ++tileX) {
+      uint32_t tile = tileY * this->_tilesX + tileX;
+      if (!(this->_tileFlags[tile] & TILE_STORED))
+        continue;
+
+      // Texels are packed half RGBA, red in the low bits
+      const uint64_t* pTexels =
+          reinterpret_cast<const uint64_t*>(this->_getBackingTile(tile)) +
+          row * CANVAS_TILE_SIZE;
+      uint32_t x0 = tileX * CANVAS_TILE_SIZE;
+      uint32_t w = std::min(CANVAS_TILE_SIZE, this->_width - x0);
+      for (uint32_t x = 0; x < w; ++x) {
+        uint64_t texel = pTexels[x];
+        pR[x0 + x] = static_cast<uint16_t>(texel);
+        pG[x0 + x] = static_cast<uint16_t>(texel >> 16);
+        pB[x0 + x] = static_cast<uint16_t>(texel >> 32);
+        pA[x0 + x] = static_cast<uint16_t>(texel >> 48);
+      }
+    }
+
+    writeExrValue(file, static_cast<int32_t>(y));
+    writeExrValue(file, scanlineBytes);
+    file.write(reinterpret_cast<const char*>(scanline.data()), scanlineBytes);
+  }
+
+  if (!file)
+    throw std::runtime_error("Failed to write EXR export: " + path);
+
+  std::cout << "Exported " << this->_width << "x" << this->_height
+            << " canvas to " << path << " (" << this->_stats.storedTiles
+            << " of " << this->_tileFlags.size() << " tiles hold dye)"
+            << std::endl;
+}
+} // namespace StableFluids
@@ -0,0 +1,710 @@
+#include "ReferenceSimulation.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace StableFluids {
+namespace {
+using Vec2 = ReferenceSimulation::Vec2;
+using Vec4 = ReferenceSimulation::Vec4;
+
+float mix(float a, float b, float t) { return a + (b - a) * t; }
+
+Vec2 mix(const Vec2& a, const Vec2& b, float t) {
+  return {mix(a.x, b.x, t), mix(a.y, b.y, t)};
+}
+
+Vec4 mix(const Vec4& a, const Vec4& b, float t) {
+  return {
+      mix(a.r, b.r, t),
+      mix(a.g, b.g, t),
+      mix(a.b, b.b, t),
+      mix(a.a, b.a, t)};
+}
+
+// VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT or VK_SAMPLER_ADDRESS_MODE_REPEAT
+int wrap(int i, int n, bool bMirror) {
+  if (i >= 0 && i < n)
+    return i;
+
+  if (!bMirror)
+    return ((i % n) + n) % n;
+
+  int period = 2 * n;
+  int t = ((i % period) + period) % period;
+  return t < n ? t : period - 1 - t;
+}
+
+// VK_FILTER_LINEAR lookup at normalized coordinates, index applies the
+// address mode and maps texel coordinates to storage
+template <typename T, typename TIndex>
+T sampleBilinear(
+    const std::vector<T>& field,
+    uint32_t width,
+    uint32_t height,
+    float u,
+    float v,
+    const TIndex& index) {
+  float x = u * width - 0.5f;
+  float y = v * height - 0.5f;
+  float x0f = std::floor(x);
+  float y0f = std::floor(y);
+  float fx = x - x0f;
+  float fy = y - y0f;
+  int x0 = static_cast<int>(x0f);
+  int y0 = static_cast<int>(y0f);
+
+  auto at = [&](int xi, int yi) -> const T& { return field[index(xi, yi)]; };
+
+  return mix(
+      mix(at(x0, y0), at(x0 + 1, y0), fx),
+      mix(at(x0, y0 + 1), at(x0 + 1, y0 + 1), fx),
+      fy);
+}
+
+// The four texels a VK_FILTER_LINEAR lookup at normalized coordinates
+// interpolates between, clamped to the grid like the texelFetch in the
+// MacCormack limiters
+template <typename TIndex>
+std::array<size_t, 4> getBilinearTexels(
+    uint32_t width,
+    uint32_t height,
+    float u,
+    float v,
+    const TIndex& index) {
+  int x0 = static_cast<int>(std::floor(u * width - 0.5f));
+  int y0 = static_cast<int>(std::floor(v * height - 0.5f));
+
+  std::array<size_t, 4> texels;
+  for (int i = 0; i < 4; ++i) {
+    texels[i] = index(
+        std::clamp(x0 + (i & 1), 0, static_cast<int>(width) - 1),
+        std::clamp(y0 + (i >> 1), 0, static_cast<int>(height) - 1));
+  }
+
+  return texels;
+}
+
+// applyMacCormack in SimulationCommon.glsl, for each channel
+float applyMacCormack(
+    float advected,
+    float reprojected,
+    float roundTrip,
+    float minValue,
+    float maxValue) {
+  return std::clamp(
+      advected + 0.5f * (reprojected - roundTrip),
+      minValue,
+      maxValue);
+}
+
+// The mirrored indexing of loadP in CalculatePressure.comp and
+// UpdateVelocity.comp
+int mirrorIndex(int i, int n) {
+  return i < n ? (i < 0 ? std::abs(i) - 1 : i) : 2 * n - i - 1;
+}
+} // namespace
+
+ReferenceSimulation::ReferenceSimulation(
+    const ReferenceSimulationSettings& settings,
+    HaloTransport* pTransport)
+    : _settings(settings), _pTransport(pTransport) {
+  if (settings.width == 0 || settings.height == 0)
+    throw std::runtime_error("Reference simulation grid must not be empty!");
+
+  if (settings.pressureIterations % 2 != 0)
+    throw std::runtime_error("Pressure iterations must be an even number!");
+
+  this->_subdomain = {0, 0, settings.width, settings.height, 0};
+  if (pTransport) {
+    const DomainDecomposition& decomposition =
+        pTransport->getDecomposition();
+    if (decomposition.width != settings.width ||
+        decomposition.height != settings.height) {
+      throw std::runtime_error("Decomposition does not match the grid size!");
+    }
+
+    if (settings.bSpectralPressure || settings.curlDownsample != 1) {
+      throw std::runtime_error(
+          "Spectral pressure and coarse curl need the whole grid!");
+    }
+
+    this->_subdomain = decomposition.getSubdomain(pTransport->getRank());
+  }
+
+  this->_x0 = static_cast<int>(this->_subdomain.x);
+  this->_y0 = static_cast<int>(this->_subdomain.y);
+  this->_x1 = this->_x0 + static_cast<int>(this->_subdomain.width);
+  this->_y1 = this->_y0 + static_cast<int>(this->_subdomain.height);
+
+  this->_h = std::max(1.0f / settings.width, 1.0f / settings.height);
+  this->_curlWidth = (settings.width - 1) / settings.curlDownsample + 1;
+  this->_curlHeight = (settings.height - 1) / settings.curlDownsample + 1;
+
+  size_t cellCount = static_cast<size_t>(this->_subdomain.getPaddedWidth()) *
+                     this->_subdomain.getPaddedHeight();
+  this->_iterationCounts.resize(cellCount, 0);
+  this->_fractal.resize(cellCount, 0.0f);
+  this->_departures.resize(cellCount, {0.0f, 0.0f});
+  this->_velocity.resize(cellCount, {0.0f, 0.0f});
+  this->_advectedVelocity.resize(cellCount, {0.0f, 0.0f});
+  this->_curl.resize(
+      settings.curlDownsample == 1
+          ? cellCount
+          : static_cast<size_t>(this->_curlWidth) * this->_curlHeight,
+      0.0f);
+  this->_divergence.resize(cellCount, 0.0f);
+  this->_pressureA.resize(cellCount, 0.0f);
+  this->_pressureB.resize(cellCount, 0.0f);
+  this->_colorA.resize(cellCount, {0.0f, 0.0f, 0.0f, 1.0f});
+  this->_colorB.resize(cellCount, {0.0f, 0.0f, 0.0f, 1.0f});
+
+  this->_projector = SpectralProjector(settings.width, settings.height, 1);
+  this->_spectralX.resize(cellCount);
+  this->_spectralY.resize(cellCount);
+
+  // The camera never moves, so the fractal is only computed once
+  this->computeFractal();
+}
+
+void ReferenceSimulation::step() {
+  // The velocity halo is refreshed right after the velocity update, the
+  // color halo is still stale from the last copy
+  this->_exchange(HALO_FIELD_COLOR, &this->_colorA[0].r);
+
+  this->reduceExposure();
+
+  this->computeDepartures();
+  // The MacCormack round trip reads the map around the forward point
+  if (this->_settings.bMacCormack)
+    this->_exchange(HALO_FIELD_DEPARTURE, &this->_departures[0].x);
+
+  this->advectVelocity();
+
+  if (this->_settings.vorticity != 0.0f) {
+    this->_exchange(
+        HALO_FIELD_ADVECTED_VELOCITY,
+        &this->_advectedVelocity[0].x);
+    this->computeCurl();
+    this->_exchange(HALO_FIELD_CURL, this->_curl.data());
+    this->applyVorticity();
+  }
+
+  if (this->_settings.bSpectralPressure) {
+    this->projectSpectral();
+  } else {
+    this->_exchange(
+        HALO_FIELD_ADVECTED_VELOCITY,
+        &this->_advectedVelocity[0].x);
+    this->computeDivergence();
+    for (uint32_t i = 0; i < this->_settings.pressureIterations; ++i) {
+      this->_exchange(HALO_FIELD_PRESSURE, this->_pressureA.data());
+      this->iteratePressure();
+    }
+    this->_exchange(HALO_FIELD_PRESSURE, this->_pressureA.data());
+    this->updateVelocity();
+  }
+
+  this->_exchange(HALO_FIELD_VELOCITY, &this->_velocity[0].x);
+
+  this->advectColor();
+  this->copyColors();
+}
+
+void ReferenceSimulation::exchangeHalos() {
+  this->_exchange(HALO_FIELD_VELOCITY, &this->_velocity[0].x);
+  this->_exchange(
+      HALO_FIELD_ADVECTED_VELOCITY,
+      &this->_advectedVelocity[0].x);
+  this->_exchange(HALO_FIELD_CURL, this->_curl.data());
+  this->_exchange(HALO_FIELD_PRESSURE, this->_pressureA.data());
+  this->_exchange(HALO_FIELD_COLOR, &this->_colorA[0].r);
+  this->_exchange(HALO_FIELD_DEPARTURE, &this->_departures[0].x);
+}
+
+void ReferenceSimulation::_exchange(HaloField field, float* data) {
+  if (this->_pTransport)
+    this->_pTransport->exchange(field, data, HALO_FIELD_CHANNELS[field]);
+}
+
+void ReferenceSimulation::computeFractal() {
+  const ReferenceSimulationSettings& s = this->_settings;
+  int iterations = static_cast<int>(s.fractalIterations);
+  double h = std::max(1.0 / s.width, 1.0 / s.height);
+  int halo = static_cast<int>(this->_subdomain.halo);
+
+  // Includes the halo, the fractal is sampled with a repeating address mode
+  // and can be computed anywhere without an exchange
+  for (int y = this->_y0 - halo; y < this->_y1 + halo; ++y) {
+    for (int x = this->_x0 - halo; x < this->_x1 + halo; ++x) {
+      int gx = wrap(x, s.width, false);
+      int gy = wrap(y, s.height, false);
+      double cx = (2.0 * gx * h - 1.0) / s.zoom + s.offsetX;
+      double cy = (2.0 * gy * h - 1.0) / s.zoom + s.offsetY;
+
+      int i = 0;
+      double zx = cx;
+      double zy = cy;
+      double magSq = 0.0;
+      for (; i < iterations; ++i) {
+        double z2x = zx * zx - zy * zy;
+        double z2y = 2.0 * zx * zy;
+        zx = z2x + cx;
+        zy = z2y + cy;
+        magSq = zx * zx + zy * zy;
+        if (magSq > 4.0)
+          break;
+      }
+
+      float mag = static_cast<float>(std::sqrt(magSq));
+      if (i == iterations) {
+        i = 0;
+        mag = 0.0f;
+      }
+
+      size_t idx = this->getIndex(x, y);
+      this->_iterationCounts[idx] = i;
+      this->_fractal[idx] =
+          (static_cast<float>(i + 1) -
+           std::log(std::max(std::log2(mag), 0.01f))) /
+          static_cast<float>(iterations);
+    }
+  }
+}
+
+void ReferenceSimulation::computeDepartures() {
+  const ReferenceSimulationSettings& s = this->_settings;
+  float scaleX = 1.0f / s.width / this->_h;
+  float scaleY = 1.0f / s.height / this->_h;
+  float dt = s.dt / static_cast<float>(s.advectionSteps);
+
+  for (int y = this->_y0; y < this->_y1; ++y) {
+    for (int x = this->_x0; x < this->_x1; ++x) {
+      float u = (x + 0.5f) / s.width;
+      float v = (y + 0.5f) / s.height;
+
+      float srcU = u;
+      float srcV = v;
+      for (uint32_t i = 0; i < s.advectionSteps; ++i) {
+        Vec2 vel{0.0f, 0.0f};
+        if (srcU >= 0.0f && srcU <= 1.0f && srcV >= 0.0f && srcV <= 1.0f)
+          vel = this->_sampleVelocity(srcU, srcV);
+
+        srcU -= vel.x * scaleX * dt;
+        srcV -= vel.y * scaleY * dt;
+      }
+
+      this->_departures[this->getIndex(x, y)] = {
+          (srcU - u) * s.width,
+          (srcV - v) * s.height};
+    }
+  }
+}
+
+void ReferenceSimulation::advectVelocity() {
+  const ReferenceSimulationSettings& s = this->_settings;
+
+  auto sampleVel = [&](float u, float v) -> Vec2 {
+    if (u < 0.0f || u > 1.0f || v < 0.0f || v > 1.0f)
+      return {0.0f, 0.0f};
+    return this->_sampleVelocity(u, v);
+  };
+
+  for (int y = this->_y0; y < this->_y1; ++y) {
+    for (int x = this->_x0; x < this->_x1; ++x) {
+      float u = (x + 0.5f) / s.width;
+      float v = (y + 0.5f) / s.height;
+
+      Vec2 src = this->_getDepartureUv(u, v);
+      Vec2 vel = sampleVel(src.x, src.y);
+
+      if (s.bMacCormack) {
+        Vec2 roundTrip =
+            this->_getDepartureUv(2.0f * u - src.x, 2.0f * v - src.y);
+        Vec2 reprojectedVel = sampleVel(u, v);
+        Vec2 roundTripVel = sampleVel(roundTrip.x, roundTrip.y);
+
+        Vec2 minVel{std::numeric_limits<float>::max(),
+                    std::numeric_limits<float>::max()};
+        Vec2 maxVel{-minVel.x, -minVel.y};
+        for (size_t idx : getBilinearTexels(
+                 s.width,
+                 s.height,
+                 src.x,
+                 src.y,
+                 [this](int x, int y) {
+                   return this->_sampleIndex(x, y, true);
+                 })) {
+          const Vec2& texel = this->_velocity[idx];
+          minVel = {std::min(minVel.x, texel.x), std::min(minVel.y, texel.y)};
+          maxVel = {std::max(maxVel.x, texel.x), std::max(maxVel.y, texel.y)};
+        }
+
+        vel = {
+            applyMacCormack(
+                vel.x,
+                reprojectedVel.x,
+                roundTripVel.x,
+                minVel.x,
+                maxVel.x),
+            applyMacCormack(
+                vel.y,
+                reprojectedVel.y,
+                roundTripVel.y,
+                minVel.y,
+                maxVel.y)};
+      }
+
+      // Buoyancy from the dye
+      if (src.x >= 0.0f && src.x <= 1.0f && src.y >= 0.0f && src.y <= 1.0f) {
+        Vec4 c = this->_sampleColor(src.x, src.y);
+        vel.y -= 0.0001f * std::sqrt(c.r * c.r + c.g * c.g + c.b * c.b);
+      }
+
+      this->_advectedVelocity[this->getIndex(x, y)] = vel;
+    }
+  }
+}
+
+void ReferenceSimulation::computeCurl() {
+  const ReferenceSimulationSettings& s = this->_settings;
+  int ds = static_cast<int>(s.curlDownsample);
+
+  auto loadVel = [&](int x, int y) -> Vec2 {
+    if (x < 0 || x >= (int)s.width || y < 0 || y >= (int)s.height)
+      return {0.0f, 0.0f};
+    return this->_advectedVelocity[this->getIndex(x, y)];
+  };
+
+  // Curl cells whose sample position is owned by this simulation
+  for (int cy = (this->_y0 + ds - 1) / ds; cy < (this->_y1 + ds - 1) / ds;
+       ++cy) {
+    for (int cx = (this->_x0 + ds - 1) / ds; cx < (this->_x1 + ds - 1) / ds;
+         ++cx) {
+      int x = cx * ds;
+      int y = cy * ds;
+
+      Vec2 vR = loadVel(x + ds, y);
+      Vec2 vL = loadVel(x - ds, y);
+      Vec2 vU = loadVel(x, y + ds);
+      Vec2 vD = loadVel(x, y - ds);
+
+      this->_curl[this->_curlIndex(cx, cy)] =
+          0.5f / (this->_h * ds) * (vR.y - vL.y - vU.x + vD.x);
+    }
+  }
+}
+
+void ReferenceSimulation::applyVorticity() {
+  const ReferenceSimulationSettings& s = this->_settings;
+  int ds = static_cast<int>(s.curlDownsample);
+  float h = this->_h;
+
+  auto loadCurl = [&](int x, int y) {
+    x = std::clamp(x, 0, (int)this->_curlWidth - 1);
+    y = std::clamp(y, 0, (int)this->_curlHeight - 1);
+    return this->_curl[this->_curlIndex(x, y)];
+  };
+
+  for (int y = this->_y0; y < this->_y1; ++y) {
+    for (int x = this->_x0; x < this->_x1; ++x) {
+      int cx = x / ds;
+      int cy = y / ds;
+
+      float fx = loadCurl(cx, cy + 1) - loadCurl(cx, cy - 1);
+      float fy = loadCurl(cx - 1, cy) - loadCurl(cx + 1, cy);
+      float fMag = std::sqrt(fx * fx + fy * fy);
+      if (fMag < 0.00001f)
+        continue;
+
+      float f = s.vorticity * h / fMag;
+      Vec2& vel = this->_advectedVelocity[this->getIndex(x, y)];
+      vel.x += f * fx;
+      vel.y += f * fy;
+    }
+  }
+}
+
+void ReferenceSimulation::computeDivergence() {
+  const ReferenceSimulationSettings& s = this->_settings;
+
+  // Includes the upward push from the dye
+  auto loadVel = [&](int x, int y) -> Vec2 {
+    if (x < 0 || x >= (int)s.width || y < 0 || y >= (int)s.height)
+      return {0.0f, 0.0f};
+
+    size_t idx = this->getIndex(x, y);
+    const Vec4& c = this->_colorA[idx];
+    Vec2 vel = this->_advectedVelocity[idx];
+    vel.y += 0.01f * std::sqrt(c.r * c.r + c.g * c.g + c.b * c.b);
+    return vel;
+  };
+
+  for (int y = this->_y0; y < this->_y1; ++y) {
+    for (int x = this->_x0; x < this->_x1; ++x) {
+      Vec2 vR = loadVel(x + 1, y);
+      Vec2 vL = loadVel(x - 1, y);
+      Vec2 vU = loadVel(x, y + 1);
+      Vec2 vD = loadVel(x, y - 1);
+
+      this->_divergence[this->getIndex(x, y)] =
+          0.5f / this->_h * (vR.x - vL.x + vU.y - vD.y);
+    }
+  }
+}
+
+void ReferenceSimulation::iteratePressure() {
+  const ReferenceSimulationSettings& s = this->_settings;
+  int width = static_cast<int>(s.width);
+  int height = static_cast<int>(s.height);
+
+  auto loadP = [&](int x, int y) {
+    return this->_pressureA[this->getIndex(
+        mirrorIndex(x, width),
+        mirrorIndex(y, height))];
+  };
+
+  for (int y = this->_y0; y < this->_y1; ++y) {
+    for (int x = this->_x0; x < this->_x1; ++x) {
+      size_t idx = this->getIndex(x, y);
+      float div = this->_divergence[idx];
+      this->_pressureB[idx] =
+          0.25f * (loadP(x + 2, y) + loadP(x - 2, y) + loadP(x, y + 2) +
+                   loadP(x, y - 2) - div * this->_h * this->_h);
+    }
+  }
+
+  std::swap(this->_pressureA, this->_pressureB);
+}
+
+void ReferenceSimulation::updateVelocity() {
+  const ReferenceSimulationSettings& s = this->_settings;
+  int width = static_cast<int>(s.width);
+  int height = static_cast<int>(s.height);
+
+  auto loadP = [&](int x, int y) {
+    return this->_pressureA[this->getIndex(
+        mirrorIndex(x, width),
+        mirrorIndex(y, height))];
+  };
+
+  for (int y = this->_y0; y < this->_y1; ++y) {
+    for (int x = this->_x0; x < this->_x1; ++x) {
+      size_t idx = this->getIndex(x, y);
+      Vec2 vel = this->_advectedVelocity[idx];
+      vel.x -= 0.5f / this->_h * (loadP(x + 1, y) - loadP(x - 1, y));
+      vel.y -= 0.5f / this->_h * (loadP(x, y + 1) - loadP(x, y - 1));
+      this->_velocity[idx] = vel;
+    }
+  }
+}
+
+void ReferenceSimulation::projectSpectral() {
+  // Only supported without a halo, so storage is the plain grid
+  size_t cellCount = this->getCellCount();
+  for (size_t i = 0; i < cellCount; ++i) {
+    this->_spectralX[i] = this->_advectedVelocity[i].x;
+    this->_spectralY[i] = this->_advectedVelocity[i].y;
+  }
+
+  this->_projector.project(this->_spectralX.data(), this->_spectralY.data());
+
+  for (size_t i = 0; i < cellCount; ++i)
+    this->_velocity[i] = {this->_spectralX[i], this->_spectralY[i]};
+}
+
+void ReferenceSimulation::advectColor() {
+  const ReferenceSimulationSettings& s = this->_settings;
+
+  for (int y = this->_y0; y < this->_y1; ++y) {
+    for (int x = this->_x0; x < this->_x1; ++x) {
+      float u0 = (x + 0.5f) / s.width;
+      float v0 = (y + 0.5f) / s.height;
+
+      // Same backtrace as the velocity
+      Vec2 departure = this->_getDepartureUv(u0, v0);
+      float u = std::clamp(departure.x, 0.0f, 1.0f);
+      float v = std::clamp(departure.y, 0.0f, 1.0f);
+
+      // Dye source from the fractal
+      float f = this->_sampleFractal(u, v);
+      float f2 = 5.0f * f;
+      Vec4 src{
+          f2 * std::cos(5.0f * f + 1.0f) + 1.01f * f2,
+          f2 * std::sin(5.0f * f + 1.0f) + 1.01f * f2,
+          f2 * std::sin(5.0f * f + 0.45f) + 1.01f * f2,
+          1.0f};
+      float r = src.r;
+      src.r *= r;
+      src.g *= r * 1.2f;
+      src.b *= r;
+
+      Vec4 txSample = this->_sampleColor(u, v);
+      if (s.bMacCormack) {
+        Vec2 roundTrip = this->_getDepartureUv(
+            2.0f * u0 - departure.x,
+            2.0f * v0 - departure.y);
+        Vec4 reprojected = this->_sampleColor(u0, v0);
+        Vec4 roundTripSample = this->_sampleColor(roundTrip.x, roundTrip.y);
+
+        Vec4 minColor{
+            std::numeric_limits<float>::max(),
+            std::numeric_limits<float>::max(),
+            std::numeric_limits<float>::max(),
+            0.0f};
+        Vec4 maxColor{-minColor.r, -minColor.g, -minColor.b, 0.0f};
+        for (size_t idx : getBilinearTexels(
+                 s.width,
+                 s.height,
+                 u,
+                 v,
+                 [this](int x, int y) {
+                   return this->_sampleIndex(x, y, true);
+                 })) {
+          const Vec4& texel = this->_colorA[idx];
+          minColor = {
+              std::min(minColor.r, texel.r),
+              std::min(minColor.g, texel.g),
+              std::min(minColor.b, texel.b),
+              0.0f};
+          maxColor = {
+              std::max(maxColor.r, texel.r),
+              std::max(maxColor.g, texel.g),
+              std::max(maxColor.b, texel.b),
+              0.0f};
+        }
+
+        txSample = {
+            applyMacCormack(
+                txSample.r,
+                reprojected.r,
+                roundTripSample.r,
+                minColor.r,
+                maxColor.r),
+            applyMacCormack(
+                txSample.g,
+                reprojected.g,
+                roundTripSample.g,
+                minColor.g,
+                maxColor.g),
+            applyMacCormack(
+                txSample.b,
+                reprojected.b,
+                roundTripSample.b,
+                minColor.b,
+                maxColor.b),
+            txSample.a};
+      }
+
+      float t = 0.95f;
+      if (u <= 0.0f || u >= 1.0f || v <= 0.0f || v >= 1.0f)
+        t = 0.5f;
+
+      if (src.r * src.r + src.g * src.g + src.b * src.b + src.a * src.a >
+          1000.0f)
+        t = 0.0f;
+
+      this->_colorB[this->getIndex(x, y)] = {
+          mix(src.r, txSample.r, t),
+          mix(src.g, txSample.g, t),
+          mix(src.b, txSample.b, t),
+          1.0f};
+    }
+  }
+}
+
+void ReferenceSimulation::copyColors() { this->_colorA = this->_colorB; }
+
+void ReferenceSimulation::reduceExposure() {
+  float minIntensity = std::numeric_limits<float>::max();
+  float maxIntensity = 0.0f;
+  for (int y = this->_y0; y < this->_y1; ++y) {
+    for (int x = this->_x0; x < this->_x1; ++x) {
+      const Vec4& c = this->_colorA[this->getIndex(x, y)];
+      float intensity = std::sqrt(c.r * c.r + c.g * c.g + c.b * c.b);
+      minIntensity = std::min(minIntensity, intensity);
+      maxIntensity = std::max(maxIntensity, intensity);
+    }
+  }
+
+  this->_minIntensity = minIntensity;
+  this->_maxIntensity = maxIntensity;
+}
+
+size_t ReferenceSimulation::_sampleIndex(int x, int y, bool bMirror) const {
+  int width = static_cast<int>(this->_settings.width);
+  int height = static_cast<int>(this->_settings.height);
+  int halo = static_cast<int>(this->_subdomain.halo);
+
+  // Repeating fields are filled in over the whole halo, so they only need to
+  // wrap once the halo runs out
+  if (bMirror || x < this->_x0 - halo || x >= this->_x1 + halo)
+    x = wrap(x, width, bMirror);
+  if (bMirror || y < this->_y0 - halo || y >= this->_y1 + halo)
+    y = wrap(y, height, bMirror);
+
+  x = std::clamp(x, this->_x0 - halo, this->_x1 + halo - 1);
+  y = std::clamp(y, this->_y0 - halo, this->_y1 + halo - 1);
+  return this->getIndex(x, y);
+}
+
+size_t ReferenceSimulation::_curlIndex(int x, int y) const {
+  if (this->_settings.curlDownsample == 1)
+    return this->getIndex(x, y);
+  return static_cast<size_t>(y) * this->_curlWidth + x;
+}
+
+Vec2 ReferenceSimulation::_sampleVelocity(float u, float v) const {
+  return sampleBilinear(
+      this->_velocity,
+      this->_settings.width,
+      this->_settings.height,
+      u,
+      v,
+      [this](int x, int y) { return this->_sampleIndex(x, y, true); });
+}
+
+Vec4 ReferenceSimulation::_sampleColor(float u, float v) const {
+  return sampleBilinear(
+      this->_colorA,
+      this->_settings.width,
+      this->_settings.height,
+      u,
+      v,
+      [this](int x, int y) { return this->_sampleIndex(x, y, true); });
+}
+
+float ReferenceSimulation::_sampleFractal(float u, float v) const {
+  return sampleBilinear(
+      this->_fractal,
+      this->_settings.width,
+      this->_settings.height,
+      u,
+      v,
+      [this](int x, int y) { return this->_sampleIndex(x, y, false); });
+}
+
+Vec2 ReferenceSimulation::_getDepartureUv(float u, float v) const {
+  int width = static_cast<int>(this->_settings.width);
+  int height = static_cast<int>(this->_settings.height);
+
+  // VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE
+  Vec2 departure = sampleBilinear(
+      this->_departures,
+      this->_settings.width,
+      this->_settings.height,
+      u,
+      v,
+      [=](int x, int y) {
+        return this->_sampleIndex(
+            std::clamp(x, 0, width - 1),
+            std::clamp(y, 0, height - 1),
+            false);
+      });
+
+  return {u + departure.x / width, v + departure.y / height};
+}
+} // namespace StableFluids
@@ -0,0 +1,398 @@
+#include "ReferenceSimulation3D.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace StableFluids {
+namespace {
+using Vec3 = ReferenceSimulation3D::Vec3;
+
+constexpr size_t NO_VOXEL = ~static_cast<size_t>(0);
+
+// Smoke density or speed above which a brick counts as occupied
+constexpr float OCCUPANCY_THRESHOLD = 1e-3f;
+
+float mix(float a, float b, float t) { return a + (b - a) * t; }
+
+Vec3 mix(const Vec3& a, const Vec3& b, float t) {
+  return {mix(a.x, b.x, t), mix(a.y, b.y, t), mix(a.z, b.z, t)};
+}
+
+// Trilinear interpolation between voxel centers, load returns zero for
+// voxels that are not resident
+template <typename T, typename TLoad>
+T sampleTrilinear(float x, float y, float z, const TLoad& load) {
+  x -= 0.5f;
+  y -= 0.5f;
+  z -= 0.5f;
+  float x0f = std::floor(x);
+  float y0f = std::floor(y);
+  float z0f = std::floor(z);
+  float fx = x - x0f;
+  float fy = y - y0f;
+  float fz = z - z0f;
+  int x0 = static_cast<int>(x0f);
+  int y0 = static_cast<int>(y0f);
+  int z0 = static_cast<int>(z0f);
+
+  auto row = [&](int yi, int zi) {
+    return mix(load(x0, yi, zi), load(x0 + 1, yi, zi), fx);
+  };
+
+  return mix(
+      mix(row(y0, z0), row(y0 + 1, z0), fy),
+      mix(row(y0, z0 + 1), row(y0 + 1, z0 + 1), fy),
+      fz);
+}
+} // namespace
+
+ReferenceSimulation3D::ReferenceSimulation3D(
+    const ReferenceSimulation3DSettings& settings)
+    : _settings(settings) {
+  if (settings.pressureIterations % 2 != 0)
+    throw std::runtime_error("Pressure iterations must be an even number!");
+
+  this->_layout = BrickLayout::create(
+      settings.size,
+      settings.bDense ? 1.0f : settings.maxOccupancy);
+
+  uint32_t capacity = this->_layout.getCapacity();
+  this->_brickMap.resize(this->_layout.getBrickCount(), 0);
+  this->_brickFlags.resize(this->_layout.getBrickCount(), 0);
+  // Popped from the back, like the free stack on the GPU
+  this->_freeSlots.resize(capacity);
+  for (uint32_t i = 0; i < capacity; ++i)
+    this->_freeSlots[i] = i;
+
+  size_t voxelCount = static_cast<size_t>(capacity) * BRICK_VOXELS;
+  this->_velocityA.resize(voxelCount, {0.0f, 0.0f, 0.0f});
+  this->_velocityB.resize(voxelCount, {0.0f, 0.0f, 0.0f});
+  this->_densityA.resize(voxelCount, 0.0f);
+  this->_densityB.resize(voxelCount, 0.0f);
+  this->_divergence.resize(voxelCount, 0.0f);
+  this->_pressureA.resize(voxelCount, 0.0f);
+  this->_pressureB.resize(voxelCount, 0.0f);
+}
+
+void ReferenceSimulation3D::step() {
+  this->updateBricks();
+  this->clearBricks();
+
+  this->advect();
+
+  this->computeDivergence();
+  for (uint32_t i = 0; i < this->_settings.pressureIterations; ++i)
+    this->iteratePressure();
+  this->project();
+
+  this->flagBricks();
+}
+
+void ReferenceSimulation3D::updateBricks() {
+  const BrickLayout& layout = this->_layout;
+  uint32_t n = layout.bricks;
+
+  auto isWanted = [&](uint32_t bx, uint32_t by, uint32_t bz) {
+    return this->_settings.bDense ||
+           this->_brickFlags[layout.getBrickIndex(bx, by, bz)] != 0 ||
+           this->_touchesEmitter(bx, by, bz);
+  };
+
+  // Release first, so the allocations below can reuse the freed slots
+  for (uint32_t bz = 0; bz < n; ++bz) {
+    for (uint32_t by = 0; by < n; ++by) {
+      for (uint32_t bx = 0; bx < n; ++bx) {
+        uint32_t& entry = this->_brickMap[layout.getBrickIndex(bx, by, bz)];
+        if (entry != 0 && !isWanted(bx, by, bz)) {
+          this->_freeSlots.push_back(entry - 1);
+          entry = 0;
+        }
+      }
+    }
+  }
+
+  this->_newSlots.clear();
+  for (uint32_t bz = 0; bz < n; ++bz) {
+    for (uint32_t by = 0; by < n; ++by) {
+      for (uint32_t bx = 0; bx < n; ++bx) {
+        uint32_t brick = layout.getBrickIndex(bx, by, bz);
+        uint32_t& entry = this->_brickMap[brick];
+        if (entry == 0 && isWanted(bx, by, bz)) {
+          if (this->_freeSlots.empty()) {
+            ++this->_overflowCount;
+          } else {
+            uint32_t slot = this->_freeSlots.back();
+            this->_freeSlots.pop_back();
+            entry = slot + 1;
+            this->_newSlots.push_back(slot);
+          }
+        }
+
+        this->_brickFlags[brick] = 0;
+      }
+    }
+  }
+
+  this->_activeBricks.clear();
+  for (uint32_t brick = 0; brick < layout.getBrickCount(); ++brick) {
+    if (this->_brickMap[brick] != 0)
+      this->_activeBricks.push_back(brick);
+  }
+}
+
+void ReferenceSimulation3D::clearBricks() {
+  // Only the fields that carry over between steps, the others are written
+  // before they are read
+  for (uint32_t slot : this->_newSlots) {
+    size_t begin = _getSlotStart(slot);
+    size_t end = begin + BRICK_VOXELS;
+    std::fill(
+        this->_velocityA.begin() + begin,
+        this->_velocityA.begin() + end,
+        Vec3{0.0f, 0.0f, 0.0f});
+    std::fill(
+        this->_densityA.begin() + begin,
+        this->_densityA.begin() + end,
+        0.0f);
+    std::fill(
+        this->_pressureA.begin() + begin,
+        this->_pressureA.begin() + end,
+        0.0f);
+  }
+}
+
+void ReferenceSimulation3D::advect() {
+  const ReferenceSimulation3DSettings& s = this->_settings;
+  // Velocities are in normalized units per second, the backtrace is in
+  // voxels
+  float scale = s.dt * s.size;
+  float decay = std::max(1.0f - s.densityDecay * s.dt, 0.0f);
+
+  float emitterX = s.emitterX * s.size;
+  float emitterY = s.emitterY * s.size;
+  float emitterZ = s.emitterZ * s.size;
+  float emitterRadius = s.emitterRadius * s.size;
+
+  this->_forEachVoxel([&](int x, int y, int z, size_t voxel) {
+    float px = x + 0.5f;
+    float py = y + 0.5f;
+    float pz = z + 0.5f;
+
+    // Midpoint backtrace
+    const Vec3& v0 = this->_velocityA[voxel];
+    Vec3 vm = this->_sampleVelocity(
+        px - 0.5f * scale * v0.x,
+        py - 0.5f * scale * v0.y,
+        pz - 0.5f * scale * v0.z);
+    float srcX = px - scale * vm.x;
+    float srcY = py - scale * vm.y;
+    float srcZ = pz - scale * vm.z;
+
+    Vec3 vel = this->_sampleVelocity(srcX, srcY, srcZ);
+    float density = decay * this->_sampleDensity(srcX, srcY, srcZ);
+    vel.y += s.buoyancy * density * s.dt;
+
+    float dx = px - emitterX;
+    float dy = py - emitterY;
+    float dz = pz - emitterZ;
+    if (dx * dx + dy * dy + dz * dz < emitterRadius * emitterRadius) {
+      density = std::max(density, 1.0f);
+      vel = {0.0f, s.emitterSpeed, 0.0f};
+    }
+
+    this->_velocityB[voxel] = vel;
+    this->_densityB[voxel] = density;
+  });
+}
+
+void ReferenceSimulation3D::computeDivergence() {
+  float size = static_cast<float>(this->_settings.size);
+
+  auto loadVel = [&](int x, int y, int z) -> Vec3 {
+    size_t voxel = this->_getVoxel(x, y, z);
+    return voxel == NO_VOXEL ? Vec3{0.0f, 0.0f, 0.0f}
+                             : this->_velocityB[voxel];
+  };
+
+  this->_forEachVoxel([&](int x, int y, int z, size_t voxel) {
+    this->_divergence[voxel] =
+        0.5f * size *
+        (loadVel(x + 1, y, z).x - loadVel(x - 1, y, z).x +
+         loadVel(x, y + 1, z).y - loadVel(x, y - 1, z).y +
+         loadVel(x, y, z + 1).z - loadVel(x, y, z - 1).z);
+  });
+}
+
+void ReferenceSimulation3D::iteratePressure() {
+  int last = static_cast<int>(this->_settings.size) - 1;
+  float h = 1.0f / this->_settings.size;
+
+  // Walls are closed, non resident bricks are at ambient pressure
+  auto loadP = [&](int x, int y, int z) {
+    size_t voxel = this->_getVoxel(
+        std::clamp(x, 0, last),
+        std::clamp(y, 0, last),
+        std::clamp(z, 0, last));
+    return voxel == NO_VOXEL ? 0.0f : this->_pressureA[voxel];
+  };
+
+  // The same wide stencil as CalculatePressure.comp, it matches the central
+  // differences of the divergence and the projection
+  this->_forEachVoxel([&](int x, int y, int z, size_t voxel) {
+    this->_pressureB[voxel] =
+        (loadP(x + 2, y, z) + loadP(x - 2, y, z) + loadP(x, y + 2, z) +
+         loadP(x, y - 2, z) + loadP(x, y, z + 2) + loadP(x, y, z - 2) -
+         4.0f * h * h * this->_divergence[voxel]) /
+        6.0f;
+  });
+
+  std::swap(this->_pressureA, this->_pressureB);
+}
+
+void ReferenceSimulation3D::project() {
+  int last = static_cast<int>(this->_settings.size) - 1;
+  float size = static_cast<float>(this->_settings.size);
+
+  auto loadP = [&](int x, int y, int z) {
+    size_t voxel = this->_getVoxel(
+        std::clamp(x, 0, last),
+        std::clamp(y, 0, last),
+        std::clamp(z, 0, last));
+    return voxel == NO_VOXEL ? 0.0f : this->_pressureA[voxel];
+  };
+
+  this->_forEachVoxel([&](int x, int y, int z, size_t voxel) {
+    Vec3 vel = this->_velocityB[voxel];
+    vel.x -= 0.5f * size * (loadP(x + 1, y, z) - loadP(x - 1, y, z));
+    vel.y -= 0.5f * size * (loadP(x, y + 1, z) - loadP(x, y - 1, z));
+    vel.z -= 0.5f * size * (loadP(x, y, z + 1) - loadP(x, y, z - 1));
+    this->_velocityA[voxel] = vel;
+    this->_densityA[voxel] = this->_densityB[voxel];
+  });
+}
+
+void ReferenceSimulation3D::flagBricks() {
+  const BrickLayout& layout = this->_layout;
+  int n = static_cast<int>(layout.bricks);
+
+  for (uint32_t brick : this->_activeBricks) {
+    size_t begin = _getSlotStart(this->_brickMap[brick] - 1);
+    bool bOccupied = false;
+    for (size_t voxel = begin; voxel < begin + BRICK_VOXELS; ++voxel) {
+      if (this->_densityA[voxel] > OCCUPANCY_THRESHOLD) {
+        bOccupied = true;
+        break;
+      }
+    }
+
+    if (!bOccupied)
+      continue;
+
+    // Smoke moves less than a brick per step, so the neighbours are enough
+    // to hold wherever it goes next
+    int bx = static_cast<int>(brick % layout.bricks);
+    int by = static_cast<int>(brick / layout.bricks % layout.bricks);
+    int bz = static_cast<int>(brick / layout.bricks / layout.bricks);
+    for (int z = std::max(bz - 1, 0); z <= std::min(bz + 1, n - 1); ++z) {
+      for (int y = std::max(by - 1, 0); y <= std::min(by + 1, n - 1); ++y) {
+        for (int x = std::max(bx - 1, 0); x <= std::min(bx + 1, n - 1); ++x)
+          this->_brickFlags[layout.getBrickIndex(x, y, z)] = 1;
+      }
+    }
+  }
+}
+
+float ReferenceSimulation3D::getDensity(int x, int y, int z) const {
+  size_t voxel = this->_getVoxel(x, y, z);
+  return voxel == NO_VOXEL ? 0.0f : this->_densityA[voxel];
+}
+
+Vec3 ReferenceSimulation3D::getVelocity(int x, int y, int z) const {
+  size_t voxel = this->_getVoxel(x, y, z);
+  return voxel == NO_VOXEL ? Vec3{0.0f, 0.0f, 0.0f} : this->_velocityA[voxel];
+}
+
+double ReferenceSimulation3D::getDensitySum() const {
+  double sum = 0.0;
+  this->_forEachVoxel([&](int, int, int, size_t voxel) {
+    sum += this->_densityA[voxel];
+  });
+  return sum;
+}
+
+size_t ReferenceSimulation3D::_getVoxel(int x, int y, int z) const {
+  int size = static_cast<int>(this->_settings.size);
+  if (x < 0 || x >= size || y < 0 || y >= size || z < 0 || z >= size)
+    return NO_VOXEL;
+
+  uint32_t entry = this->_brickMap[this->_layout.getBrickIndex(
+      x / BRICK_SIZE,
+      y / BRICK_SIZE,
+      z / BRICK_SIZE)];
+  if (entry == 0)
+    return NO_VOXEL;
+
+  uint32_t lx = x % BRICK_SIZE;
+  uint32_t ly = y % BRICK_SIZE;
+  uint32_t lz = z % BRICK_SIZE;
+  return _getSlotStart(entry - 1) + (lz * BRICK_SIZE + ly) * BRICK_SIZE + lx;
+}
+
+Vec3 ReferenceSimulation3D::_sampleVelocity(float x, float y, float z) const {
+  return sampleTrilinear<Vec3>(x, y, z, [this](int xi, int yi, int zi) {
+    size_t voxel = this->_getVoxel(xi, yi, zi);
+    return voxel == NO_VOXEL ? Vec3{0.0f, 0.0f, 0.0f}
+                             : this->_velocityA[voxel];
+  });
+}
+
+float ReferenceSimulation3D::_sampleDensity(float x, float y, float z) const {
+  return sampleTrilinear<float>(x, y, z, [this](int xi, int yi, int zi) {
+    size_t voxel = this->_getVoxel(xi, yi, zi);
+    return voxel == NO_VOXEL ? 0.0f : this->_densityA[voxel];
+  });
+}
+
+bool ReferenceSimulation3D::_touchesEmitter(
+    uint32_t bx,
+    uint32_t by,
+    uint32_t bz) const {
+  const ReferenceSimulation3DSettings& s = this->_settings;
+  float center[3] = {
+      s.emitterX * s.size,
+      s.emitterY * s.size,
+      s.emitterZ * s.size};
+  uint32_t brick[3] = {bx, by, bz};
+
+  // Distance from the emitter center to the closest point of the brick
+  float distSq = 0.0f;
+  for (int i = 0; i < 3; ++i) {
+    float lo = static_cast<float>(brick[i] * BRICK_SIZE);
+    float closest = std::clamp(center[i], lo, lo + BRICK_SIZE);
+    distSq += (center[i] - closest) * (center[i] - closest);
+  }
+
+  float radius = s.emitterRadius * s.size;
+  return distSq < radius * radius;
+}
+
+template <typename TFn>
+void ReferenceSimulation3D::_forEachVoxel(const TFn& fn) const {
+  const BrickLayout& layout = this->_layout;
+  for (uint32_t brick : this->_activeBricks) {
+    int x0 = static_cast<int>(brick % layout.bricks * BRICK_SIZE);
+    int y0 = static_cast<int>(brick / layout.bricks % layout.bricks *
+                              BRICK_SIZE);
+    int z0 = static_cast<int>(brick / layout.bricks / layout.bricks *
+                              BRICK_SIZE);
+    size_t voxel = _getSlotStart(this->_brickMap[brick] - 1);
+    for (uint32_t z = 0; z < BRICK_SIZE; ++z) {
+      for (uint32_t y = 0; y < BRICK_SIZE; ++y) {
+        for (uint32_t x = 0; x < BRICK_SIZE; ++x)
+          fn(x0 + x, y0 + y, z0 + z, voxel++);
+      }
+    }
+  }
+}
+} // namespace StableFluids
@@ -0,0 +1,375 @@
+#include "ShaderCache.h"
+
+#include <shaderc/shaderc.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+namespace {
+// Bump this whenever the compile options below change, so stale binaries are
+// not picked up from the cache.
+constexpr char SHADER_CACHE_VERSION[] = "StableFluids-spirv-v1";
+
+uint64_t fnv1a(const void* data, size_t size, uint64_t hash) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+uint64_t fnv1a(const std::string& str, uint64_t hash) {
+  return fnv1a(str.data(), str.size(), hash);
+}
+
+bool readFile(const std::string& path, std::string& contents) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open())
+    return false;
+
+  std::ostringstream ss;
+  ss << file.rdbuf();
+  contents = ss.str();
+  return true;
+}
+
+std::string toHex(uint64_t value) {
+  char buf[17];
+  snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)value);
+  return buf;
+}
+
+// Resolves an #include the same way for both the dependency scan and the
+// compiler, so the cache key always covers exactly what gets compiled.
+std::string resolveInclude(
+    const std::string& requested,
+    bool bRelative,
+    const std::string& requestingFile,
+    const std::vector<std::string>& includeDirectories) {
+  namespace fs = std::filesystem;
+  if (bRelative) {
+    fs::path candidate = fs::path(requestingFile).parent_path() / requested;
+    if (fs::exists(candidate))
+      return candidate.lexically_normal().generic_string();
+  }
+
+  for (const std::string& dir : includeDirectories) {
+    fs::path candidate = fs::path(dir) / requested;
+    if (fs::exists(candidate))
+      return candidate.lexically_normal().generic_string();
+  }
+
+  return {};
+}
+
+void scanIncludes(
+    const std::string& path,
+    const std::vector<std::string>& includeDirectories,
+    std::vector<std::string>& dependencies,
+    std::unordered_set<std::string>& visited) {
+  if (!visited.insert(path).second)
+    return;
+
+  dependencies.push_back(path);
+
+  std::string source;
+  if (!readFile(path, source))
+    return;
+
+  std::istringstream lines(source);
+  std::string line;
+  while (std::getline(lines, line)) {
+    size_t start = line.find_first_not_of(" \t");
+    if (start == std::string::npos || line.compare(start, 8, "#include") != 0)
+      continue;
+
+    size_t open = line.find_first_of("\"<", start + 8);
+    if (open == std::string::npos)
+      continue;
+
+    bool bRelative = line[open] == '"';
+    size_t close = line.find(bRelative ? '"' : '>', open + 1);
+    if (close == std::string::npos)
+      continue;
+
+    std::string resolved = resolveInclude(
+        line.substr(open + 1, close - open - 1),
+        bRelative,
+        path,
+        includeDirectories);
+    if (!resolved.empty())
+      scanIncludes(resolved, includeDirectories, dependencies, visited);
+  }
+}
+
+class Includer : public shaderc::CompileOptions::IncluderInterface {
+public:
+  Includer(const std::vector<std::string>& includeDirectories)
+      : _includeDirectories(includeDirectories) {}
+
+  shaderc_include_result* GetInclude(
+      const char* requestedSource,
+      shaderc_include_type type,
+      const char* requestingSource,
+      size_t includeDepth) override {
+    IncludeData* pData = new IncludeData();
+    pData->path = resolveInclude(
+        requestedSource,
+        type == shaderc_include_type_relative,
+        requestingSource,
+        _includeDirectories);
+
+    if (pData->path.empty() || !readFile(pData->path, pData->contents)) {
+      // shaderc reports an empty source name as a failed include, with the
+      // contents used as the error message.
+      pData->path.clear();
+      pData->contents =
+          std::string("Could not resolve include: ") + requestedSource;
+    }
+
+    pData->result.source_name = pData->path.c_str();
+    pData->result.source_name_length = pData->path.size();
+    pData->result.content = pData->contents.c_str();
+    pData->result.content_length = pData->contents.size();
+    pData->result.user_data = pData;
+
+    return &pData->result;
+  }
+
+  void ReleaseInclude(shaderc_include_result* pResult) override {
+    delete static_cast<IncludeData*>(pResult->user_data);
+  }
+
+private:
+  struct IncludeData {
+    shaderc_include_result result{};
+    std::string path;
+    std::string contents;
+  };
+
+  std::vector<std::string> _includeDirectories;
+};
+} // namespace
+
+std::string getSimulationDirectory() {
+#ifdef STABLE_FLUIDS_DIRECTORY
+  return STABLE_FLUIDS_DIRECTORY;
+#else
+  return GProjectDirectory;
+#endif
+}
+
+ShaderCache::ShaderCache(const Application& app) : _device(app.getDevice()) {
+  vkGetPhysicalDeviceProperties(
+      app.getPhysicalDevice(),
+      &this->_deviceProperties);
+
+  this->_cacheDirectory = GProjectDirectory + "/Cache";
+  this->_includeDirectories = {
+      GEngineDirectory + "/Shaders",
+      getSimulationDirectory() + "/Shaders"};
+
+  std::filesystem::create_directories(this->_cacheDirectory + "/Shaders");
+
+  // Load the serialized pipeline cache, discarding it if it was written by a
+  // different device or driver.
+  std::string initialData;
+  if (readFile(this->_cacheDirectory + "/PipelineCache.bin", initialData)) {
+    VkPipelineCacheHeaderVersionOne header{};
+    bool bValid = initialData.size() >= sizeof(header);
+    if (bValid) {
+      memcpy(&header, initialData.data(), sizeof(header));
+      bValid =
+          header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+          header.vendorID == this->_deviceProperties.vendorID &&
+          header.deviceID == this->_deviceProperties.deviceID &&
+          memcmp(
+              header.pipelineCacheUUID,
+              this->_deviceProperties.pipelineCacheUUID,
+              VK_UUID_SIZE) == 0;
+    }
+
+    if (!bValid)
+      initialData.clear();
+  }
+
+  VkPipelineCacheCreateInfo cacheInfo{};
+  cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  cacheInfo.initialDataSize = initialData.size();
+  cacheInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+  if (vkCreatePipelineCache(
+          this->_device,
+          &cacheInfo,
+          nullptr,
+          &this->_pipelineCache) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create pipeline cache!");
+  }
+
+  this->_bPipelineCacheWarm = !initialData.empty();
+}
+
+ShaderCache::~ShaderCache() { this->_destroy(); }
+
+ShaderCache::ShaderCache(ShaderCache&& rhs) { *this = std::move(rhs); }
+
+ShaderCache& ShaderCache::operator=(ShaderCache&& rhs) {
+  if (this != &rhs) {
+    this->_destroy();
+
+    this->_device = rhs._device;
+    this->_deviceProperties = rhs._deviceProperties;
+    this->_pipelineCache = rhs._pipelineCache;
+    this->_bPipelineCacheWarm = rhs._bPipelineCacheWarm;
+    this->_cacheDirectory = std::move(rhs._cacheDirectory);
+    this->_includeDirectories = std::move(rhs._includeDirectories);
+
+    rhs._device = VK_NULL_HANDLE;
+    rhs._pipelineCache = VK_NULL_HANDLE;
+  }
+
+  return *this;
+}
+
+void ShaderCache::_destroy() {
+  if (this->_pipelineCache == VK_NULL_HANDLE)
+    return;
+
+  this->savePipelineCache();
+  vkDestroyPipelineCache(this->_device, this->_pipelineCache, nullptr);
+  this->_pipelineCache = VK_NULL_HANDLE;
+}
+
+void ShaderCache::savePipelineCache() const {
+  if (this->_pipelineCache == VK_NULL_HANDLE)
+    return;
+
+  size_t size = 0;
+  if (vkGetPipelineCacheData(
+          this->_device,
+          this->_pipelineCache,
+          &size,
+          nullptr) != VK_SUCCESS ||
+      size == 0) {
+    return;
+  }
+
+  std::vector<char> data(size);
+  if (vkGetPipelineCacheData(
+          this->_device,
+          this->_pipelineCache,
+          &size,
+          data.data()) != VK_SUCCESS) {
+    return;
+  }
+
+  // Write to a temporary file first so a crash mid-write can't leave a
+  // truncated cache behind.
+  std::string path = this->_cacheDirectory + "/PipelineCache.bin";
+  {
+    std::ofstream file(path + ".tmp", std::ios::binary | std::ios::trunc);
+    file.write(data.data(), size);
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(path + ".tmp", path, ec);
+}
+
+std::vector<std::string>
+ShaderCache::collectDependencies(const std::string& shaderPath) const {
+  std::vector<std::string> dependencies;
+  std::unordered_set<std::string> visited;
+  scanIncludes(
+      std::filesystem::path(shaderPath).lexically_normal().generic_string(),
+      this->_includeDirectories,
+      dependencies,
+      visited);
+  return dependencies;
+}
+
+CompiledShader
+ShaderCache::compileComputeShader(const std::string& shaderPath) const {
+  CompiledShader shader{};
+  shader.path = shaderPath;
+  shader.dependencies = this->collectDependencies(shaderPath);
+
+  std::string source;
+  if (!readFile(shaderPath, source)) {
+    shader.errors = "Could not open shader file: " + shaderPath;
+    return shader;
+  }
+
+  uint64_t hash = fnv1a(SHADER_CACHE_VERSION, 14695981039346656037ull);
+  for (const std::string& dependency : shader.dependencies) {
+    std::string contents;
+    readFile(dependency, contents);
+    hash = fnv1a(dependency, hash);
+    hash = fnv1a(contents, hash);
+  }
+  shader.hash = hash;
+
+  std::string binaryPath =
+      this->_cacheDirectory + "/Shaders/" + toHex(hash) + ".spv";
+
+  {
+    std::string binary;
+    if (readFile(binaryPath, binary) && binary.size() > 0 &&
+        binary.size() % sizeof(uint32_t) == 0) {
+      shader.spirv.resize(binary.size() / sizeof(uint32_t));
+      memcpy(shader.spirv.data(), binary.data(), binary.size());
+      shader.bCacheHit = true;
+      return shader;
+    }
+  }
+
+  shaderc::Compiler compiler;
+  shaderc::CompileOptions options;
+  options.SetTargetEnvironment(
+      shaderc_target_env_vulkan,
+      shaderc_env_version_vulkan_1_2);
+  options.SetOptimizationLevel(shaderc_optimization_level_performance);
+  options.SetIncluder(std::make_unique<Includer>(this->_includeDirectories));
+
+  shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(
+      source,
+      shaderc_compute_shader,
+      shaderPath.c_str(),
+      options);
+
+  if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+    shader.errors = result.GetErrorMessage();
+    return shader;
+  }
+
+  shader.spirv.assign(result.cbegin(), result.cend());
+
+  {
+    // Other threads may be compiling the same permutation concurrently
+    size_t threadId = std::hash<std::thread::id>{}(std::this_thread::get_id());
+    std::string tmpPath =
+        binaryPath + "." + std::to_string(threadId) + ".tmp";
+    {
+      std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+      file.write(
+          reinterpret_cast<const char*>(shader.spirv.data()),
+          shader.spirv.size() * sizeof(uint32_t));
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, binaryPath, ec);
+  }
+
+  return shader;
+}
+} // namespace StableFluids
@@ -0,0 +1,123 @@
+#include "ShaderWatcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace StableFluids {
+namespace {
+constexpr std::chrono::milliseconds POLL_INTERVAL(250);
+} // namespace
+
+ShaderWatcher::ShaderWatcher(
+    const ShaderCache& shaderCache,
+    const std::vector<CompiledShader>& shaders,
+    CompiledCallback onCompiled)
+    : _pShaderCache(&shaderCache), _onCompiled(std::move(onCompiled)) {
+  this->_shaders.reserve(shaders.size());
+  for (const CompiledShader& shader : shaders) {
+    WatchedShader& watched = this->_shaders.emplace_back();
+    watched.path = shader.path;
+    watched.dependencies = shader.dependencies;
+    watched.lastWriteTime = _getLastWriteTime(watched.dependencies);
+  }
+
+  this->_thread = std::thread([this]() { this->_run(); });
+}
+
+ShaderWatcher::~ShaderWatcher() {
+  {
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    this->_bStop = true;
+  }
+  this->_wake.notify_one();
+  this->_thread.join();
+}
+
+void ShaderWatcher::requestRecompileAll() {
+  {
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    this->_bRecompileAll = true;
+  }
+  this->_wake.notify_one();
+}
+
+/*static*/
+std::filesystem::file_time_type ShaderWatcher::_getLastWriteTime(
+    const std::vector<std::string>& dependencies) {
+  std::filesystem::file_time_type lastWriteTime{};
+  for (const std::string& dependency : dependencies) {
+    // Editors often replace files on save, so the file may briefly not exist
+    std::error_code ec;
+    std::filesystem::file_time_type t =
+        std::filesystem::last_write_time(dependency, ec);
+    if (!ec && t > lastWriteTime)
+      lastWriteTime = t;
+  }
+
+  return lastWriteTime;
+}
+
+void ShaderWatcher::_run() {
+  while (true) {
+    bool bRecompileAll;
+    {
+      std::unique_lock<std::mutex> lock(this->_mutex);
+      this->_wake.wait_for(lock, POLL_INTERVAL, [this]() {
+        return this->_bStop || this->_bRecompileAll;
+      });
+
+      if (this->_bStop)
+        return;
+
+      bRecompileAll = this->_bRecompileAll;
+      this->_bRecompileAll = false;
+    }
+
+    for (size_t i = 0; i < this->_shaders.size(); ++i) {
+      WatchedShader& watched = this->_shaders[i];
+
+      std::filesystem::file_time_type lastWriteTime =
+          _getLastWriteTime(watched.dependencies);
+      if (!bRecompileAll && lastWriteTime == watched.lastWriteTime)
+        continue;
+
+      CompiledShader shader =
+          this->_pShaderCache->compileComputeShader(watched.path);
+
+      // The include graph may have changed with this edit. The timestamp is
+      // recorded even on failure, so a broken shader is only reported once
+      // per edit.
+      watched.dependencies = shader.dependencies;
+      watched.lastWriteTime = _getLastWriteTime(watched.dependencies);
+      watched.bFailed = shader.hasErrors();
+
+      if (watched.bFailed) {
+        std::cerr << "Failed to recompile " << watched.path << ":\n"
+                  << shader.errors << std::endl;
+        continue;
+      }
+
+      auto it = std::find_if(
+          this->_pendingReloads.begin(),
+          this->_pendingReloads.end(),
+          [i](const ShaderReload& reload) { return reload.shaderIndex == i; });
+      if (it != this->_pendingReloads.end())
+        it->shader = std::move(shader);
+      else
+        this->_pendingReloads.push_back({i, std::move(shader)});
+    }
+
+    // Successfully recompiled shaders are held back until nothing is broken
+    // anymore, since an edit to a shared include may touch several kernels.
+    bool bAnyFailed = std::any_of(
+        this->_shaders.begin(),
+        this->_shaders.end(),
+        [](const WatchedShader& watched) { return watched.bFailed; });
+    if (!bAnyFailed && !this->_pendingReloads.empty()) {
+      this->_onCompiled(std::move(this->_pendingReloads));
+      this->_pendingReloads.clear();
+    }
+  }
+}
+} // namespace StableFluids
@@ -0,0 +1,326 @@
+#ifndef _WIN32
+
+#include "SharedMemoryTransport.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace StableFluids {
+namespace {
+constexpr uint32_t SHARED_MEMORY_MAGIC = 0x48534653; // "SFSH"
+
+// Keeps the rings of different workers on separate cache lines
+constexpr size_t RING_ALIGNMENT = 64 / sizeof(float);
+
+size_t alignUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+std::runtime_error makeError(const std::string& what) {
+  return std::runtime_error(what + ": " + std::strerror(errno));
+}
+} // namespace
+
+struct SharedMemoryTransport::Header {
+  uint32_t magic;
+  uint32_t workerCount;
+  uint32_t fieldCount;
+  uint32_t halo;
+  uint64_t size;
+  pthread_barrier_t barrier;
+};
+
+/*static*/
+SharedMemoryTransport SharedMemoryTransport::create(
+    const std::string& name,
+    const DomainDecomposition& decomposition,
+    const std::vector<uint32_t>& fieldChannels) {
+  SharedMemoryTransport result;
+  result._name = name;
+  result._decomposition = decomposition;
+  result._fieldChannels = fieldChannels;
+  result._bOwner = true;
+
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0)
+    throw makeError("Failed to create shared memory segment " + name);
+
+  result._map(fd, true);
+
+  Header* pHeader = result._pHeader;
+  pHeader->workerCount = decomposition.getWorkerCount();
+  pHeader->fieldCount = static_cast<uint32_t>(fieldChannels.size());
+  pHeader->halo = decomposition.halo;
+  pHeader->size = result._mappingSize;
+
+  pthread_barrierattr_t barrierAttributes;
+  pthread_barrierattr_init(&barrierAttributes);
+  pthread_barrierattr_setpshared(&barrierAttributes, PTHREAD_PROCESS_SHARED);
+  int error = pthread_barrier_init(
+      &pHeader->barrier,
+      &barrierAttributes,
+      decomposition.getWorkerCount());
+  pthread_barrierattr_destroy(&barrierAttributes);
+  if (error != 0) {
+    errno = error;
+    throw makeError("Failed to create shared memory barrier");
+  }
+
+  // Workers only accept the segment once everything above is visible
+  std::atomic_thread_fence(std::memory_order_release);
+  pHeader->magic = SHARED_MEMORY_MAGIC;
+
+  return result;
+}
+
+SharedMemoryTransport::SharedMemoryTransport(
+    const std::string& name,
+    const DomainDecomposition& decomposition,
+    const std::vector<uint32_t>& fieldChannels,
+    uint32_t rank)
+    : _name(name),
+      _decomposition(decomposition),
+      _fieldChannels(fieldChannels),
+      _rank(rank) {
+  if (rank >= decomposition.getWorkerCount())
+    throw std::runtime_error("Worker rank is out of range!");
+
+  int fd = shm_open(name.c_str(), O_RDWR, 0600);
+  if (fd < 0)
+    throw makeError("Failed to open shared memory segment " + name);
+
+  this->_map(fd, false);
+
+  const Header* pHeader = this->_pHeader;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (pHeader->magic != SHARED_MEMORY_MAGIC ||
+      pHeader->workerCount != decomposition.getWorkerCount() ||
+      pHeader->fieldCount != fieldChannels.size() ||
+      pHeader->halo != decomposition.halo ||
+      pHeader->size != this->_mappingSize) {
+    this->_destroy();
+    throw std::runtime_error(
+        "Shared memory segment " + name +
+        " does not match the decomposition!");
+  }
+}
+
+SharedMemoryTransport::~SharedMemoryTransport() { this->_destroy(); }
+
+SharedMemoryTransport::SharedMemoryTransport(SharedMemoryTransport&& rhs) {
+  *this = std::move(rhs);
+}
+
+SharedMemoryTransport&
+SharedMemoryTransport::operator=(SharedMemoryTransport&& rhs) {
+  if (this != &rhs) {
+    this->_destroy();
+
+    this->_name = std::move(rhs._name);
+    this->_decomposition = rhs._decomposition;
+    this->_fieldChannels = std::move(rhs._fieldChannels);
+    this->_rank = rhs._rank;
+    this->_bOwner = rhs._bOwner;
+    this->_pMapping = rhs._pMapping;
+    this->_mappingSize = rhs._mappingSize;
+    this->_pHeader = rhs._pHeader;
+    this->_pRings = rhs._pRings;
+    this->_ringOffsets = std::move(rhs._ringOffsets);
+    this->_exchangeCount = rhs._exchangeCount;
+
+    rhs._bOwner = false;
+    rhs._pMapping = nullptr;
+    rhs._mappingSize = 0;
+    rhs._pHeader = nullptr;
+    rhs._pRings = nullptr;
+  }
+
+  return *this;
+}
+
+void SharedMemoryTransport::exchange(
+    uint32_t fieldId,
+    float* field,
+    uint32_t channels) {
+  if (this->_bOwner)
+    throw std::runtime_error("The segment creator cannot exchange halos!");
+
+  if (fieldId >= this->_fieldChannels.size() ||
+      this->_fieldChannels[fieldId] != channels) {
+    throw std::runtime_error("Unknown halo field or channel count!");
+  }
+
+  const DomainDecomposition& decomposition = this->_decomposition;
+  Subdomain subdomain = decomposition.getSubdomain(this->_rank);
+  int g = static_cast<int>(subdomain.halo);
+  int x0 = static_cast<int>(subdomain.x);
+  int y0 = static_cast<int>(subdomain.y);
+  int x1 = x0 + static_cast<int>(subdomain.width);
+  int y1 = y0 + static_cast<int>(subdomain.height);
+  size_t paddedWidth = subdomain.getPaddedWidth();
+  size_t cellSize = channels * sizeof(float);
+
+  auto localCell = [&](int x, int y) -> float* {
+    return field +
+           ((y - y0 + g) * paddedWidth + (x - x0 + g)) * channels;
+  };
+
+  uint32_t parity = static_cast<uint32_t>(this->_exchangeCount++ & 1);
+
+  // Publish the cells along our edges. Corners are stored twice, which
+  // keeps every section a plain rectangle.
+  float* ring = this->_pRings +
+                this->_getRingOffset(this->_rank, fieldId, parity);
+  auto publish = [&](int xBegin, int xEnd, int yBegin, int yEnd) {
+    for (int y = yBegin; y < yEnd; ++y) {
+      for (int x = xBegin; x < xEnd; ++x) {
+        std::memcpy(ring, localCell(x, y), cellSize);
+        ring += channels;
+      }
+    }
+  };
+  publish(x0, x1, y0, y0 + g);
+  publish(x0, x1, y1 - g, y1);
+  publish(x0, x0 + g, y0, y1);
+  publish(x1 - g, x1, y0, y1);
+
+  int error = pthread_barrier_wait(&this->_pHeader->barrier);
+  if (error != 0 && error != PTHREAD_BARRIER_SERIAL_THREAD) {
+    errno = error;
+    throw makeError("Failed to wait on shared memory barrier");
+  }
+
+  // Ghost cells outside the grid are left to the boundary conditions
+  int width = static_cast<int>(decomposition.width);
+  int height = static_cast<int>(decomposition.height);
+  for (int y = std::max(y0 - g, 0); y < std::min(y1 + g, height); ++y) {
+    for (int x = std::max(x0 - g, 0); x < std::min(x1 + g, width); ++x) {
+      if (x >= x0 && x < x1 && y >= y0 && y < y1)
+        continue;
+
+      uint32_t owner = decomposition.getOwner(x, y);
+      const float* ownerRing =
+          this->_pRings + this->_getRingOffset(owner, fieldId, parity);
+      size_t ringCell =
+          _getRingCell(decomposition.getSubdomain(owner), x, y);
+      std::memcpy(localCell(x, y), ownerRing + ringCell * channels, cellSize);
+    }
+  }
+}
+
+void SharedMemoryTransport::_map(int fd, bool bCreate) {
+  const DomainDecomposition& decomposition = this->_decomposition;
+  uint32_t workerCount = decomposition.getWorkerCount();
+  uint32_t fieldCount = static_cast<uint32_t>(this->_fieldChannels.size());
+
+  size_t ringFloats = 0;
+  this->_ringOffsets.resize(static_cast<size_t>(workerCount) * fieldCount * 2);
+  for (uint32_t rank = 0; rank < workerCount; ++rank) {
+    for (uint32_t fieldId = 0; fieldId < fieldCount; ++fieldId) {
+      for (uint32_t parity = 0; parity < 2; ++parity) {
+        this->_ringOffsets[(rank * fieldCount + fieldId) * 2 + parity] =
+            ringFloats;
+        ringFloats = alignUp(
+            ringFloats + this->_getRingSize(rank, fieldId),
+            RING_ALIGNMENT);
+      }
+    }
+  }
+
+  size_t headerSize = alignUp(sizeof(Header), RING_ALIGNMENT * sizeof(float));
+  size_t size = headerSize + ringFloats * sizeof(float);
+
+  if (bCreate && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    close(fd);
+    shm_unlink(this->_name.c_str());
+    throw makeError("Failed to size shared memory segment " + this->_name);
+  }
+
+  if (!bCreate) {
+    struct stat status {};
+    if (fstat(fd, &status) != 0 ||
+        static_cast<size_t>(status.st_size) != size) {
+      close(fd);
+      throw std::runtime_error(
+          "Shared memory segment " + this->_name +
+          " does not match the decomposition!");
+    }
+  }
+
+  void* pMapping =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (pMapping == MAP_FAILED) {
+    if (bCreate)
+      shm_unlink(this->_name.c_str());
+    throw makeError("Failed to map shared memory segment " + this->_name);
+  }
+
+  this->_pMapping = pMapping;
+  this->_mappingSize = size;
+  this->_pHeader = static_cast<Header*>(pMapping);
+  this->_pRings = reinterpret_cast<float*>(
+      static_cast<char*>(pMapping) + headerSize);
+}
+
+void SharedMemoryTransport::_destroy() {
+  if (this->_pMapping) {
+    if (this->_bOwner && this->_pHeader->magic == SHARED_MEMORY_MAGIC)
+      pthread_barrier_destroy(&this->_pHeader->barrier);
+    munmap(this->_pMapping, this->_mappingSize);
+    this->_pMapping = nullptr;
+    this->_pHeader = nullptr;
+    this->_pRings = nullptr;
+  }
+
+  if (this->_bOwner) {
+    shm_unlink(this->_name.c_str());
+    this->_bOwner = false;
+  }
+}
+
+size_t SharedMemoryTransport::_getRingOffset(
+    uint32_t rank,
+    uint32_t fieldId,
+    uint32_t parity) const {
+  size_t fieldCount = this->_fieldChannels.size();
+  return this->_ringOffsets[(rank * fieldCount + fieldId) * 2 + parity];
+}
+
+size_t
+SharedMemoryTransport::_getRingSize(uint32_t rank, uint32_t fieldId) const {
+  Subdomain subdomain = this->_decomposition.getSubdomain(rank);
+  return static_cast<size_t>(this->_fieldChannels[fieldId]) * subdomain.halo *
+         2 * (subdomain.width + subdomain.height);
+}
+
+/*static*/
+size_t
+SharedMemoryTransport::_getRingCell(const Subdomain& subdomain, int x, int y) {
+  // Same section order as exchange() publishes them in
+  size_t g = subdomain.halo;
+  size_t w = subdomain.width;
+  size_t h = subdomain.height;
+  size_t lx = x - subdomain.x;
+  size_t ly = y - subdomain.y;
+
+  if (ly < g)
+    return ly * w + lx;
+  if (ly >= h - g)
+    return g * w + (ly - (h - g)) * w + lx;
+  if (lx < g)
+    return 2 * g * w + ly * g + lx;
+  return 2 * g * w + h * g + ly * g + (lx - (w - g));
+}
+} // namespace StableFluids
+
+#endif // _WIN32
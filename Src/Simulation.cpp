@@ -2,248 +2,462 @@
 
 #include <Althea/InputMask.h>
 
-#include <cassert>
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <stdexcept>
 
 using namespace AltheaEngine;
 
 namespace StableFluids {
+namespace {
+struct KernelSlot {
+  const char* shaderPath;
+  ComputeKernel SimulationKernels::*kernel;
+};
+
+const std::array<KernelSlot, 22> KERNEL_SLOTS = {
+    KernelSlot{
+        "/Shaders/FractalTiles.comp",
+        &SimulationKernels::fractalTilesPass},
+    KernelSlot{"/Shaders/Mandelbrot.comp", &SimulationKernels::fractalPass},
+    KernelSlot{
+        "/Shaders/ComputeDepartures.comp",
+        &SimulationKernels::departurePass},
+    KernelSlot{"/Shaders/AdvectVelocity.comp", &SimulationKernels::advectPass},
+    KernelSlot{"/Shaders/CalculateCurl.comp", &SimulationKernels::curlPass},
+    KernelSlot{
+        "/Shaders/VorticityConfinement.comp",
+        &SimulationKernels::vorticityPass},
+    KernelSlot{
+        "/Shaders/CalculateDivergence.comp",
+        &SimulationKernels::divergencePass},
+    KernelSlot{
+        "/Shaders/CalculatePressure.comp",
+        &SimulationKernels::pressurePass},
+    KernelSlot{
+        "/Shaders/UpdateVelocity.comp",
+        &SimulationKernels::updateVelocityPass},
+    KernelSlot{
+        "/Shaders/AdvectColor.comp",
+        &SimulationKernels::advectColorPass},
+    KernelSlot{"/Shaders/CopyColors.comp", &SimulationKernels::updateColorPass},
+    KernelSlot{
+        "/Shaders/AutoExposure.comp",
+        &SimulationKernels::autoExposurePass},
+    KernelSlot{"/Shaders/SimulationStats.comp", &SimulationKernels::statsPass},
+    KernelSlot{
+        "/Shaders/ReduceSimulationStats.comp",
+        &SimulationKernels::reduceStatsPass},
+    KernelSlot{
+        "/Shaders/SpectralLoad.comp",
+        &SimulationKernels::spectralLoadPass},
+    KernelSlot{"/Shaders/SpectralFFT.comp", &SimulationKernels::fftPass},
+    KernelSlot{
+        "/Shaders/SpectralProject.comp",
+        &SimulationKernels::spectralProjectPass},
+    KernelSlot{
+        "/Shaders/SpectralStore.comp",
+        &SimulationKernels::spectralStorePass},
+    KernelSlot{
+        "/Shaders/PressureResidual.comp",
+        &SimulationKernels::pressureResidualPass},
+    KernelSlot{
+        "/Shaders/ApplyPressureCorrection.comp",
+        &SimulationKernels::pressureCorrectionPass},
+    KernelSlot{
+        "/Shaders/ComposeDisplay.comp",
+        &SimulationKernels::composeDisplayPass},
+    KernelSlot{
+        "/Shaders/DepositCanvas.comp",
+        &SimulationKernels::depositCanvasPass}};
+
+// The iterative pressure solve runs its Jacobi sweeps on an fp16 correction
+// and refines the fp32 pressure with it this many times per step. Jacobi is
+// linear, so in exact arithmetic this matches the same number of sweeps on
+// the pressure directly, but the pressure never gets rounded to fp16.
+constexpr uint32_t PRESSURE_REFINEMENT_STEPS = 2;
+// Must be even, so the correction ends up back in the first ping-pong field
+constexpr uint32_t PRESSURE_SWEEPS_PER_REFINEMENT = 20;
+static_assert(PRESSURE_SWEEPS_PER_REFINEMENT % 2 == 0);
+
+// The exposure reduction of a grid fills the entries below the smoothed
+// exposure, the exposure snapshot of each frame in flight follows it
+uint32_t getSmoothedExposureEntry(const VkExtent2D& extent) {
+  return (extent.width * extent.height - 1) / 32 + 2;
+}
 
-static ComputePipeline createComputePass(
-    const char* shaderRelativePath,
-    const Application& app,
-    const GlobalHeap& heap) {
-  ComputePipelineBuilder builder{};
-  builder.setComputeShader(GProjectDirectory + shaderRelativePath);
-  builder.layoutBuilder.addDescriptorSet(heap.getDescriptorSetLayout())
-      .addPushConstants<SimulationPushConstants>(VK_SHADER_STAGE_COMPUTE_BIT);
+uint32_t getAutoExposureEntryCount(const VkExtent2D& extent) {
+  return getSmoothedExposureEntry(extent) + 1 + MAX_FRAMES_IN_FLIGHT;
+}
 
-  return ComputePipeline(app, std::move(builder));
+// The stats pass writes one partial per workgroup, this bounds the number of
+// workgroups for any kernel permutation.
+constexpr uint32_t MIN_LOCAL_SIZE = 8;
+
+// The passes of a simulation step in execution order, used to describe when
+// each field is live. The spectral projection runs in the divergence through
+// update velocity slots.
+enum SimulationPass : uint32_t {
+  PASS_AUTO_EXPOSURE = 0,
+  PASS_FRACTAL,
+  PASS_DEPARTURES,
+  PASS_ADVECT_VELOCITY,
+  PASS_VORTICITY,
+  PASS_DIVERGENCE,
+  PASS_PRESSURE,
+  PASS_UPDATE_VELOCITY,
+  PASS_ADVECT_COLOR,
+  PASS_COPY_COLOR,
+  PASS_STATS,
+  PASS_DISPLAY
+};
+
+// Matches SPECTRAL_WIDTH / SPECTRAL_HEIGHT in SimulationCommon.glsl
+uint32_t spectralSize(uint32_t n) {
+  uint32_t p = 1;
+  while (p < n)
+    p <<= 1;
+  return p;
 }
 
+void bindKernel(
+    VkCommandBuffer commandBuffer,
+    VkDescriptorSet heapSet,
+    const ComputeKernel& kernel,
+    const SimulationPushConstants& push) {
+  kernel.bindPipeline(commandBuffer);
+  vkCmdPushConstants(
+      commandBuffer,
+      kernel.getLayout(),
+      VK_SHADER_STAGE_COMPUTE_BIT,
+      0,
+      sizeof(SimulationPushConstants),
+      &push);
+  vkCmdBindDescriptorSets(
+      commandBuffer,
+      VK_PIPELINE_BIND_POINT_COMPUTE,
+      kernel.getLayout(),
+      0,
+      1,
+      &heapSet,
+      0,
+      nullptr);
+}
+} // namespace
+
 Simulation::Simulation(
     Application& app,
     SingleTimeCommandBuffer& commandBuffer,
-    GlobalHeap& heap) {
-  const VkExtent2D& extent = app.getSwapChainExtent();
-
-  this->_simulationUniforms = TransientUniforms<SimulationUniforms>(app);
-  this->_simulationUniforms.registerToHeap(heap);
+    GlobalHeap& heap,
+    const ShaderCache& shaderCache,
+    const VkExtent2D& extent,
+    uint32_t velocityDownsample,
+    bool bExportFields)
+    : _pShaderCache(&shaderCache),
+      _heapSetLayout(heap.getDescriptorSetLayout()),
+      _allocator(app.getAllocator()),
+      _velocityDownsample(velocityDownsample),
+      _extent(extent) {
+  if (velocityDownsample == 0)
+    throw std::runtime_error("Velocity downsample must be positive!");
+  // The exposure reduction indexes texels with 32 bit integers
+  if (extent.width == 0 || extent.height == 0 ||
+      uint64_t(extent.width) * extent.height > UINT32_MAX)
+    throw std::runtime_error("Unsupported simulation extent!");
+  const KernelPermutation initialPermutation =
+      this->_getPermutation(extent, this->_preset);
+
+  for (TransientUniforms<SimulationUniforms>& uniforms :
+       this->_simulationUniforms) {
+    uniforms = TransientUniforms<SimulationUniforms>(app);
+    uniforms.registerToHeap(heap);
+  }
 
-  // Create texture resources
+  // Create the simulation fields, all out of one pooled allocation. Fields
+  // that only live for part of a step share memory.
 
   // TODO: More efficient texture formats? Where can we afford less precision?
   // Is 16-bit enough floating-point precision for all these stages?
-
-  // Iteration counts texture
   {
-    ImageOptions imageOptions{};
-    imageOptions.format = VK_FORMAT_R32_SINT;
-    imageOptions.width = extent.width;
-    imageOptions.height = extent.height;
-    imageOptions.usage = VK_IMAGE_USAGE_STORAGE_BIT;
-    this->_iterationCounts.image = Image(app, imageOptions);
+    const FieldLifetime persistent{0, PASS_DISPLAY};
+
+    std::vector<FieldDesc> fields(FIELD_COUNT);
+    fields[FIELD_FRACTAL] = {
+        VK_FORMAT_R32_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        persistent};
+    // Read by both advection passes, the dye samples it bilinearly
+    fields[FIELD_DEPARTURE] = {
+        VK_FORMAT_R16G16_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        {PASS_DEPARTURES, PASS_ADVECT_COLOR},
+        VK_FILTER_LINEAR,
+        VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE};
+    fields[FIELD_VELOCITY] = {
+        VK_FORMAT_R16G16_SFLOAT,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+        persistent,
+        VK_FILTER_LINEAR,
+        VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT};
+    fields[FIELD_ADVECTED_VELOCITY] = {
+        VK_FORMAT_R16G16_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT,
+        {PASS_ADVECT_VELOCITY, PASS_UPDATE_VELOCITY}};
+    fields[FIELD_CURL] = {
+        VK_FORMAT_R16_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT,
+        {PASS_VORTICITY, PASS_VORTICITY}};
+    // Shown by the display pass. Only read once per refinement step, so it
+    // can afford fp32 and bound the residual by fp32 rounding.
+    fields[FIELD_DIVERGENCE] = {
+        VK_FORMAT_R32_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        {PASS_DIVERGENCE, PASS_DISPLAY}};
+    // The pressure warm-starts the next solve and accumulates the
+    // corrections in fp32. The residual and correction ping-pong are only
+    // scratch space for the fp16 Jacobi sweeps.
+    fields[FIELD_PRESSURE] = {
+        VK_FORMAT_R32_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        persistent};
+    fields[FIELD_PRESSURE_RESIDUAL] = {
+        VK_FORMAT_R16_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT,
+        {PASS_PRESSURE, PASS_PRESSURE}};
+    fields[FIELD_PRESSURE_CORRECTION_A] = {
+        VK_FORMAT_R16_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT,
+        {PASS_PRESSURE, PASS_PRESSURE}};
+    fields[FIELD_PRESSURE_CORRECTION_B] = {
+        VK_FORMAT_R16_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT,
+        {PASS_PRESSURE, PASS_PRESSURE}};
+    fields[FIELD_COLOR_A] = {
+        VK_FORMAT_R32G32B32A32_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        persistent,
+        VK_FILTER_LINEAR,
+        VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT};
+    fields[FIELD_COLOR_B] = {
+        VK_FORMAT_R32G32B32A32_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        {PASS_ADVECT_COLOR, PASS_COPY_COLOR},
+        VK_FILTER_LINEAR,
+        VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT};
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+      fields[FIELD_DISPLAY + i] = {
+          VK_FORMAT_R32G32B32A32_SFLOAT,
+          VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+          persistent};
+    }
 
-    ImageViewOptions viewOptions{};
-    viewOptions.format = imageOptions.format;
-    this->_iterationCounts.view =
-        ImageView(app, this->_iterationCounts.image, viewOptions);
+    // Everything but the dye and the fractal lives on the velocity grid
+    for (SimulationField field :
+         {FIELD_DEPARTURE,
+          FIELD_VELOCITY,
+          FIELD_ADVECTED_VELOCITY,
+          FIELD_CURL,
+          FIELD_DIVERGENCE,
+          FIELD_PRESSURE,
+          FIELD_PRESSURE_RESIDUAL,
+          FIELD_PRESSURE_CORRECTION_A,
+          FIELD_PRESSURE_CORRECTION_B}) {
+      fields[field].downsample = velocityDownsample;
+    }
 
-    SamplerOptions samplerOptions{};
-    samplerOptions.normalized = false;
-    samplerOptions.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
-    this->_iterationCounts.sampler = Sampler(app, samplerOptions);
+    this->_fields = FieldPool(
+        app,
+        heap,
+        extent.width,
+        extent.height,
+        fields,
+        1,
+        bExportFields);
 
-    this->_iterationCounts.registerToImageHeap(heap);
+    std::cout << "Allocated " << FIELD_COUNT << " simulation fields in "
+              << (this->_fields.getPooledSize() >> 20) << "MB (vs "
+              << (this->_fields.getSeparateSize() >> 20)
+              << "MB as separate allocations)" << std::endl;
   }
 
-  // Fractal texture
-  {
-    ImageOptions imageOptions{};
-    imageOptions.format = VK_FORMAT_R32_SFLOAT;
-    imageOptions.width = extent.width;
-    imageOptions.height = extent.height;
-    imageOptions.usage =
-        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-    this->_fractalTexture.image = Image(app, imageOptions);
+  this->_fractalTiles = FractalTileCache(app, heap, extent);
 
-    ImageViewOptions viewOptions{};
-    viewOptions.format = imageOptions.format;
-    this->_fractalTexture.view =
-        ImageView(app, this->_fractalTexture.image, viewOptions);
-
-    this->_fractalTexture.sampler = Sampler(app, {});
-
-    this->_fractalTexture.registerToImageHeap(heap);
-    this->_fractalTexture.registerToTextureHeap(heap);
-  }
-
-  // Velocity field texture
+  // Auto exposure
   {
-    ImageOptions imageOptions{};
-    imageOptions.format = VK_FORMAT_R16G16_SFLOAT;
-    imageOptions.width = extent.width;
-    imageOptions.height = extent.height;
-    imageOptions.usage =
-        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
-    this->_velocityField.image = Image(app, imageOptions);
-
-    ImageViewOptions viewOptions{};
-    viewOptions.format = VK_FORMAT_R16G16_SFLOAT;
-    this->_velocityField.view =
-        ImageView(app, this->_velocityField.image, viewOptions);
-
-    SamplerOptions samplerOptions{};
-    samplerOptions.addressModeU = VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT;
-    samplerOptions.addressModeV = VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT;
-    this->_velocityField.sampler = Sampler(app, samplerOptions);
-
-    this->_velocityField.registerToImageHeap(heap);
-    this->_velocityField.registerToTextureHeap(heap);
+    _autoExposureBuffer =
+        StructuredBuffer<AutoExposure>(app, getAutoExposureEntryCount(extent));
+    _autoExposureBuffer.zeroBuffer(commandBuffer);
+    _autoExposureBuffer.registerToHeap(heap);
   }
 
-  // Advected velocity field texture
+  // Spectral projection
   {
-    ImageOptions imageOptions{};
-    imageOptions.format = VK_FORMAT_R16G16_SFLOAT;
-    imageOptions.width = extent.width;
-    imageOptions.height = extent.height;
-    imageOptions.usage = VK_IMAGE_USAGE_STORAGE_BIT;
-    this->_advectedVelocityField.image = Image(app, imageOptions);
-
-    ImageViewOptions viewOptions{};
-    viewOptions.format = VK_FORMAT_R16G16_SFLOAT;
-    this->_advectedVelocityField.view =
-        ImageView(app, this->_advectedVelocityField.image, viewOptions);
-    this->_advectedVelocityField.sampler = Sampler(app, {});
-
-    this->_advectedVelocityField.registerToImageHeap(heap);
+    uint32_t entryCount =
+        spectralSize(initialPermutation.getVelocityWidth()) *
+        spectralSize(initialPermutation.getVelocityHeight());
+    _spectralBuffer = StructuredBuffer<glm::vec4>(app, 2 * entryCount);
+    _spectralBuffer.registerToHeap(heap);
   }
 
-  // Divergence field texture
-  {
-    ImageOptions imageOptions{};
-    imageOptions.format = VK_FORMAT_R16_SFLOAT;
-    imageOptions.width = extent.width;
-    imageOptions.height = extent.height;
-    imageOptions.usage =
-        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-    this->_divergenceField.image = Image(app, imageOptions);
-
-    // TODO: Are views and samplers needed for storage-only usage?
-    ImageViewOptions viewOptions{};
-    viewOptions.format = VK_FORMAT_R16_SFLOAT;
-    this->_divergenceField.view =
-        ImageView(app, this->_divergenceField.image, viewOptions);
-    this->_divergenceField.sampler = Sampler(app, {});
-
-    this->_divergenceField.registerToImageHeap(heap);
-    this->_divergenceField.registerToTextureHeap(heap);
-  }
-
-  // Pressure field textures
+  // Simulation statistics
   {
-    ImageOptions imageOptions{};
-    imageOptions.format = VK_FORMAT_R16_SFLOAT;
-    imageOptions.width = extent.width;
-    imageOptions.height = extent.height;
-    imageOptions.usage =
-        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-
-    ImageViewOptions viewOptions{};
-    viewOptions.format = VK_FORMAT_R16_SFLOAT;
-
-    this->_pressureFieldA.image = Image(app, imageOptions);
-    this->_pressureFieldB.image = Image(app, imageOptions);
-
-    this->_pressureFieldA.view =
-        ImageView(app, this->_pressureFieldA.image, viewOptions);
-    this->_pressureFieldB.view =
-        ImageView(app, this->_pressureFieldB.image, viewOptions);
-
-    this->_pressureFieldA.sampler = Sampler(app, {});
-    this->_pressureFieldB.sampler = Sampler(app, {});
+    uint32_t maxGroupCount = ((extent.width - 1) / MIN_LOCAL_SIZE + 1) *
+                             ((extent.height - 1) / MIN_LOCAL_SIZE + 1);
+    _statsBuffer =
+        StructuredBuffer<SimulationStatsEntry>(app, maxGroupCount + 1);
+    _statsBuffer.zeroBuffer(commandBuffer);
+    _statsBuffer.registerToHeap(heap);
+
+    VmaAllocationCreateInfo readbackInfo{};
+    readbackInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
+    readbackInfo.usage = VMA_MEMORY_USAGE_AUTO;
+
+    for (StatsReadback& readback : _statsReadbacks) {
+      readback.buffer = BufferUtilities::createBuffer(
+          app,
+          sizeof(SimulationStatsEntry),
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+          readbackInfo);
+    }
 
-    this->_pressureFieldA.registerToImageHeap(heap);
-    this->_pressureFieldB.registerToImageHeap(heap);
-    this->_pressureFieldA.registerToTextureHeap(heap);
-    this->_pressureFieldB.registerToTextureHeap(heap);
+    _projectionTimer = GpuTimer(app);
   }
 
-  // Color field textures
-  {
-    ImageOptions imageOptions{};
-    imageOptions.format = VK_FORMAT_R32G32B32A32_SFLOAT;
-    imageOptions.width = extent.width;
-    imageOptions.height = extent.height;
-    imageOptions.usage =
-        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-
-    ImageViewOptions viewOptions{};
-    viewOptions.format = VK_FORMAT_R32G32B32A32_SFLOAT;
-    viewOptions.aspectFlags = VK_IMAGE_ASPECT_COLOR_BIT;
-
-    SamplerOptions samplerOptions{};
-    samplerOptions.addressModeU = VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT;
-    samplerOptions.addressModeV = VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT;
-
-    this->_colorFieldA.image = Image(app, imageOptions);
-    this->_colorFieldB.image = Image(app, imageOptions);
-
-    this->_colorFieldA.view =
-        ImageView(app, this->_colorFieldA.image, viewOptions);
-    this->_colorFieldB.view =
-        ImageView(app, this->_colorFieldB.image, viewOptions);
-
-    this->_colorFieldA.sampler = Sampler(app, samplerOptions);
-    this->_colorFieldB.sampler = Sampler(app, samplerOptions);
-
-    this->_colorFieldA.registerToImageHeap(heap);
-    this->_colorFieldB.registerToImageHeap(heap);
-    this->_colorFieldA.registerToTextureHeap(heap);
-    this->_colorFieldB.registerToTextureHeap(heap);
+  // Create compute passes, other permutations are created in the background
+  // on first use. Start on the other presets right away, so switching to
+  // them does not have to wait.
+  this->_compileShaders();
+  for (const CompiledShader& shader : this->_shaders) {
+    if (shader.hasErrors())
+      throw std::runtime_error(shader.errors);
   }
 
-  // Auto exposure
-  {
-    _autoExposureBuffer = StructuredBuffer<AutoExposure>(app, 2048 * 2048 / 32);
-    _autoExposureBuffer.zeroBuffer(commandBuffer);
-    _autoExposureBuffer.registerToHeap(heap);
+  this->_kernelPermutations.emplace(
+      initialPermutation,
+      _createKernels(
+          app,
+          shaderCache,
+          this->_heapSetLayout,
+          this->_shaders,
+          initialPermutation,
+          true));
+  for (SimulationPreset preset :
+       {SimulationPreset::Preview,
+        SimulationPreset::Default,
+        SimulationPreset::HighQuality}) {
+    this->_getKernels(app, this->_getPermutation(extent, preset), false);
   }
 
-  // Create compute passes
-
-  this->_fractalPass = createComputePass("/Shaders/Mandelbrot.comp", app, heap);
-  this->_advectPass =
-      createComputePass("/Shaders/AdvectVelocity.comp", app, heap);
-  this->_divergencePass =
-      createComputePass("/Shaders/CalculateDivergence.comp", app, heap);
-  this->_pressurePass =
-      createComputePass("/Shaders/CalculatePressure.comp", app, heap);
-  this->_updateVelocityPass =
-      createComputePass("/Shaders/UpdateVelocity.comp", app, heap);
-  this->_advectColorPass =
-      createComputePass("/Shaders/AdvectColor.comp", app, heap);
-  this->_fractalPass = createComputePass("/Shaders/Mandelbrot.comp", app, heap);
-  this->_updateColorPass =
-      createComputePass("/Shaders/CopyColors.comp", app, heap);
-  this->_autoExposurePass =
-      createComputePass("/Shaders/AutoExposure.comp", app, heap);
+  // Watch for shader edits. The watcher thread only gets pointers to state
+  // that stays put when the simulation is moved.
+  this->_reloadState = std::make_shared<KernelReloadState>();
+  this->_reloadState->permutations.push_back(initialPermutation);
+  this->_shaderWatcher = std::make_unique<ShaderWatcher>(
+      shaderCache,
+      this->_shaders,
+      [pState = this->_reloadState,
+       pApp = &app,
+       pShaderCache = this->_pShaderCache,
+       heapSetLayout =
+           this->_heapSetLayout](std::vector<ShaderReload>&& reloads) {
+        std::vector<KernelPermutation> permutations;
+        {
+          std::lock_guard<std::mutex> lock(pState->mutex);
+          permutations = pState->permutations;
+        }
+
+        KernelReloadState::PendingReload pending{};
+        pending.shaders = std::move(reloads);
+
+        try {
+          for (const KernelPermutation& permutation : permutations) {
+            std::vector<uint32_t> constants =
+                permutation.getSpecializationConstants();
+
+            auto& kernels = pending.kernels.emplace_back();
+            kernels.first = permutation;
+            for (const ShaderReload& reload : pending.shaders) {
+              kernels.second.push_back(ComputeKernel(
+                  *pApp,
+                  reload.shader,
+                  pShaderCache->getPipelineCache(),
+                  heapSetLayout,
+                  sizeof(SimulationPushConstants),
+                  constants));
+            }
+          }
+        } catch (const std::exception& e) {
+          std::cerr << e.what() << std::endl;
+          return;
+        }
+
+        std::lock_guard<std::mutex> lock(pState->mutex);
+        pState->pending.push_back(std::move(pending));
+      });
 
   // TODO:
   // Particle update pass
 }
 
 void Simulation::update(
-    const Application& app,
+    Application& app,
     VkCommandBuffer commandBuffer,
     VkDescriptorSet heapSet,
     const FrameContext& frame) {
+  // Swap in any kernels recompiled in the background since the last update
+  this->_applyShaderReloads(app, frame);
+
+  // The fence for this frame slot has been waited on by now, so reading back
+  // the statistics it recorded last time never stalls
+  this->_readBackStats(frame);
+  this->_fractalTiles.beginFrame(frame);
+  if (this->_pCanvas)
+    this->_pCanvas->beginFrame(frame);
+
+  InputFrame input{};
+  if (!this->_pInputReplay || !this->_pInputReplay->next(input)) {
+    if (this->_pInputReplay) {
+      std::cout << "Input replay finished after "
+                << this->_pInputReplay->getFrameCount() << " frames"
+                << std::endl;
+      this->_pInputReplay = nullptr;
+    }
+
+    input.inputMask = this->_bLiveInput
+                          ? app.getInputManager().getCurrentInputMask()
+                          : 0;
+    input.zoomDir = this->targetZoomDir;
+    // A camera path advances by its own timestep every update, so the
+    // simulation has to as well for runs along it to be reproducible
+    input.deltaTime = this->_pCameraPath ? this->_pCameraPath->getTimestep()
+                                         : frame.deltaTime;
+    input.flags = this->clear ? INPUT_FRAME_FLAG_CLEAR : 0;
+    input.preset = static_cast<uint32_t>(this->_preset);
+    input.pressureSolver = static_cast<uint32_t>(this->_pressureSolver);
+    input.advectionScheme = static_cast<uint32_t>(this->_advectionScheme);
+    input.vorticity = this->vorticity;
+  }
+
+  if (this->_pInputRecorder)
+    this->_pInputRecorder->record(input);
+
+  this->clear = (input.flags & INPUT_FRAME_FLAG_CLEAR) != 0;
+  this->_preset = static_cast<SimulationPreset>(input.preset);
+  this->_pressureSolver = static_cast<PressureSolver>(input.pressureSolver);
+  this->_advectionScheme = static_cast<AdvectionScheme>(input.advectionScheme);
+  this->vorticity = input.vorticity;
+
   // TODO: Refactor this out into generalized 2D controller
-  float deltaTime = glm::clamp(frame.deltaTime, 0.0f, 1.0f / 30.0f);
+  float deltaTime = glm::clamp(input.deltaTime, 0.0f, 1.0f / 30.0f);
 
-  uint32_t inputMask = app.getInputManager().getCurrentInputMask();
+  uint32_t inputMask = input.inputMask;
+  this->_inputMask = inputMask;
 
   // this->_targetSpeed2D =
   //     glm::clamp(this->_targetSpeed2D + this->_accelerationMag2D * deltaTime,
@@ -268,11 +482,10 @@ void Simulation::update(
   }
 
   float targetZoomVelocity;
-  if (abs(targetZoomDir) < 0.001f) {
+  if (abs(input.zoomDir) < 0.001f) {
     targetZoomVelocity = 0.0f;
   } else {
-    targetZoomVelocity =
-        this->_targetZoomSpeed * glm::sign(this->targetZoomDir);
+    targetZoomVelocity = this->_targetZoomSpeed * glm::sign(input.zoomDir);
   }
 
   // Velocity feedback controller
@@ -286,77 +499,273 @@ void Simulation::update(
   this->zoom *= glm::pow(2.0, this->_velocityZoom * deltaTime);
   this->offset += glm::dvec2(this->_velocity2D) / this->zoom * (double)deltaTime;
 
-  const VkExtent2D& extent = app.getSwapChainExtent();
+  if (this->_pCameraPath) {
+    CameraPath::Keyframe camera = this->_pCameraPath->step();
+    this->zoom = camera.zoom;
+    this->offset = glm::dvec2(camera.offsetX, camera.offsetY);
+  }
+
+  // Fixed timestep, the simulation only advances in whole steps no matter
+  // the frame rate. A pending clear is applied by the next step.
+  this->_timeAccumulator += input.deltaTime;
+  uint32_t stepCount = 0;
+  while (this->_timeAccumulator >= this->timestep &&
+         stepCount < MAX_SIMULATION_STEPS_PER_FRAME) {
+    this->_timeAccumulator -= this->timestep;
+    ++stepCount;
+  }
+  this->_timeAccumulator =
+      std::min(this->_timeAccumulator, static_cast<double>(this->timestep));
+  // The fields hold nothing until they were stepped once
+  if (this->_stepNumber == 0)
+    stepCount = std::max(stepCount, 1u);
+  this->_lastStepCount = stepCount;
+
+  const VkExtent2D& extent = this->_extent;
+  KernelPermutation permutation = this->_getPermutation(extent, this->_preset);
+  // Keep stepping with the active kernels while the ones for new settings are
+  // being created, only the first update has none to fall back on
+  const SimulationKernels* pKernels =
+      this->_getKernels(app, permutation, this->_stepNumber == 0);
+  if (!pKernels) {
+    permutation = this->_activePermutation;
+    pKernels = this->_getKernels(app, permutation, true);
+  }
+  const SimulationKernels& kernels = *pKernels;
+
+  // The dye only changes when stepping. The canvas view has to be current
+  // before the uniforms are.
+  bool bDepositCanvas = this->_pCanvas && stepCount > 0;
+  if (bDepositCanvas)
+    this->_pCanvas->update(commandBuffer, frame, this->zoom, this->offset);
+
+  // Only the last step of a frame gets displayed, the others are folded in
+  for (uint32_t i = 0; i < stepCount; ++i) {
+    this->_step(
+        commandBuffer,
+        heapSet,
+        frame,
+        permutation,
+        kernels,
+        i,
+        i + 1 == stepCount);
+  }
+
+  if (stepCount == 0) {
+    // The display pass and the draw still need uniforms for this frame slot.
+    // Their reprojection maps the current camera onto the last step's.
+    this->_simulationUniforms[0].updateUniforms(
+        this->_makeUniforms(extent, frame),
+        frame);
+    this->_displayUniforms = 0;
+  }
+
+  // Without a step the fields are still under the last step's camera, so
+  // the display follows the camera by reprojecting them
+  this->_composeDisplay(
+      commandBuffer,
+      heapSet,
+      frame,
+      permutation,
+      kernels,
+      stepCount == 0);
+
+  if (bDepositCanvas)
+    this->_depositCanvas(commandBuffer, heapSet, frame, permutation, kernels);
+}
+
+void Simulation::enablePagedCanvas(
+    const Application& app,
+    GlobalHeap& heap,
+    uint32_t width,
+    uint32_t height,
+    const std::string& backingPath) {
+  // Texel p of the simulation samples (2 * p * h - 1) / zoom + offset
+  double h = glm::max(1.0 / this->_extent.width, 1.0 / this->_extent.height);
+  double texelSpacing = 2.0 * h / this->zoom;
+  glm::dvec2 center =
+      (h * glm::dvec2(this->_extent.width, this->_extent.height) -
+       glm::dvec2(1.0)) /
+          this->zoom +
+      this->offset;
+
+  this->_pCanvas = std::make_unique<PagedCanvas>(
+      app,
+      heap,
+      this->_extent,
+      width,
+      height,
+      center - 0.5 * glm::dvec2(width, height) * texelSpacing,
+      texelSpacing,
+      backingPath);
+}
 
+SimulationUniforms Simulation::_makeUniforms(
+    const VkExtent2D& extent,
+    const FrameContext& frame) const {
   SimulationUniforms uniforms{};
   uniforms.width = static_cast<int>(extent.width);
   uniforms.height = static_cast<int>(extent.height);
-  uniforms.time = static_cast<float>(frame.currentTime);
-  uniforms.dt = 1.0f / 30.0f;
+  uniforms.time = static_cast<float>(this->_time);
+  uniforms.dt = this->timestep;
   uniforms.sorOmega = 1.f;
   uniforms.density = 0.5f;
-  uniforms.vorticity = 0.5f;
-  uniforms.flags = this->clear ? 1 : 0;
+  uniforms.vorticity = this->vorticity;
+  uniforms.velocityDetail = this->velocityDetail;
+  uniforms.flags =
+      (this->clear ? 1 : 0) |
+      (this->_advectionScheme == AdvectionScheme::MacCormack ? 2 : 0) |
+      (this->_pressureSolver == PressureSolver::Spectral ? 4 : 0);
   uniforms.zoom = this->zoom;
-  uniforms.lastZoom = this->_lastZoom;
   uniforms.offsetX = this->offset.x;
   uniforms.offsetY = this->offset.y;
-  uniforms.lastOffsetX = this->_lastOffset.x;
-  uniforms.lastOffsetY = this->_lastOffset.y;
-  uniforms.inputMask = inputMask;
 
-  uniforms.fractalTexture = _fractalTexture.textureHandle.index;
-  uniforms.velocityFieldTexture = _velocityField.textureHandle.index;
-  uniforms.colorFieldTexture = _colorFieldA.textureHandle.index;
-  uniforms.divergenceFieldTexture = _divergenceField.textureHandle.index;
+  // The advection passes sample the previous fields where each texel was
+  // under last frame's camera. The mapping is the same affine transform for
+  // every texel, so compose it here in double precision and hand the shaders
+  // a float scale and a translation in texels.
+  {
+    double h = glm::max(1.0 / extent.width, 1.0 / extent.height);
+    double scale = this->_lastZoom / this->zoom;
+    glm::dvec2 pan = this->_lastZoom * (this->offset - this->_lastOffset);
+    glm::dvec2 translation = (pan + glm::dvec2(1.0 - scale)) / (2.0 * h);
+
+    uniforms.reprojectScale = static_cast<float>(scale);
+    uniforms.reprojectOffset = glm::vec2(translation);
+  }
+  uniforms.inputMask = this->_inputMask;
+  uniforms.spectralBuffer = _spectralBuffer.getHandle().index;
+
+  uniforms.fractalTexture = _fields[FIELD_FRACTAL].textureHandle.index;
+  uniforms.velocityFieldTexture = _fields[FIELD_VELOCITY].textureHandle.index;
+  uniforms.colorFieldTexture = _fields[FIELD_COLOR_A].textureHandle.index;
+  uniforms.divergenceFieldTexture =
+      _fields[FIELD_DIVERGENCE].textureHandle.index;
 
-  uniforms.pressureFieldTexture = _pressureFieldA.textureHandle.index;
-  uniforms.advectedColorFieldImage = _colorFieldB.imageHandle.index;
+  uniforms.pressureFieldTexture = _fields[FIELD_PRESSURE].textureHandle.index;
+  uniforms.advectedColorFieldImage = _fields[FIELD_COLOR_B].imageHandle.index;
   uniforms.advectedVelocityFieldImage =
-      _advectedVelocityField.imageHandle.index;
-  uniforms.divergenceFieldImage = _divergenceField.imageHandle.index;
+      _fields[FIELD_ADVECTED_VELOCITY].imageHandle.index;
+  uniforms.divergenceFieldImage = _fields[FIELD_DIVERGENCE].imageHandle.index;
 
-  uniforms.pressureFieldImage = _pressureFieldA.imageHandle.index;
-  uniforms.fractalImage = _fractalTexture.imageHandle.index;
-  uniforms.velocityFieldImage = _velocityField.imageHandle.index;
-  uniforms.iterationCountsImage = _iterationCounts.imageHandle.index;
+  uniforms.pressureFieldImage = _fields[FIELD_PRESSURE].imageHandle.index;
+  uniforms.fractalImage = _fields[FIELD_FRACTAL].imageHandle.index;
+  uniforms.velocityFieldImage = _fields[FIELD_VELOCITY].imageHandle.index;
+  uniforms.fractalAtlasImage =
+      this->_fractalTiles.getAtlas().imageHandle.index;
 
-  uniforms.colorFieldImage = _colorFieldA.imageHandle.index;
+  uniforms.colorFieldImage = _fields[FIELD_COLOR_A].imageHandle.index;
   uniforms.autoExposureBuffer = _autoExposureBuffer.getHandle().index;
+  uniforms.statsBuffer = _statsBuffer.getHandle().index;
+  uniforms.curlFieldImage = _fields[FIELD_CURL].imageHandle.index;
+
+  uniforms.pressureResidualImage =
+      _fields[FIELD_PRESSURE_RESIDUAL].imageHandle.index;
+  uniforms.pressureCorrectionImage =
+      _fields[FIELD_PRESSURE_CORRECTION_A].imageHandle.index;
+  uniforms.displayImage =
+      _fields[FIELD_DISPLAY + frame.frameRingBufferIndex].imageHandle.index;
+  uniforms.displayTexture =
+      _fields[FIELD_DISPLAY + frame.frameRingBufferIndex].textureHandle.index;
+
+  uniforms.departureMapImage = _fields[FIELD_DEPARTURE].imageHandle.index;
+  uniforms.departureMapTexture = _fields[FIELD_DEPARTURE].textureHandle.index;
+
+  uniforms.displayExposureEntry =
+      getSmoothedExposureEntry(extent) + 1 + frame.frameRingBufferIndex;
+
+  const FractalTileView& fractalView = this->_fractalTiles.getView();
+  uniforms.fractalGridOriginX = fractalView.gridOrigin.x;
+  uniforms.fractalGridOriginY = fractalView.gridOrigin.y;
+  uniforms.fractalTexelSpacing = fractalView.texelSpacing;
+  uniforms.fractalTilePageTable =
+      this->_fractalTiles.getPageTableHandle().index;
+  uniforms.fractalTileRequests = this->_fractalTiles.getRequestsHandle().index;
+  uniforms.fractalGridWidth = fractalView.gridWidth;
+  uniforms.fractalGridHeight = fractalView.gridHeight;
+  uniforms.fractalAtlasTilesX = this->_fractalTiles.getAtlasTilesX();
+
+  if (this->_pCanvas) {
+    const CanvasView& canvasView = this->_pCanvas->getView();
+    uniforms.canvasGridOriginX = canvasView.gridOrigin.x;
+    uniforms.canvasGridOriginY = canvasView.gridOrigin.y;
+    uniforms.canvasTexelSpacing = this->_pCanvas->getTexelSpacing();
+    uniforms.canvasPageTable = this->_pCanvas->getPageTableHandle().index;
+    uniforms.canvasAtlasImage = this->_pCanvas->getAtlas().imageHandle.index;
+    uniforms.canvasGridWidth = canvasView.gridWidth;
+    uniforms.canvasGridHeight = canvasView.gridHeight;
+    uniforms.canvasAtlasTilesX = this->_pCanvas->getAtlasTilesX();
+  }
+
+  return uniforms;
+}
 
-  this->_simulationUniforms.updateUniforms(uniforms, frame);
+void Simulation::_step(
+    VkCommandBuffer commandBuffer,
+    VkDescriptorSet heapSet,
+    const FrameContext& frame,
+    const KernelPermutation& permutation,
+    const SimulationKernels& kernels,
+    uint32_t stepIndex,
+    bool bLastStep) {
+  const VkExtent2D extent{permutation.width, permutation.height};
+
+  this->_time += this->timestep;
+
+  // The fractal depends on the iteration count, so it needs to be refreshed
+  // when switching presets even if the camera did not move. Cached tiles
+  // only go stale if the iteration count itself changed.
+  bool bPermutationChanged = !(permutation == this->_activePermutation);
+  if (permutation.fractalIterations !=
+      this->_activePermutation.fractalIterations) {
+    this->_fractalTiles.clear();
+  }
+  this->_activePermutation = permutation;
+
+  // The camera only moves between updates, so this is at most the first step
+  // of an update. The tile view has to be current before the uniforms are.
+  bool bUpdateFractal = this->zoom != this->_lastZoom ||
+                        this->offset != this->_lastOffset ||
+                        bPermutationChanged;
+  uint32_t fractalTilesComputed = 0;
+  if (bUpdateFractal) {
+    fractalTilesComputed =
+        this->_fractalTiles
+            .update(commandBuffer, frame, this->zoom, this->offset)
+            .requestCount;
+  }
+
+  // After the first step the camera has caught up, so the reprojection of
+  // later steps is the identity
+  this->_simulationUniforms[stepIndex].updateUniforms(
+      this->_makeUniforms(extent, frame),
+      frame);
+  this->_displayUniforms = stepIndex;
 
   this->clear = false;
 
-  uint32_t groupCountX = (extent.width - 1) / 16 + 1;
-  uint32_t groupCountY = (extent.height - 1) / 16 + 1;
+  uint32_t groupCountX = (extent.width - 1) / permutation.localSizeX + 1;
+  uint32_t groupCountY = (extent.height - 1) / permutation.localSizeY + 1;
+
+  // The velocity passes run on the (possibly coarser) velocity grid
+  uint32_t velocityWidth = permutation.getVelocityWidth();
+  uint32_t velocityHeight = permutation.getVelocityHeight();
+  uint32_t velocityGroupCountX =
+      (velocityWidth - 1) / permutation.localSizeX + 1;
+  uint32_t velocityGroupCountY =
+      (velocityHeight - 1) / permutation.localSizeY + 1;
 
   SimulationPushConstants push{};
-  push.simUniforms = _simulationUniforms.getCurrentHandle(frame).index;
+  push.simUniforms =
+      _simulationUniforms[stepIndex].getCurrentHandle(frame).index;
 
-  auto bindCompute = [&](const ComputePipeline& c) {
-    c.bindPipeline(commandBuffer);
-    vkCmdPushConstants(
-        commandBuffer,
-        c.getLayout(),
-        VK_SHADER_STAGE_COMPUTE_BIT,
-        0,
-        sizeof(SimulationPushConstants),
-        &push);
-    vkCmdBindDescriptorSets(
-        commandBuffer,
-        VK_PIPELINE_BIND_POINT_COMPUTE,
-        c.getLayout(),
-        0,
-        1,
-        &heapSet,
-        0,
-        nullptr);
+  auto bindCompute = [&](const ComputeKernel& c) {
+    bindKernel(commandBuffer, heapSet, c, push);
   };
 
   // Auto-exposure
   {
-    this->_colorFieldA.image.transitionLayout(
+    this->_fields[FIELD_COLOR_A].transitionLayout(
         commandBuffer,
         VK_IMAGE_LAYOUT_GENERAL,
         VK_ACCESS_SHADER_READ_BIT,
@@ -371,9 +780,12 @@ void Simulation::update(
     uint32_t exposureGroupCount = (extent.width * extent.height - 1) / 32 + 1;
 
     while (true) {
-      bindCompute(_autoExposurePass);
+      bindCompute(kernels.autoExposurePass);
       vkCmdDispatch(commandBuffer, exposureGroupCount, 1, 1);
-      _autoExposureBarrier(commandBuffer);
+      _autoExposureBarrier(
+          commandBuffer,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+          VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
 
       if (exposureGroupCount == 1)
         break;
@@ -390,192 +802,557 @@ void Simulation::update(
   push.params1 = 0;
   push.params2 = 0;
 
-  // Update fractal pass
-  if (this->zoom != this->_lastZoom || this->offset != this->_lastOffset) {
+  // Update fractal pass, computes the missing tiles and assembles the field
+  // out of the tile atlas
+  if (bUpdateFractal) {
     this->_lastZoom = this->zoom;
     this->_lastOffset = this->offset;
 
-    this->_iterationCounts.image.transitionLayout(
+    PooledField& atlas = this->_fractalTiles.getAtlas();
+    if (fractalTilesComputed > 0) {
+      bindCompute(kernels.fractalTilesPass);
+      vkCmdDispatch(
+          commandBuffer,
+          (FRACTAL_TILE_SIZE - 1) / permutation.localSizeX + 1,
+          (FRACTAL_TILE_SIZE - 1) / permutation.localSizeY + 1,
+          fractalTilesComputed);
+    }
+
+    atlas.transitionLayout(
         commandBuffer,
         VK_IMAGE_LAYOUT_GENERAL,
-        VK_ACCESS_SHADER_WRITE_BIT,
+        VK_ACCESS_SHADER_READ_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-    this->_fractalTexture.image.transitionLayout(
+    this->_fields[FIELD_FRACTAL].transitionLayout(
         commandBuffer,
         VK_IMAGE_LAYOUT_GENERAL,
         VK_ACCESS_SHADER_WRITE_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 
-    bindCompute(_fractalPass);
+    bindCompute(kernels.fractalPass);
     vkCmdDispatch(commandBuffer, groupCountX, groupCountY, 1);
   }
 
-  // Advect velocity pass
+  // Departure map pass, the backtrace shared by both advection passes
   {
-    this->_velocityField.image.transitionLayout(
+    this->_fields[FIELD_VELOCITY].transitionLayout(
         commandBuffer,
         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
         VK_ACCESS_SHADER_READ_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-    this->_advectedVelocityField.image.transitionLayout(
+    this->_fields[FIELD_DEPARTURE].discard(
         commandBuffer,
         VK_IMAGE_LAYOUT_GENERAL,
         VK_ACCESS_SHADER_WRITE_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 
-    bindCompute(_advectPass);
-    vkCmdDispatch(commandBuffer, groupCountX, groupCountY, 1);
+    bindCompute(kernels.departurePass);
+    vkCmdDispatch(commandBuffer, velocityGroupCountX, velocityGroupCountY, 1);
   }
 
-  // Calculate divergence pass
+  // Advect velocity pass
   {
-    this->_advectedVelocityField.image.transitionLayout(
+    this->_fields[FIELD_DEPARTURE].transitionLayout(
         commandBuffer,
-        VK_IMAGE_LAYOUT_GENERAL,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
         VK_ACCESS_SHADER_READ_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-    this->_divergenceField.image.transitionLayout(
+    this->_fields[FIELD_ADVECTED_VELOCITY].discard(
         commandBuffer,
         VK_IMAGE_LAYOUT_GENERAL,
         VK_ACCESS_SHADER_WRITE_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 
-    bindCompute(_divergencePass);
-    vkCmdDispatch(commandBuffer, groupCountX, groupCountY, 1);
+    bindCompute(kernels.advectPass);
+    vkCmdDispatch(commandBuffer, velocityGroupCountX, velocityGroupCountY, 1);
   }
 
-  // Calculate pressure passes
-  {
-    this->_divergenceField.image.transitionLayout(
+  // Vorticity confinement passes, the curl is computed once per step on its
+  // own grid and the confinement force is added to the advected velocity
+  if (this->vorticity != 0.0f) {
+    this->_fields[FIELD_ADVECTED_VELOCITY].transitionLayout(
         commandBuffer,
         VK_IMAGE_LAYOUT_GENERAL,
         VK_ACCESS_SHADER_READ_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    this->_fields[FIELD_CURL].discard(
+        commandBuffer,
+        VK_IMAGE_LAYOUT_GENERAL,
+        VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 
-    const uint32_t CALC_PRESSURE_ITERS = 40;
-    // Must be an even number of iterations so the ping-pong buffer results end
-    // up up in a consistent place (pressureFieldA)
-    assert(CALC_PRESSURE_ITERS % 2 == 0);
-    for (uint32_t pressureIter = 0; pressureIter < CALC_PRESSURE_ITERS;
-         ++pressureIter) {
-      uint32_t phase = pressureIter % 2;
+    uint32_t curlWidth = (velocityWidth - 1) / permutation.curlDownsample + 1;
+    uint32_t curlHeight =
+        (velocityHeight - 1) / permutation.curlDownsample + 1;
 
-      this->_pressureFieldA.image.transitionLayout(
-          commandBuffer,
-          VK_IMAGE_LAYOUT_GENERAL,
-          phase ? VK_ACCESS_SHADER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT,
-          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-      this->_pressureFieldB.image.transitionLayout(
-          commandBuffer,
-          VK_IMAGE_LAYOUT_GENERAL,
-          phase ? VK_ACCESS_SHADER_READ_BIT : VK_ACCESS_SHADER_WRITE_BIT,
-          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    bindCompute(kernels.curlPass);
+    vkCmdDispatch(
+        commandBuffer,
+        (curlWidth - 1) / permutation.localSizeX + 1,
+        (curlHeight - 1) / permutation.localSizeY + 1,
+        1);
 
-      push.params0 = phase;
-      bindCompute(_pressurePass);
-      vkCmdDispatch(commandBuffer, groupCountX, groupCountY, 1);
-    }
+    this->_fields[FIELD_CURL].transitionLayout(
+        commandBuffer,
+        VK_IMAGE_LAYOUT_GENERAL,
+        VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    // The confinement force is applied in-place, each thread only touches
+    // its own texel
+    this->_fields[FIELD_ADVECTED_VELOCITY].transitionLayout(
+        commandBuffer,
+        VK_IMAGE_LAYOUT_GENERAL,
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+    bindCompute(kernels.vorticityPass);
+    vkCmdDispatch(commandBuffer, velocityGroupCountX, velocityGroupCountY, 1);
   }
 
-  // Update velocity pass
-  {
-    this->_pressureFieldA.image.transitionLayout(
+  // Times the projection of whichever solver is active
+  bool bTimeProjection = this->_bStatsEnabled && bLastStep;
+  if (bTimeProjection)
+    this->_projectionTimer.begin(commandBuffer, frame);
+
+  if (this->_pressureSolver == PressureSolver::Spectral) {
+    // Spectral projection: forward FFT, projection in frequency space,
+    // inverse FFT. Each FFT stage ping-pongs between the buffer halves.
+    this->_fields[FIELD_ADVECTED_VELOCITY].transitionLayout(
         commandBuffer,
         VK_IMAGE_LAYOUT_GENERAL,
         VK_ACCESS_SHADER_READ_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-    this->_velocityField.image.transitionLayout(
+
+    // The solve itself has no use for the divergence, but the debug view and
+    // the stats show it the same as with the iterative solver
+    this->_fields[FIELD_DIVERGENCE].discard(
+        commandBuffer,
+        VK_IMAGE_LAYOUT_GENERAL,
+        VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    bindCompute(kernels.divergencePass);
+    vkCmdDispatch(commandBuffer, velocityGroupCountX, velocityGroupCountY, 1);
+
+    uint32_t spectralWidth = spectralSize(velocityWidth);
+    uint32_t spectralHeight = spectralSize(velocityHeight);
+    uint32_t spectralGroupCountX =
+        (spectralWidth - 1) / permutation.localSizeX + 1;
+    uint32_t spectralGroupCountY =
+        (spectralHeight - 1) / permutation.localSizeY + 1;
+
+    bindCompute(kernels.spectralLoadPass);
+    vkCmdDispatch(commandBuffer, spectralGroupCountX, spectralGroupCountY, 1);
+    _spectralBarrier(commandBuffer);
+
+    uint32_t half = 0;
+    auto fft = [&](bool bColumns, bool bInverse) {
+      uint32_t n = bColumns ? spectralHeight : spectralWidth;
+      uint32_t lineCount = bColumns ? spectralWidth : spectralHeight;
+
+      push.params1 = (bColumns ? 1 : 0) | (bInverse ? 2 : 0);
+      for (uint32_t stageSpan = 1; stageSpan < n; stageSpan <<= 1) {
+        push.params0 = stageSpan;
+        push.params2 = half;
+        bindCompute(kernels.fftPass);
+        vkCmdDispatch(
+            commandBuffer,
+            (n / 2 - 1) / permutation.localSizeX + 1,
+            (lineCount - 1) / permutation.localSizeY + 1,
+            1);
+        _spectralBarrier(commandBuffer);
+        half = 1 - half;
+      }
+    };
+
+    fft(false, false);
+    fft(true, false);
+
+    push.params2 = half;
+    bindCompute(kernels.spectralProjectPass);
+    vkCmdDispatch(commandBuffer, spectralGroupCountX, spectralGroupCountY, 1);
+    _spectralBarrier(commandBuffer);
+
+    fft(true, true);
+    fft(false, true);
+
+    this->_fields[FIELD_VELOCITY].transitionLayout(
         commandBuffer,
         VK_IMAGE_LAYOUT_GENERAL,
         VK_ACCESS_SHADER_WRITE_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-    // Note: The advected velocity field texture has already been transitioned
-    // for reading by this point.
 
-    bindCompute(_updateVelocityPass);
-    vkCmdDispatch(commandBuffer, groupCountX, groupCountY, 1);
+    push.params0 = 0;
+    push.params1 = 0;
+    push.params2 = half;
+    bindCompute(kernels.spectralStorePass);
+    vkCmdDispatch(commandBuffer, velocityGroupCountX, velocityGroupCountY, 1);
+    push.params2 = 0;
+  } else {
+    // Calculate divergence pass
+    {
+      this->_fields[FIELD_ADVECTED_VELOCITY].transitionLayout(
+          commandBuffer,
+          VK_IMAGE_LAYOUT_GENERAL,
+          VK_ACCESS_SHADER_READ_BIT,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+      this->_fields[FIELD_DIVERGENCE].discard(
+          commandBuffer,
+          VK_IMAGE_LAYOUT_GENERAL,
+          VK_ACCESS_SHADER_WRITE_BIT,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+      bindCompute(kernels.divergencePass);
+      vkCmdDispatch(commandBuffer, velocityGroupCountX, velocityGroupCountY, 1);
+    }
+
+    // Calculate pressure passes. Each refinement step computes the residual
+    // of the fp32 pressure, runs the Jacobi sweeps on an fp16 correction and
+    // adds the correction back onto the pressure.
+    {
+      this->_fields[FIELD_DIVERGENCE].transitionLayout(
+          commandBuffer,
+          VK_IMAGE_LAYOUT_GENERAL,
+          VK_ACCESS_SHADER_READ_BIT,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+      for (uint32_t refinement = 0; refinement < PRESSURE_REFINEMENT_STEPS;
+           ++refinement) {
+        this->_fields[FIELD_PRESSURE].transitionLayout(
+            commandBuffer,
+            VK_IMAGE_LAYOUT_GENERAL,
+            VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        if (refinement == 0) {
+          this->_fields[FIELD_PRESSURE_RESIDUAL].discard(
+              commandBuffer,
+              VK_IMAGE_LAYOUT_GENERAL,
+              VK_ACCESS_SHADER_WRITE_BIT,
+              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+          this->_fields[FIELD_PRESSURE_CORRECTION_A].discard(
+              commandBuffer,
+              VK_IMAGE_LAYOUT_GENERAL,
+              VK_ACCESS_SHADER_WRITE_BIT,
+              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+          this->_fields[FIELD_PRESSURE_CORRECTION_B].discard(
+              commandBuffer,
+              VK_IMAGE_LAYOUT_GENERAL,
+              VK_ACCESS_SHADER_WRITE_BIT,
+              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        } else {
+          this->_fields[FIELD_PRESSURE_RESIDUAL].transitionLayout(
+              commandBuffer,
+              VK_IMAGE_LAYOUT_GENERAL,
+              VK_ACCESS_SHADER_WRITE_BIT,
+              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+          this->_fields[FIELD_PRESSURE_CORRECTION_A].transitionLayout(
+              commandBuffer,
+              VK_IMAGE_LAYOUT_GENERAL,
+              VK_ACCESS_SHADER_WRITE_BIT,
+              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        }
+
+        // Also resets the correction to zero
+        bindCompute(kernels.pressureResidualPass);
+        vkCmdDispatch(
+            commandBuffer,
+            velocityGroupCountX,
+            velocityGroupCountY,
+            1);
+
+        this->_fields[FIELD_PRESSURE_RESIDUAL].transitionLayout(
+            commandBuffer,
+            VK_IMAGE_LAYOUT_GENERAL,
+            VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+        for (uint32_t sweep = 0; sweep < PRESSURE_SWEEPS_PER_REFINEMENT;
+             ++sweep) {
+          uint32_t phase = sweep % 2;
+
+          this->_fields[FIELD_PRESSURE_CORRECTION_A].transitionLayout(
+              commandBuffer,
+              VK_IMAGE_LAYOUT_GENERAL,
+              phase ? VK_ACCESS_SHADER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT,
+              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+          this->_fields[FIELD_PRESSURE_CORRECTION_B].transitionLayout(
+              commandBuffer,
+              VK_IMAGE_LAYOUT_GENERAL,
+              phase ? VK_ACCESS_SHADER_READ_BIT : VK_ACCESS_SHADER_WRITE_BIT,
+              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+          push.params0 = phase;
+          bindCompute(kernels.pressurePass);
+          vkCmdDispatch(
+              commandBuffer,
+              velocityGroupCountX,
+              velocityGroupCountY,
+              1);
+        }
+        push.params0 = 0;
+
+        this->_fields[FIELD_PRESSURE_CORRECTION_A].transitionLayout(
+            commandBuffer,
+            VK_IMAGE_LAYOUT_GENERAL,
+            VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        // Updated in-place, each thread only touches its own texel
+        this->_fields[FIELD_PRESSURE].transitionLayout(
+            commandBuffer,
+            VK_IMAGE_LAYOUT_GENERAL,
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+        bindCompute(kernels.pressureCorrectionPass);
+        vkCmdDispatch(
+            commandBuffer,
+            velocityGroupCountX,
+            velocityGroupCountY,
+            1);
+      }
+    }
+
+    // Update velocity pass
+    {
+      this->_fields[FIELD_PRESSURE].transitionLayout(
+          commandBuffer,
+          VK_IMAGE_LAYOUT_GENERAL,
+          VK_ACCESS_SHADER_READ_BIT,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+      this->_fields[FIELD_VELOCITY].transitionLayout(
+          commandBuffer,
+          VK_IMAGE_LAYOUT_GENERAL,
+          VK_ACCESS_SHADER_WRITE_BIT,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+      // Note: The advected velocity field texture has already been
+      // transitioned for reading by this point.
+
+      bindCompute(kernels.updateVelocityPass);
+      vkCmdDispatch(commandBuffer, velocityGroupCountX, velocityGroupCountY, 1);
+    }
   }
 
+  if (bTimeProjection)
+    this->_projectionTimer.end(commandBuffer, frame);
+
   // Advect color field
   {
-    this->_fractalTexture.image.transitionLayout(
+    this->_fields[FIELD_FRACTAL].transitionLayout(
         commandBuffer,
         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
         VK_ACCESS_SHADER_READ_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-    this->_velocityField.image.transitionLayout(
+    this->_fields[FIELD_VELOCITY].transitionLayout(
         commandBuffer,
         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
         VK_ACCESS_SHADER_READ_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-    this->_colorFieldA.image.transitionLayout(
+    this->_fields[FIELD_COLOR_A].transitionLayout(
         commandBuffer,
         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
         VK_ACCESS_SHADER_READ_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-    this->_colorFieldB.image.transitionLayout(
+    this->_fields[FIELD_COLOR_B].discard(
         commandBuffer,
         VK_IMAGE_LAYOUT_GENERAL,
         VK_ACCESS_SHADER_WRITE_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    // Note: The departure map is still in the read layout from the velocity
+    // advection. The projected velocity is only read for the detail.
 
-    bindCompute(_advectColorPass);
+    bindCompute(kernels.advectColorPass);
     vkCmdDispatch(commandBuffer, groupCountX, groupCountY, 1);
   }
 
   // Copy color texture
   {
-    this->_colorFieldA.image.transitionLayout(
+    this->_fields[FIELD_COLOR_A].transitionLayout(
         commandBuffer,
         VK_IMAGE_LAYOUT_GENERAL,
         VK_ACCESS_SHADER_WRITE_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-    this->_colorFieldB.image.transitionLayout(
+    this->_fields[FIELD_COLOR_B].transitionLayout(
         commandBuffer,
         VK_IMAGE_LAYOUT_GENERAL,
         VK_ACCESS_SHADER_READ_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 
-    bindCompute(_updateColorPass);
+    bindCompute(kernels.updateColorPass);
+    vkCmdDispatch(commandBuffer, groupCountX, groupCountY, 1);
+  }
+
+  // Simulation statistics, only the displayed step is read back
+  if (this->_bStatsEnabled && bLastStep) {
+    this->_fields[FIELD_PRESSURE].transitionLayout(
+        commandBuffer,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    this->_fields[FIELD_DIVERGENCE].transitionLayout(
+        commandBuffer,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    this->_fields[FIELD_COLOR_A].transitionLayout(
+        commandBuffer,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    // Note: The velocity field has already been transitioned for reading by
+    // the color advection pass.
+
+    bindCompute(kernels.statsPass);
     vkCmdDispatch(commandBuffer, groupCountX, groupCountY, 1);
+    _statsBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    push.params0 = groupCountX * groupCountY;
+    bindCompute(kernels.reduceStatsPass);
+    vkCmdDispatch(commandBuffer, 1, 1, 1);
+    push.params0 = 0;
+    _statsBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_ACCESS_TRANSFER_READ_BIT);
+
+    StatsReadback& readback = this->_statsReadbacks[frame.frameRingBufferIndex];
+
+    VkBufferCopy region{};
+    region.srcOffset = 0;
+    region.dstOffset = 0;
+    region.size = sizeof(SimulationStatsEntry);
+    vkCmdCopyBuffer(
+        commandBuffer,
+        _statsBuffer.getAllocation().getBuffer(),
+        readback.buffer.getBuffer(),
+        1,
+        &region);
+
+    // Make the copy visible to the host once the frame fence is signaled
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.buffer = readback.buffer.getBuffer();
+    barrier.offset = 0;
+    barrier.size = sizeof(SimulationStatsEntry);
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT,
+        0,
+        0,
+        nullptr,
+        1,
+        &barrier,
+        0,
+        nullptr);
+
+    readback.bPending = true;
+    readback.stepNumber = this->_stepNumber;
+    readback.dt = this->timestep;
+    // The velocity statistics are over the velocity grid
+    readback.h = glm::max(1.0f / velocityWidth, 1.0f / velocityHeight);
+    readback.cellCount = velocityWidth * velocityHeight;
+    readback.fractalTilesComputed = fractalTilesComputed;
+    readback.fractalTileHitRate =
+        this->_fractalTiles.getStats().getHitRate();
+    if (this->_pCanvas) {
+      const CanvasStats& canvasStats = this->_pCanvas->getStats();
+      readback.canvasResidentTiles = canvasStats.residentTiles;
+      readback.canvasPagedBytes =
+          (canvasStats.pagedInTiles + canvasStats.pagedOutTiles) *
+          CANVAS_TILE_BYTES;
+    }
+  }
+
+  this->_stepNumber++;
+}
+
+void Simulation::_composeDisplay(
+    VkCommandBuffer commandBuffer,
+    VkDescriptorSet heapSet,
+    const FrameContext& frame,
+    const KernelPermutation& permutation,
+    const SimulationKernels& kernels,
+    bool bReproject) {
+  const SimulationField displayFields[] = {
+      FIELD_FRACTAL,
+      FIELD_PRESSURE,
+      FIELD_DIVERGENCE,
+      FIELD_VELOCITY,
+      FIELD_COLOR_A};
+  for (SimulationField field : displayFields) {
+    this->_fields[field].transitionLayout(
+        commandBuffer,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
   }
 
-  // Transition resources for visualizing in fragment shader
-  this->_iterationCounts.image.transitionLayout(
+  // The last frame that drew from this slot's display field has been fenced
+  PooledField& display =
+      this->_fields[FIELD_DISPLAY + frame.frameRingBufferIndex];
+  display.discard(
       commandBuffer,
       VK_IMAGE_LAYOUT_GENERAL,
-      VK_ACCESS_SHADER_READ_BIT,
-      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
-  this->_fractalTexture.image.transitionLayout(
-      commandBuffer,
-      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-      VK_ACCESS_SHADER_READ_BIT,
-      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
-  this->_pressureFieldA.image.transitionLayout(
-      commandBuffer,
-      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-      VK_ACCESS_SHADER_READ_BIT,
-      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
-  this->_divergenceField.image.transitionLayout(
+      VK_ACCESS_SHADER_WRITE_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+  SimulationPushConstants push{};
+  push.simUniforms = this->getSimUniforms(frame).index;
+  push.params0 = bReproject ? 1 : 0;
+  bindKernel(commandBuffer, heapSet, kernels.composeDisplayPass, push);
+  vkCmdDispatch(
       commandBuffer,
-      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-      VK_ACCESS_SHADER_READ_BIT,
-      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
-  this->_velocityField.image.transitionLayout(
+      (permutation.width - 1) / permutation.localSizeX + 1,
+      (permutation.height - 1) / permutation.localSizeY + 1,
+      1);
+
+  // Rendering only reads the display field and the exposure snapshot, the
+  // simulation fields are free for the next step as soon as this is done
+  display.transitionLayout(
       commandBuffer,
       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
       VK_ACCESS_SHADER_READ_BIT,
       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
-  this->_colorFieldA.image.transitionLayout(
+  _autoExposureBarrier(
       commandBuffer,
-      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-      VK_ACCESS_SHADER_READ_BIT,
-      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+          VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+}
 
-  _autoExposureBarrier(commandBuffer);
+void Simulation::_depositCanvas(
+    VkCommandBuffer commandBuffer,
+    VkDescriptorSet heapSet,
+    const FrameContext& frame,
+    const KernelPermutation& permutation,
+    const SimulationKernels& kernels) {
+  const CanvasView& view = this->_pCanvas->getView();
+  if (view.gridWidth == 0 || view.gridHeight == 0)
+    return;
+
+  // The display composition left the dye readable, and update() left the
+  // tile pool writable
+  SimulationPushConstants push{};
+  push.simUniforms = this->getSimUniforms(frame).index;
+  bindKernel(commandBuffer, heapSet, kernels.depositCanvasPass, push);
+  vkCmdDispatch(
+      commandBuffer,
+      (view.gridWidth * CANVAS_TILE_SIZE - 1) / permutation.localSizeX + 1,
+      (view.gridHeight * CANVAS_TILE_SIZE - 1) / permutation.localSizeY + 1,
+      1);
 }
 
-void Simulation::_autoExposureBarrier(VkCommandBuffer commandBuffer) {
+void Simulation::_autoExposureBarrier(
+    VkCommandBuffer commandBuffer,
+    VkPipelineStageFlags dstStage,
+    VkAccessFlags dstAccess) {
   VkBufferMemoryBarrier barrier{};
   barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
   barrier.buffer = _autoExposureBuffer.getAllocation().getBuffer();
@@ -583,15 +1360,64 @@ void Simulation::_autoExposureBarrier(VkCommandBuffer commandBuffer) {
   barrier.size = _autoExposureBuffer.getSize();
   barrier.srcAccessMask =
       VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+  barrier.dstAccessMask = dstAccess;
+
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      dstStage,
+      0,
+      0,
+      nullptr,
+      1,
+      &barrier,
+      0,
+      nullptr);
+}
+
+void Simulation::_statsBarrier(
+    VkCommandBuffer commandBuffer,
+    VkPipelineStageFlags dstStage,
+    VkAccessFlags dstAccess) {
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.buffer = _statsBuffer.getAllocation().getBuffer();
+  barrier.offset = 0;
+  barrier.size = _statsBuffer.getSize();
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = dstAccess;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      dstStage,
+      0,
+      0,
+      nullptr,
+      1,
+      &barrier,
+      0,
+      nullptr);
+}
+
+void Simulation::_spectralBarrier(VkCommandBuffer commandBuffer) {
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.buffer = _spectralBuffer.getAllocation().getBuffer();
+  barrier.offset = 0;
+  barrier.size = _spectralBuffer.getSize();
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
   barrier.dstAccessMask =
-      VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 
   vkCmdPipelineBarrier(
       commandBuffer,
-      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
-          VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
-          VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
       0,
       0,
       nullptr,
@@ -601,15 +1427,338 @@ void Simulation::_autoExposureBarrier(VkCommandBuffer commandBuffer) {
       nullptr);
 }
 
-void Simulation::tryRecompileShaders(Application& app) {
-  this->_fractalPass.tryRecompile(app);
-  this->_advectPass.tryRecompile(app);
-  this->_fractalPass.tryRecompile(app);
-  this->_divergencePass.tryRecompile(app);
-  this->_pressurePass.tryRecompile(app);
-  this->_updateVelocityPass.tryRecompile(app);
-  this->_advectColorPass.tryRecompile(app);
-  this->_updateColorPass.tryRecompile(app);
-  this->_autoExposurePass.tryRecompile(app);
+void Simulation::_readBackStats(const FrameContext& frame) {
+  StatsReadback& readback = this->_statsReadbacks[frame.frameRingBufferIndex];
+  if (!readback.bPending)
+    return;
+
+  readback.bPending = false;
+
+  // Random access readbacks may land in non-coherent memory
+  vmaInvalidateAllocation(
+      this->_allocator,
+      readback.buffer.getAllocation(),
+      0,
+      VK_WHOLE_SIZE);
+
+  SimulationStatsEntry entry;
+  void* pData = readback.buffer.mapMemory();
+  memcpy(&entry, pData, sizeof(SimulationStatsEntry));
+  readback.buffer.unmapMemory();
+
+  SimulationStats& stats = this->_stats;
+  stats.stepNumber = readback.stepNumber;
+  stats.kineticEnergy = entry.kineticEnergy;
+  stats.maxDivergence = entry.divergenceMax;
+  stats.meanDivergence = entry.divergenceSum / readback.cellCount;
+  stats.maxPressureResidual = entry.residualMax;
+  stats.meanPressureResidual = entry.residualSum / readback.cellCount;
+  stats.maxVelocity = entry.velocityMax;
+  stats.cflNumber = entry.velocityMax * readback.dt / readback.h;
+  stats.dyeMass = entry.dyeMass;
+  stats.dyeDetail = entry.dyeDetail;
+  stats.fractalTilesComputed = readback.fractalTilesComputed;
+  stats.fractalTileHitRate = readback.fractalTileHitRate;
+  stats.canvasResidentTiles = readback.canvasResidentTiles;
+  stats.canvasPagedBytes = readback.canvasPagedBytes;
+  if (!this->_projectionTimer.read(frame, stats.projectionMs))
+    stats.projectionMs = 0.0f;
+
+  if (this->_pStatsLog) {
+    *this->_pStatsLog << stats.stepNumber << "," << stats.kineticEnergy << ","
+                      << stats.maxDivergence << "," << stats.meanDivergence
+                      << "," << stats.maxPressureResidual << ","
+                      << stats.meanPressureResidual << "," << stats.maxVelocity
+                      << "," << stats.cflNumber << "," << stats.dyeMass
+                      << "," << stats.dyeDetail
+                      << "," << stats.fractalTilesComputed << ","
+                      << stats.fractalTileHitRate << ","
+                      << stats.canvasResidentTiles << ","
+                      << stats.canvasPagedBytes << ","
+                      << stats.projectionMs << "\n";
+  }
+}
+
+void Simulation::setTuning(const SimulationTuning& tuning) {
+  // The stats buffer holds a partial per workgroup of the smallest shape
+  if (tuning.localSizeX < MIN_LOCAL_SIZE || tuning.localSizeY < MIN_LOCAL_SIZE)
+    throw std::runtime_error("Workgroup shape is below the minimum size!");
+
+  this->_tuning = tuning;
+}
+
+void Simulation::setStatsLog(std::ostream* pLog) {
+  this->_pStatsLog = pLog;
+
+  // Only write the header for a fresh log, the simulation gets recreated
+  // along with the swapchain
+  if (pLog && pLog->tellp() == 0) {
+    *pLog << "step,kineticEnergy,maxDivergence,meanDivergence,"
+             "maxPressureResidual,meanPressureResidual,maxVelocity,cfl,"
+             "dyeMass,dyeDetail,fractalTilesComputed,fractalTileHitRate,"
+             "canvasResidentTiles,canvasPagedBytes,projectionMs\n";
+  }
+}
+
+void Simulation::_compileShaders() {
+  auto start = std::chrono::steady_clock::now();
+
+  // GLSL compilation (or a cache lookup on warm starts) is independent per
+  // shader, so each one is built on its own thread.
+  std::vector<std::future<CompiledShader>> futures;
+  futures.reserve(KERNEL_SLOTS.size());
+  for (const KernelSlot& slot : KERNEL_SLOTS) {
+    futures.push_back(std::async(
+        std::launch::async,
+        [pShaderCache = this->_pShaderCache,
+         path = getSimulationDirectory() + slot.shaderPath]() {
+          return pShaderCache->compileComputeShader(path);
+        }));
+  }
+
+  this->_shaders.clear();
+  for (std::future<CompiledShader>& future : futures)
+    this->_shaders.push_back(future.get());
+
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+
+  uint32_t cacheHits = 0;
+  for (const CompiledShader& shader : this->_shaders)
+    if (shader.bCacheHit)
+      ++cacheHits;
+
+  std::cout << "Loaded " << this->_shaders.size() << " compute shaders in "
+            << ms << "ms (" << cacheHits << "/" << this->_shaders.size()
+            << " SPIR-V cache hits)" << std::endl;
+}
+
+Simulation::PendingKernels Simulation::_createKernelsAsync(
+    const Application& app,
+    const KernelPermutation& permutation) const {
+  // The worker only gets copies and pointers to state that stays put when
+  // the simulation is moved
+  PendingKernels pending{};
+  pending.shaderReloadCount = this->_shaderReloadCount;
+  pending.kernels = std::async(
+      std::launch::async,
+      [&app,
+       permutation,
+       shaders = this->_shaders,
+       pShaderCache = this->_pShaderCache,
+       heapSetLayout = this->_heapSetLayout]() {
+        return _createKernels(
+            app,
+            *pShaderCache,
+            heapSetLayout,
+            shaders,
+            permutation,
+            false);
+      });
+
+  return pending;
+}
+
+SimulationKernels Simulation::_createKernels(
+    const Application& app,
+    const ShaderCache& shaderCache,
+    VkDescriptorSetLayout heapSetLayout,
+    const std::vector<CompiledShader>& shaders,
+    const KernelPermutation& permutation,
+    bool bLogStartupTime) {
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<uint32_t> constants = permutation.getSpecializationConstants();
+
+  // Pipeline creation is also independent per kernel. The driver may reuse
+  // binaries from the pipeline cache here.
+  std::vector<std::future<ComputeKernel>> futures;
+  futures.reserve(KERNEL_SLOTS.size());
+  for (const CompiledShader& shader : shaders) {
+    futures.push_back(std::async(
+        std::launch::async,
+        [&app, &shader, &constants, &shaderCache, heapSetLayout]() {
+          return ComputeKernel(
+              app,
+              shader,
+              shaderCache.getPipelineCache(),
+              heapSetLayout,
+              sizeof(SimulationPushConstants),
+              constants);
+        }));
+  }
+
+  SimulationKernels kernels{};
+  for (size_t i = 0; i < KERNEL_SLOTS.size(); ++i)
+    kernels.*KERNEL_SLOTS[i].kernel = futures[i].get();
+
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+
+  uint32_t cacheHits = 0;
+  for (const CompiledShader& shader : shaders)
+    if (shader.bCacheHit)
+      ++cacheHits;
+
+  const char* startType =
+      (cacheHits == shaders.size() && shaderCache.isPipelineCacheWarm())
+          ? "warm"
+          : "cold";
+
+  std::cout << "Created " << KERNEL_SLOTS.size() << " compute pipelines in "
+            << ms << "ms (" << startType << " pipeline cache)" << std::endl;
+
+  // Keep a running log of pipeline creation times so regressions can be
+  // tracked
+  if (bLogStartupTime) {
+    std::ofstream log(
+        shaderCache.getCacheDirectory() + "/StartupTimes.csv",
+        std::ios::app);
+    log << startType << "," << KERNEL_SLOTS.size() << "," << cacheHits << ","
+        << ms << "\n";
+  }
+
+  return kernels;
+}
+
+KernelPermutation Simulation::_getPermutation(
+    const VkExtent2D& extent,
+    SimulationPreset preset) const {
+  KernelPermutation permutation{};
+  permutation.width = extent.width;
+  permutation.height = extent.height;
+  permutation.velocityDownsample = this->_velocityDownsample;
+  permutation.localSizeX = this->_tuning.localSizeX;
+  permutation.localSizeY = this->_tuning.localSizeY;
+
+  switch (preset) {
+  case SimulationPreset::Preview:
+    permutation.advectionSteps = 2;
+    permutation.fractalIterations = 250;
+    permutation.curlDownsample = 2;
+    break;
+  case SimulationPreset::Default:
+    break;
+  case SimulationPreset::HighQuality:
+    permutation.advectionSteps = 8;
+    permutation.fractalIterations = 4000;
+    break;
+  };
+
+  return permutation;
+}
+
+const SimulationKernels* Simulation::_getKernels(
+    const Application& app,
+    const KernelPermutation& permutation,
+    bool bWait) {
+  auto it = this->_kernelPermutations.find(permutation);
+  if (it != this->_kernelPermutations.end())
+    return &it->second;
+
+  auto pendingIt = this->_pendingKernels.find(permutation);
+  if (pendingIt == this->_pendingKernels.end()) {
+    pendingIt =
+        this->_pendingKernels
+            .emplace(permutation, this->_createKernelsAsync(app, permutation))
+            .first;
+  }
+
+  PendingKernels& pending = pendingIt->second;
+  if (!bWait && pending.kernels.wait_for(std::chrono::seconds(0)) !=
+                    std::future_status::ready) {
+    return nullptr;
+  }
+
+  SimulationKernels kernels = pending.kernels.get();
+  if (pending.shaderReloadCount != this->_shaderReloadCount) {
+    // Shaders were reloaded while these were being created
+    pending = this->_createKernelsAsync(app, permutation);
+    if (!bWait)
+      return nullptr;
+    kernels = pending.kernels.get();
+  }
+  this->_pendingKernels.erase(pendingIt);
+
+  it = this->_kernelPermutations.emplace(permutation, std::move(kernels)).first;
+
+  // Future hot-reloads need to build this permutation as well
+  if (this->_reloadState) {
+    std::lock_guard<std::mutex> lock(this->_reloadState->mutex);
+    this->_reloadState->permutations.push_back(permutation);
+  }
+
+  return &it->second;
+}
+
+void Simulation::tryRecompileShaders() {
+  if (this->_shaderWatcher)
+    this->_shaderWatcher->requestRecompileAll();
+}
+
+void Simulation::_applyShaderReloads(
+    Application& app,
+    const FrameContext& frame) {
+  if (!this->_reloadState)
+    return;
+
+  std::vector<KernelReloadState::PendingReload> pending;
+  {
+    // Never block the render loop on the watcher thread, just try again next
+    // frame
+    std::unique_lock<std::mutex> lock(
+        this->_reloadState->mutex,
+        std::try_to_lock);
+    if (!lock.owns_lock() || this->_reloadState->pending.empty())
+      return;
+
+    pending.swap(this->_reloadState->pending);
+  }
+
+  // The replaced kernels may still be referenced by frames in flight
+  auto pRetired = std::make_shared<std::vector<ComputeKernel>>();
+
+  for (KernelReloadState::PendingReload& reload : pending) {
+    for (const ShaderReload& shader : reload.shaders)
+      this->_shaders[shader.shaderIndex] = shader.shader;
+    ++this->_shaderReloadCount;
+
+    for (auto& [permutation, kernels] : this->_kernelPermutations) {
+      auto built = std::find_if(
+          reload.kernels.begin(),
+          reload.kernels.end(),
+          [&permutation = permutation](const auto& entry) {
+            return entry.first == permutation;
+          });
+
+      for (size_t i = 0; i < reload.shaders.size(); ++i) {
+        const ShaderReload& shader = reload.shaders[i];
+        ComputeKernel& slot = kernels.*KERNEL_SLOTS[shader.shaderIndex].kernel;
+
+        pRetired->push_back(std::move(slot));
+        if (built != reload.kernels.end()) {
+          slot = std::move(built->second[i]);
+        } else {
+          // This permutation was first used after the reload started
+          slot = ComputeKernel(
+              app,
+              shader.shader,
+              this->_pShaderCache->getPipelineCache(),
+              this->_heapSetLayout,
+              sizeof(SimulationPushConstants),
+              permutation.getSpecializationConstants());
+        }
+      }
+    }
+
+    for (const ShaderReload& shader : reload.shaders)
+      std::cout << "Reloaded " << shader.shader.path << std::endl;
+  }
+
+  app.addDeletiontask(DeletionTask{
+      [pRetired]() { pRetired->clear(); },
+      frame.frameRingBufferIndex});
 }
-} // namespace StableFluids
\ No newline at end of file
+} // namespace StableFluids
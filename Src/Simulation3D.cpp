@@ -0,0 +1,843 @@
+#include "Simulation3D.h"
+
+#include <Althea/InputMask.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+namespace {
+struct KernelSlot {
+  const char* shaderPath;
+  ComputeKernel VolumeKernels::*kernel;
+};
+
+const std::array<KernelSlot, 8> KERNEL_SLOTS = {
+    KernelSlot{
+        "/Shaders/VolumeUpdateBricks.comp",
+        &VolumeKernels::updateBricksPass},
+    KernelSlot{
+        "/Shaders/VolumeClearBricks.comp",
+        &VolumeKernels::clearBricksPass},
+    KernelSlot{"/Shaders/VolumeAdvect.comp", &VolumeKernels::advectPass},
+    KernelSlot{
+        "/Shaders/VolumeDivergence.comp",
+        &VolumeKernels::divergencePass},
+    KernelSlot{"/Shaders/VolumePressure.comp", &VolumeKernels::pressurePass},
+    KernelSlot{"/Shaders/VolumeProject.comp", &VolumeKernels::projectPass},
+    KernelSlot{
+        "/Shaders/VolumeFlagBricks.comp",
+        &VolumeKernels::flagBricksPass},
+    KernelSlot{
+        "/Shaders/RaymarchVolume.comp",
+        &VolumeKernels::raymarchPass}};
+
+// Must be even, so the pressure ends up back in the first ping-pong field
+constexpr uint32_t PRESSURE_ITERATIONS = 20;
+static_assert(PRESSURE_ITERATIONS % 2 == 0);
+
+// Matches the workgroup sizes in VolumeUpdateBricks.comp and
+// RaymarchVolume.comp, the brick kernels run one workgroup per brick
+constexpr uint32_t UPDATE_BRICKS_LOCAL_SIZE = 64;
+constexpr uint32_t RAYMARCH_LOCAL_SIZE = 8;
+
+// Brick kernels are dispatched with one workgroup per active brick, which has
+// to fit the minimum workgroup count limit
+constexpr uint32_t MAX_BRICK_CAPACITY = 65535;
+
+// Indirect dispatches of the brick kernels, see _writeDispatchArgs
+enum BrickDispatch : uint32_t {
+  BRICK_DISPATCH_ACTIVE = 0,
+  BRICK_DISPATCH_NEW,
+  BRICK_DISPATCH_COUNT
+};
+
+// Dispatched in order by the brick update, see VolumeUpdateBricks.comp
+enum UpdateBricksPhase : uint32_t {
+  PHASE_RESET = 0,
+  PHASE_RELEASE,
+  PHASE_ALLOCATE,
+  PHASE_LIST
+};
+
+// The passes of a volume step in execution order, used to describe when
+// each field is live
+enum VolumePass : uint32_t {
+  PASS_UPDATE_BRICKS = 0,
+  PASS_CLEAR_BRICKS,
+  PASS_ADVECT,
+  PASS_DIVERGENCE,
+  PASS_PRESSURE,
+  PASS_PROJECT,
+  PASS_FLAG_BRICKS,
+  PASS_RAYMARCH
+};
+
+// Counters, then the brick map, brick flags and the free, new and active
+// lists
+size_t getBrickBufferSize(const BrickLayout& layout) {
+  return sizeof(BrickCounters) / sizeof(uint32_t) +
+         2 * static_cast<size_t>(layout.getBrickCount()) +
+         3 * static_cast<size_t>(layout.getCapacity());
+}
+
+void bindKernel(
+    VkCommandBuffer commandBuffer,
+    VkDescriptorSet heapSet,
+    const ComputeKernel& kernel,
+    const SimulationPushConstants& push) {
+  kernel.bindPipeline(commandBuffer);
+  vkCmdPushConstants(
+      commandBuffer,
+      kernel.getLayout(),
+      VK_SHADER_STAGE_COMPUTE_BIT,
+      0,
+      sizeof(SimulationPushConstants),
+      &push);
+  vkCmdBindDescriptorSets(
+      commandBuffer,
+      VK_PIPELINE_BIND_POINT_COMPUTE,
+      kernel.getLayout(),
+      0,
+      1,
+      &heapSet,
+      0,
+      nullptr);
+}
+} // namespace
+
+Simulation3D::Simulation3D(
+    Application& app,
+    SingleTimeCommandBuffer& commandBuffer,
+    GlobalHeap& heap,
+    const ShaderCache& shaderCache,
+    uint32_t size,
+    float maxOccupancy)
+    : _pShaderCache(&shaderCache),
+      _heapSetLayout(heap.getDescriptorSetLayout()),
+      _allocator(app.getAllocator()),
+      _layout(BrickLayout::create(size, maxOccupancy)) {
+  if (this->_layout.getCapacity() > MAX_BRICK_CAPACITY)
+    throw std::runtime_error("Too many bricks for the volume brick pool!");
+
+  this->_displayExtent = app.getSwapChainExtent();
+
+  this->_uniforms = TransientUniforms<VolumeUniforms>(app);
+  this->_uniforms.registerToHeap(heap);
+
+  // The brick atlas, all out of one pooled allocation. The scratch fields
+  // of the advection and the pressure solve share memory.
+  {
+    const FieldLifetime persistent{0, PASS_RAYMARCH};
+
+    std::vector<FieldDesc> fields(VOLUME_FIELD_COUNT);
+    fields[VOLUME_FIELD_VELOCITY_A] = {
+        VK_FORMAT_R16G16B16A16_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT,
+        persistent};
+    fields[VOLUME_FIELD_VELOCITY_B] = {
+        VK_FORMAT_R16G16B16A16_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT,
+        {PASS_ADVECT, PASS_PROJECT}};
+    fields[VOLUME_FIELD_DENSITY_A] = {
+        VK_FORMAT_R16_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT,
+        persistent};
+    fields[VOLUME_FIELD_DENSITY_B] = {
+        VK_FORMAT_R16_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT,
+        {PASS_ADVECT, PASS_PROJECT}};
+    fields[VOLUME_FIELD_DIVERGENCE] = {
+        VK_FORMAT_R32_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT,
+        {PASS_DIVERGENCE, PASS_PRESSURE}};
+    // The pressure warm-starts the next solve
+    fields[VOLUME_FIELD_PRESSURE_A] = {
+        VK_FORMAT_R32_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT,
+        persistent};
+    fields[VOLUME_FIELD_PRESSURE_B] = {
+        VK_FORMAT_R32_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT,
+        {PASS_PRESSURE, PASS_PRESSURE}};
+
+    // Voxels are only ever loaded, the brick map makes hardware filtering
+    // across brick borders useless
+    for (FieldDesc& field : fields)
+      field.filter = VK_FILTER_NEAREST;
+
+    this->_fields = FieldPool(
+        app,
+        heap,
+        this->_layout.atlasX * BRICK_SIZE,
+        this->_layout.atlasY * BRICK_SIZE,
+        fields,
+        this->_layout.atlasZ * BRICK_SIZE);
+
+    std::cout << "Allocated " << this->_layout.getCapacity() << " of "
+              << this->_layout.getBrickCount() << " bricks of a " << size
+              << "^3 volume in " << (this->getFieldMemory() >> 20)
+              << "MB (vs " << (this->getDenseFieldMemory() >> 20)
+              << "MB dense)" << std::endl;
+  }
+
+  // Display fields at the swapchain extent, one per frame in flight so the
+  // next raymarch never waits on a frame that is still being rendered
+  {
+    std::vector<FieldDesc> fields(
+        MAX_FRAMES_IN_FLIGHT,
+        FieldDesc{
+            VK_FORMAT_R32G32B32A32_SFLOAT,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            {0, PASS_RAYMARCH}});
+
+    this->_displayFields = FieldPool(
+        app,
+        heap,
+        this->_displayExtent.width,
+        this->_displayExtent.height,
+        fields);
+  }
+
+  // Brick map and lists, the first step resets them
+  {
+    this->_brickBuffer = StructuredBuffer<uint32_t>(
+        app,
+        getBrickBufferSize(this->_layout));
+    this->_brickBuffer.zeroBuffer(commandBuffer);
+    this->_brickBuffer.registerToHeap(heap);
+
+    VmaAllocationCreateInfo readbackInfo{};
+    readbackInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
+    readbackInfo.usage = VMA_MEMORY_USAGE_AUTO;
+
+    for (CountersReadback& readback : this->_countersReadbacks) {
+      readback.buffer = BufferUtilities::createBuffer(
+          app,
+          sizeof(BrickCounters),
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+          readbackInfo);
+    }
+
+    VmaAllocationCreateInfo deviceInfo{};
+    deviceInfo.usage = VMA_MEMORY_USAGE_AUTO;
+
+    this->_dispatchArgs = BufferUtilities::createBuffer(
+        app,
+        BRICK_DISPATCH_COUNT * sizeof(VkDispatchIndirectCommand),
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        deviceInfo);
+
+    // Only the group counts along x change, they are copied in every step
+    std::array<VkDispatchIndirectCommand, BRICK_DISPATCH_COUNT> args{};
+    for (VkDispatchIndirectCommand& arg : args)
+      arg = {0, 1, 1};
+    vkCmdUpdateBuffer(
+        commandBuffer,
+        this->_dispatchArgs.getBuffer(),
+        0,
+        sizeof(args),
+        args.data());
+  }
+
+  this->_compileShaders();
+  for (const CompiledShader& shader : this->_shaders) {
+    if (shader.hasErrors())
+      throw std::runtime_error(shader.errors);
+  }
+
+  this->_kernels = this->_createKernels(app);
+
+  // Watch for shader edits, see Simulation
+  this->_reloadState = std::make_shared<KernelReloadState>();
+  this->_shaderWatcher = std::make_unique<ShaderWatcher>(
+      shaderCache,
+      this->_shaders,
+      [pState = this->_reloadState,
+       pApp = &app,
+       pShaderCache = this->_pShaderCache,
+       heapSetLayout = this->_heapSetLayout,
+       constants = this->_getSpecializationConstants()](
+          std::vector<ShaderReload>&& reloads) {
+        KernelReloadState::PendingReload pending{};
+        pending.shaders = std::move(reloads);
+
+        try {
+          for (const ShaderReload& reload : pending.shaders) {
+            pending.kernels.push_back(ComputeKernel(
+                *pApp,
+                reload.shader,
+                pShaderCache->getPipelineCache(),
+                heapSetLayout,
+                sizeof(SimulationPushConstants),
+                constants));
+          }
+        } catch (const std::exception& e) {
+          std::cerr << e.what() << std::endl;
+          return;
+        }
+
+        std::lock_guard<std::mutex> lock(pState->mutex);
+        pState->pending.push_back(std::move(pending));
+      });
+}
+
+VkDeviceSize Simulation3D::getDenseFieldMemory() const {
+  // The atlas fields scaled up to every brick of the volume, as separate
+  // allocations
+  return this->_fields.getSeparateSize() / this->_layout.getCapacity() *
+         this->_layout.getBrickCount();
+}
+
+void Simulation3D::update(
+    Application& app,
+    VkCommandBuffer commandBuffer,
+    VkDescriptorSet heapSet,
+    const FrameContext& frame) {
+  this->_applyShaderReloads(app, frame);
+
+  // The fence for this frame slot has been waited on by now
+  this->_readBackCounters(frame);
+
+  // Orbit camera
+  float deltaTime = glm::clamp(frame.deltaTime, 0.0f, 1.0f / 30.0f);
+  uint32_t inputMask = app.getInputManager().getCurrentInputMask();
+  if (inputMask & INPUT_BIT_A)
+    this->cameraYaw -= deltaTime;
+  if (inputMask & INPUT_BIT_D)
+    this->cameraYaw += deltaTime;
+  if (inputMask & INPUT_BIT_W)
+    this->cameraPitch += deltaTime;
+  if (inputMask & INPUT_BIT_S)
+    this->cameraPitch -= deltaTime;
+  this->cameraPitch = glm::clamp(this->cameraPitch, -1.5f, 1.5f);
+  this->cameraDistance = glm::clamp(
+      this->cameraDistance * glm::exp2(-this->targetZoomDir * deltaTime),
+      1.0f,
+      8.0f);
+
+  // Fixed timestep, see Simulation::update
+  this->_timeAccumulator += frame.deltaTime;
+  uint32_t stepCount = 0;
+  while (this->_timeAccumulator >= this->timestep &&
+         stepCount < MAX_SIMULATION_STEPS_PER_FRAME) {
+    this->_timeAccumulator -= this->timestep;
+    ++stepCount;
+  }
+  this->_timeAccumulator =
+      std::min(this->_timeAccumulator, static_cast<double>(this->timestep));
+
+  // Every step of a frame uses the same uniforms
+  this->_uniforms.updateUniforms(
+      this->_makeUniforms(app.getSwapChainExtent(), frame),
+      frame);
+
+  // Last frame's raymarch and counter copy read the brick buffer
+  this->_brickBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+  for (uint32_t i = 0; i < stepCount; ++i) {
+    this->_time += this->timestep;
+    this->_step(commandBuffer, heapSet, frame);
+  }
+
+  this->_raymarch(commandBuffer, heapSet, frame);
+}
+
+VolumeUniforms Simulation3D::_makeUniforms(
+    const VkExtent2D& extent,
+    const FrameContext& frame) const {
+  VolumeUniforms uniforms{};
+
+  glm::vec3 center(0.5f);
+  glm::vec3 cameraPosition =
+      center + this->cameraDistance *
+                   glm::vec3(
+                       glm::cos(this->cameraPitch) * glm::sin(this->cameraYaw),
+                       glm::sin(this->cameraPitch),
+                       glm::cos(this->cameraPitch) * glm::cos(this->cameraYaw));
+
+  glm::mat4 view =
+      glm::lookAt(cameraPosition, center, glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 projection = glm::perspective(
+      glm::radians(45.0f),
+      static_cast<float>(extent.width) / extent.height,
+      0.01f,
+      100.0f);
+  // Vulkan clip space points y down
+  projection[1][1] *= -1.0f;
+
+  uniforms.inverseViewProjection = glm::inverse(projection * view);
+  uniforms.cameraPosition = glm::vec4(cameraPosition, 1.0f);
+  uniforms.emitter = glm::vec4(this->emitterCenter, this->emitterRadius);
+
+  uniforms.time = static_cast<float>(this->_time);
+  uniforms.dt = this->timestep;
+  uniforms.buoyancy = this->buoyancy;
+  uniforms.densityDecay = this->densityDecay;
+
+  uniforms.emitterSpeed = this->emitterSpeed;
+  uniforms.brickBuffer = this->_brickBuffer.getHandle().index;
+  uniforms.velocityImage =
+      this->_fields[VOLUME_FIELD_VELOCITY_A].imageHandle.index;
+  uniforms.densityImage =
+      this->_fields[VOLUME_FIELD_DENSITY_A].imageHandle.index;
+
+  uniforms.divergenceImage =
+      this->_fields[VOLUME_FIELD_DIVERGENCE].imageHandle.index;
+  uniforms.pressureImage =
+      this->_fields[VOLUME_FIELD_PRESSURE_A].imageHandle.index;
+  uniforms.displayImage =
+      this->_displayFields[frame.frameRingBufferIndex].imageHandle.index;
+  uniforms.displayTexture =
+      this->_displayFields[frame.frameRingBufferIndex].textureHandle.index;
+
+  return uniforms;
+}
+
+void Simulation3D::_step(
+    VkCommandBuffer commandBuffer,
+    VkDescriptorSet heapSet,
+    const FrameContext& frame) {
+  SimulationPushConstants push{};
+  push.simUniforms = this->_uniforms.getCurrentHandle(frame).index;
+
+  auto bindCompute = [&](const ComputeKernel& c) {
+    bindKernel(commandBuffer, heapSet, c, push);
+  };
+
+  auto access = [&](VolumeField field, VkAccessFlags accessMask) {
+    this->_fields[field].transitionLayout(
+        commandBuffer,
+        VK_IMAGE_LAYOUT_GENERAL,
+        accessMask,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  };
+
+  auto discard = [&](VolumeField field) {
+    this->_fields[field].discard(
+        commandBuffer,
+        VK_IMAGE_LAYOUT_GENERAL,
+        VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  };
+
+  // Brick update, releases the bricks that were not flagged by the last step
+  // and allocates the ones that were
+  {
+    uint32_t groupCount =
+        (this->_layout.getBrickCount() - 1) / UPDATE_BRICKS_LOCAL_SIZE + 1;
+
+    std::vector<uint32_t> phases = {PHASE_RELEASE, PHASE_ALLOCATE, PHASE_LIST};
+    if (this->clear)
+      phases.insert(phases.begin(), PHASE_RESET);
+    this->clear = false;
+
+    for (uint32_t phase : phases) {
+      push.params0 = phase;
+      bindCompute(this->_kernels.updateBricksPass);
+      vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+      this->_brickBarrier(
+          commandBuffer,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+              VK_PIPELINE_STAGE_TRANSFER_BIT,
+          VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT |
+              VK_ACCESS_TRANSFER_READ_BIT);
+    }
+    push.params0 = 0;
+
+    this->_writeDispatchArgs(commandBuffer);
+  }
+
+  // One workgroup per active or new brick, the counts never leave the GPU
+  auto dispatchBricks = [&](BrickDispatch dispatch) {
+    vkCmdDispatchIndirect(
+        commandBuffer,
+        this->_dispatchArgs.getBuffer(),
+        dispatch * sizeof(VkDispatchIndirectCommand));
+  };
+
+  // Clear the newly allocated bricks
+  {
+    access(VOLUME_FIELD_VELOCITY_A, VK_ACCESS_SHADER_WRITE_BIT);
+    access(VOLUME_FIELD_DENSITY_A, VK_ACCESS_SHADER_WRITE_BIT);
+    access(VOLUME_FIELD_PRESSURE_A, VK_ACCESS_SHADER_WRITE_BIT);
+
+    bindCompute(this->_kernels.clearBricksPass);
+    dispatchBricks(BRICK_DISPATCH_NEW);
+  }
+
+  // Advect velocity and smoke, add buoyancy and the emitter
+  {
+    access(VOLUME_FIELD_VELOCITY_A, VK_ACCESS_SHADER_READ_BIT);
+    access(VOLUME_FIELD_DENSITY_A, VK_ACCESS_SHADER_READ_BIT);
+    discard(VOLUME_FIELD_VELOCITY_B);
+    discard(VOLUME_FIELD_DENSITY_B);
+
+    bindCompute(this->_kernels.advectPass);
+    dispatchBricks(BRICK_DISPATCH_ACTIVE);
+  }
+
+  // Divergence
+  {
+    access(VOLUME_FIELD_VELOCITY_B, VK_ACCESS_SHADER_READ_BIT);
+    discard(VOLUME_FIELD_DIVERGENCE);
+
+    bindCompute(this->_kernels.divergencePass);
+    dispatchBricks(BRICK_DISPATCH_ACTIVE);
+  }
+
+  // Jacobi iterations, warm-started from last step's pressure
+  {
+    access(VOLUME_FIELD_DIVERGENCE, VK_ACCESS_SHADER_READ_BIT);
+    discard(VOLUME_FIELD_PRESSURE_B);
+
+    for (uint32_t i = 0; i < PRESSURE_ITERATIONS; ++i) {
+      uint32_t phase = i % 2;
+
+      access(
+          VOLUME_FIELD_PRESSURE_A,
+          phase ? VK_ACCESS_SHADER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT);
+      access(
+          VOLUME_FIELD_PRESSURE_B,
+          phase ? VK_ACCESS_SHADER_READ_BIT : VK_ACCESS_SHADER_WRITE_BIT);
+
+      push.params0 = phase;
+      bindCompute(this->_kernels.pressurePass);
+      dispatchBricks(BRICK_DISPATCH_ACTIVE);
+    }
+    push.params0 = 0;
+  }
+
+  // Subtract the pressure gradient, the result goes back into the A fields
+  {
+    access(VOLUME_FIELD_PRESSURE_A, VK_ACCESS_SHADER_READ_BIT);
+    access(VOLUME_FIELD_DENSITY_B, VK_ACCESS_SHADER_READ_BIT);
+    access(VOLUME_FIELD_VELOCITY_A, VK_ACCESS_SHADER_WRITE_BIT);
+    access(VOLUME_FIELD_DENSITY_A, VK_ACCESS_SHADER_WRITE_BIT);
+    // Note: The advected velocity has already been transitioned for reading
+    // by the divergence pass.
+
+    bindCompute(this->_kernels.projectPass);
+    dispatchBricks(BRICK_DISPATCH_ACTIVE);
+  }
+
+  // Flag the bricks the next step needs
+  {
+    access(VOLUME_FIELD_DENSITY_A, VK_ACCESS_SHADER_READ_BIT);
+
+    bindCompute(this->_kernels.flagBricksPass);
+    dispatchBricks(BRICK_DISPATCH_ACTIVE);
+    this->_brickBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+  }
+}
+
+void Simulation3D::_raymarch(
+    VkCommandBuffer commandBuffer,
+    VkDescriptorSet heapSet,
+    const FrameContext& frame) {
+  this->_fields[VOLUME_FIELD_DENSITY_A].transitionLayout(
+      commandBuffer,
+      VK_IMAGE_LAYOUT_GENERAL,
+      VK_ACCESS_SHADER_READ_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+  // The last frame that drew from this slot's display field has been fenced
+  PooledField& display = this->_displayFields[frame.frameRingBufferIndex];
+  display.discard(
+      commandBuffer,
+      VK_IMAGE_LAYOUT_GENERAL,
+      VK_ACCESS_SHADER_WRITE_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+  SimulationPushConstants push{};
+  push.simUniforms = this->_uniforms.getCurrentHandle(frame).index;
+  bindKernel(commandBuffer, heapSet, this->_kernels.raymarchPass, push);
+  vkCmdDispatch(
+      commandBuffer,
+      (this->_displayExtent.width - 1) / RAYMARCH_LOCAL_SIZE + 1,
+      (this->_displayExtent.height - 1) / RAYMARCH_LOCAL_SIZE + 1,
+      1);
+
+  // Rendering only reads the display field
+  display.transitionLayout(
+      commandBuffer,
+      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      VK_ACCESS_SHADER_READ_BIT,
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+  // Read back the brick counters, see getBrickCounters
+  this->_brickBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_READ_BIT);
+
+  CountersReadback& readback =
+      this->_countersReadbacks[frame.frameRingBufferIndex];
+
+  VkBufferCopy region{};
+  region.srcOffset = 0;
+  region.dstOffset = 0;
+  region.size = sizeof(BrickCounters);
+  vkCmdCopyBuffer(
+      commandBuffer,
+      this->_brickBuffer.getAllocation().getBuffer(),
+      readback.buffer.getBuffer(),
+      1,
+      &region);
+
+  // Make the copy visible to the host once the frame fence is signaled
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.buffer = readback.buffer.getBuffer();
+  barrier.offset = 0;
+  barrier.size = sizeof(BrickCounters);
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT,
+      0,
+      0,
+      nullptr,
+      1,
+      &barrier,
+      0,
+      nullptr);
+
+  readback.bPending = true;
+}
+
+void Simulation3D::_brickBarrier(
+    VkCommandBuffer commandBuffer,
+    VkPipelineStageFlags dstStage,
+    VkAccessFlags dstAccess) {
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.buffer = this->_brickBuffer.getAllocation().getBuffer();
+  barrier.offset = 0;
+  barrier.size = this->_brickBuffer.getSize();
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = dstAccess;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+  // Also orders the writes after the counter copy that read the buffer
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+      dstStage,
+      0,
+      0,
+      nullptr,
+      1,
+      &barrier,
+      0,
+      nullptr);
+}
+
+void Simulation3D::_writeDispatchArgs(VkCommandBuffer commandBuffer) {
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.buffer = this->_dispatchArgs.getBuffer();
+  barrier.offset = 0;
+  barrier.size = BRICK_DISPATCH_COUNT * sizeof(VkDispatchIndirectCommand);
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+  // The last step's dispatches have to read their counts first
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      0,
+      0,
+      nullptr,
+      1,
+      &barrier,
+      0,
+      nullptr);
+
+  // The list phase left the counts in the buffer header
+  VkBufferCopy regions[BRICK_DISPATCH_COUNT]{};
+  regions[BRICK_DISPATCH_ACTIVE].srcOffset =
+      offsetof(BrickCounters, activeCount);
+  regions[BRICK_DISPATCH_NEW].srcOffset = offsetof(BrickCounters, newCount);
+  for (uint32_t i = 0; i < BRICK_DISPATCH_COUNT; ++i) {
+    regions[i].dstOffset = i * sizeof(VkDispatchIndirectCommand) +
+                           offsetof(VkDispatchIndirectCommand, x);
+    regions[i].size = sizeof(uint32_t);
+  }
+  vkCmdCopyBuffer(
+      commandBuffer,
+      this->_brickBuffer.getAllocation().getBuffer(),
+      this->_dispatchArgs.getBuffer(),
+      BRICK_DISPATCH_COUNT,
+      regions);
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+      0,
+      0,
+      nullptr,
+      1,
+      &barrier,
+      0,
+      nullptr);
+}
+
+void Simulation3D::_readBackCounters(const FrameContext& frame) {
+  CountersReadback& readback =
+      this->_countersReadbacks[frame.frameRingBufferIndex];
+  if (!readback.bPending)
+    return;
+
+  readback.bPending = false;
+
+  // Random access readbacks may land in non-coherent memory
+  vmaInvalidateAllocation(
+      this->_allocator,
+      readback.buffer.getAllocation(),
+      0,
+      VK_WHOLE_SIZE);
+
+  void* pData = readback.buffer.mapMemory();
+  memcpy(&this->_brickCounters, pData, sizeof(BrickCounters));
+  readback.buffer.unmapMemory();
+}
+
+std::vector<uint32_t> Simulation3D::_getSpecializationConstants() const {
+  // Ordered by constant_id, see VolumeCommon.glsl
+  return {
+      this->_layout.size,
+      this->_layout.atlasX,
+      this->_layout.atlasY,
+      this->_layout.atlasZ};
+}
+
+void Simulation3D::_compileShaders() {
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::future<CompiledShader>> futures;
+  futures.reserve(KERNEL_SLOTS.size());
+  for (const KernelSlot& slot : KERNEL_SLOTS) {
+    futures.push_back(std::async(
+        std::launch::async,
+        [pShaderCache = this->_pShaderCache,
+         path = getSimulationDirectory() + slot.shaderPath]() {
+          return pShaderCache->compileComputeShader(path);
+        }));
+  }
+
+  this->_shaders.clear();
+  for (std::future<CompiledShader>& future : futures)
+    this->_shaders.push_back(future.get());
+
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+
+  std::cout << "Loaded " << this->_shaders.size() << " volume shaders in "
+            << ms << "ms" << std::endl;
+}
+
+VolumeKernels Simulation3D::_createKernels(const Application& app) const {
+  std::vector<uint32_t> constants = this->_getSpecializationConstants();
+
+  std::vector<std::future<ComputeKernel>> futures;
+  futures.reserve(KERNEL_SLOTS.size());
+  for (const CompiledShader& shader : this->_shaders) {
+    futures.push_back(std::async(
+        std::launch::async,
+        [&app,
+         &shader,
+         &constants,
+         pShaderCache = this->_pShaderCache,
+         heapSetLayout = this->_heapSetLayout]() {
+          return ComputeKernel(
+              app,
+              shader,
+              pShaderCache->getPipelineCache(),
+              heapSetLayout,
+              sizeof(SimulationPushConstants),
+              constants);
+        }));
+  }
+
+  VolumeKernels kernels{};
+  for (size_t i = 0; i < KERNEL_SLOTS.size(); ++i)
+    kernels.*KERNEL_SLOTS[i].kernel = futures[i].get();
+
+  return kernels;
+}
+
+void Simulation3D::tryRecompileShaders() {
+  if (this->_shaderWatcher)
+    this->_shaderWatcher->requestRecompileAll();
+}
+
+void Simulation3D::_applyShaderReloads(
+    Application& app,
+    const FrameContext& frame) {
+  if (!this->_reloadState)
+    return;
+
+  std::vector<KernelReloadState::PendingReload> pending;
+  {
+    std::unique_lock<std::mutex> lock(
+        this->_reloadState->mutex,
+        std::try_to_lock);
+    if (!lock.owns_lock() || this->_reloadState->pending.empty())
+      return;
+
+    pending.swap(this->_reloadState->pending);
+  }
+
+  // The replaced kernels may still be referenced by frames in flight
+  auto pRetired = std::make_shared<std::vector<ComputeKernel>>();
+
+  for (KernelReloadState::PendingReload& reload : pending) {
+    for (size_t i = 0; i < reload.shaders.size(); ++i) {
+      const ShaderReload& shader = reload.shaders[i];
+      this->_shaders[shader.shaderIndex] = shader.shader;
+
+      ComputeKernel& slot =
+          this->_kernels.*KERNEL_SLOTS[shader.shaderIndex].kernel;
+      pRetired->push_back(std::move(slot));
+      slot = std::move(reload.kernels[i]);
+
+      std::cout << "Reloaded " << shader.shader.path << std::endl;
+    }
+  }
+
+  app.addDeletiontask(DeletionTask{
+      [pRetired]() { pRetired->clear(); },
+      frame.frameRingBufferIndex});
+}
+} // namespace StableFluids
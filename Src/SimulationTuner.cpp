@@ -0,0 +1,240 @@
+#include "SimulationTuner.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace AltheaEngine;
+
+namespace StableFluids {
+namespace {
+// Frames a candidate runs with its own kernels before its timings count,
+// covers the frames still in flight with the previous candidate
+constexpr uint32_t TUNER_WARMUP_FRAMES = MAX_FRAMES_IN_FLIGHT + 2;
+// Timed frames per candidate, the median of these is what gets compared
+constexpr uint32_t TUNER_SAMPLES_PER_CANDIDATE = 24;
+
+float median(std::vector<float> values) {
+  auto middle = values.begin() + values.size() / 2;
+  std::nth_element(values.begin(), middle, values.end());
+  return *middle;
+}
+
+std::ostream&
+operator<<(std::ostream& stream, const SimulationTuning& tuning) {
+  return stream << tuning.localSizeX << "x" << tuning.localSizeY
+                << " workgroups";
+}
+} // namespace
+
+SimulationTuner::SimulationTuner(
+    const Application& app,
+    const ShaderCache& shaderCache,
+    const VkExtent2D& extent,
+    uint32_t velocityDownsample)
+    : _timer(app),
+      _path(shaderCache.getCacheDirectory() + "/Tuning.csv") {
+  VkPhysicalDeviceDriverProperties driverProperties{};
+  driverProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DRIVER_PROPERTIES;
+
+  VkPhysicalDeviceProperties2 properties{};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties.pNext = &driverProperties;
+  vkGetPhysicalDeviceProperties2(app.getPhysicalDevice(), &properties);
+
+  const VkPhysicalDeviceLimits& limits = properties.properties.limits;
+  this->_maxInvocations = limits.maxComputeWorkGroupInvocations;
+  this->_maxSizeX = limits.maxComputeWorkGroupSize[0];
+  this->_maxSizeY = limits.maxComputeWorkGroupSize[1];
+
+  this->_key.vendorID = properties.properties.vendorID;
+  this->_key.deviceID = properties.properties.deviceID;
+  this->_key.driverID = static_cast<uint32_t>(driverProperties.driverID);
+  this->_key.driverVersion = properties.properties.driverVersion;
+  this->_key.width = extent.width;
+  this->_key.height = extent.height;
+  this->_key.velocityDownsample = velocityDownsample;
+}
+
+bool SimulationTuner::load(SimulationTuning& tuning) const {
+  std::ifstream file(this->_path);
+  if (!file.is_open())
+    return false;
+
+  // Later rows win, so retuning just appends. Rows written before only the
+  // workgroup shape was tuned have extra columns after it, which are ignored.
+  bool bFound = false;
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream row(line);
+    std::vector<uint32_t> values;
+    std::string value;
+    try {
+      while (values.size() < 9 && std::getline(row, value, ','))
+        values.push_back(static_cast<uint32_t>(std::stoul(value)));
+    } catch (const std::exception&) {
+      continue;
+    }
+    if (values.size() < 9)
+      continue;
+
+    SimulationTuningKey key{};
+    key.vendorID = values[0];
+    key.deviceID = values[1];
+    key.driverID = values[2];
+    key.driverVersion = values[3];
+    key.width = values[4];
+    key.height = values[5];
+    key.velocityDownsample = values[6];
+    if (!(key == this->_key))
+      continue;
+
+    tuning.localSizeX = values[7];
+    tuning.localSizeY = values[8];
+    bFound = true;
+  }
+
+  return bFound;
+}
+
+void SimulationTuner::_save(const SimulationTuning& tuning, float msPerStep)
+    const {
+  std::ofstream file(this->_path, std::ios::app);
+  const SimulationTuningKey& key = this->_key;
+  file << key.vendorID << "," << key.deviceID << "," << key.driverID << ","
+       << key.driverVersion << "," << key.width << "," << key.height << ","
+       << key.velocityDownsample << "," << tuning.localSizeX << ","
+       << tuning.localSizeY << "," << msPerStep << "\n";
+}
+
+void SimulationTuner::start(Simulation& simulation) {
+  if (!this->isSupported())
+    throw std::runtime_error("Device does not support timestamp queries!");
+
+  this->_initialTuning = simulation.getTuning();
+  for (PendingTiming& pending : this->_pendingTimings)
+    pending.bPending = false;
+
+  this->_bRunning = true;
+  this->_candidates.clear();
+  this->_currentCandidate = 0;
+  for (uint32_t sizeX : {8, 16, 32}) {
+    for (uint32_t sizeY : {8, 16, 32}) {
+      if (sizeX * sizeY > this->_maxInvocations || sizeX > this->_maxSizeX ||
+          sizeY > this->_maxSizeY) {
+        continue;
+      }
+
+      Candidate& candidate = this->_candidates.emplace_back();
+      candidate.tuning.localSizeX = sizeX;
+      candidate.tuning.localSizeY = sizeY;
+    }
+  }
+
+  simulation.setTuning(this->_candidates[0].tuning);
+
+  std::cout << "Tuning " << this->_candidates.size()
+            << " workgroup shapes for " << this->_key.width << "x"
+            << this->_key.height << std::endl;
+}
+
+void SimulationTuner::cancel(Simulation& simulation) {
+  if (!this->isRunning())
+    return;
+
+  simulation.setTuning(this->_initialTuning);
+  this->_bRunning = false;
+  this->_candidates.clear();
+}
+
+void SimulationTuner::beginUpdate(
+    VkCommandBuffer commandBuffer,
+    const FrameContext& frame,
+    Simulation& simulation) {
+  if (!this->isRunning())
+    return;
+
+  // The fence for this frame slot has been waited on by now
+  PendingTiming& pending = this->_pendingTimings[frame.frameRingBufferIndex];
+  float ms;
+  if (this->_timer.read(frame, ms) && pending.bPending) {
+    this->_candidates[pending.candidate].msPerStep.push_back(
+        ms / pending.stepCount);
+  }
+  pending.bPending = false;
+
+  if (this->_candidates[this->_currentCandidate].msPerStep.size() >=
+      TUNER_SAMPLES_PER_CANDIDATE) {
+    if (++this->_currentCandidate == this->_candidates.size()) {
+      this->_finish(simulation);
+      return;
+    }
+
+    simulation.setTuning(this->_candidates[this->_currentCandidate].tuning);
+  }
+
+  this->_timer.begin(commandBuffer, frame);
+}
+
+void SimulationTuner::endUpdate(
+    VkCommandBuffer commandBuffer,
+    const FrameContext& frame,
+    const Simulation& simulation) {
+  if (!this->isRunning())
+    return;
+
+  this->_timer.end(commandBuffer, frame);
+
+  // The candidate's kernels are created in the background, until they are
+  // ready the simulation keeps stepping with the previous ones
+  if (!simulation.isTuningActive())
+    return;
+
+  Candidate& candidate = this->_candidates[this->_currentCandidate];
+  if (candidate.warmupFrames < TUNER_WARMUP_FRAMES) {
+    ++candidate.warmupFrames;
+    return;
+  }
+
+  // Updates that only composed the display say nothing about a step
+  if (simulation.getLastStepCount() == 0)
+    return;
+
+  PendingTiming& pending = this->_pendingTimings[frame.frameRingBufferIndex];
+  pending.bPending = true;
+  pending.candidate = this->_currentCandidate;
+  pending.stepCount = simulation.getLastStepCount();
+}
+
+const SimulationTuner::Candidate&
+SimulationTuner::_getFastest(float& msPerStep) const {
+  const Candidate* pFastest = nullptr;
+  for (const Candidate& candidate : this->_candidates) {
+    float ms = median(candidate.msPerStep);
+    std::cout << "  " << candidate.tuning << ": " << ms << "ms per step"
+              << std::endl;
+    if (!pFastest || ms < msPerStep) {
+      pFastest = &candidate;
+      msPerStep = ms;
+    }
+  }
+
+  return *pFastest;
+}
+
+void SimulationTuner::_finish(Simulation& simulation) {
+  float ms;
+  SimulationTuning fastest = this->_getFastest(ms).tuning;
+
+  simulation.setTuning(fastest);
+  this->_save(fastest, ms);
+
+  std::cout << "Tuned to " << fastest << " (" << ms
+            << "ms per step), saved to " << this->_path << std::endl;
+
+  this->_bRunning = false;
+  this->_candidates.clear();
+}
+} // namespace StableFluids
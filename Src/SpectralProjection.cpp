@@ -0,0 +1,224 @@
+#include "SpectralProjection.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+namespace StableFluids {
+namespace {
+constexpr float PI = 3.14159265358979323846f;
+
+uint32_t nextPowerOfTwo(uint32_t n) {
+  uint32_t p = 1;
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+std::vector<std::complex<float>> computeTwiddles(uint32_t n) {
+  std::vector<std::complex<float>> twiddles(n / 2);
+  for (uint32_t k = 0; k < n / 2; ++k)
+    twiddles[k] = std::polar(1.0f, -2.0f * PI * k / n);
+  return twiddles;
+}
+
+// Splits [0, count) into contiguous ranges, one per thread
+template <typename TFunc>
+void parallelFor(uint32_t count, uint32_t threadCount, const TFunc& func) {
+  threadCount = std::min(threadCount, count);
+  if (threadCount <= 1) {
+    func(0, count);
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  threads.reserve(threadCount);
+  for (uint32_t i = 0; i < threadCount; ++i) {
+    uint32_t begin = count * i / threadCount;
+    uint32_t end = count * (i + 1) / threadCount;
+    threads.emplace_back([&func, begin, end]() { func(begin, end); });
+  }
+
+  for (std::thread& thread : threads)
+    thread.join();
+}
+
+// In-place iterative radix-2 FFT over n contiguous entries. The inverse is
+// not normalized.
+template <typename TSpectrum>
+void fft(
+    TSpectrum* data,
+    uint32_t n,
+    const std::vector<std::complex<float>>& twiddles,
+    bool bInverse) {
+  for (uint32_t i = 1, j = 0; i < n; ++i) {
+    uint32_t bit = n >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+
+    if (i < j)
+      std::swap(data[i], data[j]);
+  }
+
+  for (uint32_t len = 2; len <= n; len <<= 1) {
+    uint32_t twiddleStride = n / len;
+    for (uint32_t i = 0; i < n; i += len) {
+      for (uint32_t k = 0; k < len / 2; ++k) {
+        std::complex<float> w = twiddles[k * twiddleStride];
+        if (bInverse)
+          w = std::conj(w);
+
+        TSpectrum& a = data[i + k];
+        TSpectrum& b = data[i + k + len / 2];
+
+        std::complex<float> bu = b.u * w;
+        std::complex<float> bv = b.v * w;
+        b.u = a.u - bu;
+        b.v = a.v - bv;
+        a.u += bu;
+        a.v += bv;
+      }
+    }
+  }
+}
+} // namespace
+
+SpectralProjector::SpectralProjector(
+    uint32_t width,
+    uint32_t height,
+    uint32_t threadCount)
+    : _width(width),
+      _height(height),
+      _paddedWidth(nextPowerOfTwo(width)),
+      _paddedHeight(nextPowerOfTwo(height)),
+      _threadCount(threadCount) {
+  if (width == 0 || height == 0)
+    throw std::runtime_error("Spectral projection grid must not be empty!");
+
+  if (this->_threadCount == 0)
+    this->_threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+  this->_spectrum.resize(
+      static_cast<size_t>(this->_paddedWidth) * this->_paddedHeight);
+  this->_rowTwiddles = computeTwiddles(this->_paddedWidth);
+  this->_columnTwiddles = computeTwiddles(this->_paddedHeight);
+}
+
+void SpectralProjector::project(float* velocityX, float* velocityY) {
+  uint32_t paddedWidth = this->_paddedWidth;
+
+  // Load the velocity field, the padding is still fluid
+  parallelFor(
+      this->_paddedHeight,
+      this->_threadCount,
+      [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; ++y) {
+          Spectrum* row =
+              &this->_spectrum[static_cast<size_t>(y) * paddedWidth];
+          for (uint32_t x = 0; x < paddedWidth; ++x) {
+            if (x < this->_width && y < this->_height) {
+              size_t idx = static_cast<size_t>(y) * this->_width + x;
+              row[x].u = velocityX[idx];
+              row[x].v = velocityY[idx];
+            } else {
+              row[x].u = 0.0f;
+              row[x].v = 0.0f;
+            }
+          }
+        }
+      });
+
+  this->_fftRows(false);
+  this->_fftColumns(false);
+  this->_projectSpectrum();
+  this->_fftColumns(true);
+  this->_fftRows(true);
+
+  float scale = 1.0f / (static_cast<float>(paddedWidth) * this->_paddedHeight);
+  parallelFor(
+      this->_height,
+      this->_threadCount,
+      [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; ++y) {
+          const Spectrum* row =
+              &this->_spectrum[static_cast<size_t>(y) * paddedWidth];
+          for (uint32_t x = 0; x < this->_width; ++x) {
+            size_t idx = static_cast<size_t>(y) * this->_width + x;
+            velocityX[idx] = row[x].u.real() * scale;
+            velocityY[idx] = row[x].v.real() * scale;
+          }
+        }
+      });
+}
+
+void SpectralProjector::_fftRows(bool bInverse) {
+  // Padding rows are all zero going in and are discarded coming out, so
+  // they never need a row transform
+  parallelFor(
+      this->_height,
+      this->_threadCount,
+      [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; ++y) {
+          fft(
+              &this->_spectrum[static_cast<size_t>(y) * this->_paddedWidth],
+              this->_paddedWidth,
+              this->_rowTwiddles,
+              bInverse);
+        }
+      });
+}
+
+void SpectralProjector::_fftColumns(bool bInverse) {
+  uint32_t paddedWidth = this->_paddedWidth;
+  uint32_t paddedHeight = this->_paddedHeight;
+
+  parallelFor(
+      paddedWidth,
+      this->_threadCount,
+      [&](uint32_t begin, uint32_t end) {
+        // Columns are strided in memory, so each one is gathered into a
+        // contiguous scratch buffer first
+        std::vector<Spectrum> column(paddedHeight);
+        for (uint32_t x = begin; x < end; ++x) {
+          for (uint32_t y = 0; y < paddedHeight; ++y)
+            column[y] = this->_spectrum[y * paddedWidth + x];
+
+          fft(column.data(), paddedHeight, this->_columnTwiddles, bInverse);
+
+          for (uint32_t y = 0; y < paddedHeight; ++y)
+            this->_spectrum[y * paddedWidth + x] = column[y];
+        }
+      });
+}
+
+void SpectralProjector::_projectSpectrum() {
+  uint32_t paddedWidth = this->_paddedWidth;
+  uint32_t paddedHeight = this->_paddedHeight;
+
+  parallelFor(
+      paddedHeight,
+      this->_threadCount,
+      [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; ++y) {
+          // Symbol of the central difference, the grid spacing cancels out
+          float ky = std::sin(2.0f * PI * y / paddedHeight);
+          for (uint32_t x = 0; x < paddedWidth; ++x) {
+            float kx = std::sin(2.0f * PI * x / paddedWidth);
+            float k2 = kx * kx + ky * ky;
+
+            // The mean flow and the Nyquist modes are invisible to the
+            // central difference divergence, leave them alone
+            if (k2 < 1e-12f)
+              continue;
+
+            Spectrum& s = this->_spectrum[y * paddedWidth + x];
+            Complex kDotU = (kx * s.u + ky * s.v) / k2;
+            s.u -= kx * kDotU;
+            s.v -= ky * kDotU;
+          }
+        }
+      });
+}
+} // namespace StableFluids
@@ -0,0 +1,52 @@
+#include "TileSlotCache.h"
+
+namespace StableFluids {
+TileSlotCache::TileSlotCache(uint32_t capacity)
+    : _keys(capacity), _lruEntries(capacity) {
+  this->clear();
+}
+
+bool TileSlotCache::find(const TileKey& key, uint32_t& slot) {
+  auto it = this->_slotsByKey.find(key);
+  if (it == this->_slotsByKey.end())
+    return false;
+
+  slot = it->second;
+  this->_lru.splice(this->_lru.begin(), this->_lru, this->_lruEntries[slot]);
+  return true;
+}
+
+bool TileSlotCache::insert(
+    const TileKey& key,
+    uint32_t& slot,
+    TileKey& evictedKey) {
+  bool bEvicted = false;
+  if (!this->_freeSlots.empty()) {
+    slot = this->_freeSlots.back();
+    this->_freeSlots.pop_back();
+    this->_lruEntries[slot] =
+        this->_lru.insert(this->_lru.begin(), slot);
+  } else {
+    slot = this->_lru.back();
+    evictedKey = this->_keys[slot];
+    this->_slotsByKey.erase(evictedKey);
+    this->_lru.splice(this->_lru.begin(), this->_lru, this->_lruEntries[slot]);
+    bEvicted = true;
+  }
+
+  this->_keys[slot] = key;
+  this->_slotsByKey.emplace(key, slot);
+  return bEvicted;
+}
+
+void TileSlotCache::clear() {
+  this->_lru.clear();
+  this->_slotsByKey.clear();
+
+  uint32_t capacity = this->getCapacity();
+  this->_freeSlots.resize(capacity);
+  // Hand out the low slots first
+  for (uint32_t i = 0; i < capacity; ++i)
+    this->_freeSlots[i] = capacity - 1 - i;
+}
+} // namespace StableFluids
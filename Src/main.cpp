@@ -1,4 +1,6 @@
 #include "FluidCanvas2D.h"
+#include "FluidCanvas3D.h"
+#include "LaunchOptions.h"
 
 #include <Althea/Application.h>
 
@@ -6,9 +8,21 @@
 
 using namespace AltheaEngine;
 
-int main() {
+int main(int argc, char** argv) {
+  try {
+    StableFluids::GLaunchOptions =
+        StableFluids::LaunchOptions::parse(argc, argv);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl
+              << StableFluids::LaunchOptions::USAGE << std::endl;
+    return EXIT_FAILURE;
+  }
+
   Application app("Stable Fluids", "../..", "../../Extern/Althea");
-  app.createGame<StableFluids::FluidCanvas2D>();
+  if (StableFluids::GLaunchOptions.volumeSize != 0)
+    app.createGame<StableFluids::FluidCanvas3D>();
+  else
+    app.createGame<StableFluids::FluidCanvas2D>();
 
   try {
     app.run();
@@ -18,4 +32,4 @@ int main() {
   }
 
   return EXIT_SUCCESS;
-}
\ No newline at end of file
+}